@@ -0,0 +1,239 @@
+#include "byte_stream.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// 按超时等条件成立, timeoutMs < 0 一直等
+template <typename Pred>
+static bool waitFor(std::condition_variable& cv, std::unique_lock<std::mutex>& lock,
+                    int timeoutMs, Pred pred) {
+    if (timeoutMs < 0) {
+        cv.wait(lock, pred);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(timeoutMs), pred);
+}
+
+// ---------------- 写端 ----------------
+
+// 放在 shared_ptr 里, 窗口回调可能在写端析构时还在发送线程上跑
+struct ByteStreamWriter::State {
+    SecureUdpSender& sender;
+    uint16_t stream;
+    size_t segmentSize;
+    size_t bufferSize;
+
+    std::string buffer;     // [head, size) 是还没成包发出的字节
+    size_t head = 0;
+    bool flushing = false;  // 不满一段也要发
+    bool closing = false;
+    bool finSent = false;
+
+    mutable std::mutex mu;
+    std::condition_variable cv;
+
+    State(SecureUdpSender& s, uint16_t id, size_t seg, size_t buf)
+        : sender(s), stream(id), segmentSize(seg), bufferSize(buf) {}
+
+    size_t pending() const { return buffer.size() - head; }
+
+    // 持锁调用: 在窗口允许的范围内尽量成段发出
+    void pump() {
+        while (pending() >= segmentSize || (flushing && pending() > 0)) {
+            size_t n = std::min(segmentSize, pending());
+            if (!sender.send(stream, buffer.substr(head, n))) break; // 窗口满, 等 ACK
+            head += n;
+        }
+        if (pending() == 0) flushing = false;
+
+        // 已发部分过半再整体前移, 摊还下来每字节只搬一次
+        if (head > buffer.size() / 2) {
+            buffer.erase(0, head);
+            head = 0;
+        }
+
+        if (closing && !finSent && pending() == 0) {
+            finSent = sender.send(stream, std::string());
+        }
+        cv.notify_all();
+    }
+};
+
+ByteStreamWriter::ByteStreamWriter(SecureUdpSender& sender, size_t segmentSize,
+                                   size_t bufferSize, size_t window)
+    : sender_(sender),
+      stream_(sender.openStream(true, window, Priority::Bulk))
+{
+    if (segmentSize == 0 || bufferSize < segmentSize) {
+        throw std::runtime_error("Invalid byte stream buffer size");
+    }
+    state_ = std::make_shared<State>(sender, stream_, segmentSize, bufferSize);
+    std::weak_ptr<State> weak = state_;
+    sender_.onWindowOpen(stream_, [weak] {
+        if (auto state = weak.lock()) {
+            std::lock_guard<std::mutex> lock(state->mu);
+            state->pump();
+        }
+    });
+}
+
+ByteStreamWriter::~ByteStreamWriter() {
+    sender_.onWindowOpen(stream_, nullptr);
+}
+
+size_t ByteStreamWriter::write(const uint8_t* data, size_t len, int timeoutMs) {
+    State& st = *state_;
+    std::unique_lock<std::mutex> lock(st.mu);
+    if (st.closing) return 0;
+
+    size_t written = 0;
+    while (written < len) {
+        size_t space = st.bufferSize - st.pending();
+        if (space == 0) {
+            bool ok = waitFor(st.cv, lock, timeoutMs,
+                              [&st] { return st.pending() < st.bufferSize; });
+            if (!ok) break;
+            continue;
+        }
+        size_t n = std::min(space, len - written);
+        st.buffer.append(reinterpret_cast<const char*>(data + written), n);
+        written += n;
+        st.pump();
+    }
+    return written;
+}
+
+void ByteStreamWriter::flush() {
+    std::lock_guard<std::mutex> lock(state_->mu);
+    state_->flushing = true;
+    state_->pump();
+}
+
+void ByteStreamWriter::close() {
+    std::lock_guard<std::mutex> lock(state_->mu);
+    state_->flushing = true;
+    state_->closing = true;
+    state_->pump();
+}
+
+size_t ByteStreamWriter::buffered() const {
+    std::lock_guard<std::mutex> lock(state_->mu);
+    return state_->pending();
+}
+
+// ---------------- 读端 ----------------
+
+struct ByteStreamReader::State {
+    std::vector<uint8_t> ring;
+    size_t head = 0;    // 读位置, 单调增长, 取模得到下标
+    size_t tail = 0;    // 写位置
+    bool eof = false;
+    bool closed = false;
+
+    std::mutex mu;
+    std::condition_variable cv;
+
+    explicit State(size_t capacity) : ring(capacity) {}
+
+    size_t used() const { return tail - head; }
+
+    // 在接收端持锁交付时调用, 不能等。环里放不下整段就返回 false,
+    // 接收端不确认这一段、这个流暂停交付, 发送端窗口随之停住, 形成反压;
+    // 同一接收端上的其他流不受影响。
+    bool append(const std::string& segment) {
+        std::lock_guard<std::mutex> lock(mu);
+        if (closed) return true;
+        if (segment.empty()) {
+            eof = true;
+            cv.notify_all();
+            return true;
+        }
+        if (segment.size() > ring.size() - used()) return false;
+
+        const uint8_t* src = reinterpret_cast<const uint8_t*>(segment.data());
+        size_t left = segment.size();
+        while (left > 0) {
+            size_t pos = tail % ring.size();
+            size_t n = std::min(left, ring.size() - pos);
+            std::memcpy(ring.data() + pos, src, n);
+            tail += n;
+            src += n;
+            left -= n;
+        }
+        cv.notify_all();
+        return true;
+    }
+};
+
+ByteStreamReader::ByteStreamReader(SecureUdpReceiver& receiver, uint16_t stream, size_t capacity)
+    : receiver_(receiver), stream_(stream)
+{
+    if (capacity == 0) {
+        throw std::runtime_error("Invalid byte stream buffer size");
+    }
+    state_ = std::make_shared<State>(capacity);
+    std::shared_ptr<State> state = state_;
+    receiver_.setStreamConsumer(stream_, [state](const std::string& segment) {
+        return state->append(segment);
+    });
+}
+
+ByteStreamReader::~ByteStreamReader() {
+    {
+        // 之后到的段直接丢掉, 不再卡着这个流
+        std::lock_guard<std::mutex> lock(state_->mu);
+        state_->closed = true;
+        state_->cv.notify_all();
+    }
+    receiver_.setStreamHandler(stream_, nullptr);
+}
+
+int ByteStreamReader::peek(struct iovec iov[2], int timeoutMs) {
+    State& st = *state_;
+    std::unique_lock<std::mutex> lock(st.mu);
+    bool ok = waitFor(st.cv, lock, timeoutMs, [&st] { return st.used() > 0 || st.eof; });
+    if (!ok) return -1;
+
+    size_t avail = st.used();
+    if (avail == 0) return 0;
+
+    size_t pos = st.head % st.ring.size();
+    size_t first = std::min(avail, st.ring.size() - pos);
+    iov[0].iov_base = st.ring.data() + pos;
+    iov[0].iov_len = first;
+    if (avail == first) return 1;
+    iov[1].iov_base = st.ring.data();
+    iov[1].iov_len = avail - first;
+    return 2;
+}
+
+void ByteStreamReader::consume(size_t n) {
+    std::lock_guard<std::mutex> lock(state_->mu);
+    state_->head += std::min(n, state_->used());
+    state_->cv.notify_all();
+}
+
+ssize_t ByteStreamReader::read(uint8_t* buf, size_t len, int timeoutMs) {
+    struct iovec iov[2];
+    int count = peek(iov, timeoutMs);
+    if (count <= 0) return count;
+
+    size_t copied = 0;
+    for (int i = 0; i < count && copied < len; i++) {
+        size_t n = std::min(len - copied, iov[i].iov_len);
+        std::memcpy(buf + copied, iov[i].iov_base, n);
+        copied += n;
+    }
+    consume(copied);
+    return static_cast<ssize_t>(copied);
+}
+
+bool ByteStreamReader::eof() const {
+    std::lock_guard<std::mutex> lock(state_->mu);
+    return state_->eof && state_->used() == 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <cstdint>
+#include <memory>
+#include "receiver.h"
+#include "sender.h"
+#include "wire.h"
+
+// 在按序流之上的字节流接口, 类似 TCP 的 write/read。
+// 写端把字节攒成接近 MTU 的段再加密发送, 受流窗口限制;
+// 读端把按序交付的段拼进一个连续的环形缓冲, 可以零拷贝读取。
+// 两端的流ID要一致: 发送端按 openStream 的顺序分配, 从 1 开始。
+
+class ByteStreamWriter {
+public:
+    // 默认最大数据报 (1500 字节 MTU 下的 UDP 载荷) 减去最长包头和 TAG
+    static constexpr size_t DEFAULT_SEGMENT = DEFAULT_MAX_DATAGRAM - wire::MAX_HEADER_LEN - wire::TAG_LEN;
+    static constexpr size_t DEFAULT_BUFFER = 4 << 20;
+
+    explicit ByteStreamWriter(SecureUdpSender& sender,
+                              size_t segmentSize = DEFAULT_SEGMENT,
+                              size_t bufferSize = DEFAULT_BUFFER,
+                              size_t window = SecureUdpSender::DEFAULT_STREAM_WINDOW);
+    ~ByteStreamWriter();
+
+    ByteStreamWriter(const ByteStreamWriter&) = delete;
+    ByteStreamWriter& operator=(const ByteStreamWriter&) = delete;
+
+    uint16_t stream() const { return stream_; }
+
+    // 拷进发送缓冲, 缓冲满时等待, timeoutMs < 0 一直等; 返回写入的字节数
+    size_t write(const uint8_t* data, size_t len, int timeoutMs = -1);
+    // 不满一段的尾巴也立即发出
+    void flush();
+    // flush 并发一个空段表示流结束, 之后不能再写
+    void close();
+    // 还没发出去的字节数
+    size_t buffered() const;
+
+private:
+    struct State;
+
+    SecureUdpSender& sender_;
+    uint16_t stream_;
+    std::shared_ptr<State> state_;
+};
+
+class ByteStreamReader {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 4 << 20;
+
+    // capacity 不能小于写端的段长, 否则放不下的段会让这个流一直停着
+    ByteStreamReader(SecureUdpReceiver& receiver, uint16_t stream,
+                     size_t capacity = DEFAULT_CAPACITY);
+    ~ByteStreamReader();
+
+    ByteStreamReader(const ByteStreamReader&) = delete;
+    ByteStreamReader& operator=(const ByteStreamReader&) = delete;
+
+    // 流结束且读完返回 0, 超时返回 -1
+    ssize_t read(uint8_t* buf, size_t len, int timeoutMs = -1);
+
+    // 零拷贝读取: 可读数据在环里最多分两段, 返回段数 (流结束为 0, 超时为 -1)。
+    // 用完后调 consume() 归还空间, 之前 iov 指向的内存一直有效。
+    int peek(struct iovec iov[2], int timeoutMs = -1);
+    void consume(size_t n);
+
+    bool eof() const;
+
+private:
+    struct State;
+
+    SecureUdpReceiver& receiver_;
+    uint16_t stream_;
+    std::shared_ptr<State> state_;
+};
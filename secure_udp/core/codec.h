@@ -0,0 +1,134 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+
+// 线上格式的编解码骨架: 包格式用 Layout<Field...> 在编译期描述一次,
+// 偏移和总长都是常量, 读写展开成无对齐的 memcpy 加小端转换, 不再逐字节移位。
+// 调用方先用 Layout::SIZE 做一次长度检查, 之后的字段访问都不再检查。
+namespace wire {
+
+constexpr bool HOST_LITTLE_ENDIAN = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+template <typename T>
+inline T byteSwap(T v) {
+    static_assert(std::is_unsigned<T>::value, "wire fields are unsigned");
+    if constexpr (sizeof(T) == 1) return v;
+    else if constexpr (sizeof(T) == 2) return static_cast<T>(__builtin_bswap16(v));
+    else if constexpr (sizeof(T) == 4) return static_cast<T>(__builtin_bswap32(v));
+    else return static_cast<T>(__builtin_bswap64(v));
+}
+
+// 从 p 读 N 字节小端无符号数 (N <= sizeof(T)), p 不要求对齐
+template <typename T, size_t N = sizeof(T)>
+inline T loadLe(const uint8_t* p) {
+    static_assert(N >= 1 && N <= sizeof(T), "field wider than its type");
+    T v = 0;
+    if constexpr (HOST_LITTLE_ENDIAN) {
+        std::memcpy(&v, p, N);
+    } else {
+        // 小端的 N 字节放进 v 的前 N 字节, 整体翻转后正好落在低位
+        std::memcpy(&v, p, N);
+        v = byteSwap(v);
+    }
+    return v;
+}
+
+template <typename T, size_t N = sizeof(T)>
+inline void storeLe(uint8_t* p, T v) {
+    static_assert(N >= 1 && N <= sizeof(T), "field wider than its type");
+    if constexpr (HOST_LITTLE_ENDIAN) {
+        std::memcpy(p, &v, N);
+    } else {
+        // 翻转后内存里是小端表示, 前 N 字节就是低 N 字节
+        v = byteSwap(v);
+        std::memcpy(p, &v, N);
+    }
+}
+
+// 运行时才知道宽度的字段 (如截断的 PN), 宽度 1..sizeof(T)
+template <typename T>
+inline T loadLe(const uint8_t* p, size_t n) {
+    switch (n) {
+    case 1: return loadLe<T, 1>(p);
+    case 2: if constexpr (sizeof(T) >= 2) return loadLe<T, 2>(p); break;
+    case 3: if constexpr (sizeof(T) >= 3) return loadLe<T, 3>(p); break;
+    case 4: if constexpr (sizeof(T) >= 4) return loadLe<T, 4>(p); break;
+    default: break;
+    }
+    return 0;
+}
+
+template <typename T>
+inline void storeLe(uint8_t* p, T v, size_t n) {
+    switch (n) {
+    case 1: storeLe<T, 1>(p, v); break;
+    case 2: if constexpr (sizeof(T) >= 2) storeLe<T, 2>(p, v); break;
+    case 3: if constexpr (sizeof(T) >= 3) storeLe<T, 3>(p, v); break;
+    case 4: if constexpr (sizeof(T) >= 4) storeLe<T, 4>(p, v); break;
+    default: break;
+    }
+}
+
+// 一个字段: 值类型 T, 线上占 N 字节
+template <typename T, size_t N = sizeof(T)>
+struct Field {
+    using type = T;
+    static constexpr size_t SIZE = N;
+};
+
+// 按顺序排列的一组字段
+template <typename... Fields>
+struct Layout {
+    static constexpr size_t COUNT = sizeof...(Fields);
+    static constexpr size_t SIZE = (Fields::SIZE + ... + 0);
+
+    template <size_t I>
+    using FieldAt = std::tuple_element_t<I, std::tuple<Fields...>>;
+    template <size_t I>
+    using TypeAt = typename FieldAt<I>::type;
+
+    template <size_t I>
+    static constexpr size_t offset() {
+        constexpr size_t sizes[] = {Fields::SIZE..., 0};
+        size_t off = 0;
+        for (size_t i = 0; i < I; i++) off += sizes[i];
+        return off;
+    }
+
+    template <size_t I>
+    static TypeAt<I> get(const uint8_t* base) {
+        return loadLe<TypeAt<I>, FieldAt<I>::SIZE>(base + offset<I>());
+    }
+
+    template <size_t I>
+    static void set(uint8_t* base, TypeAt<I> v) {
+        storeLe<TypeAt<I>, FieldAt<I>::SIZE>(base + offset<I>(), v);
+    }
+
+    // 全部字段一次写出, 参数顺序同字段顺序
+    static void encode(uint8_t* base, typename Fields::type... values) {
+        encodeAt<0>(base, values...);
+    }
+
+    // 全部字段一次读出
+    static std::tuple<typename Fields::type...> decode(const uint8_t* base) {
+        return decodeAll(base, std::make_index_sequence<COUNT>());
+    }
+
+private:
+    template <size_t I, typename V, typename... Rest>
+    static void encodeAt(uint8_t* base, V v, Rest... rest) {
+        set<I>(base, v);
+        if constexpr (sizeof...(Rest) > 0) encodeAt<I + 1>(base, rest...);
+    }
+
+    template <size_t... I>
+    static std::tuple<typename Fields::type...> decodeAll(const uint8_t* base, std::index_sequence<I...>) {
+        return std::tuple<typename Fields::type...>(get<I>(base)...);
+    }
+};
+
+} // namespace wire
@@ -0,0 +1,145 @@
+#include "compression.h"
+#include "codec.h"
+#include <lz4.h>
+#include <zdict.h>
+#include <zstd.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+// [CODEC(1B)][ORIGINAL_LEN(3B)]
+using CompressedPrefix = wire::Layout<wire::Field<uint8_t>, wire::Field<uint32_t, 3>>;
+enum { CMP_CODEC, CMP_ORIGINAL_LEN };
+static_assert(PayloadCompressor::MAX_ORIGINAL < (1u << 24), "original length must fit in 3 bytes");
+
+// 至少省 1/8 才算值得
+static constexpr size_t MIN_SAVING_DIVISOR = 8;
+// 慢于这个速度 (每字节纳秒数) 说明数据不适合压缩
+static constexpr double MAX_NS_PER_BYTE = 20.0;
+static constexpr uint32_t MAX_BACKOFF = 64;
+
+// zstd 上下文不能跨线程共用, 每个线程一个; 字典本身只读, 可以共用
+static ZSTD_CCtx* threadCCtx() {
+    thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> ctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+    return ctx.get();
+}
+
+static ZSTD_DCtx* threadDCtx() {
+    thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> ctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    return ctx.get();
+}
+
+PayloadCompressor::PayloadCompressor()
+    : cdict_(nullptr), ddict_(nullptr), skip_(0), backoff_(0) {
+}
+
+PayloadCompressor::~PayloadCompressor() {
+    ZSTD_freeCDict(cdict_);
+    ZSTD_freeDDict(ddict_);
+}
+
+std::string PayloadCompressor::trainDictionary(const std::vector<std::string>& samples, size_t capacity) {
+    std::string buffer;
+    std::vector<size_t> sizes;
+    for (auto& s : samples) {
+        buffer += s;
+        sizes.push_back(s.size());
+    }
+
+    std::string dictionary(capacity, '\0');
+    size_t n = ZDICT_trainFromBuffer(&dictionary[0], capacity, buffer.data(), sizes.data(),
+                                     static_cast<unsigned>(sizes.size()));
+    if (ZDICT_isError(n)) {
+        throw std::runtime_error(std::string("Dictionary training failed: ") + ZDICT_getErrorName(n));
+    }
+    dictionary.resize(n);
+    return dictionary;
+}
+
+void PayloadCompressor::setDictionary(const std::string& dictionary, int level) {
+    ZSTD_freeCDict(cdict_);
+    ZSTD_freeDDict(ddict_);
+    cdict_ = ZSTD_createCDict(dictionary.data(), dictionary.size(), level);
+    ddict_ = ZSTD_createDDict(dictionary.data(), dictionary.size());
+    if (!cdict_ || !ddict_) {
+        throw std::runtime_error("Failed to load compression dictionary");
+    }
+}
+
+void PayloadCompressor::penalize() {
+    uint32_t next = std::min(std::max(backoff_.load(std::memory_order_relaxed) * 2, 1u), MAX_BACKOFF);
+    backoff_.store(next, std::memory_order_relaxed);
+    skip_.store(next, std::memory_order_relaxed);
+}
+
+bool PayloadCompressor::compress(const uint8_t* data, size_t len, std::string& out) {
+    if (len < MIN_INPUT || len > MAX_ORIGINAL) return false;
+
+    // 退避期内直接跳过; 多线程下计数不精确无妨, 只要不减到负数
+    uint32_t skip = skip_.load(std::memory_order_relaxed);
+    while (skip > 0) {
+        if (skip_.compare_exchange_weak(skip, skip - 1, std::memory_order_relaxed)) return false;
+    }
+
+    bool useZstd = cdict_ && len <= SMALL_MESSAGE;
+    size_t bound = useZstd ? ZSTD_compressBound(len) : static_cast<size_t>(LZ4_compressBound(static_cast<int>(len)));
+    out.resize(CompressedPrefix::SIZE + bound);
+    uint8_t* dst = reinterpret_cast<uint8_t*>(&out[0]);
+
+    ZSTD_CCtx* cctx = useZstd ? threadCCtx() : nullptr;
+    auto start = std::chrono::steady_clock::now();
+    size_t n;
+    if (useZstd) {
+        n = ZSTD_compress_usingCDict(cctx, dst + CompressedPrefix::SIZE, bound, data, len, cdict_);
+        if (ZSTD_isError(n)) n = 0;
+    } else {
+        int r = LZ4_compress_default(reinterpret_cast<const char*>(data),
+                                     reinterpret_cast<char*>(dst + CompressedPrefix::SIZE),
+                                     static_cast<int>(len), static_cast<int>(bound));
+        n = r > 0 ? static_cast<size_t>(r) : 0;
+    }
+    double nsPerByte = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count() / double(len);
+
+    // 小消息的计时误差太大, 只看压缩率
+    bool tooSlow = len > SMALL_MESSAGE && nsPerByte > MAX_NS_PER_BYTE;
+    size_t total = CompressedPrefix::SIZE + n;
+    if (n == 0 || total > len - len / MIN_SAVING_DIVISOR || tooSlow) {
+        penalize();
+        return false;
+    }
+    backoff_.store(0, std::memory_order_relaxed);
+
+    CompressedPrefix::encode(dst, static_cast<uint8_t>(useZstd ? Codec::Zstd : Codec::Lz4),
+                             static_cast<uint32_t>(len));
+    out.resize(total);
+    return true;
+}
+
+bool PayloadCompressor::decompress(const uint8_t* data, size_t len, std::string& out) const {
+    if (len < CompressedPrefix::SIZE) return false;
+    Codec codec = static_cast<Codec>(CompressedPrefix::get<CMP_CODEC>(data));
+    size_t original = CompressedPrefix::get<CMP_ORIGINAL_LEN>(data);
+    if (original > MAX_ORIGINAL) return false;
+
+    const uint8_t* src = data + CompressedPrefix::SIZE;
+    size_t srcLen = len - CompressedPrefix::SIZE;
+    out.resize(original);
+
+    if (codec == Codec::Lz4) {
+        int r = LZ4_decompress_safe(reinterpret_cast<const char*>(src), &out[0],
+                                    static_cast<int>(srcLen), static_cast<int>(original));
+        return r >= 0 && static_cast<size_t>(r) == original;
+    }
+    if (codec == Codec::Zstd) {
+        if (!ddict_) {
+            std::cerr << "Received dictionary-compressed payload without a dictionary\n";
+            return false;
+        }
+        size_t r = ZSTD_decompress_usingDDict(threadDCtx(), &out[0], original, src, srcLen, ddict_);
+        return !ZSTD_isError(r) && r == original;
+    }
+    return false;
+}
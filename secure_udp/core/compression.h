@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+// 加密前的可选压缩: 明文加密后就压不动了, 只能在加密之前压。
+// 大消息用 LZ4 (快); 小消息在配了训练好的字典时用 zstd + 字典,
+// 没有字典的小消息几乎压不动。压缩率或速度太差时自动跳过, 并指数退避
+// 暂停尝试, 不可压缩的流量上不白花 CPU。
+//
+// 压缩后的载荷 (在密文里): [CODEC(1B)][ORIGINAL_LEN(3B)][DATA],
+// 包头 FLAGS 里的 FLAG_COMPRESSED 表示载荷是这种格式。
+class PayloadCompressor {
+public:
+    enum class Codec : uint8_t { None = 0, Lz4 = 1, Zstd = 2 };
+
+    // 再短的消息省不下几个字节
+    static constexpr size_t MIN_INPUT = 64;
+    // 不超过这个长度且有字典时用 zstd
+    static constexpr size_t SMALL_MESSAGE = 512;
+    // 解压后最大长度, 防止解压炸弹
+    static constexpr size_t MAX_ORIGINAL = 1 << 20;
+
+    PayloadCompressor();
+    ~PayloadCompressor();
+
+    PayloadCompressor(const PayloadCompressor&) = delete;
+    PayloadCompressor& operator=(const PayloadCompressor&) = delete;
+
+    // 用样本消息训练 zstd 字典, 收发两端要装同一份
+    static std::string trainDictionary(const std::vector<std::string>& samples,
+                                       size_t capacity = 16 * 1024);
+    // 须在开始收发前设置
+    void setDictionary(const std::string& dictionary, int level = 3);
+
+    // 压缩后写入 out (含前缀); 不值得压缩时返回 false
+    bool compress(const uint8_t* data, size_t len, std::string& out);
+    bool decompress(const uint8_t* data, size_t len, std::string& out) const;
+
+private:
+    void penalize();
+
+    ZSTD_CDict_s* cdict_;
+    ZSTD_DDict_s* ddict_;
+
+    // 连续压不动时跳过后面若干条, 跳过的条数逐次翻倍
+    std::atomic<uint32_t> skip_;
+    std::atomic<uint32_t> backoff_;
+};
@@ -0,0 +1,459 @@
+#include "endpoint.h"
+#include "../config/config.h"
+#include "../crypto/aes_gcm.h"
+#include "codec.h"
+#include "transport.h"
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <iostream>
+#include <vector>
+
+// 包格式: [FLAGS(1B)][SEQ(4B)][BASE(4B)][ACK(4B)][ACK_SESSION(6B)][TIMESTAMP(8B)][NONCE(12B)][CIPHERTEXT][TAG(16B)]
+// 前 27 字节头部作为 AAD 参与认证, 纯 ACK 包是头部加空密文的 TAG。TIMESTAMP 是发出这一份时
+// 本机 steady_clock 的毫秒数。ACK 和 TIMESTAMP 每次发出都会变, 所以每一份都用新 NONCE 重新加密。
+// NONCE 为 [SESSION(6B)][COUNTER(6B)], SESSION 每个实例随机取一次, COUNTER 逐包递增。
+// 对端重启后 SESSION 会变: BASE 是发送方最老的未确认序号, 它之前的都已交付过,
+// 接收方换到新会话时从 BASE 收起; ACK_SESSION 是 ACK 所确认的那个会话, 不是本端当前会话的 ACK 不理。
+// PING/PONG 的时间都在密文里: PING 为 [ID(4B)][T1(8B)], PONG 为 [ID(4B)][T1(8B)][T2(8B)][T3(8B)],
+// T1 是发 PING 的时刻, T2/T3 是对端收到 PING 和发出 PONG 的时刻, 都是各自的微秒时钟。
+static constexpr uint8_t FLAG_DATA = 0x01;
+static constexpr uint8_t FLAG_ACK = 0x02;
+static constexpr uint8_t FLAG_PING = 0x04;
+static constexpr uint8_t FLAG_PONG = 0x08;
+using EndpointHeader = wire::Layout<wire::Field<uint8_t>, wire::Field<uint32_t>, wire::Field<uint32_t>,
+                                    wire::Field<uint32_t>, wire::Field<uint64_t, 6>, wire::Field<uint64_t>>;
+enum { HDR_FLAGS, HDR_SEQ, HDR_BASE, HDR_ACK, HDR_ACK_SESSION, HDR_TIMESTAMP };
+static constexpr size_t HEADER_LEN = EndpointHeader::SIZE;
+using EndpointNonce = wire::Layout<wire::Field<uint64_t, 6>, wire::Field<uint64_t, 6>>;
+static constexpr size_t NONCE_LEN = EndpointNonce::SIZE;
+static constexpr size_t TAG_LEN = 16;
+static constexpr size_t OVERHEAD = HEADER_LEN + NONCE_LEN + TAG_LEN;
+static constexpr uint64_t NONCE_COUNTER_LIMIT = uint64_t(1) << 48;
+using PingLayout = wire::Layout<wire::Field<uint32_t>, wire::Field<uint64_t>>;
+using PongLayout = wire::Layout<wire::Field<uint32_t>, wire::Field<uint64_t>,
+                                wire::Field<uint64_t>, wire::Field<uint64_t>>;
+enum { PONG_ID, PONG_T1, PONG_T2, PONG_T3 };
+
+static constexpr auto ACK_DELAY = std::chrono::milliseconds(10);
+static constexpr auto RETRANSMIT_TIMEOUT = std::chrono::milliseconds(100);
+// 最多记住这么多个超前收到的序号, 更远的包先丢掉, 等对端重传
+static constexpr uint32_t MAX_RECEIVE_AHEAD = 4096;
+// 记住对端最近这么多个旧会话, 它们迟到或被重放的包不会把接收状态切回去
+static constexpr size_t MAX_RETIRED_SESSIONS = 8;
+// 平滑 RTT 的增益, 同 TCP
+static constexpr double RTT_GAIN = 0.125;
+
+static uint64_t nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SecureUdpEndpoint::SecureUdpEndpoint(int localPort, const std::string& remoteIp, int remotePort)
+    : session_(0), nonceCounter_(0), maxDatagram_(DEFAULT_MAX_DATAGRAM), truncated_(0), seq_(0), sendBase_(0),
+      peerSession_(0), peerKnown_(false), nextExpected_(0), ackPending_(false),
+      keepalive_(DEFAULT_KEEPALIVE), freshness_(0), pingId_(0), pingSentUs_(0), pingOutstanding_(false),
+      clockSamples_{}, clockSampleCount_(0), stats_{}, running_(false)
+{
+    if (!aes_gcm_init(ctx_, reinterpret_cast<const uint8_t*>(SHARED_KEY.data()), SHARED_KEY.size())) {
+        throw std::runtime_error("Invalid shared key");
+    }
+    // 0 在 ACK_SESSION 里表示还不认识对端
+    while (session_ == 0) {
+        uint8_t random[12];
+        aes_gcm_random_nonce(random);
+        session_ = EndpointNonce::get<0>(random);
+    }
+
+    sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd_ < 0) {
+        perror("socket");
+        throw std::runtime_error("Failed to create socket");
+    }
+
+    struct sockaddr_in localAddr{};
+    localAddr.sin_family = AF_INET;
+    localAddr.sin_addr.s_addr = INADDR_ANY;
+    localAddr.sin_port = htons(localPort);
+
+    if (bind(sockfd_, (struct sockaddr*)&localAddr, sizeof(localAddr)) < 0) {
+        perror("bind");
+        close(sockfd_);
+        throw std::runtime_error("Failed to bind socket");
+    }
+
+    wakeFd_ = eventfd(0, EFD_NONBLOCK);
+    if (wakeFd_ < 0) {
+        perror("eventfd");
+        close(sockfd_);
+        throw std::runtime_error("Failed to create eventfd");
+    }
+
+    remoteAddr_ = {};
+    remoteAddr_.sin_family = AF_INET;
+    remoteAddr_.sin_port = htons(remotePort);
+    inet_pton(AF_INET, remoteIp.c_str(), &remoteAddr_.sin_addr);
+}
+
+SecureUdpEndpoint::~SecureUdpEndpoint() {
+    stop();
+    close(wakeFd_);
+    close(sockfd_);
+}
+
+void SecureUdpEndpoint::start(std::function<void(const std::string&)> onMessage) {
+    callback_ = std::move(onMessage);
+    running_ = true;
+    nextPing_ = std::chrono::steady_clock::now(); // 一开始就对时
+    ioThread_ = std::thread(&SecureUdpEndpoint::ioThreadFunc, this);
+}
+
+void SecureUdpEndpoint::setMaxDatagram(size_t bytes) {
+    if (bytes < OVERHEAD || bytes > MAX_UDP_DATAGRAM) {
+        throw std::runtime_error("Invalid maximum datagram size");
+    }
+    if (running_) {
+        throw std::runtime_error("Maximum datagram size must be set before start()");
+    }
+    maxDatagram_ = bytes;
+    // 大包时内核接收缓冲也要跟着放大, 否则排不下几个
+    int want = static_cast<int>(bytes * 64);
+    if (setsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF, &want, sizeof(want)) < 0) {
+        perror("setsockopt SO_RCVBUF");
+    }
+}
+
+void SecureUdpEndpoint::setKeepalive(std::chrono::milliseconds interval) {
+    if (running_) {
+        throw std::runtime_error("Keepalive must be set before start()");
+    }
+    keepalive_ = interval;
+}
+
+void SecureUdpEndpoint::setFreshnessWindow(std::chrono::milliseconds window) {
+    std::lock_guard<std::mutex> lock(statsMu_);
+    freshness_ = window;
+}
+
+SecureUdpEndpoint::PathStats SecureUdpEndpoint::pathStats() const {
+    std::lock_guard<std::mutex> lock(statsMu_);
+    return stats_;
+}
+
+void SecureUdpEndpoint::stop() {
+    if (running_) {
+        running_ = false;
+        uint64_t one = 1;
+        (void)write(wakeFd_, &one, sizeof(one));
+        if (ioThread_.joinable()) ioThread_.join();
+    }
+}
+
+size_t SecureUdpEndpoint::unacknowledged() {
+    std::lock_guard<std::mutex> lock(mu_);
+    return unackedPackets_.size();
+}
+
+bool SecureUdpEndpoint::send(const std::string& data) {
+    if (data.size() + OVERHEAD > maxDatagram_) {
+        std::cerr << "Message of " << data.size() << " bytes exceeds maximum datagram size "
+                  << maxDatagram_ << "\n";
+        return false;
+    }
+    // 序号在 mu_ 里分配, 没发出去就还回去: 对端从 BASE 起连续收, 不能留空洞
+    std::lock_guard<std::mutex> lock(mu_);
+    uint32_t currentSeq = seq_.fetch_add(1);
+    Outgoing& out = unackedPackets_[currentSeq];
+    out.flags = FLAG_DATA | FLAG_ACK;
+    out.plaintext = data;
+    out.lastSent = std::chrono::steady_clock::now();
+    if (!transmit(out.flags, currentSeq, out.plaintext)) {
+        unackedPackets_.erase(currentSeq);
+        seq_ = currentSeq;
+        return false;
+    }
+    return true;
+}
+
+// 持 mu_ 调用, ACK 和 ACK_SESSION 因此总是同一个会话的。
+// ACK 和时间戳在每次真正发出时再填, 重传包也带着最新的累计 ACK 和发出时刻;
+// 它们在 AAD 里, 所以每一份都要用新 NONCE 重新加密
+bool SecureUdpEndpoint::transmit(uint8_t flags, uint32_t seq, const std::string& plaintext) {
+    uint64_t counter = nonceCounter_.fetch_add(1);
+    if (counter >= NONCE_COUNTER_LIMIT) {
+        std::cerr << "Nonce space exhausted\n";
+        return false; // 再发 NONCE 就会重复
+    }
+    std::vector<uint8_t> packet(OVERHEAD + plaintext.size());
+    uint8_t* p = packet.data();
+    EndpointHeader::encode(p, flags, seq, sendBase_, nextExpected_.load(), peerKnown_ ? peerSession_ : 0,
+                           nowMicros() / 1000);
+    uint8_t* nonce = p + HEADER_LEN;
+    EndpointNonce::encode(nonce, session_, counter);
+    uint8_t* cipher = nonce + NONCE_LEN;
+    if (!aes_gcm_encrypt(ctx_, nonce, p, HEADER_LEN, reinterpret_cast<const uint8_t*>(plaintext.data()),
+                         plaintext.size(), cipher, cipher + plaintext.size())) {
+        std::cerr << "Encryption failed\n";
+        return false;
+    }
+
+    ssize_t sent = sendto(sockfd_, packet.data(), packet.size(), 0,
+            (struct sockaddr*)&remoteAddr_, sizeof(remoteAddr_));
+    if (sent < 0) {
+        perror("sendto");
+        return true; // 已进未确认表, 超时重传
+    }
+    // 捎带了 ACK, 不必再单独发
+    ackPending_ = false;
+    return true;
+}
+
+void SecureUdpEndpoint::sendAckOnly() {
+    std::lock_guard<std::mutex> lock(mu_);
+    transmit(FLAG_ACK, 0, std::string());
+}
+
+void SecureUdpEndpoint::retransmitExpired() {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto& p : unackedPackets_) {
+        if (now - p.second.lastSent < RETRANSMIT_TIMEOUT) continue;
+        transmit(p.second.flags, p.first, p.second.plaintext);
+        p.second.lastSent = now;
+    }
+}
+
+// 持 mu_ 调用。确认的是 [sendBase_, ack) 这一段, 按回绕比较; 超过已发序号的不可能是真的
+void SecureUdpEndpoint::handleAck(uint32_t ack) {
+    int32_t advance = static_cast<int32_t>(ack - sendBase_);
+    if (advance <= 0 || static_cast<int32_t>(seq_.load() - ack) < 0) return;
+    if (sendBase_ < ack) {
+        unackedPackets_.erase(unackedPackets_.lower_bound(sendBase_), unackedPackets_.lower_bound(ack));
+    } else {
+        // 序号在这一段里回绕了
+        unackedPackets_.erase(unackedPackets_.lower_bound(sendBase_), unackedPackets_.end());
+        unackedPackets_.erase(unackedPackets_.begin(), unackedPackets_.lower_bound(ack));
+    }
+    sendBase_ = ack;
+}
+
+// 持 mu_ 调用, 包已认证。第一次见到对端直接认下; 之后会话号变了就是对端重启了,
+// 旧会话的接收状态作废, 从新会话的 BASE 收起。返回 false 表示包来自对端已经退役的会话
+bool SecureUdpEndpoint::trackPeerSession(uint64_t session, uint32_t base) {
+    if (peerKnown_ && session == peerSession_) return true;
+    if (std::find(retiredSessions_.begin(), retiredSessions_.end(), session) != retiredSessions_.end()) {
+        return false;
+    }
+    if (peerKnown_) {
+        retiredSessions_.push_back(peerSession_);
+        if (retiredSessions_.size() > MAX_RETIRED_SESSIONS) retiredSessions_.pop_front();
+    }
+    peerKnown_ = true;
+    peerSession_ = session;
+    nextExpected_ = base;
+    receivedAhead_.clear();
+    // 之前发出的 ACK 都不是给这个会话的, 对端认不了, 尽快补一个
+    ackPending_ = true;
+    ackDeadline_ = std::chrono::steady_clock::now() + ACK_DELAY;
+    return true;
+}
+
+void SecureUdpEndpoint::handleDatagram(const uint8_t* data, size_t len) {
+    if (len < OVERHEAD) return;
+
+    uint8_t flags = EndpointHeader::get<HDR_FLAGS>(data);
+    uint32_t seq = EndpointHeader::get<HDR_SEQ>(data);
+
+    // 新鲜度检查在解密之前, 过期的包不花解密的开销; 改过时间戳的包随后过不了认证
+    int64_t ageUs = 0;
+    if ((flags & FLAG_DATA) && !isFresh(EndpointHeader::get<HDR_TIMESTAMP>(data), ageUs)) return;
+
+    const uint8_t* nonce = data + HEADER_LEN;
+    const uint8_t* cipher = nonce + NONCE_LEN;
+    size_t cipherLen = len - OVERHEAD;
+    std::string plaintext(cipherLen, '\0');
+    if (!aes_gcm_decrypt(ctx_, nonce, data, HEADER_LEN, cipher, cipherLen, cipher + cipherLen,
+                         reinterpret_cast<uint8_t*>(&plaintext[0]))) {
+        std::cerr << "Decryption failed for packet seq=" << seq << "\n";
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (!trackPeerSession(EndpointNonce::get<0>(nonce), EndpointHeader::get<HDR_BASE>(data))) return;
+        // 认证过、且确认的是本端当前会话的 ACK 才能清未确认表: 对端重启前的 ACK 属于别的序号空间
+        if ((flags & FLAG_ACK) && EndpointHeader::get<HDR_ACK_SESSION>(data) == session_) {
+            handleAck(EndpointHeader::get<HDR_ACK>(data));
+        }
+    }
+    if (flags & FLAG_PING) {
+        handlePing(plaintext);
+        return;
+    }
+    if (flags & FLAG_PONG) {
+        handlePong(plaintext);
+        return;
+    }
+    if (!(flags & FLAG_DATA)) return;
+    {
+        std::lock_guard<std::mutex> lock(statsMu_);
+        if (stats_.synced) stats_.oneWayDelay = std::chrono::microseconds(ageUs);
+    }
+
+    uint32_t expected = nextExpected_.load();
+    // 超前太远的包不收也不确认, 乱序集合不会无限增长。序号按回绕比较
+    int32_t ahead = static_cast<int32_t>(seq - expected);
+    if (ahead >= static_cast<int32_t>(MAX_RECEIVE_AHEAD)) return;
+
+    // 无论是否重复都要回 ACK, 对端可能没收到上一次的 ACK
+    if (!ackPending_) {
+        ackPending_ = true;
+        ackDeadline_ = std::chrono::steady_clock::now() + ACK_DELAY;
+    }
+
+    if (ahead < 0 || receivedAhead_.count(seq)) return;
+
+    if (seq == expected) {
+        ++expected;
+        while (receivedAhead_.erase(expected)) ++expected;
+        nextExpected_ = expected;
+    } else {
+        receivedAhead_.insert(seq);
+    }
+
+    if (callback_) callback_(plaintext);
+}
+
+void SecureUdpEndpoint::ioThreadFunc() {
+    std::vector<uint8_t> buffer(maxDatagram_);
+    struct pollfd fds[2] = {{sockfd_, POLLIN, 0}, {wakeFd_, POLLIN, 0}};
+
+    while (running_) {
+        int timeoutMs = static_cast<int>(RETRANSMIT_TIMEOUT.count());
+        if (ackPending_) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                ackDeadline_ - std::chrono::steady_clock::now()).count();
+            timeoutMs = left < 0 ? 0 : static_cast<int>(left);
+        }
+        if (keepalive_.count() > 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                nextPing_ - std::chrono::steady_clock::now()).count();
+            timeoutMs = std::min(timeoutMs, left < 0 ? 0 : static_cast<int>(left));
+        }
+
+        int n = poll(fds, 2, timeoutMs);
+        if (n < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (!running_) break;
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t v;
+            (void)read(wakeFd_, &v, sizeof(v));
+        }
+
+        if (fds[0].revents & POLLIN) {
+            while (true) {
+                // MSG_TRUNC 时返回数据报的实际长度, 比缓冲区大的整个丢掉
+                ssize_t len = recvfrom(sockfd_, buffer.data(), buffer.size(), MSG_DONTWAIT | MSG_TRUNC,
+                                       nullptr, nullptr);
+                if (len <= 0) break;
+                if (static_cast<size_t>(len) > buffer.size()) {
+                    truncated_++;
+                    continue;
+                }
+                handleDatagram(buffer.data(), static_cast<size_t>(len));
+            }
+        }
+
+        retransmitExpired();
+
+        auto now = std::chrono::steady_clock::now();
+        if (keepalive_.count() > 0 && now >= nextPing_) {
+            sendPing();
+            nextPing_ = now + keepalive_;
+        }
+
+        if (ackPending_ && now >= ackDeadline_) {
+            sendAckOnly();
+        }
+    }
+}
+
+// 只在 I/O 线程调用。上一个 PING 没等到回应就作废, 迟到的 PONG 不再采样
+void SecureUdpEndpoint::sendPing() {
+    pingId_++;
+    pingSentUs_ = nowMicros();
+    uint8_t body[PingLayout::SIZE];
+    PingLayout::encode(body, pingId_, pingSentUs_);
+    pingOutstanding_ = true;
+    std::lock_guard<std::mutex> lock(mu_);
+    transmit(FLAG_PING | FLAG_ACK, 0, std::string(reinterpret_cast<char*>(body), sizeof(body)));
+}
+
+void SecureUdpEndpoint::handlePing(const std::string& body) {
+    if (body.size() != PingLayout::SIZE) return;
+    uint64_t received = nowMicros();
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(body.data());
+
+    uint8_t reply[PongLayout::SIZE];
+    PongLayout::encode(reply, PingLayout::get<0>(p), PingLayout::get<1>(p), received, nowMicros());
+    std::lock_guard<std::mutex> lock(mu_);
+    transmit(FLAG_PONG | FLAG_ACK, 0, std::string(reinterpret_cast<char*>(reply), sizeof(reply)));
+}
+
+// NTP 式的四时刻估计: RTT 扣掉对端处理时间, 偏差假设两个方向时延相等。
+// 最近几个样本里取 RTT 最小的那个的偏差, 排队造成的不对称误差最小
+void SecureUdpEndpoint::handlePong(const std::string& body) {
+    if (body.size() != PongLayout::SIZE) return;
+    int64_t t4 = static_cast<int64_t>(nowMicros());
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(body.data());
+    // 重放的或过期的 PONG 对不上当前的 PING
+    if (!pingOutstanding_ || PongLayout::get<PONG_ID>(p) != pingId_ ||
+        PongLayout::get<PONG_T1>(p) != pingSentUs_) {
+        return;
+    }
+    pingOutstanding_ = false;
+
+    int64_t t1 = static_cast<int64_t>(PongLayout::get<PONG_T1>(p));
+    int64_t t2 = static_cast<int64_t>(PongLayout::get<PONG_T2>(p));
+    int64_t t3 = static_cast<int64_t>(PongLayout::get<PONG_T3>(p));
+    ClockSample sample;
+    sample.rttUs = std::max<int64_t>(0, (t4 - t1) - (t3 - t2));
+    sample.offsetUs = ((t2 - t1) + (t3 - t4)) / 2;
+
+    clockSamples_[clockSampleCount_ % clockSamples_.size()] = sample;
+    clockSampleCount_++;
+    size_t n = std::min(clockSampleCount_, clockSamples_.size());
+    auto best = std::min_element(clockSamples_.begin(), clockSamples_.begin() + n,
+        [](const ClockSample& a, const ClockSample& b) { return a.rttUs < b.rttUs; });
+
+    std::lock_guard<std::mutex> lock(statsMu_);
+    if (!stats_.synced) {
+        stats_.srtt = std::chrono::microseconds(sample.rttUs);
+        stats_.minRtt = stats_.srtt;
+    }
+    stats_.synced = true;
+    stats_.srtt += std::chrono::microseconds(
+        static_cast<int64_t>(RTT_GAIN * static_cast<double>(sample.rttUs - stats_.srtt.count())));
+    stats_.minRtt = std::min(stats_.minRtt, std::chrono::microseconds(sample.rttUs));
+    stats_.clockOffset = std::chrono::microseconds(best->offsetUs);
+}
+
+// 包头时间戳按估出的偏差换算到本地时钟, ageUs 为包龄 (还没对时为 0)。
+// 窗口要留出单向时延和偏差估计的误差 (最多半个 RTT)
+bool SecureUdpEndpoint::isFresh(uint64_t timestampMs, int64_t& ageUs) {
+    ageUs = 0;
+    std::lock_guard<std::mutex> lock(statsMu_);
+    if (!stats_.synced) return true;
+    int64_t sentUs = static_cast<int64_t>(timestampMs) * 1000 - stats_.clockOffset.count();
+    ageUs = static_cast<int64_t>(nowMicros()) - sentUs;
+    if (freshness_.count() == 0 || std::llabs(ageUs) <= freshness_.count() * 1000) return true;
+    stats_.stale++;
+    return false;
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <netinet/in.h>
+#include "../crypto/aes_gcm.h"
+
+// 单 socket 双向端点: 收发共用一个 socket 和一个 I/O 线程,
+// ACK 捎带在出方向的数据包头部, 只有没有数据可捎带时才单独发 ACK 包。
+// 头部整个作为 AAD 认证, 每次发出 (含重传) 都带最新的 ACK 和时间戳重新加密。
+class SecureUdpEndpoint {
+public:
+    static constexpr std::chrono::milliseconds DEFAULT_KEEPALIVE{1000};
+
+    // 心跳得到的链路估计
+    struct PathStats {
+        bool synced;                              // 至少收到过一个 PONG, 下面的估计才有意义
+        std::chrono::microseconds srtt;
+        std::chrono::microseconds minRtt;
+        std::chrono::microseconds clockOffset;    // 对端时钟减本地时钟
+        std::chrono::microseconds oneWayDelay;    // 最近一个数据包的单向时延, 毫秒精度
+        uint64_t stale;                           // 没通过新鲜度检查被丢掉的包
+    };
+
+    SecureUdpEndpoint(int localPort, const std::string& remoteIp, int remotePort);
+    ~SecureUdpEndpoint();
+
+    void start(std::function<void(const std::string&)> onMessage);
+    bool send(const std::string& data);
+    void stop();
+    // 已发出、对端还没确认的消息数
+    size_t unacknowledged();
+
+    // 收发两个方向的数据报 (UDP 载荷) 上限, 默认 DEFAULT_MAX_DATAGRAM (1472), 回环或巨帧路径最大可到 65507;
+    // 须在 start() 之前, 两端要一致
+    void setMaxDatagram(size_t bytes);
+    // 超过上限而被丢掉的入包数
+    uint64_t truncatedDatagrams() const { return truncated_; }
+
+    // 每 interval 发一个加密的 PING, 对端立即回 PONG: 维持 NAT 映射, 持续采样 RTT,
+    // 并估计对端时钟相对本地的偏差。0 关闭; 须在 start() 之前
+    void setKeepalive(std::chrono::milliseconds interval);
+    // 估出时钟偏差后, 包头时间戳换算到本地时钟, 和当前时刻相差超过 window 的数据包
+    // 不解密直接丢掉。0 (默认) 不检查
+    void setFreshnessWindow(std::chrono::milliseconds window);
+    PathStats pathStats() const;
+
+private:
+    // 留明文, 每次发出再加密
+    struct Outgoing {
+        uint8_t flags;
+        std::string plaintext;
+        std::chrono::steady_clock::time_point lastSent;
+    };
+
+    void ioThreadFunc();
+    void handleDatagram(const uint8_t* data, size_t len);
+    void handleAck(uint32_t ack);
+    bool trackPeerSession(uint64_t session, uint32_t base);
+    bool transmit(uint8_t flags, uint32_t seq, const std::string& plaintext);
+    void sendAckOnly();
+    void retransmitExpired();
+    void sendPing();
+    void handlePing(const std::string& body);
+    void handlePong(const std::string& body);
+    bool isFresh(uint64_t timestampMs, int64_t& ageUs);
+
+    int sockfd_;
+    int wakeFd_;
+    AesGcmContext ctx_;
+    uint64_t session_;                  // NONCE 的前 6 字节, 每个实例随机
+    std::atomic<uint64_t> nonceCounter_;
+    struct sockaddr_in remoteAddr_;
+    size_t maxDatagram_;
+    std::atomic<uint64_t> truncated_;
+
+    // 发送方向
+    std::atomic<uint32_t> seq_;
+    uint32_t sendBase_;                 // 最老的未确认序号, 之前的对端都已确认
+    std::map<uint32_t, Outgoing> unackedPackets_;
+    std::mutex mu_;
+
+    // 接收方向, 只对对端当前会话: nextExpected_ 之前的序号都已收到, 即要回给对端的累计 ACK。
+    // 会话号和 nextExpected_ 只在持 mu_ 时一起换
+    uint64_t peerSession_;
+    bool peerKnown_;
+    std::deque<uint64_t> retiredSessions_;
+    std::atomic<uint32_t> nextExpected_;
+    std::set<uint32_t> receivedAhead_;
+    std::atomic<bool> ackPending_;
+    std::chrono::steady_clock::time_point ackDeadline_;
+
+    // 心跳: 只有 I/O 线程改, statsMu_ 保护给外部读的部分
+    struct ClockSample {
+        int64_t rttUs;
+        int64_t offsetUs;
+    };
+    std::chrono::milliseconds keepalive_;
+    std::chrono::milliseconds freshness_;
+    std::chrono::steady_clock::time_point nextPing_;
+    uint32_t pingId_;
+    uint64_t pingSentUs_;
+    bool pingOutstanding_;
+    std::array<ClockSample, 8> clockSamples_;
+    size_t clockSampleCount_;
+    PathStats stats_;
+    mutable std::mutex statsMu_;
+
+    std::thread ioThread_;
+    std::atomic<bool> running_;
+    std::function<void(const std::string&)> callback_;
+};
@@ -0,0 +1,92 @@
+#include "fanout.h"
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+
+namespace fanout {
+
+struct sockaddr_in makeAddr(const std::string& ip, int port) {
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) != 1) {
+        throw std::runtime_error("Invalid address: " + ip);
+    }
+    return addr;
+}
+
+void initKey(AesGcmContext& ctx, const std::string& key, const char* what) {
+    if (!aes_gcm_init(ctx, reinterpret_cast<const uint8_t*>(key.data()), key.size())) {
+        throw std::runtime_error(std::string("Invalid ") + what);
+    }
+}
+
+int openSocket(int localPort) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        throw std::runtime_error("Failed to create socket");
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in localAddr{};
+    localAddr.sin_family = AF_INET;
+    localAddr.sin_addr.s_addr = INADDR_ANY;
+    localAddr.sin_port = htons(localPort);
+    if (bind(fd, (struct sockaddr*)&localAddr, sizeof(localAddr)) < 0) {
+        perror("bind");
+        close(fd);
+        throw std::runtime_error("Failed to bind socket");
+    }
+    return fd;
+}
+
+bool joinMulticast(int fd, const std::string& groupIp) {
+    struct ip_mreq mreq{};
+    mreq.imr_multiaddr = makeAddr(groupIp, 0).sin_addr;
+    mreq.imr_interface.s_addr = INADDR_ANY;
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        perror("setsockopt IP_ADD_MEMBERSHIP");
+        return false;
+    }
+    return true;
+}
+
+void setMulticastTtl(int fd, int ttl) {
+    if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+        perror("setsockopt IP_MULTICAST_TTL");
+        throw std::runtime_error("Failed to set multicast TTL");
+    }
+}
+
+void buildBatch(std::vector<struct sockaddr_in>& destinations, struct iovec* iov,
+                std::vector<struct mmsghdr>& batch) {
+    batch.assign(destinations.size(), mmsghdr{});
+    for (size_t i = 0; i < destinations.size(); i++) {
+        msghdr& hdr = batch[i].msg_hdr;
+        hdr.msg_name = &destinations[i];
+        hdr.msg_namelen = sizeof(destinations[i]);
+        hdr.msg_iov = iov;
+        hdr.msg_iovlen = 1;
+    }
+}
+
+bool sendBatch(int fd, std::vector<struct mmsghdr>& batch) {
+    size_t done = 0;
+    while (done < batch.size()) {
+        unsigned int count = static_cast<unsigned int>(std::min<size_t>(batch.size() - done, MMSG_BATCH));
+        int sent = sendmmsg(fd, batch.data() + done, count, 0);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            perror("sendmmsg");
+            return false;
+        }
+        done += static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+} // namespace fanout
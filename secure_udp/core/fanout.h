@@ -0,0 +1,44 @@
+#pragma once
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../crypto/aes_gcm.h"
+
+// GroupSender 和 Publisher 共用的扇出部件: 一份密文用 sendmmsg 批量发给一组目标,
+// 另有建 socket、组播设置这些两边一样的步骤。
+// 两边的包都是 [明文头][NONCE(12B)][CIPHERTEXT][TAG(16B)], 明文头作为 AAD。
+namespace fanout {
+
+constexpr size_t NONCE_LEN = 12;
+constexpr size_t TAG_LEN = 16;
+constexpr size_t MAX_DATAGRAM = 65507;
+// 内核单次 sendmmsg 最多接受的消息数 (UIO_MAXIOV)
+constexpr size_t MMSG_BATCH = 1024;
+
+// 地址无效时抛异常
+struct sockaddr_in makeAddr(const std::string& ip, int port);
+
+// 按地址分状态时用的键: IP << 16 | 端口
+inline uint64_t addrKey(const struct sockaddr_in& addr) {
+    return (uint64_t(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+}
+
+// what 只用于异常信息, 如 "group key"
+void initKey(AesGcmContext& ctx, const std::string& key, const char* what);
+
+// 绑定 localPort 的 UDP socket, 带 SO_REUSEADDR, 同一台机器上可以有多个组播接收端
+int openSocket(int localPort);
+// 失败时 perror 并返回 false, socket 由调用方关闭
+bool joinMulticast(int fd, const std::string& groupIp);
+void setMulticastTtl(int fd, int ttl);
+
+// 每个目标一个 mmsghdr, 共用同一个 iovec, 目标列表变化后要重建
+void buildBatch(std::vector<struct sockaddr_in>& destinations, struct iovec* iov,
+                std::vector<struct mmsghdr>& batch);
+// 按 MMSG_BATCH 分批把 batch 发完, 发之前先填好 iovec
+bool sendBatch(int fd, std::vector<struct mmsghdr>& batch);
+
+} // namespace fanout
@@ -0,0 +1,386 @@
+#include "fec.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FEC_X86 1
+#endif
+
+namespace {
+
+// GF(2^8), 本原多项式 x^8 + x^4 + x^3 + x^2 + 1
+struct GaloisField {
+    std::array<uint8_t, 512> exp;
+    std::array<uint8_t, 256> log;
+    std::array<std::array<uint8_t, 256>, 256> mul;
+
+    GaloisField() {
+        unsigned x = 1;
+        for (int i = 0; i < 255; i++) {
+            exp[i] = static_cast<uint8_t>(x);
+            log[x] = static_cast<uint8_t>(i);
+            x <<= 1;
+            if (x & 0x100) x ^= 0x11d;
+        }
+        for (int i = 255; i < 512; i++) exp[i] = exp[i - 255];
+        log[0] = 0;
+        for (int a = 0; a < 256; a++) {
+            for (int b = 0; b < 256; b++) {
+                mul[a][b] = (a && b) ? exp[log[a] + log[b]] : 0;
+            }
+        }
+    }
+
+    uint8_t inv(uint8_t a) const { return exp[255 - log[a]]; }
+};
+
+const GaloisField& gf() {
+    static const GaloisField field;
+    return field;
+}
+
+// 修复包 j 对数据包 i 的系数。Cauchy 矩阵 1/(x_j + y_i) 的任意方阵子式都可逆,
+// 再按列缩放让第 0 行全为 1: 可逆性不变, 且单个修复包就是普通异或
+uint8_t coefficient(size_t repair, size_t data) {
+    const GaloisField& f = gf();
+    uint8_t y = static_cast<uint8_t>(data);
+    uint8_t cauchy = f.inv(static_cast<uint8_t>(fec::MAX_DATA_COUNT + repair) ^ y);
+    uint8_t first = f.inv(static_cast<uint8_t>(fec::MAX_DATA_COUNT) ^ y);
+    return f.mul[cauchy][f.inv(first)];
+}
+
+void xorScalar(uint8_t* dst, const uint8_t* src, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t a, b;
+        std::memcpy(&a, dst + i, 8);
+        std::memcpy(&b, src + i, 8);
+        a ^= b;
+        std::memcpy(dst + i, &a, 8);
+    }
+    for (; i < n; i++) dst[i] ^= src[i];
+}
+
+void mulAddScalar(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n) {
+    const uint8_t* row = gf().mul[c].data();
+    for (size_t i = 0; i < n; i++) dst[i] ^= row[src[i]];
+}
+
+// c 乘以一个字节 = c 乘低 4 位 ^ c 乘高 4 位, 两张 16 项的表用 PSHUFB 并行查
+void nibbleTables(uint8_t c, uint8_t lo[16], uint8_t hi[16]) {
+    const uint8_t* row = gf().mul[c].data();
+    for (int i = 0; i < 16; i++) {
+        lo[i] = row[i];
+        hi[i] = row[i << 4];
+    }
+}
+
+#ifdef FEC_X86
+__attribute__((target("sse2")))
+void xorSse2(uint8_t* dst, const uint8_t* src, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(a, b));
+    }
+    xorScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("ssse3")))
+void mulAddSsse3(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n) {
+    alignas(16) uint8_t lo[16], hi[16];
+    nibbleTables(c, lo, hi);
+    __m128i tlo = _mm_load_si128(reinterpret_cast<const __m128i*>(lo));
+    __m128i thi = _mm_load_si128(reinterpret_cast<const __m128i*>(hi));
+    __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i l = _mm_shuffle_epi8(tlo, _mm_and_si128(s, mask));
+        __m128i h = _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(d, _mm_xor_si128(l, h)));
+    }
+    mulAddScalar(dst + i, src + i, c, n - i);
+}
+
+__attribute__((target("avx2")))
+void xorAvx2(uint8_t* dst, const uint8_t* src, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(a, b));
+    }
+    xorSse2(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void mulAddAvx2(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n) {
+    alignas(16) uint8_t lo[16], hi[16];
+    nibbleTables(c, lo, hi);
+    // vpshufb 在两个 128 位半边内各自查表, 表要复制到两半
+    __m256i tlo = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(lo)));
+    __m256i thi = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(hi)));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i l = _mm256_shuffle_epi8(tlo, _mm256_and_si256(s, mask));
+        __m256i h = _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(d, _mm256_xor_si256(l, h)));
+    }
+    mulAddSsse3(dst + i, src + i, c, n - i);
+}
+#endif
+
+struct Kernels {
+    void (*xorInto)(uint8_t*, const uint8_t*, size_t);
+    void (*mulAdd)(uint8_t*, const uint8_t*, uint8_t, size_t);
+    const char* name;
+};
+
+// 启动时按 CPU 选一次, 之后都是间接调用
+Kernels selectKernels() {
+#ifdef FEC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {xorAvx2, mulAddAvx2, "avx2"};
+    if (__builtin_cpu_supports("ssse3")) return {xorSse2, mulAddSsse3, "ssse3"};
+#endif
+    return {xorScalar, mulAddScalar, "scalar"};
+}
+
+const Kernels& kernels() {
+    static const Kernels k = selectKernels();
+    return k;
+}
+
+// 数据包在码字里的前两字节是它的长度
+void storeLength(uint8_t out[fec::LEN_FIELD], size_t len) {
+    wire::storeLe<uint16_t>(out, static_cast<uint16_t>(len));
+}
+
+// parity ^= c * [LEN][packet]
+void accumulate(uint8_t* parity, const uint8_t* packet, size_t packetLen, uint8_t c) {
+    uint8_t len[fec::LEN_FIELD];
+    storeLength(len, packetLen);
+    fec::mulAddInto(parity, len, c, fec::LEN_FIELD);
+    fec::mulAddInto(parity + fec::LEN_FIELD, packet, c, packetLen);
+}
+
+} // namespace
+
+namespace fec {
+
+void xorInto(uint8_t* dst, const uint8_t* src, size_t n) {
+    kernels().xorInto(dst, src, n);
+}
+
+void mulAddInto(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n) {
+    if (c == 0) return;
+    if (c == 1) {
+        kernels().xorInto(dst, src, n);
+        return;
+    }
+    kernels().mulAdd(dst, src, c, n);
+}
+
+const char* kernelName() {
+    return kernels().name;
+}
+
+} // namespace fec
+
+FecEncoder::FecEncoder()
+    : scheme_(FecScheme::None), dataCount_(0), repairCount_(0), group_(0), index_(0), symbolLen_(0) {
+}
+
+void FecEncoder::configure(FecScheme scheme, size_t dataCount, size_t repairCount) {
+    if (scheme == FecScheme::Xor) repairCount = 1;
+    if (scheme != FecScheme::None &&
+        (dataCount < 1 || dataCount > fec::MAX_DATA_COUNT ||
+         repairCount < 1 || repairCount > fec::MAX_REPAIR_COUNT)) {
+        throw std::runtime_error("Invalid FEC group size");
+    }
+    if (index_ > 0) group_++; // 改配置前没发完的组不再出修复包
+    scheme_ = scheme;
+    dataCount_ = dataCount;
+    repairCount_ = repairCount;
+    index_ = 0;
+    symbolLen_ = 0;
+    parity_.assign(repairCount, std::vector<uint8_t>(fec::LEN_FIELD + fec::MAX_PROTECTED, 0));
+}
+
+void FecEncoder::protect(const uint8_t* data, size_t len, std::vector<std::string>& out) {
+    if (!enabled() || len > fec::MAX_PROTECTED) {
+        out.emplace_back(reinterpret_cast<const char*>(data), len);
+        return;
+    }
+    if (index_ == 0) groupStart_ = std::chrono::steady_clock::now();
+
+    std::string packet(fec::PREFIX_LEN + len, '\0');
+    uint8_t* p = reinterpret_cast<uint8_t*>(&packet[0]);
+    fec::PrefixLayout::encode(p, fec::KIND_DATA, group_, static_cast<uint8_t>(index_),
+                              static_cast<uint8_t>(dataCount_), static_cast<uint8_t>(repairCount_));
+    std::memcpy(p + fec::PREFIX_LEN, data, len);
+
+    for (size_t j = 0; j < repairCount_; j++) {
+        accumulate(parity_[j].data(), data, len, coefficient(j, index_));
+    }
+    symbolLen_ = std::max(symbolLen_, fec::LEN_FIELD + len);
+    out.push_back(std::move(packet));
+
+    if (++index_ == dataCount_) finishGroup(out);
+}
+
+void FecEncoder::flushOlderThan(std::chrono::steady_clock::duration maxAge, std::vector<std::string>& out) {
+    if (!enabled() || index_ == 0) return;
+    if (std::chrono::steady_clock::now() - groupStart_ < maxAge) return;
+    finishGroup(out);
+}
+
+void FecEncoder::finishGroup(std::vector<std::string>& out) {
+    // DATA_COUNT 写实际个数, 提前收尾的组比配置的小
+    for (size_t j = 0; j < repairCount_; j++) {
+        std::string packet(fec::PREFIX_LEN + symbolLen_, '\0');
+        uint8_t* p = reinterpret_cast<uint8_t*>(&packet[0]);
+        fec::PrefixLayout::encode(p, fec::KIND_REPAIR, group_, static_cast<uint8_t>(index_ + j),
+                                  static_cast<uint8_t>(index_), static_cast<uint8_t>(repairCount_));
+        std::memcpy(p + fec::PREFIX_LEN, parity_[j].data(), symbolLen_);
+        std::memset(parity_[j].data(), 0, symbolLen_);
+        out.push_back(std::move(packet));
+    }
+    group_++;
+    index_ = 0;
+    symbolLen_ = 0;
+}
+
+FecDecoder::Group& FecDecoder::groupFor(uint16_t id) {
+    auto it = groups_.find(id);
+    if (it != groups_.end()) return it->second;
+    if (order_.size() >= MAX_GROUPS) {
+        groups_.erase(order_.front());
+        order_.pop_front();
+    }
+    order_.push_back(id);
+    return groups_[id];
+}
+
+void FecDecoder::receive(const uint8_t* data, size_t len, std::vector<std::string>& out) {
+    if (!fec::isFecPacket(data, len)) return;
+    uint8_t kind = fec::PrefixLayout::get<fec::PREFIX_KIND>(data);
+    uint16_t id = fec::PrefixLayout::get<fec::PREFIX_GROUP>(data);
+    size_t index = fec::PrefixLayout::get<fec::PREFIX_INDEX>(data);
+    size_t dataCount = fec::PrefixLayout::get<fec::PREFIX_DATA_COUNT>(data);
+    size_t repairCount = fec::PrefixLayout::get<fec::PREFIX_REPAIR_COUNT>(data);
+    if (dataCount < 1 || dataCount > fec::MAX_DATA_COUNT ||
+        repairCount < 1 || repairCount > fec::MAX_REPAIR_COUNT) {
+        return;
+    }
+    const char* body = reinterpret_cast<const char*>(data) + fec::PREFIX_LEN;
+    size_t bodyLen = len - fec::PREFIX_LEN;
+
+    // 数据包不等恢复, 原报文先交出去
+    if (kind == fec::KIND_DATA) out.emplace_back(body, bodyLen);
+
+    std::lock_guard<std::mutex> lock(mu_);
+    Group& g = groupFor(id);
+    if (g.done) return;
+
+    if (kind == fec::KIND_DATA) {
+        if (index >= dataCount) return;
+        // 修复包里的个数才是准的, 提前收尾的组比数据包里写的小
+        if (g.repairs.empty()) g.dataCount = dataCount;
+        if (g.data.size() <= index) g.data.resize(index + 1);
+        g.data[index].assign(body, bodyLen);
+    } else if (kind == fec::KIND_REPAIR) {
+        if (index < dataCount || index >= dataCount + repairCount) return;
+        if (bodyLen < fec::LEN_FIELD || bodyLen > fec::LEN_FIELD + fec::MAX_PROTECTED) return;
+        if (!g.repairs.empty() && g.repairs.begin()->second.size() != bodyLen) return;
+        g.dataCount = dataCount;
+        g.repairCount = repairCount;
+        g.repairs.emplace(index - dataCount, std::string(body, bodyLen));
+    } else {
+        return;
+    }
+    tryRecover(g, out);
+}
+
+void FecDecoder::tryRecover(Group& g, std::vector<std::string>& out) {
+    if (g.dataCount == 0) return;
+    if (g.data.size() < g.dataCount) g.data.resize(g.dataCount);
+
+    std::vector<size_t> missing;
+    for (size_t i = 0; i < g.dataCount; i++) {
+        if (g.data[i].empty()) missing.push_back(i);
+    }
+    if (missing.empty()) {
+        g.done = true;
+        g.data.clear();
+        g.repairs.clear();
+        return;
+    }
+    if (missing.size() > g.repairs.size()) return;
+
+    size_t symbolLen = g.repairs.begin()->second.size();
+    size_t e = missing.size();
+
+    // 用前 e 个修复包, 先减掉已收到数据包的贡献, 剩下的只和丢失的包有关
+    std::vector<size_t> rows;
+    std::vector<std::vector<uint8_t>> syndromes;
+    for (auto& r : g.repairs) {
+        if (rows.size() == e) break;
+        std::vector<uint8_t> s(r.second.begin(), r.second.end());
+        for (size_t i = 0; i < g.dataCount; i++) {
+            if (g.data[i].empty()) continue;
+            if (fec::LEN_FIELD + g.data[i].size() > symbolLen) return; // 和修复包对不上
+            accumulate(s.data(), reinterpret_cast<const uint8_t*>(g.data[i].data()), g.data[i].size(),
+                       coefficient(r.first, i));
+        }
+        rows.push_back(r.first);
+        syndromes.push_back(std::move(s));
+    }
+
+    // e x e 子矩阵求逆 (Gauss-Jordan), Cauchy 子式保证可逆
+    const GaloisField& f = gf();
+    std::vector<std::vector<uint8_t>> a(e, std::vector<uint8_t>(2 * e, 0));
+    for (size_t r = 0; r < e; r++) {
+        for (size_t c = 0; c < e; c++) a[r][c] = coefficient(rows[r], missing[c]);
+        a[r][e + r] = 1;
+    }
+    for (size_t c = 0; c < e; c++) {
+        size_t pivot = c;
+        while (pivot < e && a[pivot][c] == 0) pivot++;
+        if (pivot == e) return;
+        std::swap(a[c], a[pivot]);
+        uint8_t scale = f.inv(a[c][c]);
+        for (auto& v : a[c]) v = f.mul[scale][v];
+        for (size_t r = 0; r < e; r++) {
+            if (r == c || a[r][c] == 0) continue;
+            fec::mulAddInto(a[r].data(), a[c].data(), a[r][c], 2 * e);
+        }
+    }
+
+    for (size_t c = 0; c < e; c++) {
+        std::vector<uint8_t> symbol(symbolLen, 0);
+        for (size_t r = 0; r < e; r++) {
+            fec::mulAddInto(symbol.data(), syndromes[r].data(), a[c][e + r], symbolLen);
+        }
+        size_t len = wire::loadLe<uint16_t>(symbol.data());
+        if (len == 0 || fec::LEN_FIELD + len > symbolLen) continue; // 伪造或不一致的修复包
+        out.emplace_back(reinterpret_cast<const char*>(symbol.data()) + fec::LEN_FIELD, len);
+        recovered_++;
+    }
+    g.done = true;
+    g.data.clear();
+    g.repairs.clear();
+}
+
+uint64_t FecDecoder::recovered() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return recovered_;
+}
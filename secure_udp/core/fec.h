@@ -0,0 +1,123 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "codec.h"
+
+// 前向纠错: 发送端把连续 K 个已加密的数据报编成一组, 追加 M 个修复包,
+// 接收端在一组里丢了不超过 M 个包时直接算回来, 不用等一个 RTT 的重传。
+// 修复包只是密文的线性组合, 不需要密钥; 恢复出的包照常解密认证。
+//
+// 封装: [KIND(1B)][GROUP(2B)][INDEX(1B)][DATA_COUNT(1B)][REPAIR_COUNT(1B)][...]
+// 数据包后面是原报文, 修复包后面是 [LEN_PARITY(2B)][PARITY]。
+// KIND 的高两位都置位, 和紧凑包头 FLAGS 的保留位重合, 接收端据此区分。
+// 组内第 i 个数据包按 [LEN(2B)][报文][补零] 对齐到组内最长, 再参与编码。
+enum class FecScheme : uint8_t {
+    None,
+    Xor,            // 一个修复包, 各数据包逐字节异或, 只能补一个
+    ReedSolomon,    // GF(2^8) 上的 Cauchy 矩阵, 丢任意 M 个都能补
+};
+
+namespace fec {
+
+constexpr uint8_t KIND_DATA = 0xc0;
+constexpr uint8_t KIND_REPAIR = 0xc1;
+constexpr uint8_t KIND_MASK = 0xc0;
+
+using PrefixLayout = wire::Layout<wire::Field<uint8_t>, wire::Field<uint16_t>, wire::Field<uint8_t>,
+                                  wire::Field<uint8_t>, wire::Field<uint8_t>>;
+enum { PREFIX_KIND, PREFIX_GROUP, PREFIX_INDEX, PREFIX_DATA_COUNT, PREFIX_REPAIR_COUNT };
+constexpr size_t PREFIX_LEN = PrefixLayout::SIZE;
+constexpr size_t LEN_FIELD = 2;
+
+constexpr size_t MAX_DATA_COUNT = 64;
+constexpr size_t MAX_REPAIR_COUNT = 16;
+// 参与编码的报文最长这么多, 更长的不封装直接发。按整个 1500 字节 MTU 取,
+// 默认最大数据报 (DEFAULT_MAX_DATAGRAM) 下的包都在范围内
+constexpr size_t MAX_PROTECTED = 1500;
+
+inline bool isFecPacket(const uint8_t* data, size_t len) {
+    return len >= PREFIX_LEN && (data[0] & KIND_MASK) == KIND_MASK;
+}
+
+// FEC 数据包里的原报文; 不是数据包 (修复包或没封装的) 时返回 nullptr
+inline const uint8_t* innerPacket(const uint8_t* data, size_t len, size_t& innerLen) {
+    if (!isFecPacket(data, len) || data[0] != KIND_DATA) return nullptr;
+    innerLen = len - PREFIX_LEN;
+    return data + PREFIX_LEN;
+}
+
+// dst ^= src
+void xorInto(uint8_t* dst, const uint8_t* src, size_t n);
+// dst ^= c * src, GF(2^8) 乘法
+void mulAddInto(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n);
+// 运行时选中的内核: "avx2", "ssse3" 或 "scalar"
+const char* kernelName();
+
+} // namespace fec
+
+// 非线程安全, 由发送端持锁调用
+class FecEncoder {
+public:
+    FecEncoder();
+
+    void configure(FecScheme scheme, size_t dataCount, size_t repairCount);
+    bool enabled() const { return scheme_ != FecScheme::None; }
+    // 组号从哪里开始。发送端每个会话随机取一个, 接收端同一来源上先后几个会话的组号不会撞上
+    void setFirstGroup(uint16_t group) { group_ = group; }
+
+    // 封装一个数据报追加到 out; 凑满一组时修复包也追加到 out
+    void protect(const uint8_t* data, size_t len, std::vector<std::string>& out);
+    // 不满的一组开了超过 maxAge 就提前收尾, 流量停下时最后几个包也有保护
+    void flushOlderThan(std::chrono::steady_clock::duration maxAge, std::vector<std::string>& out);
+
+private:
+    void finishGroup(std::vector<std::string>& out);
+
+    FecScheme scheme_;
+    size_t dataCount_;
+    size_t repairCount_;
+
+    uint16_t group_;
+    size_t index_;
+    size_t symbolLen_;      // 本组最长的 [LEN][报文]
+    std::chrono::steady_clock::time_point groupStart_;
+    // 修复包的校验和边发边累加, 不保留数据包
+    std::vector<std::vector<uint8_t>> parity_;
+};
+
+// 线程安全, 接收端可能在多个核上并发处理报文。组号只在一个发送端内唯一,
+// 接收端按来源各用一个解码器
+class FecDecoder {
+public:
+    // 最多同时跟踪这么多组, 更早的组放弃恢复
+    static constexpr size_t MAX_GROUPS = 64;
+
+    // 处理一个 FEC 报文: 数据包的原报文立即追加到 out, 本包促成的恢复结果也追加到 out
+    void receive(const uint8_t* data, size_t len, std::vector<std::string>& out);
+
+    uint64_t recovered() const;
+
+private:
+    struct Group {
+        size_t dataCount = 0;
+        size_t repairCount = 0;
+        std::vector<std::string> data;          // 下标为组内序号, 空表示没收到
+        std::map<size_t, std::string> repairs;  // 修复包序号 -> [LEN_PARITY][PARITY]
+        bool done = false;
+    };
+
+    Group& groupFor(uint16_t id);
+    void tryRecover(Group& g, std::vector<std::string>& out);
+
+    std::unordered_map<uint16_t, Group> groups_;
+    std::deque<uint16_t> order_;
+    uint64_t recovered_ = 0;
+    mutable std::mutex mu_;
+};
@@ -0,0 +1,424 @@
+#include "file_transfer.h"
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include "codec.h"
+
+// 数据消息的前缀: 这段数据在文件里的偏移
+using OffsetLayout = wire::Layout<wire::Field<uint64_t>>;
+// 偏移的最高位置位、不带数据的消息是 SYNC: 接收端把已写的数据 fdatasync 落盘后才确认它
+static constexpr uint64_t SYNC_FLAG = 1ull << 63;
+// 控制流上的 DONE: [MAGIC][VERSION][SIZE]
+using DoneLayout = wire::Layout<wire::Field<uint32_t>, wire::Field<uint16_t>, wire::Field<uint64_t>>;
+
+static constexpr uint32_t DONE_MAGIC = 0x54465553;      // "SUFT"
+static constexpr uint16_t DONE_VERSION = 1;
+static constexpr uint32_t JOURNAL_MAGIC = 0x4A465553;   // "SUFJ"
+static constexpr uint32_t JOURNAL_VERSION = 1;
+static constexpr size_t CONTROL_WINDOW = 16;
+// 等窗口时最多睡这么久再查一次确认和超时, 窗口回调会提前叫醒
+static constexpr std::chrono::milliseconds POLL_INTERVAL{10};
+
+// ---------------- 续传日志 ----------------
+
+// 文件头后面是每块一位的位图, 整个文件 mmap; 头和源文件对不上 (换了文件或改过) 就清空重来。
+// 位只在块的数据被对端落盘确认后置上, 日志落盘晚了最多是重发几个块, 不会漏发
+struct FileSender::Journal {
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t fileSize;
+        uint64_t chunkSize;
+        int64_t mtimeNs;
+    };
+
+    int fd = -1;
+    uint8_t* base = nullptr;
+    size_t length = 0;
+    std::mutex mu;
+
+    Journal(const std::string& path, uint64_t fileSize, uint64_t chunkSize, int64_t mtimeNs, uint64_t chunks)
+        : length(sizeof(Header) + (chunks + 7) / 8) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            perror("open");
+            throw std::runtime_error("Failed to open transfer journal " + path);
+        }
+        // 两个发送进程共用一个日志会互相覆盖
+        if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+            close(fd);
+            throw std::runtime_error("Transfer journal is in use: " + path);
+        }
+        struct stat st{};
+        if (fstat(fd, &st) < 0) {
+            perror("fstat");
+            close(fd);
+            throw std::runtime_error("Failed to stat transfer journal " + path);
+        }
+        bool sized = static_cast<size_t>(st.st_size) == length;
+        if (!sized && ftruncate(fd, static_cast<off_t>(length)) < 0) {
+            perror("ftruncate");
+            close(fd);
+            throw std::runtime_error("Failed to size transfer journal " + path);
+        }
+        void* mem = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED) {
+            perror("mmap");
+            close(fd);
+            throw std::runtime_error("Failed to map transfer journal " + path);
+        }
+        base = static_cast<uint8_t*>(mem);
+
+        Header* h = reinterpret_cast<Header*>(base);
+        if (!sized || h->magic != JOURNAL_MAGIC || h->version != JOURNAL_VERSION ||
+            h->fileSize != fileSize || h->chunkSize != chunkSize || h->mtimeNs != mtimeNs) {
+            // 先清位图再写头, 中途崩了下次仍然认不出这个头
+            h->magic = 0;
+            std::memset(base + sizeof(Header), 0, length - sizeof(Header));
+            msync(base, length, MS_SYNC);
+            h->version = JOURNAL_VERSION;
+            h->fileSize = fileSize;
+            h->chunkSize = chunkSize;
+            h->mtimeNs = mtimeNs;
+            h->magic = JOURNAL_MAGIC;
+            msync(base, length, MS_SYNC);
+        }
+    }
+
+    ~Journal() {
+        if (base) {
+            msync(base, length, MS_SYNC);
+            munmap(base, length);
+        }
+        if (fd >= 0) close(fd);
+    }
+
+    bool confirmed(uint64_t chunk) {
+        std::lock_guard<std::mutex> lock(mu);
+        return base[sizeof(Header) + chunk / 8] & (1u << (chunk % 8));
+    }
+
+    void confirm(uint64_t chunk) {
+        std::lock_guard<std::mutex> lock(mu);
+        base[sizeof(Header) + chunk / 8] |= static_cast<uint8_t>(1u << (chunk % 8));
+        msync(base, length, MS_ASYNC);
+    }
+};
+
+// 一次 send() 的共享状态, 各发送线程从 chunks 里领块
+struct FileSender::Job {
+    const uint8_t* data = nullptr;
+    uint64_t size = 0;
+    Journal* journal = nullptr;
+    std::vector<uint64_t> chunks;       // 还没确认的块号
+    std::atomic<size_t> next{0};
+    bool bounded = false;
+    std::chrono::steady_clock::time_point deadline;
+    std::atomic<bool> failed{false};
+
+    bool expired() {
+        if (bounded && std::chrono::steady_clock::now() >= deadline) failed = true;
+        return failed;
+    }
+};
+
+// ---------------- 发送端 ----------------
+
+FileSender::FileSender(SecureUdpSender& sender, const FileTransferOptions& options)
+    : sender_(sender), options_(options), bytesSent_(0),
+      mu_(std::make_shared<std::mutex>()), cv_(std::make_shared<std::condition_variable>())
+{
+    if (options_.chunkSize == 0 || options_.streams == 0 || options_.segmentSize == 0) {
+        throw std::runtime_error("Invalid file transfer options");
+    }
+    control_ = sender_.openStream(true, CONTROL_WINDOW, Priority::Bulk);
+    for (size_t i = 0; i < options_.streams; i++) {
+        // 消息自带偏移, 数据流不必按序交付, 一个丢包不会卡住同流后面的写入
+        streams_.push_back(sender_.openStream(false, options_.window, Priority::Bulk));
+    }
+    std::weak_ptr<std::mutex> weakMu = mu_;
+    std::weak_ptr<std::condition_variable> weakCv = cv_;
+    auto wake = [weakMu, weakCv] {
+        auto mu = weakMu.lock();
+        auto cv = weakCv.lock();
+        if (!mu || !cv) return;
+        std::lock_guard<std::mutex> lock(*mu);
+        cv->notify_all();
+    };
+    sender_.onWindowOpen(control_, wake);
+    for (uint16_t stream : streams_) sender_.onWindowOpen(stream, wake);
+}
+
+FileSender::~FileSender() {
+    sender_.onWindowOpen(control_, nullptr);
+    for (uint16_t stream : streams_) sender_.onWindowOpen(stream, nullptr);
+}
+
+// 一个数据流的发送线程: 领块, 整块从映射发出, 记下块后第一个序号。
+// 累计确认越过它说明整块已进对端的页缓存; 有续传日志时再在同一个流上发 SYNC,
+// SYNC 也被确认了才说明已落盘, 这时才记进日志。一个 SYNC 覆盖它之前所有已确认的块
+void FileSender::sendStream(Job& job, size_t index) {
+    uint16_t stream = streams_[index];
+    struct Pending {
+        uint64_t chunk;
+        uint32_t after;     // 等这个序号之前都被确认: 先是块的数据, 发了 SYNC 后是 SYNC
+        bool syncing;
+    };
+    std::deque<Pending> unconfirmed;
+
+    auto confirm = [&] {
+        while (!unconfirmed.empty() && sender_.acknowledgedBefore(stream, unconfirmed.front().after)) {
+            if (job.journal && !unconfirmed.front().syncing) break;
+            if (job.journal) job.journal->confirm(unconfirmed.front().chunk);
+            unconfirmed.pop_front();
+        }
+        if (!job.journal) return;
+        size_t ready = 0;
+        while (ready < unconfirmed.size() && !unconfirmed[ready].syncing &&
+               sender_.acknowledgedBefore(stream, unconfirmed[ready].after)) {
+            ready++;
+        }
+        if (ready == 0) return;
+        uint8_t sync[OffsetLayout::SIZE];
+        OffsetLayout::encode(sync, SYNC_FLAG | unconfirmed.front().chunk * options_.chunkSize);
+        if (!sender_.send(stream, sync, sizeof(sync))) return; // 窗口满, 下次再发
+        uint32_t after = sender_.nextSequence(stream);
+        for (size_t i = 0; i < ready; i++) {
+            unconfirmed[i].after = after;
+            unconfirmed[i].syncing = true;
+        }
+    };
+    auto pause = [&] {
+        if (job.expired()) return false;
+        std::unique_lock<std::mutex> lock(*mu_);
+        cv_->wait_for(lock, POLL_INTERVAL);
+        return !job.failed;
+    };
+
+    long page = sysconf(_SC_PAGESIZE);
+    while (!job.failed) {
+        size_t i = job.next++;
+        if (i >= job.chunks.size()) break;
+        uint64_t chunk = job.chunks[i];
+        uint64_t begin = chunk * options_.chunkSize;
+        uint64_t end = std::min<uint64_t>(begin + options_.chunkSize, job.size);
+
+        // 提前把这一块读进页缓存, 加密时不在缺页上停
+        uint64_t aligned = begin - begin % static_cast<uint64_t>(page);
+        madvise(const_cast<uint8_t*>(job.data) + aligned, end - aligned, MADV_WILLNEED);
+
+        for (uint64_t off = begin; off < end; ) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(options_.segmentSize, end - off));
+            uint8_t head[OffsetLayout::SIZE];
+            OffsetLayout::encode(head, off);
+            if (!sender_.send(stream, head, sizeof(head), job.data + off, n)) {
+                // 窗口满, 顺便看看前面的块确认了没有
+                confirm();
+                if (!pause()) return;
+                continue;
+            }
+            off += n;
+            bytesSent_ += n;
+        }
+        unconfirmed.push_back({chunk, sender_.nextSequence(stream), false});
+        confirm();
+    }
+
+    while (true) {
+        confirm();
+        if (unconfirmed.empty() || !pause()) return;
+    }
+}
+
+bool FileSender::send(const std::string& path, int timeoutMs) {
+    // 发不出的消息 send() 一直返回 false, 和窗口满分不开, 不设期限时会一直等下去
+    if (std::max<size_t>(OffsetLayout::SIZE + options_.segmentSize, DoneLayout::SIZE) > sender_.maxMessage()) {
+        throw std::runtime_error("File transfer segment exceeds the sender's maximum message size");
+    }
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("open");
+        throw std::runtime_error("Failed to open " + path);
+    }
+    struct stat st{};
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        throw std::runtime_error("Failed to stat " + path);
+    }
+
+    Job job;
+    job.size = static_cast<uint64_t>(st.st_size);
+    job.bounded = timeoutMs >= 0;
+    job.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    void* mem = nullptr;
+    if (job.size > 0) {
+        mem = mmap(nullptr, job.size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED) {
+            perror("mmap");
+            close(fd);
+            throw std::runtime_error("Failed to map " + path);
+        }
+        madvise(mem, job.size, MADV_SEQUENTIAL);
+        job.data = static_cast<const uint8_t*>(mem);
+    }
+    // 映射建好后文件描述符就用不着了
+    close(fd);
+
+    uint64_t chunks = (job.size + options_.chunkSize - 1) / options_.chunkSize;
+    std::unique_ptr<Journal> journal;
+    try {
+        if (!options_.journalPath.empty()) {
+            int64_t mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+            journal = std::make_unique<Journal>(options_.journalPath, job.size, options_.chunkSize,
+                                                mtimeNs, chunks);
+        }
+    } catch (...) {
+        if (mem) munmap(mem, job.size);
+        throw;
+    }
+    job.journal = journal.get();
+    for (uint64_t c = 0; c < chunks; c++) {
+        if (!journal || !journal->confirmed(c)) job.chunks.push_back(c);
+    }
+
+    bytesSent_ = 0;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < streams_.size(); i++) {
+        workers.emplace_back(&FileSender::sendStream, this, std::ref(job), i);
+    }
+    for (auto& t : workers) t.join();
+    if (mem) munmap(mem, job.size);
+    if (job.failed) return false;
+
+    // 所有块都已交付到对端的写入回调, 这时再宣告结束
+    uint8_t done[DoneLayout::SIZE];
+    DoneLayout::encode(done, DONE_MAGIC, DONE_VERSION, job.size);
+    while (!sender_.send(control_, done, sizeof(done))) {
+        if (job.expired()) return false;
+        std::unique_lock<std::mutex> lock(*mu_);
+        cv_->wait_for(lock, POLL_INTERVAL);
+    }
+    uint32_t after = sender_.nextSequence(control_);
+    while (!sender_.acknowledgedBefore(control_, after)) {
+        if (job.expired()) return false;
+        std::unique_lock<std::mutex> lock(*mu_);
+        cv_->wait_for(lock, POLL_INTERVAL);
+    }
+    return true;
+}
+
+// ---------------- 接收端 ----------------
+
+FileReceiver::FileReceiver(SecureUdpReceiver& receiver, const std::string& path,
+                           uint16_t firstStream, size_t streams)
+    : receiver_(receiver), control_(firstStream), streams_(streams),
+      bytesWritten_(0), fileSize_(0), lastError_(0), done_(false)
+{
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        perror("open");
+        throw std::runtime_error("Failed to open " + path);
+    }
+    receiver_.setStreamConsumer(control_, [this](const std::string& message) {
+        return handleControl(message);
+    });
+    for (size_t i = 1; i <= streams_; i++) {
+        receiver_.setStreamConsumer(static_cast<uint16_t>(control_ + i), [this](const std::string& message) {
+            return handleData(message);
+        });
+    }
+}
+
+FileReceiver::~FileReceiver() {
+    // 注销后回调不会再跑, 之后才能关文件
+    receiver_.setStreamHandler(control_, nullptr);
+    for (size_t i = 1; i <= streams_; i++) {
+        receiver_.setStreamHandler(static_cast<uint16_t>(control_ + i), nullptr);
+    }
+    close(fd_);
+}
+
+// 在接收线程上调用。写完才返回 true, 接收端随后回的 ACK 因此意味着数据已进页缓存;
+// SYNC 落盘后才返回 true, 它的 ACK 意味着之前收下的数据都已落盘。
+// 写或落盘失败 (如磁盘满) 返回 false: 这个消息不算收到也不确认, 发送端照常重传, 它的块
+// 不会记进续传日志, 也不会发 DONE; 错误码留在 lastError() 里
+bool FileReceiver::handleData(const std::string& message) {
+    if (message.size() < OffsetLayout::SIZE) return true;
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(message.data());
+    uint64_t off = OffsetLayout::get<0>(p);
+    if (off & SYNC_FLAG) {
+        if (fdatasync(fd_) < 0) {
+            int err = errno;
+            if (lastError_.exchange(err) != err) perror("fdatasync");
+            return false;
+        }
+        lastError_ = 0;
+        return true;
+    }
+    const uint8_t* data = p + OffsetLayout::SIZE;
+    size_t left = message.size() - OffsetLayout::SIZE;
+    while (left > 0) {
+        ssize_t n = pwrite(fd_, data, left, static_cast<off_t>(off));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // 重传会一遍遍撞上同一个错误, 只在错误码变了时打印
+            int err = errno;
+            if (lastError_.exchange(err) != err) perror("pwrite");
+            return false;
+        }
+        data += n;
+        off += static_cast<uint64_t>(n);
+        left -= static_cast<size_t>(n);
+        bytesWritten_ += static_cast<uint64_t>(n);
+    }
+    lastError_ = 0;
+    return true;
+}
+
+// 截断或落盘失败返回 false: DONE 不确认, 发送端一直重传, wait() 也不会返回 true
+bool FileReceiver::handleControl(const std::string& message) {
+    if (message.size() != DoneLayout::SIZE) return true;
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(message.data());
+    if (DoneLayout::get<0>(p) != DONE_MAGIC || DoneLayout::get<1>(p) != DONE_VERSION) return true;
+    uint64_t size = DoneLayout::get<2>(p);
+
+    // 续传时目标文件可能比源文件长, 截掉旧的尾巴
+    if (ftruncate(fd_, static_cast<off_t>(size)) < 0) {
+        int err = errno;
+        if (lastError_.exchange(err) != err) perror("ftruncate");
+        return false;
+    }
+    if (fsync(fd_) < 0) {
+        int err = errno;
+        if (lastError_.exchange(err) != err) perror("fsync");
+        return false;
+    }
+    lastError_ = 0;
+    fileSize_ = size;
+
+    std::lock_guard<std::mutex> lock(mu_);
+    done_ = true;
+    cv_.notify_all();
+    return true;
+}
+
+bool FileReceiver::wait(int timeoutMs) {
+    std::unique_lock<std::mutex> lock(mu_);
+    if (timeoutMs < 0) {
+        cv_.wait(lock, [this] { return done_; });
+        return true;
+    }
+    return cv_.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return done_; });
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "byte_stream.h"
+#include "receiver.h"
+#include "sender.h"
+#include "wire.h"
+
+// 大文件传输: 源文件整个 mmap, 按块分给几个并行的数据流, 每个消息直接从映射加密发出。
+// 消息是 [OFFSET(8B)][数据], 自带在文件里的位置, 接收端按偏移 pwrite, 乱序、重复都无所谓。
+// 块的最后一个消息被对端累计确认后, 再发一个 SYNC 让对端 fdatasync, SYNC 也确认了才把
+// 该块记进续传日志; 中断后重跑只发日志里没有的块, 日志里的块在对端一定已落盘。
+// 全部确认后在控制流上发 DONE, 接收端截到文件大小并 fsync。
+// 两端的流ID要一致: 控制流是发送端打开的第一个流, 数据流紧随其后。
+
+struct FileTransferOptions {
+    // 分给一个数据流的单位, 也是续传的粒度
+    size_t chunkSize = 4 << 20;
+    // 并行的数据流数, 每个流一个发送线程
+    size_t streams = 4;
+    // 每个消息带的文件字节数, 加上 8 字节偏移后不超过一个数据报
+    size_t segmentSize = ByteStreamWriter::DEFAULT_SEGMENT - 8;
+    size_t window = SecureUdpSender::DEFAULT_STREAM_WINDOW;
+    // 续传日志, 记着哪些块对端已确认; 空则每次从头发
+    std::string journalPath;
+};
+
+class FileSender {
+public:
+    explicit FileSender(SecureUdpSender& sender, const FileTransferOptions& options = {});
+    ~FileSender();
+
+    FileSender(const FileSender&) = delete;
+    FileSender& operator=(const FileSender&) = delete;
+
+    uint16_t firstStream() const { return control_; }
+
+    // 发完并等到对端确认 DONE 才返回, timeoutMs < 0 一直等。
+    // 超时返回 false, 已确认的块留在日志里, 下次 send() 同一个文件时跳过。
+    // segmentSize 加上偏移超过发送端的消息上限 (SecureUdpSender::maxMessage) 时抛出
+    bool send(const std::string& path, int timeoutMs = -1);
+    // 本次 send() 实际发出的文件字节数 (不含续传跳过的部分)
+    uint64_t bytesSent() const { return bytesSent_; }
+
+private:
+    struct Journal;
+    struct Job;
+
+    void sendStream(Job& job, size_t index);
+
+    SecureUdpSender& sender_;
+    FileTransferOptions options_;
+    uint16_t control_;
+    std::vector<uint16_t> streams_;
+    std::atomic<uint64_t> bytesSent_;
+
+    // 窗口回调只负责叫醒等窗口的发送线程
+    std::shared_ptr<std::mutex> mu_;
+    std::shared_ptr<std::condition_variable> cv_;
+};
+
+class FileReceiver {
+public:
+    // 目标文件不截断打开, 续传时之前写下的块原样保留
+    FileReceiver(SecureUdpReceiver& receiver, const std::string& path,
+                 uint16_t firstStream = 1, size_t streams = FileTransferOptions().streams);
+    ~FileReceiver();
+
+    FileReceiver(const FileReceiver&) = delete;
+    FileReceiver& operator=(const FileReceiver&) = delete;
+
+    // 等到 DONE 到达且文件已截到大小并落盘, 超时返回 false
+    bool wait(int timeoutMs = -1);
+    // 已写入目标文件的字节数, 重传的重复消息也算
+    uint64_t bytesWritten() const { return bytesWritten_; }
+    uint64_t fileSize() const { return fileSize_; }
+    // 最近一次写、截断或落盘目标文件失败的 errno, 之后成功了就回到 0。失败的消息不确认,
+    // 发送端一直重传, 直到写得进去或它的 send() 超时
+    int lastError() const { return lastError_; }
+
+private:
+    bool handleData(const std::string& message);
+    bool handleControl(const std::string& message);
+
+    SecureUdpReceiver& receiver_;
+    uint16_t control_;
+    size_t streams_;
+    int fd_;
+    std::atomic<uint64_t> bytesWritten_;
+    std::atomic<uint64_t> fileSize_;
+    std::atomic<int> lastError_;
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool done_;
+};
@@ -0,0 +1,357 @@
+#include "group.h"
+#include "codec.h"
+#include "fanout.h"
+#include <poll.h>
+#include <unistd.h>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+
+using fanout::NONCE_LEN;
+using fanout::TAG_LEN;
+using fanout::MAX_DATAGRAM;
+
+static constexpr uint8_t TYPE_DATA = 1;
+static constexpr uint8_t TYPE_NACK = 2;
+// [TYPE(1B)][GROUP(4B)][SEQ(4B)][TIMESTAMP(8B)]
+using GroupHeader = wire::Layout<wire::Field<uint8_t>, wire::Field<uint32_t>,
+                                 wire::Field<uint32_t>, wire::Field<uint64_t>>;
+enum { GRP_TYPE, GRP_GROUP, GRP_SEQ, GRP_TIMESTAMP };
+static constexpr size_t HEADER_LEN = GroupHeader::SIZE;
+// [TYPE(1B)][GROUP(4B)][COUNT(1B)], 整段作为 AAD; 之后是 NONCE 和密文 [ECHO(8B)][SEQ(4B) * COUNT]
+using NackHeader = wire::Layout<wire::Field<uint8_t>, wire::Field<uint32_t>, wire::Field<uint8_t>>;
+enum { NACK_TYPE, NACK_GROUP, NACK_COUNT };
+static constexpr size_t ECHO_LEN = 8;
+
+// 一个 NACK 最多列这么多序号
+static constexpr size_t MAX_NACK_SEQS = 255;
+static constexpr size_t MAX_NACK_LEN = NackHeader::SIZE + NONCE_LEN + ECHO_LEN + MAX_NACK_SEQS * 4 + TAG_LEN;
+// NACK 回显的发送端时间戳比这更旧就不理; 这段时间内见过的 NONCE 也不再理, 抓到的 NACK 没法重放
+static constexpr auto NACK_MAX_AGE = std::chrono::seconds(1);
+// 一次乱序跳跃最多记这么多缺口, 防止伪造的大序号撑爆状态
+static constexpr uint32_t MAX_GAP = 1024;
+static constexpr auto NACK_INTERVAL = std::chrono::milliseconds(20);
+static constexpr int MAX_NACK_TRIES = 5;
+
+// ---------------- 发送端 ----------------
+
+GroupSender::GroupSender(uint32_t groupId, const std::string& groupKey)
+    : groupId_(groupId), sockfd_(-1), multicast_(false), multicastAddr_{},
+      iov_{}, nextSeq_(0), running_(true)
+{
+    fanout::initKey(ctx_, groupKey, "group key");
+
+    sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd_ < 0) {
+        perror("socket");
+        throw std::runtime_error("Failed to create socket");
+    }
+    nackThread_ = std::thread(&GroupSender::nackThreadFunc, this);
+}
+
+GroupSender::~GroupSender() {
+    stop();
+    if (sockfd_ >= 0) close(sockfd_);
+}
+
+void GroupSender::stop() {
+    if (running_) {
+        running_ = false;
+        if (nackThread_.joinable()) nackThread_.join();
+    }
+}
+
+void GroupSender::setMulticast(const std::string& groupIp, int port, int ttl) {
+    std::lock_guard<std::mutex> lock(mu_);
+    multicastAddr_ = fanout::makeAddr(groupIp, port);
+    fanout::setMulticastTtl(sockfd_, ttl);
+    multicast_ = true;
+}
+
+void GroupSender::addDestination(const std::string& ip, int port) {
+    std::lock_guard<std::mutex> lock(mu_);
+    destinations_.push_back(fanout::makeAddr(ip, port));
+    rebuildBatch();
+}
+
+void GroupSender::removeDestination(const std::string& ip, int port) {
+    struct sockaddr_in addr = fanout::makeAddr(ip, port);
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto it = destinations_.begin(); it != destinations_.end(); ++it) {
+        if (it->sin_addr.s_addr == addr.sin_addr.s_addr && it->sin_port == addr.sin_port) {
+            destinations_.erase(it);
+            break;
+        }
+    }
+    rebuildBatch();
+}
+
+// 持锁调用
+void GroupSender::rebuildBatch() {
+    fanout::buildBatch(destinations_, &iov_, batch_);
+}
+
+void GroupSender::enableNack(size_t history) {
+    std::lock_guard<std::mutex> lock(mu_);
+    history_.assign(history, {0, std::string()});
+}
+
+bool GroupSender::send(const std::string& data) {
+    if (data.size() > MAX_DATAGRAM - HEADER_LEN - NONCE_LEN - TAG_LEN) {
+        std::cerr << "Message too large for one datagram\n";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mu_);
+    uint32_t seq = nextSeq_++;
+    uint64_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    packet_.resize(HEADER_LEN + NONCE_LEN + data.size() + TAG_LEN);
+    uint8_t* p = packet_.data();
+    GroupHeader::encode(p, TYPE_DATA, groupId_, seq, timestamp);
+
+    // 整个组只加密这一次
+    uint8_t* nonce = p + HEADER_LEN;
+    aes_gcm_random_nonce(nonce);
+    if (!aes_gcm_encrypt(ctx_, nonce, p, HEADER_LEN,
+                         reinterpret_cast<const uint8_t*>(data.data()), data.size(),
+                         nonce + NONCE_LEN, nonce + NONCE_LEN + data.size())) {
+        std::cerr << "Encryption failed\n";
+        return false;
+    }
+
+    if (!history_.empty()) {
+        auto& slot = history_[seq % history_.size()];
+        slot.first = seq;
+        slot.second.assign(packet_.begin(), packet_.end());
+    }
+    return transmit(packet_.data(), packet_.size());
+}
+
+// 持锁调用
+bool GroupSender::transmit(const uint8_t* data, size_t len) {
+    bool ok = true;
+    if (multicast_) {
+        if (sendto(sockfd_, data, len, 0, (struct sockaddr*)&multicastAddr_, sizeof(multicastAddr_)) < 0) {
+            perror("sendto");
+            ok = false;
+        }
+    }
+
+    iov_.iov_base = const_cast<uint8_t*>(data);
+    iov_.iov_len = len;
+    return fanout::sendBatch(sockfd_, batch_) && ok;
+}
+
+void GroupSender::handleNack(const uint8_t* data, size_t len, const struct sockaddr_in& from) {
+    if (len < NackHeader::SIZE || NackHeader::get<NACK_TYPE>(data) != TYPE_NACK ||
+        NackHeader::get<NACK_GROUP>(data) != groupId_) return;
+    size_t count = NackHeader::get<NACK_COUNT>(data);
+    if (len != NackHeader::SIZE + NONCE_LEN + ECHO_LEN + count * 4 + TAG_LEN) return;
+
+    // 重发的量是 NACK 的几百倍, 不认证的话伪造源地址的 NACK 就能把流量反射到任意地址
+    const uint8_t* nonce = data + NackHeader::SIZE;
+    size_t ctLen = ECHO_LEN + count * 4;
+    uint8_t body[ECHO_LEN + MAX_NACK_SEQS * 4];
+    if (!aes_gcm_decrypt(ctx_, nonce, data, NackHeader::SIZE, nonce + NONCE_LEN, ctLen,
+                         nonce + NONCE_LEN + ctLen, body)) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    uint64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+    uint64_t echo = wire::loadLe<uint64_t>(body);
+    if (echo > nowMs || nowMs - echo > static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(NACK_MAX_AGE).count())) return;
+
+    std::lock_guard<std::mutex> lock(mu_);
+    while (!recentNacks_.empty() && now - recentNacks_.front().first >= NACK_MAX_AGE) {
+        seenNacks_.erase(recentNacks_.front().second);
+        recentNacks_.pop_front();
+    }
+    uint64_t nonceKey = wire::loadLe<uint64_t>(nonce);
+    if (!seenNacks_.insert(nonceKey).second) return;   // 重放
+    recentNacks_.emplace_back(now, nonceKey);
+
+    // 只重发给要的那个接收端
+    if (history_.empty()) return;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t seq = wire::loadLe<uint32_t>(body + ECHO_LEN + i * 4);
+        auto& slot = history_[seq % history_.size()];
+        if (slot.second.empty() || slot.first != seq) continue; // 已经滚出历史
+        sendto(sockfd_, slot.second.data(), slot.second.size(), 0,
+               (const struct sockaddr*)&from, sizeof(from));
+    }
+}
+
+void GroupSender::nackThreadFunc() {
+    uint8_t buffer[MAX_NACK_LEN];
+    while (running_) {
+        struct pollfd pfd = {sockfd_, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0) continue;
+
+        struct sockaddr_in from{};
+        socklen_t fromLen = sizeof(from);
+        ssize_t len = recvfrom(sockfd_, buffer, sizeof(buffer), 0, (struct sockaddr*)&from, &fromLen);
+        if (len > 0) handleNack(buffer, static_cast<size_t>(len), from);
+    }
+}
+
+// ---------------- 接收端 ----------------
+
+GroupReceiver::GroupReceiver(int localPort, uint32_t groupId, const std::string& groupKey,
+                             const std::string& multicastGroup)
+    : groupId_(groupId), sockfd_(-1), running_(false)
+{
+    fanout::initKey(ctx_, groupKey, "group key");
+    sockfd_ = fanout::openSocket(localPort);
+    if (!multicastGroup.empty() && !fanout::joinMulticast(sockfd_, multicastGroup)) {
+        close(sockfd_);
+        throw std::runtime_error("Failed to join multicast group");
+    }
+}
+
+GroupReceiver::~GroupReceiver() {
+    stop();
+    if (sockfd_ >= 0) close(sockfd_);
+}
+
+void GroupReceiver::start(std::function<void(const std::string&)> onMessage) {
+    callback_ = std::move(onMessage);
+    running_ = true;
+    receiveThread_ = std::thread(&GroupReceiver::receiveThreadFunc, this);
+}
+
+void GroupReceiver::stop() {
+    if (running_) {
+        running_ = false;
+        if (receiveThread_.joinable()) receiveThread_.join();
+    }
+}
+
+void GroupReceiver::advance(Source& src) {
+    while (true) {
+        if (!src.receivedAhead.empty() && *src.receivedAhead.begin() == src.nextExpected) {
+            src.receivedAhead.erase(src.receivedAhead.begin());
+        } else if (!src.missing.empty() && src.missing.begin()->first == src.nextExpected &&
+                   src.missing.begin()->second.tries >= MAX_NACK_TRIES) {
+            src.missing.erase(src.missing.begin()); // 追不回来了, 放弃
+        } else {
+            break;
+        }
+        ++src.nextExpected;
+    }
+}
+
+void GroupReceiver::handleDatagram(const uint8_t* data, size_t len, const struct sockaddr_in& from) {
+    if (len < HEADER_LEN + NONCE_LEN + TAG_LEN) return;
+    if (GroupHeader::get<GRP_TYPE>(data) != TYPE_DATA || GroupHeader::get<GRP_GROUP>(data) != groupId_) return;
+    uint32_t seq = GroupHeader::get<GRP_SEQ>(data);
+
+    uint64_t sourceKey = fanout::addrKey(from);
+    auto it = sources_.find(sourceKey);
+    if (it != sources_.end()) {
+        const Source& known = it->second;
+        bool duplicate = static_cast<int32_t>(seq - known.nextExpected) < 0 || known.receivedAhead.count(seq);
+        if (duplicate) return;
+    }
+
+    size_t ctLen = len - HEADER_LEN - NONCE_LEN - TAG_LEN;
+    const uint8_t* nonce = data + HEADER_LEN;
+    std::string plaintext(ctLen, '\0');
+    if (!aes_gcm_decrypt(ctx_, nonce, data, HEADER_LEN, nonce + NONCE_LEN, ctLen, nonce + NONCE_LEN + ctLen,
+                         reinterpret_cast<uint8_t*>(&plaintext[0]))) {
+        std::cerr << "Decryption failed for group packet " << seq << "\n";
+        return;
+    }
+
+    // 头部已经认证过, 这时才用它的序号建状态, 伪造的包起不了头也占不了表项
+    Source& src = sources_[sourceKey];
+    if (!src.started) {
+        src.started = true;
+        src.addr = from;
+        src.nextExpected = seq;
+        src.highest = seq;
+    }
+
+    // 比已见最大序号还新, 中间没收到的都记为缺口
+    if (static_cast<int32_t>(seq - src.highest) > 0) {
+        uint32_t gapStart = src.highest + 1;
+        if (seq - gapStart > MAX_GAP) gapStart = seq - MAX_GAP;
+        auto now = std::chrono::steady_clock::now();
+        for (uint32_t s = gapStart; s != seq; ++s) {
+            // 首次立即 NACK
+            src.missing[s] = Source::Missing{now - NACK_INTERVAL, 0};
+        }
+        src.highest = seq;
+        src.timestamp = GroupHeader::get<GRP_TIMESTAMP>(data);
+    }
+    src.missing.erase(seq);
+
+    if (callback_) callback_(plaintext);
+
+    if (seq == src.nextExpected) {
+        ++src.nextExpected;
+    } else {
+        src.receivedAhead.insert(seq);
+    }
+    advance(src);
+}
+
+void GroupReceiver::sendNacks() {
+    auto now = std::chrono::steady_clock::now();
+    uint8_t body[ECHO_LEN + MAX_NACK_SEQS * 4];
+    uint8_t nack[MAX_NACK_LEN];
+
+    for (auto& entry : sources_) {
+        Source& src = entry.second;
+        size_t count = 0;
+        // 序号表连同回显的时间戳一起加密, 发送端据此认证并拒绝过期的 NACK
+        auto flush = [&] {
+            if (count == 0) return;
+            NackHeader::encode(nack, TYPE_NACK, groupId_, static_cast<uint8_t>(count));
+            wire::storeLe<uint64_t>(body, src.timestamp);
+            size_t bodyLen = ECHO_LEN + count * 4;
+            uint8_t* nonce = nack + NackHeader::SIZE;
+            aes_gcm_random_nonce(nonce);
+            if (aes_gcm_encrypt(ctx_, nonce, nack, NackHeader::SIZE, body, bodyLen,
+                                nonce + NONCE_LEN, nonce + NONCE_LEN + bodyLen)) {
+                sendto(sockfd_, nack, NackHeader::SIZE + NONCE_LEN + bodyLen + TAG_LEN, 0,
+                       (struct sockaddr*)&src.addr, sizeof(src.addr));
+            }
+            count = 0;
+        };
+
+        for (auto& m : src.missing) {
+            if (m.second.tries >= MAX_NACK_TRIES || now - m.second.lastNack < NACK_INTERVAL) continue;
+            m.second.lastNack = now;
+            m.second.tries++;
+            wire::storeLe<uint32_t>(body + ECHO_LEN + count * 4, m.first);
+            if (++count == MAX_NACK_SEQS) flush();
+        }
+        flush();
+        advance(src);
+    }
+}
+
+void GroupReceiver::receiveThreadFunc() {
+    std::vector<uint8_t> buffer(MAX_DATAGRAM);
+    int timeoutMs = static_cast<int>(NACK_INTERVAL.count());
+    auto lastScan = std::chrono::steady_clock::now();
+    while (running_) {
+        struct pollfd pfd = {sockfd_, POLLIN, 0};
+        if (poll(&pfd, 1, timeoutMs) > 0) {
+            struct sockaddr_in from{};
+            socklen_t fromLen = sizeof(from);
+            ssize_t len = recvfrom(sockfd_, buffer.data(), buffer.size(), 0,
+                                   (struct sockaddr*)&from, &fromLen);
+            if (len > 0) handleDatagram(buffer.data(), static_cast<size_t>(len), from);
+        }
+        // 缺口表不必每个包都扫
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastScan >= NACK_INTERVAL / 4) {
+            sendNacks();
+            lastScan = now;
+        }
+    }
+}
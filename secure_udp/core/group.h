@@ -0,0 +1,111 @@
+#pragma once
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "../crypto/aes_gcm.h"
+
+// 一对多发送: 组内共用一把组密钥, 每条消息只加密一次,
+// 同一份密文发往组播地址, 或用 sendmmsg 批量发给单播目标列表。
+// 可靠性靠接收端 NACK, 发送端保留最近若干包用于重传。
+// NACK 也用组密钥认证, 里面回显发送端的时间戳, 发送端只理会新鲜且没见过的 NACK。
+//
+// 包: [TYPE(1B)][GROUP(4B)][SEQ(4B)][TIMESTAMP(8B)][NONCE(12B)][CIPHERTEXT][TAG(16B)], AAD 为前 17 字节
+// NACK: [TYPE(1B)][GROUP(4B)][COUNT(1B)][NONCE(12B)][密文: ECHO(8B)][SEQ(4B) * COUNT][TAG(16B)], AAD 为前 6 字节
+
+class GroupSender {
+public:
+    GroupSender(uint32_t groupId, const std::string& groupKey);
+    ~GroupSender();
+
+    // 组播目标, ttl 为 IP_MULTICAST_TTL
+    void setMulticast(const std::string& groupIp, int port, int ttl = 1);
+    void addDestination(const std::string& ip, int port);
+    void removeDestination(const std::string& ip, int port);
+
+    // 保留最近 history 个包应答 NACK, 0 表示不重传
+    void enableNack(size_t history);
+
+    bool send(const std::string& data);
+    void stop();
+
+private:
+    void nackThreadFunc();
+    void handleNack(const uint8_t* data, size_t len, const struct sockaddr_in& from);
+    bool transmit(const uint8_t* data, size_t len);
+    void rebuildBatch();
+
+    uint32_t groupId_;
+    AesGcmContext ctx_;
+    int sockfd_;
+
+    bool multicast_;
+    struct sockaddr_in multicastAddr_;
+    std::vector<struct sockaddr_in> destinations_;
+    // 每个目标一个 mmsghdr, 共用同一个 iovec, 只在目标变化时重建
+    std::vector<struct mmsghdr> batch_;
+    struct iovec iov_;
+
+    uint32_t nextSeq_;
+    std::vector<uint8_t> packet_;
+    std::vector<std::pair<uint32_t, std::string>> history_;   // 下标为 seq % 容量
+    // 最近 NACK_MAX_AGE 内应答过的 NACK 的 NONCE 前 8 字节, 按到达先后排
+    std::deque<std::pair<std::chrono::steady_clock::time_point, uint64_t>> recentNacks_;
+    std::unordered_set<uint64_t> seenNacks_;
+
+    std::mutex mu_;
+    std::atomic<bool> running_;
+    std::thread nackThread_;
+};
+
+class GroupReceiver {
+public:
+    // multicastGroup 非空时加入该组播组
+    GroupReceiver(int localPort, uint32_t groupId, const std::string& groupKey,
+                  const std::string& multicastGroup = "");
+    ~GroupReceiver();
+
+    void start(std::function<void(const std::string&)> onMessage);
+    void stop();
+
+private:
+    // 每个发送端一份状态; 从第一次收到的序号开始, 不追要加入之前的历史
+    struct Source {
+        struct sockaddr_in addr;
+        bool started = false;
+        uint32_t nextExpected = 0;
+        uint32_t highest = 0;
+        uint64_t timestamp = 0;     // highest 那个包的 TIMESTAMP, NACK 里原样回显
+        std::set<uint32_t> receivedAhead;
+        struct Missing {
+            std::chrono::steady_clock::time_point lastNack;
+            int tries;
+        };
+        std::map<uint32_t, Missing> missing;
+    };
+
+    void receiveThreadFunc();
+    void handleDatagram(const uint8_t* data, size_t len, const struct sockaddr_in& from);
+    void advance(Source& src);
+    void sendNacks();
+
+    uint32_t groupId_;
+    AesGcmContext ctx_;
+    int sockfd_;
+    std::function<void(const std::string&)> callback_;
+    std::unordered_map<uint64_t, Source> sources_;
+
+    std::atomic<bool> running_;
+    std::thread receiveThread_;
+};
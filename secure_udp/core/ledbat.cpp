@@ -0,0 +1,71 @@
+#include "ledbat.h"
+#include <algorithm>
+#include <limits>
+
+static constexpr double GAIN = 1.0;
+static constexpr auto BASE_INTERVAL = std::chrono::minutes(1);
+// 两次减半至少隔这么久, 同一轮丢的多个包只算一次
+static constexpr auto LOSS_GUARD = std::chrono::milliseconds(100);
+
+LedbatController::LedbatController(std::chrono::milliseconds target, size_t maxWindow)
+    : target_(static_cast<double>(target.count())),
+      maxWindow_(std::max(MIN_WINDOW, static_cast<double>(maxWindow))),
+      cwnd_(MIN_WINDOW), slowStart_(true), sampled_(false), origin_(0), baseIndex_(0),
+      currentCount_(0), currentIndex_(0) {
+    baseHistory_.fill(std::numeric_limits<int64_t>::max());
+    current_.fill(0);
+}
+
+void LedbatController::onDelaySample(uint32_t delay, std::chrono::steady_clock::time_point now) {
+    if (!sampled_) {
+        sampled_ = true;
+        origin_ = delay;
+        baseRollover_ = now;
+    }
+    int64_t sample = static_cast<int32_t>(delay - origin_);
+
+    // 每分钟换一个桶, 最老的桶作废
+    if (now - baseRollover_ >= BASE_INTERVAL) {
+        baseRollover_ = now;
+        baseIndex_ = (baseIndex_ + 1) % BASE_HISTORY;
+        baseHistory_[baseIndex_] = std::numeric_limits<int64_t>::max();
+    }
+    baseHistory_[baseIndex_] = std::min(baseHistory_[baseIndex_], sample);
+
+    current_[currentIndex_] = sample;
+    currentIndex_ = (currentIndex_ + 1) % CURRENT_FILTER;
+    currentCount_ = std::min(currentCount_ + 1, CURRENT_FILTER);
+}
+
+std::chrono::milliseconds LedbatController::queuingDelay() const {
+    if (currentCount_ == 0) return std::chrono::milliseconds(0);
+    // 当前时延取最近几个样本的最小值, 滤掉单个包的抖动
+    int64_t current = *std::min_element(current_.begin(), current_.begin() + currentCount_);
+    int64_t base = *std::min_element(baseHistory_.begin(), baseHistory_.end());
+    return std::chrono::milliseconds(std::max<int64_t>(0, current - base));
+}
+
+void LedbatController::onAck(size_t acked, size_t inFlight) {
+    if (acked == 0 || currentCount_ == 0) return;
+    double queuing = static_cast<double>(queuingDelay().count());
+    if (slowStart_ && queuing > target_ / 2) slowStart_ = false;
+
+    if (slowStart_) {
+        // 开始时每个 RTT 翻倍, 排队时延到目标一半或第一次丢包就转入 LEDBAT
+        cwnd_ += static_cast<double>(acked);
+    } else {
+        double offTarget = (target_ - queuing) / target_;
+        cwnd_ += GAIN * offTarget * static_cast<double>(acked) / cwnd_;
+    }
+
+    // 应用层没把窗口用满时不继续涨, 否则空闲之后会一下涌出一大窗
+    double allowed = static_cast<double>(inFlight) + 1.0;
+    cwnd_ = std::max(MIN_WINDOW, std::min({cwnd_, allowed, maxWindow_}));
+}
+
+void LedbatController::onLoss(std::chrono::steady_clock::time_point now) {
+    if (now - lastLoss_ < LOSS_GUARD) return;
+    lastLoss_ = now;
+    slowStart_ = false;
+    cwnd_ = std::max(MIN_WINDOW, cwnd_ / 2);
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// LEDBAT (RFC 6817) 式的拥塞窗口, 给后台大流量用: 排队时延一超过目标就让路。
+// 时延样本是对端收到时刻减去包头时间戳, 两端时钟的固定偏差在减基准时延时抵消,
+// 基准取最近十分钟 (每分钟一个桶) 的最小值, 能跟上时钟漂移和路由变化。
+// 窗口以包为单位; 非线程安全, 由发送端持锁调用。
+class LedbatController {
+public:
+    static constexpr std::chrono::milliseconds DEFAULT_TARGET{100};
+    static constexpr double MIN_WINDOW = 2.0;
+
+    explicit LedbatController(std::chrono::milliseconds target = DEFAULT_TARGET, size_t maxWindow = 256);
+
+    // delay 为对端回报的原始单向时延 (毫秒, 含未知的固定偏差, 按 32 位回绕)
+    void onDelaySample(uint32_t delay, std::chrono::steady_clock::time_point now);
+    // acked 个包被确认, inFlight 为确认前的在途包数
+    void onAck(size_t acked, size_t inFlight);
+    // 有包超时重传或对端回报了新的 CE 标记, 每个 RTT 最多减半一次
+    void onLoss(std::chrono::steady_clock::time_point now);
+
+    size_t window() const { return static_cast<size_t>(cwnd_); }
+    // 最近的排队时延估计, 没有样本时为 0
+    std::chrono::milliseconds queuingDelay() const;
+
+private:
+    static constexpr size_t BASE_HISTORY = 10;
+    static constexpr size_t CURRENT_FILTER = 4;
+
+    double target_;
+    double maxWindow_;
+    double cwnd_;
+    bool slowStart_;
+
+    bool sampled_;
+    uint32_t origin_;       // 第一个样本, 之后的样本都换算成相对它的有符号值
+    std::array<int64_t, BASE_HISTORY> baseHistory_;
+    size_t baseIndex_;
+    std::chrono::steady_clock::time_point baseRollover_;
+    std::array<int64_t, CURRENT_FILTER> current_;
+    size_t currentCount_;
+    size_t currentIndex_;
+
+    std::chrono::steady_clock::time_point lastLoss_;
+};
@@ -0,0 +1,193 @@
+#include "multipath_transport.h"
+#include "fec.h"
+#include "wire.h"
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <poll.h>
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+
+// 还没有样本时各路径一样, 由在途包数轮流分配
+static constexpr double INITIAL_RTT_MS = 50.0;
+static constexpr double RTT_GAIN = 0.125;
+static constexpr double LOSS_GAIN = 0.1;
+
+static uint64_t packetKey(uint16_t stream, uint32_t seq) {
+    return (uint64_t(stream) << 32) | seq;
+}
+
+MultipathTransport::MultipathTransport(const std::vector<PathSpec>& paths)
+    : epollFd_(-1)
+{
+    if (paths.empty()) {
+        throw std::runtime_error("Multipath transport needs at least one path");
+    }
+
+    epollFd_ = epoll_create1(0);
+    if (epollFd_ < 0) {
+        perror("epoll_create1");
+        throw std::runtime_error("Failed to create epoll");
+    }
+
+    paths_.reserve(paths.size());
+    for (auto& spec : paths) {
+        paths_.push_back(Path{spec, UdpTransport::connect(spec.remoteIp, spec.remotePort, spec.localIp),
+                              INITIAL_RTT_MS, 0.0, 0, 0});
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = paths_.size() - 1;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, paths_.back().transport.fd(), &ev) < 0) {
+            perror("epoll_ctl");
+            close(epollFd_);
+            throw std::runtime_error("Failed to register path socket");
+        }
+    }
+}
+
+MultipathTransport::~MultipathTransport() {
+    if (epollFd_ >= 0) close(epollFd_);
+}
+
+// 持锁调用。预计完成时间 ~ RTT * (前面排着的包 + 1), 再按丢包率折算重传
+size_t MultipathTransport::pickPath() const {
+    size_t best = 0;
+    double bestScore = 0;
+    for (size_t i = 0; i < paths_.size(); i++) {
+        const Path& p = paths_[i];
+        double score = p.srttMs * double(p.inFlight + 1) / std::max(1.0 - p.lossRate, 0.05);
+        if (i == 0 || score < bestScore) {
+            best = i;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+bool MultipathTransport::sendOn(size_t path, const uint8_t* data, size_t len, uint8_t tos) {
+    UdpTransport& t = paths_[path].transport;
+    return tos ? t.sendMarked(data, len, tos) : t.send(data, len);
+}
+
+// 持锁调用
+void MultipathTransport::recordSend(const uint8_t* data, size_t len, size_t path, bool redundant) {
+    // FEC 封装的数据包按里面的原报文记账, 修复包不记
+    if (fec::isFecPacket(data, len)) {
+        data = fec::innerPacket(data, len, len);
+        if (!data) return;
+    }
+    wire::Header header;
+    if (wire::parseHeader(data, len, header) == 0) return;
+    if (header.nack()) return; // NACK 流没有 ACK, 没法采样, 也不能算在途
+
+    // PN 是截断的, 按该流发过的最大序号还原; 重传的旧包也落在半窗口内
+    uint16_t stream = header.stream();
+    auto largest = largestSent_.find(stream);
+    uint32_t expected = largest == largestSent_.end() ? 0 : largest->second + 1;
+    uint32_t seq = wire::decodePacketNumber(expected, header.pn, header.pnLen());
+    if (largest == largestSent_.end() || static_cast<int32_t>(seq - largest->second) > 0) {
+        largestSent_[stream] = seq;
+    }
+    uint64_t key = packetKey(stream, seq);
+
+    auto it = sent_.find(key);
+    if (it != sent_.end()) {
+        // 同一个包又发了一次, 说明上次走的路径丢了它 (或者太慢)
+        Path& old = paths_[it->second.path];
+        old.lossRate += LOSS_GAIN * (1.0 - old.lossRate);
+        old.inFlight--;
+        it->second.ambiguous = true;
+    } else {
+        it = sent_.emplace(key, SentInfo{path, {}, redundant}).first;
+    }
+    it->second.path = path;
+    it->second.sentAt = std::chrono::steady_clock::now();
+    paths_[path].inFlight++;
+    paths_[path].sent++;
+}
+
+bool MultipathTransport::send(const uint8_t* data, size_t len) {
+    return sendMarked(data, len, 0);
+}
+
+bool MultipathTransport::sendMarked(const uint8_t* data, size_t len, uint8_t tos) {
+    std::lock_guard<std::mutex> lock(mu_);
+    size_t path = pickPath();
+    recordSend(data, len, path, false);
+    return sendOn(path, data, len, tos);
+}
+
+bool MultipathTransport::sendRedundant(const uint8_t* data, size_t len, uint8_t tos) {
+    std::lock_guard<std::mutex> lock(mu_);
+    // 只在最优路径上记账, 其余副本不计在途也不采样
+    recordSend(data, len, pickPath(), true);
+    bool ok = false;
+    for (size_t i = 0; i < paths_.size(); i++) {
+        ok = sendOn(i, data, len, tos) || ok;
+    }
+    return ok;
+}
+
+void MultipathTransport::forget(std::map<uint64_t, SentInfo>::iterator it) {
+    Path& p = paths_[it->second.path];
+    p.inFlight--;
+    p.lossRate -= LOSS_GAIN * p.lossRate;
+    sent_.erase(it);
+}
+
+// 这里没有密钥, ACK 的认证尾留给发送端检查; 只用来估计路径, 不改发送端状态。
+// 路径 socket 都 connect 过, 只收得到对端地址来的包
+void MultipathTransport::onAck(const uint8_t* data, size_t len) {
+    wire::Ack ack;
+    if (len <= wire::CONTROL_TRAILER_LEN || !wire::parseAck(data, len - wire::CONTROL_TRAILER_LEN, ack)) return;
+    uint16_t stream = ack.stream;
+    uint32_t cumulative = ack.cumulative;
+    uint32_t seq = ack.seq;
+
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = sent_.find(packetKey(stream, seq));
+    if (it != sent_.end()) {
+        if (!it->second.ambiguous) {
+            // Karn: 只用只发过一次的包采样
+            double sample = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - it->second.sentAt).count();
+            Path& p = paths_[it->second.path];
+            p.srttMs += RTT_GAIN * (sample - p.srttMs);
+        }
+        forget(it);
+    }
+
+    auto first = sent_.lower_bound(packetKey(stream, 0));
+    auto last = sent_.lower_bound(packetKey(stream, cumulative));
+    while (first != last) forget(first++);
+}
+
+ssize_t MultipathTransport::recv(uint8_t* buf, size_t len, int timeoutMs) {
+    while (true) {
+        for (auto& p : paths_) {
+            ssize_t n = p.transport.recv(buf, len, 0);
+            if (n > 0) {
+                onAck(buf, static_cast<size_t>(n));
+                return n;
+            }
+        }
+        if (timeoutMs == 0) return -1;
+
+        // 路径 socket 都挂在 epollFd_ 上, 等它可读即可
+        struct pollfd pfd = {epollFd_, POLLIN, 0};
+        int ret = poll(&pfd, 1, timeoutMs);
+        if (ret <= 0) return -1;
+        timeoutMs = 0;
+    }
+}
+
+std::vector<MultipathTransport::PathStats> MultipathTransport::stats() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    std::vector<PathStats> result;
+    for (auto& p : paths_) {
+        result.push_back(PathStats{p.spec.localIp, p.spec.remoteIp, p.srttMs, p.lossRate,
+                                   p.inFlight, p.sent});
+    }
+    return result;
+}
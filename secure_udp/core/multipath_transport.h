@@ -0,0 +1,74 @@
+#pragma once
+#include "transport.h"
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 多路径传输: 一个会话同时用几对 (本地地址, 对端地址), 例如两条上行链路。
+// 每条路径单独估计 RTT 和丢包率, 每个包发到预计最早送达的路径上。
+// 估计值来自对端的 ACK, 所以要求对端是 SecureUdpReceiver。
+class MultipathTransport final : public Transport {
+public:
+    struct PathSpec {
+        std::string localIp;     // 空表示由路由决定出口
+        std::string remoteIp;
+        int remotePort;
+    };
+
+    struct PathStats {
+        std::string localIp;
+        std::string remoteIp;
+        double srttMs;
+        double lossRate;
+        size_t inFlight;
+        uint64_t sent;
+    };
+
+    explicit MultipathTransport(const std::vector<PathSpec>& paths);
+    ~MultipathTransport() override;
+
+    MultipathTransport(const MultipathTransport&) = delete;
+    MultipathTransport& operator=(const MultipathTransport&) = delete;
+
+    bool send(const uint8_t* data, size_t len) override;
+    bool sendMarked(const uint8_t* data, size_t len, uint8_t tos) override;
+    bool sendRedundant(const uint8_t* data, size_t len, uint8_t tos) override;
+    ssize_t recv(uint8_t* buf, size_t len, int timeoutMs) override;
+    // 聚合所有路径 socket 的 epoll fd, 任一路径可读时可读
+    int fd() const override { return epollFd_; }
+    bool hasSourceAddress() const override { return true; }
+
+    std::vector<PathStats> stats() const;
+
+private:
+    struct Path {
+        PathSpec spec;
+        UdpTransport transport;
+        double srttMs;
+        double lossRate;
+        size_t inFlight;
+        uint64_t sent;
+    };
+
+    struct SentInfo {
+        size_t path;
+        std::chrono::steady_clock::time_point sentAt;
+        bool ambiguous;     // 重传或冗余发送过, 不能用来采样 RTT
+    };
+
+    size_t pickPath() const;
+    bool sendOn(size_t path, const uint8_t* data, size_t len, uint8_t tos);
+    void recordSend(const uint8_t* data, size_t len, size_t path, bool redundant);
+    void onAck(const uint8_t* data, size_t len);
+    void forget(std::map<uint64_t, SentInfo>::iterator it);
+
+    std::vector<Path> paths_;
+    int epollFd_;
+
+    // 键与发送端一致: (流ID << 32) | 流内序号
+    std::map<uint64_t, SentInfo> sent_;
+    std::map<uint16_t, uint32_t> largestSent_;
+    mutable std::mutex mu_;
+};
@@ -0,0 +1,111 @@
+#pragma once
+#include "../crypto/aes_gcm.h"
+#include "transport.h"
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+// secure_udp 模板的编译期策略。每个策略只需满足鸭子类型约定,
+// 模板在编译期按 constexpr 常量裁掉不用的功能。Transport 策略见 transport.h。
+namespace secure_udp {
+
+// ---- Cipher: NONCE_LEN / TAG_LEN, nonce(), encrypt(), decrypt() ----
+// aad 只认证不加密, 用来保护明文包头; 不认证的 Cipher 可以忽略它
+
+class AesGcmCipher {
+public:
+    static constexpr size_t NONCE_LEN = 12;
+    static constexpr size_t TAG_LEN = 16;
+
+    explicit AesGcmCipher(const std::string& key) {
+        if (!aes_gcm_init(ctx_, reinterpret_cast<const uint8_t*>(key.data()), key.size())) {
+            throw std::runtime_error("Invalid AES-GCM key");
+        }
+    }
+
+    void nonce(uint8_t* out) const { aes_gcm_random_nonce(out); }
+
+    bool encrypt(const uint8_t* nonce, const uint8_t* aad, size_t aadLen, const uint8_t* in, size_t len,
+                 uint8_t* out, uint8_t* tag) const {
+        return aes_gcm_encrypt(ctx_, nonce, aad, aadLen, in, len, out, tag);
+    }
+
+    bool decrypt(const uint8_t* nonce, const uint8_t* aad, size_t aadLen, const uint8_t* in, size_t len,
+                 const uint8_t* tag, uint8_t* out) const {
+        return aes_gcm_decrypt(ctx_, nonce, aad, aadLen, in, len, tag, out);
+    }
+
+private:
+    AesGcmContext ctx_;
+};
+
+// 不加密, 包里也不留 nonce/tag, 用于可信链路或基准测试
+struct NullCipher {
+    static constexpr size_t NONCE_LEN = 0;
+    static constexpr size_t TAG_LEN = 0;
+
+    void nonce(uint8_t*) const {}
+
+    bool encrypt(const uint8_t*, const uint8_t*, size_t, const uint8_t* in, size_t len, uint8_t* out,
+                 uint8_t*) const {
+        if (in != out) std::memmove(out, in, len);
+        return true;
+    }
+
+    bool decrypt(const uint8_t*, const uint8_t*, size_t, const uint8_t* in, size_t len, const uint8_t*,
+                 uint8_t* out) const {
+        if (in != out) std::memmove(out, in, len);
+        return true;
+    }
+};
+
+// ---- Reliability: ENABLED, store(), ack(), forEachUnacked() ----
+
+// 发完即忘, 不保留任何包
+struct NoReliability {
+    static constexpr bool ENABLED = false;
+
+    void store(uint32_t, const uint8_t*, size_t) {}
+    void ack(uint32_t) {}
+    template <typename Fn>
+    void forEachUnacked(Fn&&) {}
+};
+
+// 保留未确认的包, 由调用方周期性地调用 retransmit()
+class RetransmitReliability {
+public:
+    static constexpr bool ENABLED = true;
+
+    void store(uint32_t seq, const uint8_t* packet, size_t len) {
+        std::lock_guard<std::mutex> lock(mu_);
+        unackedPackets_[seq].assign(reinterpret_cast<const char*>(packet), len);
+    }
+
+    // 累计确认: seq 之前的包都已送达。按回绕比较, "之前" 是 [seq - 2^31, seq) 这半圈
+    void ack(uint32_t seq) {
+        constexpr uint32_t HALF = 1u << 31;
+        std::lock_guard<std::mutex> lock(mu_);
+        if (seq >= HALF) {
+            unackedPackets_.erase(unackedPackets_.lower_bound(seq - HALF), unackedPackets_.lower_bound(seq));
+        } else {
+            unackedPackets_.erase(unackedPackets_.begin(), unackedPackets_.lower_bound(seq));
+            unackedPackets_.erase(unackedPackets_.lower_bound(seq + HALF), unackedPackets_.end());
+        }
+    }
+
+    template <typename Fn>
+    void forEachUnacked(Fn&& fn) {
+        std::lock_guard<std::mutex> lock(mu_);
+        for (auto& p : unackedPackets_) {
+            fn(reinterpret_cast<const uint8_t*>(p.second.data()), p.second.size());
+        }
+    }
+
+private:
+    std::map<uint32_t, std::string> unackedPackets_;
+    std::mutex mu_;
+};
+
+} // namespace secure_udp
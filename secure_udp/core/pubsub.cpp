@@ -0,0 +1,441 @@
+#include "pubsub.h"
+#include "codec.h"
+#include "fanout.h"
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+
+using fanout::NONCE_LEN;
+using fanout::TAG_LEN;
+using fanout::MAX_DATAGRAM;
+
+static constexpr uint8_t TYPE_DATA = 1;
+static constexpr uint8_t TYPE_REGISTER = 2;
+static constexpr uint8_t TYPE_CHALLENGE = 3;
+// [TYPE(1B)][EPOCH(8B)][TOPIC(4B)][SEQ(4B)], 整段作为 AAD。EPOCH 是发布端实例的随机号,
+// 发布端重启后 SEQ 从 0 重来, 订阅端看到新的 EPOCH 就清掉各主题的去重状态
+using DataHeader = wire::Layout<wire::Field<uint8_t>, wire::Field<uint64_t>, wire::Field<uint32_t>,
+                                wire::Field<uint32_t>>;
+enum { DATA_TYPE, DATA_EPOCH, DATA_TOPIC, DATA_SEQ };
+// 登记的明文部分: [GEN(8B)][COUNT(2B)][COOKIE(28B)], 后跟 COUNT 个 TOPIC(4B)
+using RegisterBody = wire::Layout<wire::Field<uint64_t>, wire::Field<uint16_t>>;
+enum { REG_GEN, REG_COUNT };
+// cookie 是 [NONCE(12B)][TAG(16B)], TAG 用发布端自己的随机密钥认证 [IP(4B)][PORT(2B)][EPOCH(8B)],
+// 发布端验证时现算一遍, 不必为还没通过的地址存状态
+using CookieAad = wire::Layout<wire::Field<uint32_t>, wire::Field<uint16_t>, wire::Field<uint64_t>>;
+static constexpr size_t COOKIE_LEN = NONCE_LEN + TAG_LEN;
+// cookie 在本期和下一期内有效
+static constexpr std::chrono::seconds COOKIE_EPOCH{60};
+static constexpr size_t CHALLENGE_LEN = 1 + NONCE_LEN + COOKIE_LEN + TAG_LEN;
+static constexpr size_t DATA_OVERHEAD = DataHeader::SIZE + NONCE_LEN + TAG_LEN;
+// 一次登记最多这么多个主题, 整个登记包不超过 1472 字节, 即 1500 字节 MTU 下的 UDP 载荷
+static constexpr size_t MAX_TOPICS = (1472 - 1 - NONCE_LEN - TAG_LEN - RegisterBody::SIZE - COOKIE_LEN) / 4;
+static constexpr int POLL_MS = 100;
+// 订阅端记住发布端最近这么多个旧 EPOCH, 重放的旧包不能把状态切回去
+static constexpr size_t MAX_RETIRED_EPOCHS = 8;
+
+static uint64_t cookieEpoch() {
+    return std::chrono::steady_clock::now().time_since_epoch() / COOKIE_EPOCH;
+}
+
+static bool sealCookie(const AesGcmContext& ctx, const struct sockaddr_in& addr, uint64_t epoch,
+                       const uint8_t* nonce, uint8_t* tag) {
+    uint8_t aad[CookieAad::SIZE];
+    CookieAad::encode(aad, addr.sin_addr.s_addr, addr.sin_port, epoch);
+    return aes_gcm_encrypt(ctx, nonce, aad, sizeof(aad), nullptr, 0, nullptr, tag);
+}
+
+// ---------------- 发布端 ----------------
+
+Publisher::Publisher(int localPort, const std::string& key)
+    : sockfd_(-1), multicast_(false), multicastAddr_{}, iov_{}, running_(true)
+{
+    fanout::initKey(ctx_, key, "bus key");
+    uint8_t secret[NONCE_LEN * 3];  // aes_gcm_random_nonce 一次写满一个 NONCE
+    for (size_t i = 0; i < 3; i++) aes_gcm_random_nonce(secret + i * NONCE_LEN);
+    if (!aes_gcm_init(cookieCtx_, secret, 32)) {
+        throw std::runtime_error("Failed to create cookie key");
+    }
+    uint8_t epoch[NONCE_LEN];
+    aes_gcm_random_nonce(epoch);
+    epoch_ = wire::loadLe<uint64_t>(epoch);
+    sockfd_ = fanout::openSocket(localPort);
+    controlThread_ = std::thread(&Publisher::controlThreadFunc, this);
+}
+
+Publisher::~Publisher() {
+    stop();
+    if (sockfd_ >= 0) close(sockfd_);
+}
+
+void Publisher::stop() {
+    if (running_) {
+        running_ = false;
+        if (controlThread_.joinable()) controlThread_.join();
+    }
+}
+
+void Publisher::setMulticast(const std::string& groupIp, int port, int ttl) {
+    std::lock_guard<std::mutex> lock(mu_);
+    multicastAddr_ = fanout::makeAddr(groupIp, port);
+    fanout::setMulticastTtl(sockfd_, ttl);
+    multicast_ = true;
+}
+
+size_t Publisher::subscribers(uint32_t topic) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = topics_.find(topic);
+    return it == topics_.end() ? 0 : it->second.destinations.size();
+}
+
+bool Publisher::publish(uint32_t topic, const std::string& data) {
+    if (data.size() > MAX_DATAGRAM - DATA_OVERHEAD) {
+        std::cerr << "Message too large for one datagram\n";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mu_);
+    Topic& t = topics_[topic];
+    // 没人订阅也不组播时连加密都省了; 序号照样占用, 订阅端据此能看出漏了多少
+    uint32_t seq = t.nextSeq++;
+    if (t.batch.empty() && !multicast_) return true;
+
+    packet_.resize(DATA_OVERHEAD + data.size());
+    uint8_t* p = packet_.data();
+    DataHeader::encode(p, TYPE_DATA, epoch_, topic, seq);
+
+    // 整个主题只加密这一次
+    uint8_t* nonce = p + DataHeader::SIZE;
+    aes_gcm_random_nonce(nonce);
+    if (!aes_gcm_encrypt(ctx_, nonce, p, DataHeader::SIZE,
+                         reinterpret_cast<const uint8_t*>(data.data()), data.size(),
+                         nonce + NONCE_LEN, nonce + NONCE_LEN + data.size())) {
+        std::cerr << "Encryption failed\n";
+        return false;
+    }
+
+    bool ok = true;
+    if (multicast_) {
+        if (sendto(sockfd_, p, packet_.size(), 0, (struct sockaddr*)&multicastAddr_, sizeof(multicastAddr_)) < 0) {
+            perror("sendto");
+            ok = false;
+        }
+    }
+
+    iov_.iov_base = p;
+    iov_.iov_len = packet_.size();
+    return fanout::sendBatch(sockfd_, t.batch) && ok;
+}
+
+// 持锁调用: 按当前登记重算每个主题的目标列表, 主题的序号保留
+void Publisher::rebuildTopics() {
+    for (auto& t : topics_) {
+        t.second.destinations.clear();
+    }
+    for (auto& r : registrations_) {
+        for (uint32_t topic : r.second.topics) {
+            topics_[topic].destinations.push_back(r.second.addr);
+        }
+    }
+    for (auto& t : topics_) {
+        fanout::buildBatch(t.second.destinations, &iov_, t.second.batch);
+    }
+}
+
+bool Publisher::checkCookie(const uint8_t* cookie, const struct sockaddr_in& from) {
+    uint8_t aad[CookieAad::SIZE];
+    uint64_t epoch = cookieEpoch();
+    for (uint64_t e : {epoch, epoch - 1}) {
+        CookieAad::encode(aad, from.sin_addr.s_addr, from.sin_port, e);
+        if (aes_gcm_decrypt(cookieCtx_, cookie, aad, sizeof(aad), nullptr, 0, cookie + NONCE_LEN, nullptr)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 质询比登记短, 伪造源地址的重放借它也放大不了流量
+void Publisher::sendChallenge(const struct sockaddr_in& to) {
+    uint8_t cookie[COOKIE_LEN];
+    aes_gcm_random_nonce(cookie);
+    if (!sealCookie(cookieCtx_, to, cookieEpoch(), cookie, cookie + NONCE_LEN)) return;
+
+    uint8_t packet[CHALLENGE_LEN];
+    packet[0] = TYPE_CHALLENGE;
+    uint8_t* nonce = packet + 1;
+    aes_gcm_random_nonce(nonce);
+    if (!aes_gcm_encrypt(ctx_, nonce, packet, 1, cookie, COOKIE_LEN, nonce + NONCE_LEN, nonce + NONCE_LEN + COOKIE_LEN)) {
+        return;
+    }
+    if (sendto(sockfd_, packet, sizeof(packet), 0, (const struct sockaddr*)&to, sizeof(to)) < 0) {
+        perror("sendto");
+    }
+}
+
+void Publisher::handleRegistration(const uint8_t* data, size_t len, const struct sockaddr_in& from) {
+    if (len < 1 + NONCE_LEN + RegisterBody::SIZE + COOKIE_LEN + TAG_LEN || data[0] != TYPE_REGISTER) return;
+    const uint8_t* nonce = data + 1;
+    size_t ctLen = len - 1 - NONCE_LEN - TAG_LEN;
+    std::vector<uint8_t> body(ctLen);
+    // 认证只说明登记出自总线成员; 抓到的登记换个源地址重放照样能解密
+    if (!aes_gcm_decrypt(ctx_, nonce, data, 1, nonce + NONCE_LEN, ctLen, nonce + NONCE_LEN + ctLen, body.data())) {
+        return;
+    }
+    uint64_t generation = RegisterBody::get<REG_GEN>(body.data());
+    size_t count = RegisterBody::get<REG_COUNT>(body.data());
+    if (ctLen != RegisterBody::SIZE + COOKIE_LEN + count * 4) return;
+    // 所以登记里还要带发布端发往这个地址的 cookie, 收不到发往该地址的包就拿不到,
+    // 没法把流量引到别人的地址上
+    if (!checkCookie(body.data() + RegisterBody::SIZE, from)) {
+        sendChallenge(from);
+        return;
+    }
+
+    uint64_t key = fanout::addrKey(from);
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = registrations_.find(key);
+    // 代数不增的是重放或乱序到达的旧登记
+    if (it != registrations_.end() && generation <= it->second.generation) return;
+
+    std::vector<uint32_t> topics;
+    for (size_t i = 0; i < count; i++) {
+        topics.push_back(wire::loadLe<uint32_t>(body.data() + RegisterBody::SIZE + COOKIE_LEN + i * 4));
+    }
+    std::sort(topics.begin(), topics.end());
+    topics.erase(std::unique(topics.begin(), topics.end()), topics.end());
+
+    if (topics.empty()) {
+        // 订阅端退出时发的空列表
+        if (it != registrations_.end()) {
+            registrations_.erase(it);
+            rebuildTopics();
+        }
+        return;
+    }
+    Registration& r = registrations_[key];
+    bool changed = r.topics != topics;
+    r.addr = from;
+    r.generation = generation;
+    r.lastSeen = std::chrono::steady_clock::now();
+    r.topics.swap(topics);
+    if (changed) rebuildTopics();
+}
+
+void Publisher::expire(std::chrono::steady_clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mu_);
+    bool changed = false;
+    for (auto it = registrations_.begin(); it != registrations_.end(); ) {
+        if (now - it->second.lastSeen >= SUBSCRIPTION_TIMEOUT) {
+            it = registrations_.erase(it);
+            changed = true;
+        } else {
+            ++it;
+        }
+    }
+    if (changed) rebuildTopics();
+}
+
+void Publisher::controlThreadFunc() {
+    std::vector<uint8_t> buffer(MAX_DATAGRAM);
+    auto lastExpire = std::chrono::steady_clock::now();
+    while (running_) {
+        struct pollfd pfd = {sockfd_, POLLIN, 0};
+        if (poll(&pfd, 1, POLL_MS) > 0) {
+            struct sockaddr_in from{};
+            socklen_t fromLen = sizeof(from);
+            ssize_t len = recvfrom(sockfd_, buffer.data(), buffer.size(), 0, (struct sockaddr*)&from, &fromLen);
+            if (len > 0) handleRegistration(buffer.data(), static_cast<size_t>(len), from);
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastExpire >= std::chrono::seconds(1)) {
+            expire(now);
+            lastExpire = now;
+        }
+    }
+}
+
+// ---------------- 订阅端 ----------------
+
+Subscriber::Subscriber(const std::string& publisherIp, int publisherPort, const std::string& key,
+                       int localPort, const std::string& multicastGroup)
+    : sockfd_(-1), publisher_(fanout::makeAddr(publisherIp, publisherPort)), registering_(multicastGroup.empty()),
+      cookie_(COOKIE_LEN), epoch_(0), epochKnown_(false), filtered_(0), running_(false)
+{
+    fanout::initKey(ctx_, key, "bus key");
+    // 代数从墙上时钟起步, 重启后的登记不会被当成旧的
+    generation_ = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    sockfd_ = fanout::openSocket(localPort);
+    if (!multicastGroup.empty() && !fanout::joinMulticast(sockfd_, multicastGroup)) {
+        close(sockfd_);
+        throw std::runtime_error("Failed to join multicast group");
+    }
+}
+
+Subscriber::~Subscriber() {
+    stop();
+    if (sockfd_ >= 0) close(sockfd_);
+}
+
+void Subscriber::subscribe(uint32_t topic, std::function<void(const std::string&)> handler) {
+    std::lock_guard<std::mutex> lock(mu_);
+    topics_[topic].handler = std::move(handler);
+    if (running_) sendRegistration();
+}
+
+void Subscriber::unsubscribe(uint32_t topic) {
+    // 交付时持有 mu_, 这里拿到锁就说明旧回调没有在跑
+    std::lock_guard<std::mutex> lock(mu_);
+    topics_.erase(topic);
+    if (running_) sendRegistration();
+}
+
+void Subscriber::start() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        running_ = true;
+        sendRegistration();
+    }
+    receiveThread_ = std::thread(&Subscriber::receiveThreadFunc, this);
+}
+
+void Subscriber::stop() {
+    if (running_) {
+        running_ = false;
+        if (receiveThread_.joinable()) receiveThread_.join();
+        // 告诉发布端别再发了, 丢了也会在超时后过期
+        std::lock_guard<std::mutex> lock(mu_);
+        std::unordered_map<uint32_t, TopicState> topics;
+        topics_.swap(topics);
+        sendRegistration();
+        topics_.swap(topics);
+    }
+}
+
+// 持锁调用。每次发的都是完整的主题列表, 丢了或乱序都不会让状态出错
+void Subscriber::sendRegistration() {
+    if (!registering_) return;
+    size_t count = std::min(topics_.size(), MAX_TOPICS);
+    if (count < topics_.size()) {
+        std::cerr << "Too many topics for one registration, keeping " << count << "\n";
+    }
+    std::vector<uint8_t> body(RegisterBody::SIZE + COOKIE_LEN + count * 4);
+    RegisterBody::encode(body.data(), ++generation_, static_cast<uint16_t>(count));
+    // 还没有 cookie 时带全零, 发布端会回一个质询
+    std::copy(cookie_.begin(), cookie_.end(), body.begin() + RegisterBody::SIZE);
+    size_t i = 0;
+    for (const auto& t : topics_) {
+        if (i == count) break;
+        wire::storeLe<uint32_t>(body.data() + RegisterBody::SIZE + COOKIE_LEN + i * 4, t.first);
+        i++;
+    }
+
+    std::vector<uint8_t> packet(1 + NONCE_LEN + body.size() + TAG_LEN);
+    packet[0] = TYPE_REGISTER;
+    uint8_t* nonce = packet.data() + 1;
+    aes_gcm_random_nonce(nonce);
+    if (!aes_gcm_encrypt(ctx_, nonce, packet.data(), 1, body.data(), body.size(),
+                         nonce + NONCE_LEN, nonce + NONCE_LEN + body.size())) {
+        std::cerr << "Encryption failed\n";
+        return;
+    }
+    if (sendto(sockfd_, packet.data(), packet.size(), 0, (struct sockaddr*)&publisher_, sizeof(publisher_)) < 0) {
+        perror("sendto");
+    }
+}
+
+// 发布端发来的 cookie 存下来, 立刻带着它重新登记
+void Subscriber::handleChallenge(const uint8_t* data, size_t len) {
+    if (len != CHALLENGE_LEN || !registering_) return;
+    const uint8_t* nonce = data + 1;
+    uint8_t cookie[COOKIE_LEN];
+    if (!aes_gcm_decrypt(ctx_, nonce, data, 1, nonce + NONCE_LEN, COOKIE_LEN, nonce + NONCE_LEN + COOKIE_LEN, cookie)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mu_);
+    if (std::equal(cookie_.begin(), cookie_.end(), cookie)) return;
+    cookie_.assign(cookie, cookie + COOKIE_LEN);
+    if (running_) sendRegistration();
+}
+
+void Subscriber::handleDatagram(const uint8_t* data, size_t len) {
+    if (len > 0 && data[0] == TYPE_CHALLENGE) {
+        handleChallenge(data, len);
+        return;
+    }
+    if (len < DATA_OVERHEAD || DataHeader::get<DATA_TYPE>(data) != TYPE_DATA) return;
+    uint64_t epoch = DataHeader::get<DATA_EPOCH>(data);
+    uint32_t topic = DataHeader::get<DATA_TOPIC>(data);
+    uint32_t seq = DataHeader::get<DATA_SEQ>(data);
+
+    std::lock_guard<std::mutex> lock(mu_);
+    // 解密之前按主题过滤, 没订阅的主题只花一次哈希查找
+    auto it = topics_.find(topic);
+    if (it == topics_.end()) {
+        filtered_++;
+        return;
+    }
+    TopicState& st = it->second;
+    // 发布端已退役的实例发的包只可能是迟到或重放的
+    bool newEpoch = !epochKnown_ || epoch != epoch_;
+    if (newEpoch && std::find(retiredEpochs_.begin(), retiredEpochs_.end(), epoch) != retiredEpochs_.end()) return;
+    // 重复包也在解密前丢掉; 认证通过之后才更新窗口。新 EPOCH 的包先认证, 不和旧实例的序号比
+    int32_t ahead = static_cast<int32_t>(seq - st.highest);
+    if (!newEpoch && st.started && ahead <= 0 && (-ahead >= 64 || (st.window >> -ahead) & 1)) return;
+
+    size_t ctLen = len - DATA_OVERHEAD;
+    const uint8_t* nonce = data + DataHeader::SIZE;
+    std::string plaintext(ctLen, '\0');
+    if (!aes_gcm_decrypt(ctx_, nonce, data, DataHeader::SIZE, nonce + NONCE_LEN, ctLen,
+                         nonce + NONCE_LEN + ctLen, reinterpret_cast<uint8_t*>(&plaintext[0]))) {
+        std::cerr << "Decryption failed for topic " << topic << " seq " << seq << "\n";
+        return;
+    }
+    if (newEpoch) {
+        // 发布端重启过: 序号从头来, 各主题都按第一次收到重新起步
+        if (epochKnown_) {
+            retiredEpochs_.push_back(epoch_);
+            if (retiredEpochs_.size() > MAX_RETIRED_EPOCHS) retiredEpochs_.pop_front();
+        }
+        epoch_ = epoch;
+        epochKnown_ = true;
+        for (auto& t : topics_) t.second.started = false;
+    }
+
+    if (!st.started) {
+        st.started = true;
+        st.highest = seq;
+        st.window = 1;
+    } else if (ahead > 0) {
+        st.window = ahead >= 64 ? 1 : (st.window << ahead) | 1;
+        st.highest = seq;
+    } else {
+        st.window |= uint64_t(1) << -ahead;
+    }
+    if (st.handler) st.handler(plaintext);
+}
+
+void Subscriber::receiveThreadFunc() {
+    std::vector<uint8_t> buffer(MAX_DATAGRAM);
+    auto lastRefresh = std::chrono::steady_clock::now();
+    while (running_) {
+        struct pollfd pfd = {sockfd_, POLLIN, 0};
+        if (poll(&pfd, 1, POLL_MS) > 0) {
+            // 有数据就一直读到读空
+            while (true) {
+                ssize_t len = recv(sockfd_, buffer.data(), buffer.size(), MSG_DONTWAIT);
+                if (len < 0) break;
+                handleDatagram(buffer.data(), static_cast<size_t>(len));
+            }
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastRefresh >= REFRESH_INTERVAL) {
+            std::lock_guard<std::mutex> lock(mu_);
+            sendRegistration();
+            lastRefresh = now;
+        }
+    }
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "../crypto/aes_gcm.h"
+
+// 按主题的发布/订阅。所有参与方共用一把总线密钥, 每条消息只加密一次,
+// 同一份密文用 sendmmsg 批量发给订阅了该主题的所有订阅端 (也可再发一份到组播组)。
+// 订阅端定期把自己要的主题列表发给发布端登记, 发布端过期不再续约的登记。
+// 登记里带着发布端此前发到订阅端地址的 cookie, 拿着别人的登记换地址重放过不了这一关。
+// EPOCH、TOPIC 和 SEQ 明文在包头里并作为 AAD 参与认证, 订阅端先按主题过滤, 没订阅的主题不解密。
+// EPOCH 每个发布端实例随机取一次, 订阅端据此认出发布端重启, 重新开始各主题的去重。
+// 一个订阅端只对应一个发布端。
+//
+// 数据: [TYPE(1B)][EPOCH(8B)][TOPIC(4B)][SEQ(4B)][NONCE(12B)][CIPHERTEXT][TAG(16B)], AAD 为前 17 字节
+// 登记: [TYPE(1B)][NONCE(12B)][密文: GEN(8B)][COUNT(2B)][COOKIE(28B)][TOPIC(4B) * COUNT][TAG(16B)]
+// 质询: [TYPE(1B)][NONCE(12B)][密文: COOKIE(28B)][TAG(16B)], 登记的 cookie 不对时由发布端回给登记的来源地址
+
+class Publisher {
+public:
+    // 这么久没续约的订阅端不再发
+    static constexpr std::chrono::seconds SUBSCRIPTION_TIMEOUT{15};
+
+    // 在 localPort 上收订阅登记, 数据也从这个 socket 发出
+    Publisher(int localPort, const std::string& key);
+    ~Publisher();
+
+    Publisher(const Publisher&) = delete;
+    Publisher& operator=(const Publisher&) = delete;
+
+    // 每条消息另发一份到组播组, 组里的订阅端自己按主题过滤
+    void setMulticast(const std::string& groupIp, int port, int ttl = 1);
+
+    bool publish(uint32_t topic, const std::string& data);
+    // 当前订阅了该主题的单播订阅端数
+    size_t subscribers(uint32_t topic);
+    void stop();
+
+private:
+    struct Registration {
+        struct sockaddr_in addr;
+        uint64_t generation = 0;
+        std::chrono::steady_clock::time_point lastSeen;
+        std::vector<uint32_t> topics;
+    };
+    // 每个主题一个目标列表和对应的 mmsghdr, 共用 iov_, 只在登记变化时重建
+    struct Topic {
+        uint32_t nextSeq = 0;
+        std::vector<struct sockaddr_in> destinations;
+        std::vector<struct mmsghdr> batch;
+    };
+
+    void controlThreadFunc();
+    void handleRegistration(const uint8_t* data, size_t len, const struct sockaddr_in& from);
+    bool checkCookie(const uint8_t* cookie, const struct sockaddr_in& from);
+    void sendChallenge(const struct sockaddr_in& to);
+    void expire(std::chrono::steady_clock::time_point now);
+    void rebuildTopics();
+
+    AesGcmContext ctx_;
+    AesGcmContext cookieCtx_;   // 随机密钥, 只有本发布端知道
+    uint64_t epoch_;            // 本实例的随机号, 每个数据包都带
+    int sockfd_;
+    bool multicast_;
+    struct sockaddr_in multicastAddr_;
+
+    std::unordered_map<uint64_t, Registration> registrations_;  // 键为 IP << 16 | 端口
+    std::unordered_map<uint32_t, Topic> topics_;
+    struct iovec iov_;
+    std::vector<uint8_t> packet_;
+
+    std::mutex mu_;
+    std::atomic<bool> running_;
+    std::thread controlThread_;
+};
+
+class Subscriber {
+public:
+    // 登记的续约间隔, 登记包丢了也会在下一轮补上
+    static constexpr std::chrono::seconds REFRESH_INTERVAL{5};
+
+    // multicastGroup 非空时在 localPort 上加入该组收数据, 不向发布端登记
+    Subscriber(const std::string& publisherIp, int publisherPort, const std::string& key,
+               int localPort = 0, const std::string& multicastGroup = "");
+    ~Subscriber();
+
+    Subscriber(const Subscriber&) = delete;
+    Subscriber& operator=(const Subscriber&) = delete;
+
+    // 在接收线程上回调; 返回后登记立即发出
+    void subscribe(uint32_t topic, std::function<void(const std::string&)> handler);
+    // 返回时该主题的回调已不在运行
+    void unsubscribe(uint32_t topic);
+
+    void start();
+    void stop();
+
+    // 因没有订阅而未解密就丢掉的包数
+    uint64_t filtered() const { return filtered_; }
+
+private:
+    struct TopicState {
+        std::function<void(const std::string&)> handler;
+        bool started = false;
+        uint32_t highest = 0;
+        uint64_t window = 0;        // 第 i 位表示 highest - i 已收到, 用来丢重复包
+    };
+
+    void receiveThreadFunc();
+    void handleDatagram(const uint8_t* data, size_t len);
+    void handleChallenge(const uint8_t* data, size_t len);
+    void sendRegistration();
+
+    AesGcmContext ctx_;
+    int sockfd_;
+    struct sockaddr_in publisher_;
+    bool registering_;
+    uint64_t generation_;
+    std::vector<uint8_t> cookie_;    // 发布端最近一次质询给的
+
+    std::unordered_map<uint32_t, TopicState> topics_;
+    // 当前发布端实例的 EPOCH, 和它之前的几个
+    uint64_t epoch_;
+    bool epochKnown_;
+    std::deque<uint64_t> retiredEpochs_;
+    std::mutex mu_;
+    std::atomic<uint64_t> filtered_;
+
+    std::atomic<bool> running_;
+    std::thread receiveThread_;
+};
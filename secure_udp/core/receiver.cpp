@@ -1,31 +1,49 @@
 #include "receiver.h"
 #include "../config/config.h"
 #include "../crypto/aes_gcm.h"
-#include <arpa/inet.h>
-#include <sys/socket.h>
-#include <unistd.h>
+#include "runtime.h"
+#include "wire.h"
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <chrono>
 
+// NACK 流: 多久扫一次缺口, 同一个缺口隔多久再要一次, 最多同时跟踪多少个缺口
+static constexpr auto NACK_CHECK_INTERVAL = std::chrono::milliseconds(20);
+static constexpr auto NACK_RETRY_INTERVAL = std::chrono::milliseconds(30);
+static constexpr uint32_t MAX_TRACKED_GAP = 256;
+// 最多同时记住多少个对端会话, 满了挤掉最久没有音讯的; 一个地址上最多试几个会话号
+static constexpr size_t MAX_PEER_SESSIONS = 1024;
+static constexpr size_t MAX_SESSIONS_PER_ADDR = 4;
+
+static uint64_t addrKey(const struct sockaddr_in& addr) {
+    return (uint64_t(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+}
+
+
 SecureUdpReceiver::SecureUdpReceiver(int localPort)
-    : running_(false) {
-    sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd_ < 0) {
-        perror("socket");
-        throw std::runtime_error("Failed to create socket");
-    }
+    : SecureUdpReceiver(std::make_unique<UdpTransport>(UdpTransport::bind(localPort))) {
+}
+
+SecureUdpReceiver::SecureUdpReceiver(Runtime& runtime, int localPort)
+    : SecureUdpReceiver(runtime, std::make_unique<UdpTransport>(UdpTransport::bind(localPort))) {
+}
 
-    struct sockaddr_in localAddr{};
-    localAddr.sin_family = AF_INET;
-    localAddr.sin_addr.s_addr = INADDR_ANY;
-    localAddr.sin_port = htons(localPort);
+SecureUdpReceiver::SecureUdpReceiver(std::unique_ptr<Transport> transport)
+    : transport_(std::move(transport)), running_(false), maxDatagram_(DEFAULT_MAX_DATAGRAM),
+      nackDeadline_(DEFAULT_NACK_DEADLINE), clockStart_(std::chrono::steady_clock::now()),
+      runtime_(nullptr), loop_(nullptr), nackTimer_(0), inflight_(0) {
+    if (!aes_gcm_init(ctx_, reinterpret_cast<const uint8_t*>(SHARED_KEY.data()), SHARED_KEY.size())) {
+        throw std::runtime_error("Invalid shared key");
+    }
+}
 
-    if (bind(sockfd_, (struct sockaddr*)&localAddr, sizeof(localAddr)) < 0) {
-        perror("bind");
-        close(sockfd_);
-        throw std::runtime_error("Failed to bind socket");
+SecureUdpReceiver::SecureUdpReceiver(Runtime& runtime, std::unique_ptr<Transport> transport)
+    : SecureUdpReceiver(std::move(transport)) {
+    if (transport_->fd() < 0) {
+        throw std::runtime_error("Transport has no pollable fd for runtime mode");
     }
+    runtime_ = &runtime;
 }
 
 SecureUdpReceiver::~SecureUdpReceiver() {
@@ -33,50 +51,508 @@ SecureUdpReceiver::~SecureUdpReceiver() {
 }
 
 void SecureUdpReceiver::start(std::function<void(const std::string&)> onMessage) {
-    callback_ = std::move(onMessage);
+    if (onMessage) {
+        callback_ = [onMessage = std::move(onMessage)](const std::string& message) {
+            onMessage(message);
+            return true;
+        };
+    }
+    buffer_.assign(maxDatagram_, 0);
+    transport_->setMaxDatagram(maxDatagram_);
     running_ = true;
+    if (runtime_) {
+        loop_ = &runtime_->place();
+        loop_->addFd(transport_->fd(), [this] { onReadable(); });
+        nackTimer_ = loop_->addTimer(NACK_CHECK_INTERVAL, [this] {
+            resumeBlocked();
+            sendNacks();
+        });
+        return;
+    }
     receiveThread_ = std::thread(&SecureUdpReceiver::receiveThreadFunc, this);
 }
 
+void SecureUdpReceiver::setStreamHandler(uint16_t stream,
+                                         std::function<void(const std::string&)> handler) {
+    if (!handler) {
+        setStreamConsumer(stream, nullptr);
+        return;
+    }
+    setStreamConsumer(stream, [handler = std::move(handler)](const std::string& message) {
+        handler(message);
+        return true;
+    });
+}
+
+void SecureUdpReceiver::setStreamConsumer(uint16_t stream,
+                                          std::function<bool(const std::string&)> consumer) {
+    // 交付时持有 mu_, 这里拿到锁就说明旧回调没有在跑
+    std::lock_guard<std::mutex> lock(mu_);
+    if (consumer) {
+        streamHandlers_[stream] = std::move(consumer);
+    } else {
+        streamHandlers_.erase(stream);
+    }
+}
+
+void SecureUdpReceiver::setCompressionDictionary(const std::string& dictionary) {
+    compressor_.setDictionary(dictionary);
+}
+
+void SecureUdpReceiver::setNackDeadline(std::chrono::milliseconds deadline) {
+    std::lock_guard<std::mutex> lock(mu_);
+    nackDeadline_ = deadline;
+}
+
+void SecureUdpReceiver::setMaxDatagram(size_t bytes) {
+    if (bytes < wire::MAX_HEADER_LEN + wire::TAG_LEN || bytes > MAX_UDP_DATAGRAM) {
+        throw std::runtime_error("Invalid maximum datagram size");
+    }
+    if (running_) {
+        throw std::runtime_error("Maximum datagram size must be set before start()");
+    }
+    maxDatagram_ = bytes;
+}
+
 void SecureUdpReceiver::stop() {
     if (running_) {
         running_ = false;
         if (receiveThread_.joinable()) receiveThread_.join();
-        close(sockfd_);
+        if (loop_) {
+            loop_->removeFd(transport_->fd());
+            loop_->cancelTimer(nackTimer_);
+            // 解密任务可能被别的核偷走, 等它们都结束。在本循环线程里停时,
+            // 排在本循环的任务没人跑, 先就地跑掉; 循环退出前也会跑完排着的任务
+            if (loop_->inLoopThread()) loop_->runQueued();
+            {
+                std::unique_lock<std::mutex> lock(inflightMu_);
+                inflightDone_.wait(lock, [this] { return inflight_ == 0; });
+            }
+            runtime_->release(*loop_);
+        }
     }
 }
 
 void SecureUdpReceiver::receiveThreadFunc() {
-    std::vector<uint8_t> buffer(1500);
+    auto& buffer = buffer_;
+    auto lastNackCheck = std::chrono::steady_clock::now();
     while (running_) {
-        ssize_t len = recvfrom(sockfd_, buffer.data(), buffer.size(), 0, nullptr, nullptr);
-        if (len <= 0) continue;
+        // 带超时等待, stop() 不会卡在阻塞读上; 超时也用来定时补发 NACK
+        struct sockaddr_in from{};
+        uint8_t tos;
+        ssize_t len = transport_->recvMarked(buffer.data(), buffer.size(),
+                                             static_cast<int>(NACK_CHECK_INTERVAL.count()), &from, &tos);
+        if (len > 0) handleDatagram(buffer.data(), static_cast<size_t>(len), from, tos);
 
-        if (len < 4 + 8 + 12 + 16) continue; // SEQ(4) + TIMESTAMP(8) + NONCE(12) + TAG(16)
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastNackCheck >= NACK_CHECK_INTERVAL) {
+            lastNackCheck = now;
+            resumeBlocked();
+            sendNacks();
+        }
+    }
+}
 
-        size_t offset = 0;
-        uint32_t seq = 0;
-        for (int i = 0; i < 4; i++) seq |= (buffer[offset++] << (i * 8));
+void SecureUdpReceiver::onReadable() {
+    auto& buffer = buffer_;
+    while (running_) {
+        struct sockaddr_in from{};
+        uint8_t tos;
+        ssize_t len = transport_->recvMarked(buffer.data(), buffer.size(), 0, &from, &tos);
+        if (len <= 0) break;
 
-        uint64_t timestamp = 0;
-        for (int i = 0; i < 8; i++) timestamp |= (uint64_t(buffer[offset++]) << (i * 8));
+        if (!runtime_->workStealing()) {
+            handleDatagram(buffer.data(), static_cast<size_t>(len), from, tos);
+            continue;
+        }
 
-        std::vector<uint8_t> nonce(buffer.begin() + offset, buffer.begin() + offset + 12);
-        offset += 12;
+        // 解密和回调作为可偷任务投递, 热点会话的负载可以摊到空闲核上
+        {
+            std::lock_guard<std::mutex> lock(inflightMu_);
+            inflight_++;
+        }
+        loop_->post([this, from, tos, packet = std::vector<uint8_t>(buffer.begin(), buffer.begin() + len)] {
+            if (running_) handleDatagram(packet.data(), packet.size(), from, tos);
+            std::lock_guard<std::mutex> lock(inflightMu_);
+            if (--inflight_ == 0) inflightDone_.notify_all();
+        });
+    }
+}
 
-        size_t cipherLen = len - offset - 16;
-        std::vector<uint8_t> cipher(buffer.begin() + offset, buffer.begin() + offset + cipherLen);
-        std::vector<uint8_t> tag(buffer.begin() + offset + cipherLen, buffer.begin() + offset + cipherLen + 16);
+void SecureUdpReceiver::handleDatagram(const uint8_t* data, size_t len, const struct sockaddr_in& from,
+                                       uint8_t tos) {
+    if (!fec::isFecPacket(data, len)) {
+        handlePacket(data, len, from, tos);
+        return;
+    }
+    // 原报文和靠修复包算回来的报文照常解密, 算错的过不了认证。
+    // 数据包的原报文排在最前, 沿用外层的 TOS; 恢复出来的包没有 ECN 标记可言
+    size_t innerLen;
+    const uint8_t* inner = fec::innerPacket(data, len, innerLen);
+    bool hasInner = inner != nullptr;
+    std::shared_ptr<FecDecoder> decoder;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        decoder = fecDecoderFor(from);
+    }
+    // 这个地址上还没有认证过的会话时不为它建恢复状态, 数据包先拆开处理;
+    // 它认证通过后地址就有了解码器, 再记进组里, 同组后面丢的包仍能恢复
+    bool handled = false;
+    if (!decoder) {
+        if (!hasInner) return;
+        handlePacket(inner, innerLen, from, tos);
+        handled = true;
+        std::lock_guard<std::mutex> lock(mu_);
+        decoder = fecDecoderFor(from);
+        if (!decoder) return;
+    }
+    std::vector<std::string> packets;
+    decoder->receive(data, len, packets);
+    for (size_t i = handled ? 1 : 0; i < packets.size(); i++) {
+        handlePacket(reinterpret_cast<const uint8_t*>(packets[i].data()), packets[i].size(), from,
+                     hasInner && i == 0 ? tos : wire::ECN_NOT_ECT);
+    }
+}
+
+void SecureUdpReceiver::handlePacket(const uint8_t* data, size_t len, const struct sockaddr_in& from,
+                                     uint8_t tos) {
+    wire::Header header;
+    size_t offset = wire::parseHeader(data, len, header);
+    if (offset == 0) return;
+
+    bool encrypted = transport_->requiresEncryption();
+    if (encrypted && len < offset + wire::TAG_LEN) return;
+
+    // 候选会话: 长包头自带; 短包头取这个地址上最近认证过的几个, 逐个试解密。
+    // 每个候选按它在该流上已收到的最大序号还原截断的 PN, 没见过的会话从 0 开始
+    struct Candidate {
+        uint64_t session;
+        uint32_t expected;
+    };
+    Candidate candidates[MAX_SESSIONS_PER_ADDR];
+    size_t candidateCount = 0;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (header.hasLong()) {
+            candidates[candidateCount++] = {header.session, 0};
+        } else {
+            // 没有来源地址的传输上所有发送端共用一个空地址, 短包头猜不准是谁的
+            if (!transport_->hasSourceAddress()) return;
+            auto known = addrSessions_.find(addrKey(from));
+            if (known == addrSessions_.end()) return; // 还不知道会话号, 解不了; 发送端久等不到 ACK 会发 SYNC
+            for (uint64_t session : known->second) candidates[candidateCount++] = {session, 0};
+        }
+        for (size_t i = 0; i < candidateCount; i++) {
+            auto peer = sessions_.find(candidates[i].session);
+            if (peer == sessions_.end()) continue;
+            auto it = peer->second.streams.find(header.stream());
+            if (it == peer->second.streams.end()) continue;
+            const StreamState& st = it->second;
+            candidates[i].expected = st.seen ? st.largest + 1 : st.nextExpected;
+        }
+    }
 
-        std::string plaintext;
-        bool ok = aes_gcm_decrypt(std::vector<uint8_t>(SHARED_KEY.begin(), SHARED_KEY.end()),
-                                  nonce, cipher, tag, plaintext);
-        if (!ok) {
+    uint64_t session = 0;
+    uint32_t seq = 0;
+    std::string plaintext;
+    if (encrypted) {
+        size_t cipherLen = len - offset - wire::TAG_LEN;
+        plaintext.resize(cipherLen);
+        // 路由号和 COMPRESSED 位在 AAD 里, 途中被改过就过不了认证
+        uint8_t ad[wire::MAX_AAD_LEN];
+        size_t adLen = wire::makeAad(data, ad);
+        bool opened = false;
+        for (size_t i = 0; i < candidateCount && !opened; i++) {
+            session = candidates[i].session;
+            seq = wire::decodePacketNumber(candidates[i].expected, header.pn, header.pnLen());
+            uint8_t nonce[wire::NONCE_LEN];
+            wire::makeNonce(session, header.stream(), seq, nonce);
+            opened = aes_gcm_decrypt(ctx_, nonce, ad, adLen, data + offset, cipherLen, data + offset + cipherLen,
+                                     reinterpret_cast<uint8_t*>(&plaintext[0]));
+        }
+        if (!opened) {
             std::cerr << "Decryption failed for packet seq=" << seq << "\n";
-            continue;
+            return;
         }
+    } else {
+        // 本机共享内存通道的明文包, 没有 TAG, 也就没法试: 取最近的会话。
+        // 这种通道没有来源地址, 只收长包头, 候选只有包头里的那一个
+        session = candidates[0].session;
+        seq = wire::decodePacketNumber(candidates[0].expected, header.pn, header.pnLen());
+        plaintext.assign(reinterpret_cast<const char*>(data) + offset, len - offset);
+    }
 
-        if (callback_) callback_(plaintext);
+    if (header.flags & wire::FLAG_COMPRESSED) {
+        std::string original;
+        if (!compressor_.decompress(reinterpret_cast<const uint8_t*>(plaintext.data()),
+                                    plaintext.size(), original)) {
+            std::cerr << "Decompression failed for packet seq=" << seq << "\n";
+            return;
+        }
+        plaintext.swap(original);
     }
+
+    deliver(header, session, seq, std::move(plaintext), from, tos);
 }
 
+void SecureUdpReceiver::deliver(const wire::Header& header, uint64_t session, uint32_t seq, std::string plaintext,
+                                const struct sockaddr_in& from, uint8_t tos) {
+    uint16_t stream = header.stream();
+    bool ordered = header.ordered();
+    bool nack = header.nack();
+
+    uint32_t cumulative;
+    bool newGap = false;
+    bool refused = false;
+    wire::EcnCounts ecn;
+    {
+        // 持锁交付, 保证同一流的回调顺序; 各流状态互不影响
+        std::lock_guard<std::mutex> lock(mu_);
+        // 认证通过才建状态, 伪造的长包头占不了位置
+        PeerSession& peer = touchSession(session, from);
+        if (stream == wire::SYNC_STREAM) {
+            applySync(peer, plaintext);
+            return; // 不交付也不回 ACK, 之后的重传解得开就会有 ACK
+        }
+        // 只统计认证过的包, 伪造的包不能让发送端降速
+        peer.ecn.count(tos);
+        ecn = peer.ecn;
+        StreamState& st = peer.streams[stream];
+        const Consumer& cb = consumerFor(stream);
+
+        if (nack) newGap = trackGaps(st, seq);
+
+        if (!st.seen || static_cast<int32_t>(seq - st.largest) > 0) {
+            st.largest = seq;
+            st.seen = true;
+        }
+
+        // 回调收不下的包不算收到: 不记账, 回一个不确认新东西的 ACK, 等发送端重传
+        bool duplicate = seq < st.nextExpected || st.receivedAhead.count(seq) || st.pending.count(seq);
+        if (!duplicate) {
+            if (ordered) {
+                if (st.blocked) {
+                    // 卡住的包已在 pending 里, 之后到的先不收, pending 因此不超过发送端窗口
+                    refused = true;
+                } else if (seq == st.nextExpected) {
+                    if (cb && !cb(plaintext)) {
+                        st.pending.emplace(seq, std::move(plaintext));
+                        st.blocked = true;
+                    } else {
+                        ++st.nextExpected;
+                        flushPending(st, cb);
+                    }
+                } else {
+                    st.pending.emplace(seq, std::move(plaintext));
+                }
+            } else if (cb && !cb(plaintext)) {
+                refused = true;
+            } else if (seq == st.nextExpected) {
+                ++st.nextExpected;
+                while (!st.receivedAhead.empty() && *st.receivedAhead.begin() == st.nextExpected) {
+                    st.receivedAhead.erase(st.receivedAhead.begin());
+                    ++st.nextExpected;
+                }
+            } else {
+                st.receivedAhead.insert(seq);
+            }
+        }
+        cumulative = st.nextExpected;
+    }
+
+    if (newGap) sendNacks();
+
+    // 重复包也回 ACK, 上一个 ACK 可能丢了。NACK 流不回 ACK,
+    // 只在对端还带长包头时回一个, 让它知道会话号已经记下
+    if (transport_->reliable()) return;
+    if (nack && !header.hasLong()) return;
+
+    wire::Ack ack;
+    ack.stream = stream;
+    ack.cumulative = cumulative;
+    ack.seq = refused ? cumulative - 1 : seq;
+    if (ecn.any()) {
+        ack.hasEcn = true;
+        ack.ecn = ecn;
+    }
+    if (header.hasTimestamp() && !refused) {
+        // 单向时延样本, 发送端拿去做基于时延的拥塞控制
+        auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - clockStart_).count();
+        ack.hasDelay = true;
+        ack.delay = static_cast<uint32_t>(nowMs) - header.deltaTs;
+    }
+    uint8_t buf[wire::MAX_ACK_LEN];
+    size_t len = wire::sealControl(ctx_, controlNonces_, session, buf, wire::encodeAck(ack, buf));
+    if (len) transport_->sendTo(buf, len, from);
+}
+
+// 持锁调用。取出或新建该会话的状态, 记下来源地址; 这个地址的候选会话里把它排到最前
+SecureUdpReceiver::PeerSession& SecureUdpReceiver::touchSession(uint64_t session, const struct sockaddr_in& from) {
+    auto now = std::chrono::steady_clock::now();
+    auto it = sessions_.find(session);
+    if (it == sessions_.end()) {
+        if (sessions_.size() >= MAX_PEER_SESSIONS) {
+            auto oldest = sessions_.begin();
+            for (auto p = sessions_.begin(); p != sessions_.end(); ++p) {
+                if (p->second.lastSeen < oldest->second.lastSeen) oldest = p;
+            }
+            auto list = addrSessions_.find(addrKey(oldest->second.addr));
+            if (list != addrSessions_.end()) {
+                list->second.erase(std::remove(list->second.begin(), list->second.end(), oldest->first),
+                                   list->second.end());
+                if (list->second.empty()) {
+                    fecDecoders_.erase(list->first);
+                    addrSessions_.erase(list);
+                }
+            }
+            sessions_.erase(oldest);
+        }
+        it = sessions_.emplace(session, PeerSession{}).first;
+    }
+    PeerSession& peer = it->second;
+    peer.addr = from;
+    peer.lastSeen = now;
+
+    std::vector<uint64_t>& list = addrSessions_[addrKey(from)];
+    if (list.empty() || list.front() != session) {
+        list.erase(std::remove(list.begin(), list.end(), session), list.end());
+        list.insert(list.begin(), session);
+        if (list.size() > MAX_SESSIONS_PER_ADDR) list.pop_back();
+    }
+    return peer;
+}
+
+// 持锁调用。来源地址上认证过会话才有解码器, 伪造的来源占不了位置; 否则返回空
+std::shared_ptr<FecDecoder> SecureUdpReceiver::fecDecoderFor(const struct sockaddr_in& from) {
+    uint64_t key = addrKey(from);
+    if (!addrSessions_.count(key)) return nullptr;
+    std::shared_ptr<FecDecoder>& decoder = fecDecoders_[key];
+    if (!decoder) decoder = std::make_shared<FecDecoder>();
+    return decoder;
+}
+
+// 持锁调用。发送端确认过 BASE 之前都已交付: 丢过状态的流从 BASE 接着收, 按序流把接得上的包交出去
+void SecureUdpReceiver::applySync(PeerSession& peer, const std::string& entries) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(entries.data());
+    for (size_t off = 0; off + wire::SyncEntry::SIZE <= entries.size(); off += wire::SyncEntry::SIZE) {
+        uint16_t field = wire::SyncEntry::get<wire::SYNC_ENTRY_STREAM>(p + off);
+        uint32_t base = wire::SyncEntry::get<wire::SYNC_ENTRY_BASE>(p + off);
+        uint16_t stream = field & wire::STREAM_ID_MASK;
+        if (stream == wire::SYNC_STREAM || (field & wire::STREAM_NACK_FLAG)) continue;
+        StreamState& st = peer.streams[stream];
+        if (st.seen && static_cast<int32_t>(base - st.nextExpected) <= 0) continue;
+
+        st.pending.erase(st.pending.begin(), st.pending.lower_bound(base));
+        abandonBefore(st, base);
+        if (!st.seen || static_cast<int32_t>(base - 1 - st.largest) > 0) {
+            st.largest = base - 1;
+            st.seen = base != 0;
+        }
+        if (field & wire::STREAM_ORDERED_FLAG) flushPending(st, consumerFor(stream));
+    }
+}
+
+// 持锁调用
+const SecureUdpReceiver::Consumer& SecureUdpReceiver::consumerFor(uint16_t stream) const {
+    auto handler = streamHandlers_.find(stream);
+    return handler != streamHandlers_.end() ? handler->second : callback_;
+}
+
+// 持锁调用。按序流把 pending 里接得上的包依次交出去, 回调收不下就停在那里
+void SecureUdpReceiver::flushPending(StreamState& st, const Consumer& cb) {
+    while (!st.pending.empty() && st.pending.begin()->first == st.nextExpected) {
+        if (cb && !cb(st.pending.begin()->second)) {
+            st.blocked = true;
+            return;
+        }
+        st.pending.erase(st.pending.begin());
+        ++st.nextExpected;
+    }
+    st.blocked = false;
+}
+
+// 卡住的按序流定时再试一次; 只有那个流在等, 收包线程不会被它拖住
+void SecureUdpReceiver::resumeBlocked() {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto& ps : sessions_) {
+        for (auto& p : ps.second.streams) {
+            if (p.second.blocked) flushPending(p.second, consumerFor(p.first));
+        }
+    }
+}
+
+// 持锁调用。登记 seq 之前的新缺口, 返回是否有新缺口
+bool SecureUdpReceiver::trackGaps(StreamState& st, uint32_t seq) {
+    auto now = std::chrono::steady_clock::now();
+    if (!st.seen) {
+        // 中途加入的接收端不追要之前的包
+        st.nextExpected = seq;
+        return false;
+    }
+    st.missing.erase(seq);
+    if (static_cast<int32_t>(seq - st.largest) <= 1) return false;
+
+    uint32_t from = st.largest + 1;
+    if (seq - from > MAX_TRACKED_GAP) {
+        from = seq - MAX_TRACKED_GAP;
+        abandonBefore(st, from);
+    }
+    for (uint32_t s = from; s != seq; s++) {
+        st.missing.emplace(s, Missing{now, {}, 0});
+    }
+    return true;
+}
+
+// 持锁调用。before 之前的包不再等, 当作已收到推进 nextExpected, 迟到的按重复丢弃
+void SecureUdpReceiver::abandonBefore(StreamState& st, uint32_t before) {
+    st.missing.erase(st.missing.begin(), st.missing.lower_bound(before));
+    st.receivedAhead.erase(st.receivedAhead.begin(), st.receivedAhead.lower_bound(before));
+    if (static_cast<int32_t>(before - st.nextExpected) > 0) st.nextExpected = before;
+    while (!st.receivedAhead.empty() && *st.receivedAhead.begin() == st.nextExpected) {
+        st.receivedAhead.erase(st.receivedAhead.begin());
+        ++st.nextExpected;
+    }
+}
+
+void SecureUdpReceiver::sendNacks() {
+    auto now = std::chrono::steady_clock::now();
+    struct Request {
+        uint64_t session;
+        struct sockaddr_in peer;
+        uint16_t stream;
+        std::vector<uint32_t> seqs;
+    };
+    std::vector<Request> requests;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        for (auto& ps : sessions_) {
+            for (auto& p : ps.second.streams) {
+                StreamState& st = p.second;
+                // 过了期限的缺口就算补来也没用了, 按序号从小到大放弃
+                while (!st.missing.empty() && now - st.missing.begin()->second.firstSeen >= nackDeadline_) {
+                    abandonBefore(st, st.missing.begin()->first + 1);
+                }
+
+                std::vector<uint32_t> seqs;
+                for (auto& m : st.missing) {
+                    if (m.second.tries > 0 && now - m.second.lastNack < NACK_RETRY_INTERVAL) continue;
+                    m.second.lastNack = now;
+                    m.second.tries++;
+                    seqs.push_back(m.first);
+                }
+                if (!seqs.empty()) requests.push_back(Request{ps.first, ps.second.addr, p.first, std::move(seqs)});
+            }
+        }
+    }
+
+    uint8_t buf[wire::MAX_NACK_LEN];
+    for (auto& r : requests) {
+        for (size_t i = 0; i < r.seqs.size(); i += wire::MAX_NACK_SEQS) {
+            size_t count = std::min(wire::MAX_NACK_SEQS, r.seqs.size() - i);
+            size_t len = wire::sealControl(ctx_, controlNonces_, r.session, buf,
+                                           wire::encodeNack(r.stream, r.seqs.data() + i, count, buf));
+            if (len) transport_->sendTo(buf, len, r.peer);
+        }
+    }
+}
@@ -2,23 +2,131 @@
 #include <string>
 #include <thread>
 #include <atomic>
-#include <netinet/in.h>
 #include <functional>
+#include <cstdint>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include "../crypto/aes_gcm.h"
+#include "compression.h"
+#include "fec.h"
+#include "transport.h"
+#include "wire.h"
+
+class Runtime;
+class EventLoop;
 
 class SecureUdpReceiver {
 public:
+    // NACK 流上一个缺口超过这么久还没补上就放弃
+    static constexpr std::chrono::milliseconds DEFAULT_NACK_DEADLINE{200};
+
     SecureUdpReceiver(int localPort);
+    // 挂到共享运行时上, 读事件由所在核的事件循环驱动
+    SecureUdpReceiver(Runtime& runtime, int localPort);
+    explicit SecureUdpReceiver(std::unique_ptr<Transport> transport);
+    // 运行时模式要求 transport 提供可 epoll 的 fd
+    SecureUdpReceiver(Runtime& runtime, std::unique_ptr<Transport> transport);
     ~SecureUdpReceiver();
 
     void start(std::function<void(const std::string&)> onMessage);
+    // 该流的消息交给单独的回调, 不再走 start() 的回调; 传空函数取消
+    void setStreamHandler(uint16_t stream, std::function<void(const std::string&)> handler);
+    // 同上, 但回调可以返回 false 表示暂时收不下: 这个包不算收到, 也不确认, 发送端的窗口
+    // 因此停住; 按序流在隔几十毫秒重试成功之前不再往后交付, 其他流照常。回调不能阻塞
+    void setStreamConsumer(uint16_t stream, std::function<bool(const std::string&)> consumer);
+    // 发送端用了 zstd 字典时装同一份, 须在 start() 之前
+    void setCompressionDictionary(const std::string& dictionary);
+    // 应和发送端 openNackStream 的 deadline 一致
+    void setNackDeadline(std::chrono::milliseconds deadline);
+    // 能收的最大数据报 (UDP 载荷), 默认 DEFAULT_MAX_DATAGRAM, 最大 MAX_UDP_DATAGRAM;
+    // 须在 start() 之前, 不小于发送端的设置
+    void setMaxDatagram(size_t bytes);
+    // 超过最大数据报而被丢掉的包数
+    uint64_t truncatedDatagrams() const { return transport_->truncated(); }
     void stop();
 
 private:
     void receiveThreadFunc();
+    void onReadable();
+    void handleDatagram(const uint8_t* data, size_t len, const struct sockaddr_in& from, uint8_t tos);
+    void handlePacket(const uint8_t* data, size_t len, const struct sockaddr_in& from, uint8_t tos);
+    void deliver(const wire::Header& header, uint64_t session, uint32_t seq, std::string plaintext,
+                 const struct sockaddr_in& from, uint8_t tos);
+    void sendNacks();
+    void resumeBlocked();
+
+    // NACK 流上的一个缺口
+    struct Missing {
+        std::chrono::steady_clock::time_point firstSeen;
+        std::chrono::steady_clock::time_point lastNack;
+        int tries;
+    };
+
+    // 每个流独立的接收状态, nextExpected 之前的序号都已收到 (NACK 流里还包括放弃了的)
+    struct StreamState {
+        uint32_t nextExpected = 0;
+        uint32_t largest = 0;                      // 已收到的最大序号, 用来还原截断的 PN
+        bool seen = false;
+        std::set<uint32_t> receivedAhead;          // 乱序流: 已交付但不连续的序号, 用于去重
+        std::map<uint32_t, std::string> pending;   // 按序流: 等前面空洞补齐的包
+        std::map<uint32_t, Missing> missing;       // NACK 流: 还在要的包
+        bool blocked = false;                      // 按序流: 回调收不下 pending 的第一个包
+    };
+
+    using Consumer = std::function<bool(const std::string&)>;
 
-    int sockfd_;
+    // 一个对端发送端会话的接收状态, 以会话号为键; 各会话互不干扰,
+    // 重放来的旧会话的包只落到它自己的状态里, 按重复丢弃
+    struct PeerSession {
+        std::unordered_map<uint16_t, StreamState> streams;
+        wire::EcnCounts ecn;                       // 本会话收到的各 ECN 码点的包数, 随 ACK 回报
+        struct sockaddr_in addr;                   // 最近一个认证过的包的来源, NACK 发往这里
+        std::chrono::steady_clock::time_point lastSeen;
+    };
+
+    bool trackGaps(StreamState& st, uint32_t seq);
+    void abandonBefore(StreamState& st, uint32_t before);
+    PeerSession& touchSession(uint64_t session, const struct sockaddr_in& from);
+    std::shared_ptr<FecDecoder> fecDecoderFor(const struct sockaddr_in& from);
+    void applySync(PeerSession& peer, const std::string& entries);
+    const Consumer& consumerFor(uint16_t stream) const;
+    void flushPending(StreamState& st, const Consumer& cb);
+
+    std::unique_ptr<Transport> transport_;
+    AesGcmContext ctx_;
+    wire::ControlNonceSource controlNonces_;   // ACK/NACK 认证尾的 NONCE
+    PayloadCompressor compressor_;
     std::atomic<bool> running_;
+    size_t maxDatagram_;
+    // 收包缓冲, start() 时按 maxDatagram_ 分配一次; 只有收包线程或所在核的事件循环用它
+    std::vector<uint8_t> buffer_;
     std::thread receiveThread_;
-    std::function<void(const std::string&)> callback_;
+    Consumer callback_;
+
+    std::unordered_map<uint64_t, PeerSession> sessions_;
+    // 短包头不带会话号: 按来源地址找最近在这个地址上认证过的几个会话, 新的在前
+    std::unordered_map<uint64_t, std::vector<uint64_t>> addrSessions_;
+    // FEC 前缀不带会话号, 组号只在一个发送端内唯一: addrSessions_ 里每个来源地址一个解码器,
+    // 随地址一起淘汰; 同一地址上先后的会话靠发送端随机的起始组号错开
+    std::unordered_map<uint64_t, std::shared_ptr<FecDecoder>> fecDecoders_;
+    std::unordered_map<uint16_t, Consumer> streamHandlers_;
+    std::chrono::milliseconds nackDeadline_;
+    // ACK 里时延样本用的本地时钟起点
+    std::chrono::steady_clock::time_point clockStart_;
+    std::mutex mu_;
+
+    Runtime* runtime_;
+    EventLoop* loop_;
+    uint64_t nackTimer_;
+    // 投递出去还没跑完的解密任务, 归 inflightMu_ 管; 减到 0 时通知 stop()
+    size_t inflight_;
+    std::mutex inflightMu_;
+    std::condition_variable inflightDone_;
 };
 
@@ -0,0 +1,346 @@
+#include "relay.h"
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+#include "fec.h"
+#include "wire.h"
+
+static constexpr size_t MAX_EVENTS = 64;
+// 空闲流的清理间隔, 也是 epoll_wait 的超时
+static constexpr int SWEEP_INTERVAL_MS = 1000;
+
+static uint64_t flowKey(const struct sockaddr_in& addr) {
+    return (uint64_t(ntohl(addr.sin_addr.s_addr)) << 16) | ntohs(addr.sin_port);
+}
+
+// 中继只看路由号; FEC 数据包的路由号在内层包头里, 修复包没有, 只能跟着已有的流走
+static bool routeOf(const uint8_t* data, size_t len, uint32_t& route) {
+    if (fec::isFecPacket(data, len)) {
+        size_t innerLen;
+        const uint8_t* inner = fec::innerPacket(data, len, innerLen);
+        return inner && wire::peekRoute(inner, innerLen, route);
+    }
+    return wire::peekRoute(data, len, route);
+}
+
+Relay::Relay(int localPort, size_t maxDatagram, std::chrono::seconds idleTimeout, size_t maxFlows)
+    : sockfd_(-1), epollFd_(-1), wakeFd_(-1), maxDatagram_(maxDatagram), idleTimeout_(idleTimeout),
+      maxFlows_(maxFlows), forwarded_(0), returned_(0), dropped_(0), refusedFlows_(0), evictedFlows_(0),
+      flowCount_(0), running_(false)
+{
+    if (maxDatagram_ == 0 || maxDatagram_ > MAX_UDP_DATAGRAM) {
+        throw std::runtime_error("Invalid maximum datagram size");
+    }
+    if (maxFlows_ == 0) {
+        throw std::runtime_error("Invalid maximum flow count");
+    }
+    sockfd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sockfd_ < 0) {
+        perror("socket");
+        throw std::runtime_error("Failed to create socket");
+    }
+    struct sockaddr_in localAddr{};
+    localAddr.sin_family = AF_INET;
+    localAddr.sin_addr.s_addr = INADDR_ANY;
+    localAddr.sin_port = htons(localPort);
+    if (::bind(sockfd_, (struct sockaddr*)&localAddr, sizeof(localAddr)) < 0) {
+        perror("bind");
+        close(sockfd_);
+        throw std::runtime_error("Failed to bind socket");
+    }
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd_ < 0 || wakeFd_ < 0) {
+        perror("epoll/eventfd");
+        if (epollFd_ >= 0) close(epollFd_);
+        if (wakeFd_ >= 0) close(wakeFd_);
+        close(sockfd_);
+        throw std::runtime_error("Failed to create relay event loop");
+    }
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = sockfd_;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, sockfd_, &ev);
+    ev.data.fd = wakeFd_;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &ev);
+
+    batch_.buffers.resize(BATCH * maxDatagram_);
+    batch_.msgs.resize(BATCH);
+    batch_.iovs.resize(BATCH);
+    batch_.addrs.resize(BATCH);
+    batch_.out.resize(BATCH);
+    batch_.outIovs.resize(BATCH);
+}
+
+Relay::~Relay() {
+    stop();
+    for (auto& f : flows_) close(f.second.fd);
+    close(wakeFd_);
+    close(epollFd_);
+    close(sockfd_);
+}
+
+void Relay::addRoute(uint32_t route, const std::string& ip, int port) {
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) != 1) {
+        throw std::runtime_error("Invalid address: " + ip);
+    }
+    std::lock_guard<std::mutex> lock(routesMu_);
+    routes_[route] = addr;
+}
+
+void Relay::removeRoute(uint32_t route) {
+    std::lock_guard<std::mutex> lock(routesMu_);
+    routes_.erase(route);
+}
+
+void Relay::start() {
+    if (running_) return;
+    running_ = true;
+    thread_ = std::thread(&Relay::loop, this);
+}
+
+void Relay::stop() {
+    if (!running_) return;
+    running_ = false;
+    uint64_t one = 1;
+    if (write(wakeFd_, &one, sizeof(one)) < 0) perror("write eventfd");
+    if (thread_.joinable()) thread_.join();
+}
+
+Relay::Stats Relay::stats() const {
+    Stats s;
+    s.forwarded = forwarded_;
+    s.returned = returned_;
+    s.dropped = dropped_;
+    s.refusedFlows = refusedFlows_;
+    s.evictedFlows = evictedFlows_;
+    s.flows = flowCount_;
+    return s;
+}
+
+void Relay::loop() {
+    struct epoll_event events[MAX_EVENTS];
+    auto lastSweep = std::chrono::steady_clock::now();
+    while (running_) {
+        int n = epoll_wait(epollFd_, events, MAX_EVENTS, SWEEP_INTERVAL_MS);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wakeFd_) {
+                uint64_t value;
+                if (read(wakeFd_, &value, sizeof(value)) < 0) { /* 计数已清零 */ }
+            } else if (fd == sockfd_) {
+                forwardFromClients();
+            } else {
+                auto it = flowByFd_.find(fd);
+                if (it != flowByFd_.end()) returnToClient(flows_[it->second]);
+            }
+        }
+        // 流只在这里关, 同一轮事件里不会用到已关的描述符
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastSweep >= std::chrono::milliseconds(SWEEP_INTERVAL_MS)) {
+            expireFlows(now);
+            lastSweep = now;
+        }
+    }
+}
+
+// 收一批到 batch_, 返回包数
+int Relay::receiveBatch(int fd) {
+    for (size_t i = 0; i < BATCH; i++) {
+        batch_.iovs[i] = {batch_.buffers.data() + i * maxDatagram_, maxDatagram_};
+        struct msghdr& hdr = batch_.msgs[i].msg_hdr;
+        hdr = {};
+        hdr.msg_name = &batch_.addrs[i];
+        hdr.msg_namelen = sizeof(batch_.addrs[i]);
+        hdr.msg_iov = &batch_.iovs[i];
+        hdr.msg_iovlen = 1;
+    }
+    int n = recvmmsg(fd, batch_.msgs.data(), BATCH, MSG_DONTWAIT, nullptr);
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("recvmmsg");
+    return n;
+}
+
+// 把 batch_.out 的前 count 个一次发出, 发不出去的计入丢包
+size_t Relay::flush(int fd, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        int sent = sendmmsg(fd, batch_.out.data() + done, static_cast<unsigned int>(count - done), MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            // 和路由器一样, 出口排不下就丢
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) perror("sendmmsg");
+            dropped_ += count - done;
+            break;
+        }
+        done += static_cast<size_t>(sent);
+    }
+    return done;
+}
+
+// 正向: 从监听 socket 收一批, 同一个流的连续包合成一次 sendmmsg 从该流的上游 socket 发出
+void Relay::forwardFromClients() {
+    int n = receiveBatch(sockfd_);
+    if (n <= 0) return;
+
+    Flow* current = nullptr;
+    size_t count = 0;
+    auto flushCurrent = [&] {
+        if (current && count) forwarded_ += flush(current->fd, count);
+        count = 0;
+    };
+    for (int i = 0; i < n; i++) {
+        const struct msghdr& hdr = batch_.msgs[i].msg_hdr;
+        if (hdr.msg_flags & MSG_TRUNC) {
+            dropped_++;
+            continue;
+        }
+        const uint8_t* data = static_cast<const uint8_t*>(batch_.iovs[i].iov_base);
+        size_t len = batch_.msgs[i].msg_len;
+        Flow* flow = flowFor(batch_.addrs[i], data, len);
+        if (!flow) {
+            dropped_++;
+            continue;
+        }
+        if (flow != current) {
+            flushCurrent();
+            current = flow;
+        }
+        // 上游 socket 已 connect, 不带地址
+        batch_.outIovs[count] = {const_cast<uint8_t*>(data), len};
+        batch_.out[count].msg_hdr = {};
+        batch_.out[count].msg_hdr.msg_iov = &batch_.outIovs[count];
+        batch_.out[count].msg_hdr.msg_iovlen = 1;
+        count++;
+    }
+    flushCurrent();
+}
+
+// 反向: 下一跳回的包 (ACK、NACK 等) 原样从监听 socket 转给客户端
+void Relay::returnToClient(Flow& flow) {
+    int n = receiveBatch(flow.fd);
+    if (n <= 0) return;
+
+    size_t count = 0;
+    for (int i = 0; i < n; i++) {
+        if (batch_.msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            dropped_++;
+            continue;
+        }
+        batch_.outIovs[count] = {batch_.iovs[i].iov_base, batch_.msgs[i].msg_len};
+        struct msghdr& hdr = batch_.out[count].msg_hdr;
+        hdr = {};
+        hdr.msg_name = &flow.client;
+        hdr.msg_namelen = sizeof(flow.client);
+        hdr.msg_iov = &batch_.outIovs[count];
+        hdr.msg_iovlen = 1;
+        count++;
+    }
+    flow.lastActive = std::chrono::steady_clock::now();
+    returned_ += flush(sockfd_, count);
+}
+
+// 找到或建立客户端的流; 新流必须由带路由号的包建立
+Relay::Flow* Relay::flowFor(const struct sockaddr_in& client, const uint8_t* data, size_t len) {
+    uint32_t route = 0;
+    bool routed = routeOf(data, len, route);
+    uint64_t key = flowKey(client);
+    auto it = flows_.find(key);
+    if (it != flows_.end() && (!routed || route == it->second.route)) {
+        it->second.lastActive = std::chrono::steady_clock::now();
+        return &it->second;
+    }
+    if (!routed) return nullptr;
+
+    struct sockaddr_in next;
+    {
+        std::lock_guard<std::mutex> lock(routesMu_);
+        auto r = routes_.find(route);
+        if (r == routes_.end()) return nullptr;
+        next = r->second;
+    }
+
+    if (it != flows_.end()) {
+        // 客户端换了路由号, 同一个上游 socket 改连新的下一跳
+        if (connect(it->second.fd, (const struct sockaddr*)&next, sizeof(next)) < 0) {
+            perror("connect");
+            return nullptr;
+        }
+        it->second.route = route;
+        it->second.lastActive = std::chrono::steady_clock::now();
+        return &it->second;
+    }
+
+    if (!makeRoomForFlow()) return nullptr;
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return nullptr;
+    }
+    if (connect(fd, (const struct sockaddr*)&next, sizeof(next)) < 0) {
+        perror("connect");
+        close(fd);
+        return nullptr;
+    }
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        close(fd);
+        return nullptr;
+    }
+    Flow& flow = flows_[key];
+    flow.fd = fd;
+    flow.client = client;
+    flow.route = route;
+    flow.lastActive = std::chrono::steady_clock::now();
+    flowByFd_[fd] = key;
+    flowCount_ = flows_.size();
+    return &flow;
+}
+
+void Relay::closeFlow(uint64_t key) {
+    auto it = flows_.find(key);
+    if (it == flows_.end()) return;
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, it->second.fd, nullptr);
+    close(it->second.fd);
+    flowByFd_.erase(it->second.fd);
+    flows_.erase(it);
+    flowCount_ = flows_.size();
+}
+
+// 流表满时挤掉最久没动的流; 它最近还活跃过就不动它, 拒绝新流。
+// 伪造来源的洪水因此只能占满空位, 挤不走正在用的流
+bool Relay::makeRoomForFlow() {
+    if (flows_.size() < maxFlows_) return true;
+    auto oldest = flows_.begin();
+    for (auto it = flows_.begin(); it != flows_.end(); ++it) {
+        if (it->second.lastActive < oldest->second.lastActive) oldest = it;
+    }
+    if (std::chrono::steady_clock::now() - oldest->second.lastActive < EVICT_MIN_IDLE) {
+        refusedFlows_++;
+        return false;
+    }
+    closeFlow(oldest->first);
+    evictedFlows_++;
+    return true;
+}
+
+void Relay::expireFlows(std::chrono::steady_clock::time_point now) {
+    std::vector<uint64_t> idle;
+    for (const auto& f : flows_) {
+        if (now - f.second.lastActive >= idleTimeout_) idle.push_back(f.first);
+    }
+    for (uint64_t key : idle) closeFlow(key);
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "transport.h"
+
+// 区域间的中继: 按包头里的 ROUTE 选下一跳, 密文原样转发, 不持有密钥也不做任何加解密。
+// 每个客户端 (来源地址) 对应一个流, 流有自己的上游 socket:
+// 正向包从这个 socket 发往下一跳, 下一跳回的 ACK/NACK 从同一个 socket 收回, 再转给客户端。
+// 中继可以串联, 上一个中继对下一个来说就是一个客户端。
+// 收发都按批走 recvmmsg/sendmmsg, 单线程跑在 epoll 上。
+class Relay {
+public:
+    // 一次 recvmmsg 最多收这么多个包
+    static constexpr size_t BATCH = 64;
+    static constexpr std::chrono::seconds DEFAULT_IDLE_TIMEOUT{60};
+    // 每个流占一个上游 socket, 伪造来源地址的带路由号的包也能建流, 所以要封顶
+    static constexpr size_t DEFAULT_MAX_FLOWS = 4096;
+    // 流表满时, 最久没动的流至少空闲了这么久才挤掉它, 否则拒绝新流
+    static constexpr std::chrono::seconds EVICT_MIN_IDLE{5};
+
+    explicit Relay(int localPort, size_t maxDatagram = DEFAULT_MAX_DATAGRAM,
+                   std::chrono::seconds idleTimeout = DEFAULT_IDLE_TIMEOUT,
+                   size_t maxFlows = DEFAULT_MAX_FLOWS);
+    ~Relay();
+
+    Relay(const Relay&) = delete;
+    Relay& operator=(const Relay&) = delete;
+
+    // 路由号到下一跳; 已建立的流沿用建立时的下一跳, 直到空闲超时
+    void addRoute(uint32_t route, const std::string& ip, int port);
+    void removeRoute(uint32_t route);
+
+    void start();
+    void stop();
+
+    struct Stats {
+        uint64_t forwarded = 0;     // 客户端发往下一跳的
+        uint64_t returned = 0;      // 下一跳回给客户端的
+        uint64_t dropped = 0;       // 没有路由、超长或发不出去的
+        uint64_t refusedFlows = 0;  // 流表满且没有可挤掉的流, 没建成的新流
+        uint64_t evictedFlows = 0;  // 为新流让位被关掉的空闲流
+        size_t flows = 0;
+    };
+    Stats stats() const;
+
+private:
+    struct Flow {
+        int fd = -1;                        // 连到下一跳的上游 socket
+        struct sockaddr_in client{};
+        uint32_t route = 0;
+        std::chrono::steady_clock::time_point lastActive;
+    };
+
+    // 一批收包缓冲, 正反两个方向共用
+    struct Batch {
+        std::vector<uint8_t> buffers;
+        std::vector<struct mmsghdr> msgs;
+        std::vector<struct iovec> iovs;
+        std::vector<struct sockaddr_in> addrs;
+        std::vector<struct mmsghdr> out;     // 待发的一批, 指向 buffers 里收到的包
+        std::vector<struct iovec> outIovs;
+    };
+
+    void loop();
+    void forwardFromClients();
+    void returnToClient(Flow& flow);
+    Flow* flowFor(const struct sockaddr_in& client, const uint8_t* data, size_t len);
+    void closeFlow(uint64_t key);
+    bool makeRoomForFlow();
+    void expireFlows(std::chrono::steady_clock::time_point now);
+    int receiveBatch(int fd);
+    size_t flush(int fd, size_t count);
+
+    int sockfd_;
+    int epollFd_;
+    int wakeFd_;
+    size_t maxDatagram_;
+    std::chrono::seconds idleTimeout_;
+    size_t maxFlows_;
+
+    mutable std::mutex routesMu_;
+    std::unordered_map<uint32_t, struct sockaddr_in> routes_;
+
+    // 以下只在中继线程里访问; 键为客户端 IP << 16 | 端口
+    std::unordered_map<uint64_t, Flow> flows_;
+    std::unordered_map<int, uint64_t> flowByFd_;
+    Batch batch_;
+
+    std::atomic<uint64_t> forwarded_;
+    std::atomic<uint64_t> returned_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> refusedFlows_;
+    std::atomic<uint64_t> evictedFlows_;
+    std::atomic<size_t> flowCount_;
+
+    std::thread thread_;
+    std::atomic<bool> running_;
+};
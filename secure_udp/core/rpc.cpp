@@ -0,0 +1,346 @@
+#include "rpc.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include "codec.h"
+
+// [CALL_ID(8B)][METHOD(2B)][BUDGET_MS(4B)], 后跟参数
+using RequestHeader = wire::Layout<wire::Field<uint64_t>, wire::Field<uint16_t>, wire::Field<uint32_t>>;
+enum { REQ_ID, REQ_METHOD, REQ_BUDGET };
+// [CALL_ID(8B)][STATUS(1B)], 后跟结果
+using ResponseHeader = wire::Layout<wire::Field<uint64_t>, wire::Field<uint8_t>>;
+enum { RESP_ID, RESP_STATUS };
+
+// 服务端等响应流窗口时最多睡这么久再看一次期限
+static constexpr std::chrono::milliseconds WINDOW_POLL{10};
+
+// ---------------- 客户端 ----------------
+
+// 放在 shared_ptr 里, 窗口回调可能在客户端析构时还在发送线程上跑
+struct RpcClient::State {
+    using Clock = std::chrono::steady_clock;
+
+    struct Call {
+        uint16_t method;
+        std::string args;
+        std::function<void(RpcResult)> done;
+        Clock::time_point deadline;
+        std::multimap<Clock::time_point, uint64_t>::iterator timer;
+        bool sent = false;
+        uint32_t seq = 0;       // 请求在流里的序号, 超时时据此问可靠层对端收到没有
+    };
+
+    SecureUdpSender& sender;
+    uint16_t stream;
+
+    std::unordered_map<uint64_t, Call> calls;
+    std::deque<uint64_t> queue;     // 窗口满时还没发出的调用, 按发起顺序
+    std::multimap<Clock::time_point, uint64_t> deadlines;
+    uint64_t nextId = 1;
+    size_t inFlight = 0;
+    bool closing = false;
+
+    std::mutex mu;
+    std::condition_variable cv;     // 叫醒超时线程
+
+    State(SecureUdpSender& s, uint16_t id) : sender(s), stream(id) {}
+
+    // 持锁调用: 在窗口允许的范围内按顺序发出排队的请求
+    void pump() {
+        while (!queue.empty()) {
+            auto it = calls.find(queue.front());
+            if (it == calls.end()) {
+                queue.pop_front(); // 排队时已超时
+                continue;
+            }
+            Call& c = it->second;
+            // 剩余期限随请求发给服务端, 过期的请求在那边不再执行
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(c.deadline - Clock::now());
+            uint8_t head[RequestHeader::SIZE];
+            RequestHeader::encode(head, it->first, c.method,
+                                  static_cast<uint32_t>(std::max<int64_t>(left.count(), 1)));
+            uint32_t seq = sender.nextSequence(stream);
+            if (!sender.send(stream, head, sizeof(head),
+                             reinterpret_cast<const uint8_t*>(c.args.data()), c.args.size())) {
+                break; // 超长的请求在 call() 里就拒了, 这里只会是窗口满, 等 ACK
+            }
+            c.sent = true;
+            c.seq = seq;
+            std::string().swap(c.args);
+            inFlight++;
+            queue.pop_front();
+        }
+    }
+
+    // 持锁调用, 把调用从各表里摘掉, 返回它的回调
+    std::function<void(RpcResult)> take(std::unordered_map<uint64_t, Call>::iterator it) {
+        std::function<void(RpcResult)> done = std::move(it->second.done);
+        deadlines.erase(it->second.timer);
+        if (it->second.sent) inFlight--;
+        calls.erase(it);
+        return done;
+    }
+
+    void onResponse(const std::string& message) {
+        if (message.size() < ResponseHeader::SIZE) return;
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(message.data());
+        std::function<void(RpcResult)> done;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            auto it = calls.find(ResponseHeader::get<RESP_ID>(p));
+            if (it == calls.end()) return; // 已超时, 迟到的响应
+            done = take(it);
+        }
+        done(RpcResult{static_cast<RpcStatus>(ResponseHeader::get<RESP_STATUS>(p)),
+                       message.substr(ResponseHeader::SIZE)});
+    }
+
+    // 超时线程: 睡到最早的期限, 不轮询
+    void timerLoop() {
+        std::unique_lock<std::mutex> lock(mu);
+        while (!closing) {
+            if (deadlines.empty()) {
+                cv.wait(lock);
+                continue;
+            }
+            if (cv.wait_until(lock, deadlines.begin()->first) == std::cv_status::no_timeout) continue;
+
+            std::vector<std::pair<std::function<void(RpcResult)>, RpcStatus>> expired;
+            auto now = Clock::now();
+            while (!deadlines.empty() && deadlines.begin()->first <= now) {
+                auto it = calls.find(deadlines.begin()->second);
+                // 可靠层确认过请求, 说明服务端收到了只是没来得及回
+                bool delivered = it->second.sent && sender.acknowledged(stream, it->second.seq);
+                expired.emplace_back(take(it), delivered ? RpcStatus::Timeout : RpcStatus::Undelivered);
+            }
+            lock.unlock();
+            for (auto& e : expired) e.first(RpcResult{e.second, std::string()});
+            lock.lock();
+        }
+    }
+};
+
+RpcClient::RpcClient(SecureUdpSender& sender, SecureUdpReceiver& receiver,
+                     uint16_t responseStream, size_t window)
+    : sender_(sender), receiver_(receiver),
+      stream_(sender.openStream(false, window, Priority::Interactive)),
+      responseStream_(responseStream)
+{
+    state_ = std::make_shared<State>(sender_, stream_);
+    std::weak_ptr<State> weak = state_;
+    sender_.onWindowOpen(stream_, [weak] {
+        if (auto state = weak.lock()) {
+            std::lock_guard<std::mutex> lock(state->mu);
+            state->pump();
+        }
+    });
+    std::shared_ptr<State> state = state_;
+    receiver_.setStreamHandler(responseStream_, [state](const std::string& message) {
+        state->onResponse(message);
+    });
+    timerThread_ = std::thread([state] { state->timerLoop(); });
+}
+
+RpcClient::~RpcClient() {
+    receiver_.setStreamHandler(responseStream_, nullptr);
+    sender_.onWindowOpen(stream_, nullptr);
+    std::vector<std::function<void(RpcResult)>> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(state_->mu);
+        state_->closing = true;
+        state_->cv.notify_all();
+    }
+    timerThread_.join();
+    {
+        std::lock_guard<std::mutex> lock(state_->mu);
+        while (!state_->calls.empty()) cancelled.push_back(state_->take(state_->calls.begin()));
+        state_->queue.clear();
+    }
+    for (auto& done : cancelled) done(RpcResult{RpcStatus::Cancelled, std::string()});
+}
+
+void RpcClient::call(uint16_t method, const std::string& args, std::chrono::milliseconds deadline,
+                     std::function<void(RpcResult)> done) {
+    // 发不出的请求不能进队列, 否则它永远排在队头, 后面的调用全被挡住
+    if (RequestHeader::SIZE + args.size() > sender_.maxMessage()) {
+        done(RpcResult{RpcStatus::TooLarge, std::string()});
+        return;
+    }
+    State& st = *state_;
+    std::lock_guard<std::mutex> lock(st.mu);
+    uint64_t id = st.nextId++;
+    State::Call& c = st.calls[id];
+    c.method = method;
+    c.args = args;
+    c.done = std::move(done);
+    c.deadline = State::Clock::now() + deadline;
+    c.timer = st.deadlines.emplace(c.deadline, id);
+    // 新的期限比原来最早的还早时要叫醒超时线程重新定时
+    if (c.timer == st.deadlines.begin()) st.cv.notify_all();
+    st.queue.push_back(id);
+    st.pump();
+}
+
+std::future<RpcResult> RpcClient::call(uint16_t method, const std::string& args,
+                                       std::chrono::milliseconds deadline) {
+    auto promise = std::make_shared<std::promise<RpcResult>>();
+    std::future<RpcResult> result = promise->get_future();
+    call(method, args, deadline, [promise](RpcResult r) { promise->set_value(std::move(r)); });
+    return result;
+}
+
+size_t RpcClient::inFlight() const {
+    std::lock_guard<std::mutex> lock(state_->mu);
+    return state_->inFlight;
+}
+
+// ---------------- 服务端 ----------------
+
+struct RpcServer::State {
+    struct Request {
+        uint64_t id;
+        uint16_t method;
+        std::chrono::steady_clock::time_point deadline;
+        std::string args;
+    };
+
+    std::unordered_map<uint16_t, Handler> handlers;
+    std::deque<Request> queue;
+    bool stopping = false;
+    uint64_t expired = 0;
+    std::mutex mu;
+    std::condition_variable cv;         // 叫醒处理线程
+
+    // 响应流窗口满时处理线程在这里等 ACK
+    std::mutex windowMu;
+    std::condition_variable windowCv;
+};
+
+RpcServer::RpcServer(SecureUdpReceiver& receiver, SecureUdpSender& sender, uint16_t requestStream,
+                     size_t workers, size_t window)
+    : receiver_(receiver), sender_(sender), requestStream_(requestStream),
+      stream_(sender.openStream(false, window, Priority::Interactive)),
+      state_(std::make_shared<State>())
+{
+    if (workers == 0) {
+        throw std::runtime_error("RPC server needs at least one worker");
+    }
+    std::weak_ptr<State> weak = state_;
+    sender_.onWindowOpen(stream_, [weak] {
+        if (auto state = weak.lock()) {
+            std::lock_guard<std::mutex> lock(state->windowMu);
+            state->windowCv.notify_all();
+        }
+    });
+    std::shared_ptr<State> state = state_;
+    // 接收线程只解析和入队, 处理函数在线程池里跑, 慢调用不挡住后面的请求
+    receiver_.setStreamHandler(requestStream_, [state](const std::string& message) {
+        if (message.size() < RequestHeader::SIZE) return;
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(message.data());
+        State::Request req;
+        req.id = RequestHeader::get<REQ_ID>(p);
+        req.method = RequestHeader::get<REQ_METHOD>(p);
+        req.deadline = std::chrono::steady_clock::now() +
+                       std::chrono::milliseconds(RequestHeader::get<REQ_BUDGET>(p));
+        req.args = message.substr(RequestHeader::SIZE);
+        std::lock_guard<std::mutex> lock(state->mu);
+        state->queue.push_back(std::move(req));
+        state->cv.notify_one();
+    });
+    for (size_t i = 0; i < workers; i++) {
+        workers_.emplace_back(&RpcServer::workerFunc, this);
+    }
+}
+
+RpcServer::~RpcServer() {
+    stop();
+}
+
+void RpcServer::handle(uint16_t method, Handler handler) {
+    std::lock_guard<std::mutex> lock(state_->mu);
+    if (handler) {
+        state_->handlers[method] = std::move(handler);
+    } else {
+        state_->handlers.erase(method);
+    }
+}
+
+void RpcServer::stop() {
+    if (workers_.empty()) return;
+    receiver_.setStreamHandler(requestStream_, nullptr);
+    {
+        std::lock_guard<std::mutex> lock(state_->mu);
+        state_->stopping = true;
+        state_->cv.notify_all();
+    }
+    for (auto& t : workers_) t.join();
+    workers_.clear();
+    sender_.onWindowOpen(stream_, nullptr);
+}
+
+uint64_t RpcServer::expired() const {
+    std::lock_guard<std::mutex> lock(state_->mu);
+    return state_->expired;
+}
+
+void RpcServer::workerFunc() {
+    State& st = *state_;
+    while (true) {
+        State::Request req;
+        Handler handler;
+        {
+            std::unique_lock<std::mutex> lock(st.mu);
+            st.cv.wait(lock, [&st] { return st.stopping || !st.queue.empty(); });
+            if (st.stopping) return;
+            req = std::move(st.queue.front());
+            st.queue.pop_front();
+            // 客户端已经放弃的调用不再执行
+            if (std::chrono::steady_clock::now() >= req.deadline) {
+                st.expired++;
+                continue;
+            }
+            auto it = st.handlers.find(req.method);
+            if (it != st.handlers.end()) handler = it->second;
+        }
+
+        RpcStatus status = RpcStatus::Ok;
+        std::string body;
+        if (!handler) {
+            status = RpcStatus::NoMethod;
+        } else {
+            try {
+                body = handler(req.args);
+            } catch (const std::exception& e) {
+                status = RpcStatus::Error;
+                body = e.what();
+            } catch (...) {
+                status = RpcStatus::Error;
+            }
+        }
+
+        // 超长的结果发不出去, 改回一个 TooLarge, 客户端不必等到超时
+        if (ResponseHeader::SIZE + body.size() > sender_.maxMessage()) {
+            status = RpcStatus::TooLarge;
+            body.clear();
+        }
+        uint8_t head[ResponseHeader::SIZE];
+        ResponseHeader::encode(head, req.id, static_cast<uint8_t>(status));
+        while (!sender_.send(stream_, head, sizeof(head),
+                             reinterpret_cast<const uint8_t*>(body.data()), body.size())) {
+            // 窗口满就等 ACK, 但不超过调用的期限
+            if (std::chrono::steady_clock::now() >= req.deadline) {
+                std::lock_guard<std::mutex> lock(st.mu);
+                st.expired++;
+                break;
+            }
+            std::unique_lock<std::mutex> lock(st.windowMu);
+            st.windowCv.wait_for(lock, WINDOW_POLL);
+        }
+    }
+}
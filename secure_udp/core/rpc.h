@@ -0,0 +1,105 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "receiver.h"
+#include "sender.h"
+
+// 请求/响应式 RPC, 建在一对可靠乱序流上: 客户端的请求流、服务端的响应流。
+// 每个请求带 64 位关联号, 响应按关联号配对, 同一会话里可以有任意多个调用在途,
+// 吞吐随流水线深度增长而不是受 RTT 限制。两端的流ID要一致, 同 ByteStream。
+//
+// 请求: [CALL_ID(8B)][METHOD(2B)][BUDGET_MS(4B)][参数]
+// 响应: [CALL_ID(8B)][STATUS(1B)][结果或错误信息]
+
+enum class RpcStatus : uint8_t {
+    Ok = 0,
+    Error = 1,          // 处理函数抛了异常, body 是异常信息
+    NoMethod = 2,
+    Timeout = 3,        // 请求已被对端确认收到, 但期限内没等到响应
+    Undelivered = 4,    // 期限内请求没能发出或没被确认, 服务端多半没见过它
+    Cancelled = 5,      // 客户端析构时还没完成的调用
+    TooLarge = 6,       // 请求或响应超过一个消息的上限, 没有发出
+};
+
+struct RpcResult {
+    RpcStatus status;
+    std::string body;
+};
+
+class RpcClient {
+public:
+    static constexpr std::chrono::milliseconds DEFAULT_DEADLINE{1000};
+    // 请求流的窗口就是最多同时在途的请求数, 超出的在本地排队
+    static constexpr size_t DEFAULT_WINDOW = 1024;
+
+    // 在 sender 上打开请求流; 响应从 receiver 的 responseStream 上来
+    RpcClient(SecureUdpSender& sender, SecureUdpReceiver& receiver,
+              uint16_t responseStream = 1, size_t window = DEFAULT_WINDOW);
+    ~RpcClient();
+
+    RpcClient(const RpcClient&) = delete;
+    RpcClient& operator=(const RpcClient&) = delete;
+
+    uint16_t requestStream() const { return stream_; }
+
+    // done 在接收线程 (收到响应) 或超时线程上回调, 每个调用恰好一次;
+    // 请求超过发送端的消息上限时在调用线程上立即以 TooLarge 回调
+    void call(uint16_t method, const std::string& args, std::chrono::milliseconds deadline,
+              std::function<void(RpcResult)> done);
+    std::future<RpcResult> call(uint16_t method, const std::string& args,
+                                std::chrono::milliseconds deadline = DEFAULT_DEADLINE);
+
+    // 已发出还没有结果的调用数, 不含本地排队的
+    size_t inFlight() const;
+
+private:
+    struct State;
+
+    SecureUdpSender& sender_;
+    SecureUdpReceiver& receiver_;
+    uint16_t stream_;
+    uint16_t responseStream_;
+    std::shared_ptr<State> state_;
+    std::thread timerThread_;
+};
+
+class RpcServer {
+public:
+    // 返回值作为响应体; 抛出的异常变成 RpcStatus::Error
+    using Handler = std::function<std::string(const std::string& args)>;
+    static constexpr size_t DEFAULT_WORKERS = 4;
+
+    // 在 sender 上打开响应流; 请求从 receiver 的 requestStream 上来
+    RpcServer(SecureUdpReceiver& receiver, SecureUdpSender& sender, uint16_t requestStream = 1,
+              size_t workers = DEFAULT_WORKERS, size_t window = RpcClient::DEFAULT_WINDOW);
+    ~RpcServer();
+
+    RpcServer(const RpcServer&) = delete;
+    RpcServer& operator=(const RpcServer&) = delete;
+
+    uint16_t responseStream() const { return stream_; }
+
+    void handle(uint16_t method, Handler handler);
+    void stop();
+
+    // 轮到处理时客户端期限已过、没有执行就丢掉的请求数
+    uint64_t expired() const;
+
+private:
+    struct State;
+
+    void workerFunc();
+
+    SecureUdpReceiver& receiver_;
+    SecureUdpSender& sender_;
+    uint16_t requestStream_;
+    uint16_t stream_;
+    std::shared_ptr<State> state_;
+    std::vector<std::thread> workers_;
+};
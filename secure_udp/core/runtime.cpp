@@ -0,0 +1,321 @@
+#include "runtime.h"
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+
+EventLoop::EventLoop(Runtime* runtime, int index)
+    : runtime_(runtime), index_(index), nextTimerId_(1),
+      sessions_(0), idle_(false), running_(true)
+{
+    epfd_ = epoll_create1(0);
+    if (epfd_ < 0) {
+        perror("epoll_create1");
+        throw std::runtime_error("Failed to create epoll");
+    }
+
+    wakeFd_ = eventfd(0, EFD_NONBLOCK);
+    if (wakeFd_ < 0) {
+        perror("eventfd");
+        close(epfd_);
+        throw std::runtime_error("Failed to create eventfd");
+    }
+
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wakeFd_;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, wakeFd_, &ev);
+
+    thread_ = std::thread(&EventLoop::run, this);
+
+    // 每个循环线程固定在一个核上
+    unsigned cpus = std::thread::hardware_concurrency();
+    if (cpus > 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(index_ % cpus, &set);
+        if (pthread_setaffinity_np(thread_.native_handle(), sizeof(set), &set) != 0) {
+            std::cerr << "Failed to pin event loop " << index_ << "\n";
+        }
+    }
+}
+
+EventLoop::~EventLoop() {
+    running_ = false;
+    wakeup();
+    if (thread_.joinable()) thread_.join();
+    close(wakeFd_);
+    close(epfd_);
+}
+
+void EventLoop::wakeup() {
+    uint64_t one = 1;
+    (void)write(wakeFd_, &one, sizeof(one));
+}
+
+void EventLoop::runQueued() {
+    while (runQueuedOnce()) {}
+}
+
+// 跑一轮排着的任务, 没有任务时返回 false
+bool EventLoop::runQueuedOnce() {
+    std::deque<Task> tasks;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        tasks.swap(pinnedTasks_);
+        for (auto& task : stealableTasks_) tasks.push_back(std::move(task));
+        stealableTasks_.clear();
+    }
+    for (auto& task : tasks) task();
+    return !tasks.empty();
+}
+
+void EventLoop::runInLoop(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        pinnedTasks_.push_back(std::move(task));
+    }
+    wakeup();
+}
+
+void EventLoop::runSync(Task task) {
+    if (inLoopThread() || !running_) {
+        task();
+        return;
+    }
+    std::promise<void> done;
+    runInLoop([&] {
+        task();
+        done.set_value();
+    });
+    done.get_future().wait();
+}
+
+void EventLoop::post(Task task) {
+    size_t backlog;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stealableTasks_.push_back(std::move(task));
+        backlog = stealableTasks_.size();
+    }
+    wakeup();
+    if (backlog > 1 && runtime_->workStealing()) runtime_->wakeIdle(this);
+}
+
+bool EventLoop::stealOne(Task& task, bool fromBack) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (stealableTasks_.empty()) return false;
+    // 别的循环从尾部偷, 尽量不和本循环从头部取任务冲突
+    if (fromBack) {
+        task = std::move(stealableTasks_.back());
+        stealableTasks_.pop_back();
+    } else {
+        task = std::move(stealableTasks_.front());
+        stealableTasks_.pop_front();
+    }
+    return true;
+}
+
+void EventLoop::addFd(int fd, Task onReadable) {
+    runSync([this, fd, &onReadable] {
+        handlers_[fd] = std::make_shared<Task>(std::move(onReadable));
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) perror("epoll_ctl");
+    });
+}
+
+void EventLoop::removeFd(int fd) {
+    runSync([this, fd] {
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+        handlers_.erase(fd);
+    });
+}
+
+uint64_t EventLoop::addTimer(std::chrono::milliseconds interval, Task fn) {
+    uint64_t id = 0;
+    runSync([&] {
+        id = nextTimerId_++;
+        liveTimers_.insert(id);
+        timers_.emplace(std::chrono::steady_clock::now() + interval, Timer{id, interval, std::move(fn)});
+    });
+    return id;
+}
+
+void EventLoop::cancelTimer(uint64_t id) {
+    runSync([this, id] {
+        liveTimers_.erase(id);
+        for (auto it = timers_.begin(); it != timers_.end(); ++it) {
+            if (it->second.id == id) {
+                timers_.erase(it);
+                break;
+            }
+        }
+    });
+}
+
+int EventLoop::nextTimeoutMs() {
+    if (timers_.empty()) return -1;
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        timers_.begin()->first - std::chrono::steady_clock::now()).count();
+    return left < 0 ? 0 : static_cast<int>(left);
+}
+
+void EventLoop::runTimers() {
+    auto now = std::chrono::steady_clock::now();
+    while (!timers_.empty() && timers_.begin()->first <= now) {
+        Timer timer = std::move(timers_.begin()->second);
+        timers_.erase(timers_.begin());
+        timer.fn();
+        // 回调里可能取消了自己
+        if (liveTimers_.count(timer.id)) {
+            timers_.emplace(now + timer.interval, std::move(timer));
+        }
+    }
+}
+
+void EventLoop::run() {
+    std::vector<struct epoll_event> events(64);
+    std::deque<Task> pinned;
+
+    while (running_) {
+        bool haveWork;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            haveWork = !pinnedTasks_.empty() || !stealableTasks_.empty();
+        }
+
+        idle_ = !haveWork;
+        int n = epoll_wait(epfd_, events.data(), static_cast<int>(events.size()),
+                           haveWork ? 0 : nextTimeoutMs());
+        idle_ = false;
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wakeFd_) {
+                uint64_t v;
+                (void)read(wakeFd_, &v, sizeof(v));
+                continue;
+            }
+            auto it = handlers_.find(fd);
+            if (it == handlers_.end()) continue;
+            // 持有一份引用, 处理函数里 removeFd 自己也安全
+            std::shared_ptr<Task> handler = it->second;
+            (*handler)();
+        }
+
+        runTimers();
+
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            pinned.swap(pinnedTasks_);
+        }
+        for (auto& task : pinned) task();
+        pinned.clear();
+
+        // 可偷任务逐个从头部取, 其余的留在队列里供空闲循环从尾部偷
+        size_t ran = 0;
+        Task task;
+        while (ran < events.size() && stealOne(task, false)) {
+            task();
+            ++ran;
+        }
+
+        // 自己没活时去最忙的循环偷一个任务
+        if (ran == 0 && runtime_->workStealing() && runtime_->steal(this, task)) task();
+    }
+
+    // 退出前跑完排着的任务: 投递方可能在等它们 (runSync 的 promise、接收端的解密计数)
+    runQueued();
+}
+
+Runtime::Runtime(size_t threads, bool workStealing)
+    : workStealing_(workStealing), stopped_(false)
+{
+    if (threads == 0) threads = 1;
+    loops_.reserve(threads);
+    for (size_t i = 0; i < threads; i++) {
+        loops_.push_back(std::make_unique<EventLoop>(this, static_cast<int>(i)));
+    }
+}
+
+Runtime::~Runtime() {
+    stop();
+}
+
+void Runtime::stop() {
+    {
+        std::unique_lock<std::mutex> lock(mu_);
+        if (stopped_) return;
+        for (auto& loop : loops_) {
+            if (loop->inLoopThread()) throw std::runtime_error("Runtime stopped from its own event loop");
+        }
+        // 会话还拿着循环的指针, 循环释放前要等它们都 stop
+        released_.wait(lock, [this] {
+            for (auto& loop : loops_) {
+                if (loop->sessions() > 0) return false;
+            }
+            return true;
+        });
+        stopped_ = true;
+    }
+
+    // 先停掉全部线程再析构, 避免还在偷任务的循环访问已释放的兄弟
+    for (auto& loop : loops_) {
+        loop->running_ = false;
+        loop->wakeup();
+    }
+    for (auto& loop : loops_) {
+        if (loop->thread_.joinable()) loop->thread_.join();
+    }
+    loops_.clear();
+}
+
+EventLoop& Runtime::place() {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (stopped_) throw std::runtime_error("Runtime already stopped");
+    EventLoop* best = loops_.front().get();
+    for (auto& loop : loops_) {
+        if (loop->sessions() < best->sessions()) best = loop.get();
+    }
+    best->sessions_++;
+    return *best;
+}
+
+void Runtime::release(EventLoop& loop) {
+    std::lock_guard<std::mutex> lock(mu_);
+    loop.sessions_--;
+    released_.notify_all();
+}
+
+void Runtime::wakeIdle(const EventLoop* except) {
+    for (auto& loop : loops_) {
+        if (loop.get() != except && loop->idle_) {
+            loop->wakeup();
+            return;
+        }
+    }
+}
+
+bool Runtime::steal(const EventLoop* thief, EventLoop::Task& task) {
+    EventLoop* victim = nullptr;
+    size_t most = 1;
+    for (auto& loop : loops_) {
+        if (loop.get() == thief) continue;
+        std::lock_guard<std::mutex> lock(loop->mu_);
+        if (loop->stealableTasks_.size() > most) {
+            most = loop->stealableTasks_.size();
+            victim = loop.get();
+        }
+    }
+    return victim && victim->stealOne(task, true);
+}
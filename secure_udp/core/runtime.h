@@ -0,0 +1,106 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class Runtime;
+
+// 单线程事件循环, 绑定到一个 CPU 核上, 负责所挂会话的 socket 读事件、定时器和任务队列。
+class EventLoop {
+public:
+    using Task = std::function<void()>;
+
+    EventLoop(Runtime* runtime, int index);
+    ~EventLoop();
+
+    // 以下注册接口可在任意线程调用, 返回时已在循环线程中生效
+    void addFd(int fd, Task onReadable);
+    void removeFd(int fd);
+    uint64_t addTimer(std::chrono::milliseconds interval, Task fn);
+    void cancelTimer(uint64_t id);
+
+    // runInLoop 的任务固定在本循环执行; post 的任务在开启 work stealing 时可被空闲循环偷走
+    void runInLoop(Task task);
+    void runSync(Task task);
+    void post(Task task);
+    // 只能在本循环线程调用: 就地跑完排着的任务, 供要在循环线程里等这些任务的场合用
+    void runQueued();
+
+    bool inLoopThread() const { return std::this_thread::get_id() == thread_.get_id(); }
+    size_t sessions() const { return sessions_.load(); }
+
+private:
+    friend class Runtime;
+
+    struct Timer {
+        uint64_t id;
+        std::chrono::milliseconds interval;
+        Task fn;
+    };
+
+    void run();
+    bool runQueuedOnce();
+    void wakeup();
+    bool stealOne(Task& task, bool fromBack);
+    int nextTimeoutMs();
+    void runTimers();
+
+    Runtime* runtime_;
+    int index_;
+    int epfd_;
+    int wakeFd_;
+
+    std::mutex mu_;
+    std::deque<Task> pinnedTasks_;
+    std::deque<Task> stealableTasks_;
+
+    // 只在循环线程内访问
+    std::unordered_map<int, std::shared_ptr<Task>> handlers_;
+    std::multimap<std::chrono::steady_clock::time_point, Timer> timers_;
+    std::unordered_set<uint64_t> liveTimers_;
+    uint64_t nextTimerId_;
+
+    std::atomic<size_t> sessions_;
+    std::atomic<bool> idle_;
+    std::atomic<bool> running_;
+    std::thread thread_;
+};
+
+// 每核一个事件循环的共享运行时。会话按负载放到最空闲的核上, 可选 work stealing。
+class Runtime {
+public:
+    explicit Runtime(size_t threads = std::thread::hardware_concurrency(), bool workStealing = false);
+    ~Runtime();
+
+    // stop() 之后再 place() 抛出
+    EventLoop& place();
+    void release(EventLoop& loop);
+    // 等所有会话都 release 后再停掉循环, 排着的任务在循环退出前跑完。
+    // 在循环线程里调用会等到自己, 抛出
+    void stop();
+
+    bool workStealing() const { return workStealing_; }
+
+private:
+    friend class EventLoop;
+
+    void wakeIdle(const EventLoop* except);
+    bool steal(const EventLoop* thief, EventLoop::Task& task);
+
+    bool workStealing_;
+    std::vector<std::unique_ptr<EventLoop>> loops_;
+
+    std::mutex mu_;
+    std::condition_variable released_;
+    bool stopped_;
+};
@@ -0,0 +1,53 @@
+#include "scheduler.h"
+
+SendScheduler::SendScheduler(Mode mode)
+    : mode_(mode), weights_{8, 4, 2, 1}, deficit_{}, current_(0), turnStarted_(false) {}
+
+void SendScheduler::push(Priority priority, uint64_t key, size_t bytes) {
+    queues_[static_cast<size_t>(priority)].push_back(Item{key, bytes});
+}
+
+bool SendScheduler::empty() const {
+    for (auto& q : queues_) {
+        if (!q.empty()) return false;
+    }
+    return true;
+}
+
+bool SendScheduler::pop(uint64_t& key) {
+    if (mode_ == Mode::StrictPriority) {
+        for (auto& q : queues_) {
+            if (q.empty()) continue;
+            key = q.front().key;
+            q.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    if (empty()) return false;
+
+    // DRR: 每轮进入一个级别时补一个份额, deficit 够发队头就发, 不够就轮到下一级
+    while (true) {
+        auto& q = queues_[current_];
+        if (!q.empty() && !turnStarted_) {
+            deficit_[current_] += weights_[current_] * QUANTUM;
+            turnStarted_ = true;
+        }
+        if (!q.empty() && q.front().bytes <= deficit_[current_]) {
+            deficit_[current_] -= q.front().bytes;
+            key = q.front().key;
+            q.pop_front();
+            if (q.empty()) deficit_[current_] = 0;
+            return true;
+        }
+        if (q.empty()) deficit_[current_] = 0;
+        current_ = (current_ + 1) % PRIORITY_LEVELS;
+        turnStarted_ = false;
+    }
+}
+
+void SendScheduler::setWeights(const std::array<uint32_t, PRIORITY_LEVELS>& weights) {
+    // 权重为 0 的级别会永远发不出去, 至少给 1
+    for (size_t i = 0; i < PRIORITY_LEVELS; i++) weights_[i] = weights[i] ? weights[i] : 1;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+enum class Priority : uint8_t {
+    Control = 0,    // 心跳、控制面
+    Interactive,
+    Normal,
+    Bulk,           // 文件块等大流量
+};
+
+static constexpr size_t PRIORITY_LEVELS = 4;
+
+// 发送队列调度器: 严格优先级, 或按权重的 deficit round robin。
+// 本身不加锁, 由 SecureUdpSender 在自己的锁内调用。
+class SendScheduler {
+public:
+    enum class Mode { StrictPriority, DeficitRoundRobin };
+
+    explicit SendScheduler(Mode mode = Mode::StrictPriority);
+
+    void setMode(Mode mode) { mode_ = mode; }
+    // DRR 下每轮各级别可发的字节数 = 权重 * QUANTUM
+    void setWeights(const std::array<uint32_t, PRIORITY_LEVELS>& weights);
+
+    void push(Priority priority, uint64_t key, size_t bytes);
+    bool pop(uint64_t& key);
+    bool empty() const;
+
+private:
+    static constexpr size_t QUANTUM = 1500;
+
+    struct Item {
+        uint64_t key;
+        size_t bytes;
+    };
+
+    Mode mode_;
+    std::array<std::deque<Item>, PRIORITY_LEVELS> queues_;
+    std::array<uint32_t, PRIORITY_LEVELS> weights_;
+    std::array<size_t, PRIORITY_LEVELS> deficit_;
+    size_t current_;
+    bool turnStarted_;
+};
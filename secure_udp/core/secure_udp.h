@@ -0,0 +1,243 @@
+#pragma once
+#include "codec.h"
+#include "policies.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <set>
+#include <string_view>
+#include <utility>
+
+// 编译期组合的 SecureUdp 核心。加密、可靠性、传输和消息处理都是模板参数,
+// 热路径上没有 std::function 和虚调用, handler 可以直接内联进接收循环。
+// 这是一套独立的小协议, 线上格式和 ::SecureUdpSender / ::SecureUdpReceiver (wire.h) 不同,
+// 两者不能互通: 收发两端都要用这里的模板, 并选同样的 Cipher 和 Reliability。
+namespace secure_udp {
+
+// 包格式: [SEQ(4B)][TIMESTAMP(8B)][NONCE][CIPHERTEXT][TAG], NONCE/TAG 长度由 Cipher 决定。
+// 明文包头作为 AAD 参与认证, 改过 SEQ 的包解不开, 不会顶掉真包的去重位置
+using PacketHeader = wire::Layout<wire::Field<uint32_t>, wire::Field<uint64_t>>;
+static constexpr size_t HEADER_LEN = PacketHeader::SIZE;
+// 可靠模式下接收端回的累计 ACK: [NONCE][CUMULATIVE(4B) 的密文][TAG], 发送端认证后才用
+using AckBody = wire::Layout<wire::Field<uint32_t>>;
+
+// 接收端去重窗口。发送端未确认的包不超过这么多, 接收端因此不会越过还在重传的缺口
+static constexpr uint32_t DEDUP_WINDOW = 4096;
+
+template <typename Cipher>
+constexpr size_t ackLength() { return Cipher::NONCE_LEN + AckBody::SIZE + Cipher::TAG_LEN; }
+
+// MaxDatagram 是收发缓冲 (都在栈上) 的大小, 两端要一致, 见 transport.h
+template <typename Cipher, typename Reliability, typename Transport,
+          size_t MaxDatagram = DEFAULT_MAX_DATAGRAM>
+class SecureUdpSender {
+public:
+    static_assert(MaxDatagram <= MAX_UDP_DATAGRAM, "datagram larger than UDP allows");
+
+    SecureUdpSender(Cipher cipher, Transport transport)
+        : cipher_(std::move(cipher)), transport_(std::move(transport)), seq_(0), acked_(0) {}
+
+    static constexpr size_t MAX_PAYLOAD = MaxDatagram - HEADER_LEN - Cipher::NONCE_LEN - Cipher::TAG_LEN;
+
+    // 可靠模式下未确认的包满了 DEDUP_WINDOW 个时返回 false, 等 retransmit() 收到 ACK 再发
+    bool send(const void* data, size_t len) {
+        if (len > MAX_PAYLOAD) return false;
+
+        uint32_t currentSeq;
+        if constexpr (Reliability::ENABLED) {
+            if (!reserveSeq(currentSeq)) {
+                pollAcks();
+                if (!reserveSeq(currentSeq)) return false;
+            }
+        } else {
+            currentSeq = seq_.fetch_add(1, std::memory_order_relaxed);
+        }
+        uint64_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+
+        uint8_t packet[MaxDatagram];
+        PacketHeader::encode(packet, currentSeq, timestamp);
+        size_t offset = HEADER_LEN;
+
+        uint8_t* nonce = packet + offset;
+        cipher_.nonce(nonce);
+        offset += Cipher::NONCE_LEN;
+
+        if (!cipher_.encrypt(nonce, packet, HEADER_LEN, static_cast<const uint8_t*>(data), len,
+                             packet + offset, packet + offset + len)) {
+            return false;
+        }
+        offset += len + Cipher::TAG_LEN;
+
+        if constexpr (Reliability::ENABLED) {
+            reliability_.store(currentSeq, packet, offset);
+        }
+        return transport_.send(packet, offset);
+    }
+
+    bool send(std::string_view data) { return send(data.data(), data.size()); }
+
+    // 可靠模式下由调用方 (线程或 Runtime 定时器) 周期性调用: 先收对端的 ACK, 再重发还没确认的包
+    void retransmit() {
+        if constexpr (Reliability::ENABLED) {
+            pollAcks();
+            reliability_.forEachUnacked([this](const uint8_t* packet, size_t len) {
+                transport_.send(packet, len);
+            });
+        }
+    }
+
+    // 不等待地读完已到的 ACK, 认证不过的丢掉
+    void pollAcks() {
+        if constexpr (Reliability::ENABLED) {
+            uint8_t buf[ackLength<Cipher>()];
+            ssize_t len;
+            while ((len = transport_.recv(buf, sizeof(buf), 0)) > 0) {
+                if (static_cast<size_t>(len) != sizeof(buf)) continue;
+                uint8_t body[AckBody::SIZE];
+                const uint8_t* cipher = buf + Cipher::NONCE_LEN;
+                if (!cipher_.decrypt(buf, nullptr, 0, cipher, AckBody::SIZE, cipher + AckBody::SIZE, body)) continue;
+                ack(AckBody::get<0>(body));
+            }
+        }
+    }
+
+    void ack(uint32_t seq) {
+        if constexpr (Reliability::ENABLED) {
+            // 只前进, 不超过已分配的序号; 按回绕比较
+            uint32_t acked = acked_.load(std::memory_order_relaxed);
+            do {
+                if (static_cast<int32_t>(seq - acked) <= 0 ||
+                    static_cast<int32_t>(seq_.load(std::memory_order_relaxed) - seq) < 0) {
+                    return;
+                }
+            } while (!acked_.compare_exchange_weak(acked, seq, std::memory_order_relaxed));
+            reliability_.ack(seq);
+        }
+    }
+
+    Transport& transport() { return transport_; }
+
+private:
+    // 未确认的不到 DEDUP_WINDOW 个才分配下一个序号, 多线程并发发送也不会超
+    bool reserveSeq(uint32_t& seq) {
+        uint32_t next = seq_.load(std::memory_order_relaxed);
+        do {
+            if (next - acked_.load(std::memory_order_relaxed) >= DEDUP_WINDOW) return false;
+        } while (!seq_.compare_exchange_weak(next, next + 1, std::memory_order_relaxed));
+        seq = next;
+        return true;
+    }
+
+    Cipher cipher_;
+    Transport transport_;
+    Reliability reliability_;
+    std::atomic<uint32_t> seq_;
+    std::atomic<uint32_t> acked_;   // 对端累计确认到的序号, 只在可靠模式下用
+};
+
+// Handler 签名: void(std::string_view plaintext)。
+// Reliability 和发送端一致: 启用时每个包回一个累计 ACK 给来源地址, 并按序号去重,
+// 重传来的包不会交付两次。这套格式没有会话号, 也不防重放 (TIMESTAMP 不检查)
+template <typename Cipher, typename Transport, typename Handler,
+          typename Reliability = NoReliability, size_t MaxDatagram = DEFAULT_MAX_DATAGRAM>
+class SecureUdpReceiver {
+public:
+    static_assert(MaxDatagram <= MAX_UDP_DATAGRAM, "datagram larger than UDP allows");
+
+    SecureUdpReceiver(Cipher cipher, Transport transport, Handler handler)
+        : cipher_(std::move(cipher)), transport_(std::move(transport)), handler_(std::move(handler)),
+          nextExpected_(0) {}
+    SecureUdpReceiver(Cipher cipher, Transport transport, Handler handler, Reliability)
+        : SecureUdpReceiver(std::move(cipher), std::move(transport), std::move(handler)) {}
+
+    // 解一个数据报并交给 handler, 明文直接解到栈上缓冲区
+    bool processDatagram(const uint8_t* data, size_t len) {
+        if (len < HEADER_LEN + Cipher::NONCE_LEN + Cipher::TAG_LEN) return false;
+        if (len > MaxDatagram) return false;
+
+        const uint8_t* nonce = data + HEADER_LEN;
+        const uint8_t* cipher = nonce + Cipher::NONCE_LEN;
+        size_t cipherLen = len - HEADER_LEN - Cipher::NONCE_LEN - Cipher::TAG_LEN;
+
+        uint8_t plaintext[MaxDatagram];
+        if (!cipher_.decrypt(nonce, data, HEADER_LEN, cipher, cipherLen, cipher + cipherLen, plaintext)) {
+            return false;
+        }
+
+        // 重复的包也算处理成功, 照样回 ACK, 上一个 ACK 可能丢了
+        if (accept(PacketHeader::get<0>(data))) {
+            handler_(std::string_view(reinterpret_cast<const char*>(plaintext), cipherLen));
+        }
+        return true;
+    }
+
+    // 阻塞读一个数据报
+    bool pollOnce() {
+        uint8_t buffer[MaxDatagram];
+        struct sockaddr_in from{};
+        ssize_t len = transport_.recvFrom(buffer, sizeof(buffer), -1, &from);
+        if (len <= 0) return false;
+        if (!processDatagram(buffer, static_cast<size_t>(len))) return false;
+        if constexpr (Reliability::ENABLED) sendAck(from);
+        return true;
+    }
+
+    void run(const std::atomic<bool>& running) {
+        while (running.load(std::memory_order_relaxed)) pollOnce();
+    }
+
+    Transport& transport() { return transport_; }
+
+private:
+    // 第一次见到 seq 返回 true; 不可靠模式没有重传, 不去重
+    bool accept(uint32_t seq) {
+        if constexpr (!Reliability::ENABLED) return true;
+        int32_t diff = static_cast<int32_t>(seq - nextExpected_);
+        if (diff < -static_cast<int32_t>(DEDUP_WINDOW)) {
+            // 远落在窗口之后, 只能是发送端重启后序号从 0 重来
+            receivedAhead_.clear();
+            nextExpected_ = seq;
+        } else if (diff < 0) {
+            return false;
+        }
+        // 超前 nextExpected_ 这么多的包到了, 就不再等更早的缺口, 去重集合因此有界。
+        // 守约的发送端不会走到这里, 它的未确认包不超过 DEDUP_WINDOW 个
+        if (seq - nextExpected_ >= DEDUP_WINDOW) {
+            uint32_t before = seq - DEDUP_WINDOW + 1;
+            receivedAhead_.erase(receivedAhead_.begin(), receivedAhead_.lower_bound(before));
+            nextExpected_ = before;
+        }
+        if (seq != nextExpected_) return receivedAhead_.insert(seq).second;
+        ++nextExpected_;
+        while (!receivedAhead_.empty() && *receivedAhead_.begin() == nextExpected_) {
+            receivedAhead_.erase(receivedAhead_.begin());
+            ++nextExpected_;
+        }
+        return true;
+    }
+
+    void sendAck(const struct sockaddr_in& to) {
+        uint8_t body[AckBody::SIZE];
+        AckBody::encode(body, nextExpected_);
+        uint8_t ack[ackLength<Cipher>()];
+        cipher_.nonce(ack);
+        uint8_t* cipher = ack + Cipher::NONCE_LEN;
+        if (!cipher_.encrypt(ack, nullptr, 0, body, sizeof(body), cipher, cipher + AckBody::SIZE)) return;
+        transport_.sendTo(ack, sizeof(ack), to);
+    }
+
+    Cipher cipher_;
+    Transport transport_;
+    Handler handler_;
+    uint32_t nextExpected_;             // 之前的序号都已交付过, 即累计 ACK
+    std::set<uint32_t> receivedAhead_;  // nextExpected_ 之后交付过的序号
+};
+
+template <typename Cipher, typename Transport, typename Handler>
+SecureUdpReceiver(Cipher, Transport, Handler) -> SecureUdpReceiver<Cipher, Transport, Handler>;
+template <typename Cipher, typename Transport, typename Handler, typename Reliability>
+SecureUdpReceiver(Cipher, Transport, Handler, Reliability)
+    -> SecureUdpReceiver<Cipher, Transport, Handler, Reliability>;
+
+} // namespace secure_udp
@@ -1,111 +1,757 @@
 #include "sender.h"
 #include "../config/config.h"
 #include "../crypto/aes_gcm.h"
-#include <arpa/inet.h>
-#include <sys/socket.h>
+#include "runtime.h"
+#include "shm_transport.h"
+#include "wire.h"
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <unistd.h>
 #include <chrono>
+#include <climits>
+#include <cstring>
 #include <iostream>
-#include <random>
+#include <algorithm>
 
-static std::vector<uint8_t> generateNonce() {
-    std::vector<uint8_t> nonce(12);
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<uint8_t> dis(0, 255);
-    for(auto &b : nonce) b = dis(gen);
-    return nonce;
+static constexpr auto RETRANSMIT_INTERVAL = std::chrono::milliseconds(100);
+// 不满的 FEC 组最多等这么久就出修复包, 远小于重传间隔
+static constexpr auto FEC_FLUSH_DELAY = std::chrono::milliseconds(10);
+// 多久检查一次有没有到期要重传的包
+static constexpr int RETRANSMIT_CHECK_MS = 20;
+// 有包在途却这么久没有认证过的 ACK/NACK, 就当对端可能丢了会话状态 (比如重启过),
+// 新包改回长包头, 并定期发 SYNC
+static constexpr auto SESSION_PROBE_AFTER = 3 * RETRANSMIT_INTERVAL;
+
+static uint64_t packetKey(uint16_t stream, uint32_t seq) {
+    return (uint64_t(stream) << 32) | seq;
+}
+
+// 截断 PN 要覆盖的序号跨度: 对端见过的最大序号不超过 nextSeq - 1,
+// 对端累计确认不低于我们收到的 acked, 两个方向都要落在半窗口内
+static uint32_t packetNumberSpan(uint32_t nextSeq, uint32_t acked, uint32_t seq) {
+    return std::max(nextSeq - seq, seq - acked + 1);
 }
 
 SecureUdpSender::SecureUdpSender(const std::string& remoteIp, int remotePort)
-    : seq_(0), running_(true)
+    : SecureUdpSender(connectTransport(remoteIp, remotePort))
 {
-    sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd_ < 0) {
-        perror("socket");
-        throw std::runtime_error("Failed to create socket");
-    }
+}
 
-    remoteAddr_.sin_family = AF_INET;
-    remoteAddr_.sin_port = htons(remotePort);
-    inet_pton(AF_INET, remoteIp.c_str(), &remoteAddr_.sin_addr);
+SecureUdpSender::SecureUdpSender(Runtime& runtime, const std::string& remoteIp, int remotePort)
+    : SecureUdpSender(runtime, connectTransport(remoteIp, remotePort))
+{
+}
 
+SecureUdpSender::SecureUdpSender(std::unique_ptr<Transport> transport)
+    : transport_(std::move(transport)), session_(0), sessionConfirmed_(false), syncSeq_(0), timestamps_(false),
+      nextStreamId_(1), tos_{}, redundant_{}, compress_{}, ecn_(false), routed_(false), route_(0), maxDatagram_(DEFAULT_MAX_DATAGRAM), ceMarks_(0),
+      wakeFd_(-1), drainScheduled_(false), running_(true),
+      runtime_(nullptr), loop_(nullptr), retransmitTimer_(0)
+{
+    initSession();
+    wakeFd_ = eventfd(0, EFD_NONBLOCK);
+    if (wakeFd_ < 0) {
+        perror("eventfd");
+        throw std::runtime_error("Failed to create eventfd");
+    }
     sendThread_ = std::thread(&SecureUdpSender::sendThreadFunc, this);
 }
 
+SecureUdpSender::SecureUdpSender(Runtime& runtime, std::unique_ptr<Transport> transport)
+    : transport_(std::move(transport)), session_(0), sessionConfirmed_(false), syncSeq_(0), timestamps_(false),
+      nextStreamId_(1), tos_{}, redundant_{}, compress_{}, ecn_(false), routed_(false), route_(0), maxDatagram_(DEFAULT_MAX_DATAGRAM), ceMarks_(0),
+      wakeFd_(-1), drainScheduled_(false), running_(true),
+      runtime_(&runtime), loop_(nullptr), retransmitTimer_(0)
+{
+    initSession();
+    loop_ = &runtime.place();
+    if (transport_->fd() >= 0) {
+        loop_->addFd(transport_->fd(), [this] { pollAcks(0); });
+    }
+    retransmitTimer_ = loop_->addTimer(std::chrono::milliseconds(RETRANSMIT_CHECK_MS), [this] {
+        // 没有 fd 可挂的传输只能在定时器里顺带收 ACK
+        if (transport_->fd() < 0) pollAcks(0);
+        queueRetransmits();
+        drain();
+    });
+}
+
+void SecureUdpSender::initSession() {
+    if (!aes_gcm_init(ctx_, reinterpret_cast<const uint8_t*>(SHARED_KEY.data()), SHARED_KEY.size())) {
+        throw std::runtime_error("Invalid shared key");
+    }
+    // 每个发送端实例一个随机会话号, 隐式 NONCE 因此不会跨实例重复
+    uint8_t random[wire::NONCE_LEN];
+    aes_gcm_random_nonce(random);
+    session_ = 0;
+    for (size_t i = 0; i < wire::SESSION_LEN; i++) session_ |= uint64_t(random[i]) << (i * 8);
+    fec_.setFirstGroup(wire::loadLe<uint16_t>(random + wire::SESSION_LEN));
+    sessionStart_ = std::chrono::steady_clock::now();
+    lastFeedback_ = sessionStart_;
+    streams_[0] = StreamState{false, DEFAULT_STREAM_WINDOW, 0, 0, 0, Priority::Normal, nullptr};
+}
+
 SecureUdpSender::~SecureUdpSender() {
     stop();
+    if (wakeFd_ >= 0) close(wakeFd_);
+}
+
+uint16_t SecureUdpSender::openStream(bool ordered, size_t window, Priority priority) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (nextStreamId_ >= wire::SYNC_STREAM) {
+        throw std::runtime_error("Too many streams");
+    }
+    uint16_t id = nextStreamId_++;
+    streams_[id] = StreamState{ordered, window, 0, 0, 0, priority, nullptr};
+    return id;
+}
+
+uint16_t SecureUdpSender::openNackStream(std::chrono::milliseconds deadline, Priority priority) {
+    if (deadline.count() <= 0) {
+        throw std::runtime_error("NACK deadline must be positive");
+    }
+    std::lock_guard<std::mutex> lock(mu_);
+    if (nextStreamId_ >= wire::SYNC_STREAM) {
+        throw std::runtime_error("Too many streams");
+    }
+    uint16_t id = nextStreamId_++;
+    streams_[id] = StreamState{false, 0, 0, 0, 0, priority, nullptr, deadline};
+    return id;
+}
+
+void SecureUdpSender::setScheduler(SendScheduler::Mode mode,
+                                   const std::array<uint32_t, PRIORITY_LEVELS>& weights) {
+    std::lock_guard<std::mutex> lock(mu_);
+    scheduler_.setMode(mode);
+    scheduler_.setWeights(weights);
+}
+
+void SecureUdpSender::setFec(FecScheme scheme, size_t dataCount, size_t repairCount) {
+    std::lock_guard<std::mutex> lock(mu_);
+    fec_.configure(scheme, dataCount, repairCount);
+}
+
+void SecureUdpSender::setEcn(bool enabled) {
+    std::lock_guard<std::mutex> lock(mu_);
+    ecn_ = enabled;
+}
+
+void SecureUdpSender::setMaxDatagram(size_t bytes) {
+    if (bytes < wire::MAX_HEADER_LEN + wire::TAG_LEN || bytes > MAX_UDP_DATAGRAM) {
+        throw std::runtime_error("Invalid maximum datagram size");
+    }
+    std::lock_guard<std::mutex> lock(mu_);
+    maxDatagram_ = bytes;
+}
+
+// 持锁调用。按最长包头算, 重传时改写包头也不会超; 压缩只会变小。
+// 开了 FEC 时按修复包算: 它比最长的数据包多一个 LEN_PARITY
+size_t SecureUdpSender::messageLimit() const {
+    size_t tagLen = transport_->requiresEncryption() ? wire::TAG_LEN : 0;
+    size_t overhead = wire::MAX_HEADER_LEN + tagLen + (fec_.enabled() ? fec::PREFIX_LEN + fec::LEN_FIELD : 0);
+    return maxDatagram_ > overhead ? maxDatagram_ - overhead : 0;
+}
+
+size_t SecureUdpSender::maxMessage() {
+    std::lock_guard<std::mutex> lock(mu_);
+    return messageLimit();
+}
+
+void SecureUdpSender::setSessionStore(const std::shared_ptr<SequenceStore>& store) {
+    if (store->limit() > SESSION_SPACE) {
+        throw std::runtime_error("Session store limit exceeds the session field");
+    }
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto& p : streams_) {
+        if (p.second.nextSeq != 0) {
+            throw std::runtime_error("Session store must be set before the first send");
+        }
+    }
+    // 取号失败时保留原来的随机会话号
+    session_ = store->next();
+    sessionStart_ = std::chrono::steady_clock::now();
+}
+
+void SecureUdpSender::setRoute(uint32_t route) {
+    std::lock_guard<std::mutex> lock(mu_);
+    routed_ = true;
+    route_ = route;
+}
+
+void SecureUdpSender::setTimestamps(bool enabled) {
+    timestamps_ = enabled;
+}
+
+void SecureUdpSender::setScavenger(uint16_t stream, std::chrono::milliseconds target) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = streams_.find(stream);
+    if (it == streams_.end()) {
+        throw std::runtime_error("Unknown stream");
+    }
+    if (it->second.nackDeadline.count() > 0) {
+        throw std::runtime_error("NACK streams have no congestion window");
+    }
+    scavengers_.erase(stream);
+    scavengers_.emplace(stream, LedbatController(target, it->second.window));
+}
+
+void SecureUdpSender::setCompression(Priority priority, bool enabled) {
+    std::lock_guard<std::mutex> lock(mu_);
+    compress_[static_cast<size_t>(priority)] = enabled;
+}
+
+void SecureUdpSender::setCompressionDictionary(const std::string& dictionary) {
+    compressor_.setDictionary(dictionary);
+}
+
+void SecureUdpSender::setRedundant(Priority priority, bool redundant) {
+    std::lock_guard<std::mutex> lock(mu_);
+    redundant_[static_cast<size_t>(priority)] = redundant;
+}
+
+void SecureUdpSender::onWindowOpen(uint16_t stream, std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = streams_.find(stream);
+    if (it == streams_.end()) {
+        throw std::runtime_error("Unknown stream");
+    }
+    it->second.onWindowOpen = std::move(callback);
+}
+
+void SecureUdpSender::setDscp(Priority priority, uint8_t dscp) {
+    std::lock_guard<std::mutex> lock(mu_);
+    // DSCP 占 TOS 字节的高 6 位
+    tos_[static_cast<size_t>(priority)] = static_cast<uint8_t>(dscp << 2);
 }
 
 bool SecureUdpSender::send(const std::string& data) {
-    uint32_t currentSeq = seq_.fetch_add(1);
-
-    // 加密数据
-    std::vector<uint8_t> nonce = generateNonce();
-    std::vector<uint8_t> cipherText;
-    std::vector<uint8_t> tag;
-    bool ret = aes_gcm_encrypt(
-        std::vector<uint8_t>(SHARED_KEY.begin(), SHARED_KEY.end()),
-        nonce,
-        data,
-        cipherText,
-        tag);
-
-    if (!ret) {
-        std::cerr << "Encryption failed\n";
-        return false;
+    return send(0, data);
+}
+
+bool SecureUdpSender::send(uint16_t stream, const std::string& data) {
+    return send(stream, nullptr, 0, reinterpret_cast<const uint8_t*>(data.data()), data.size());
+}
+
+bool SecureUdpSender::send(uint16_t stream, const uint8_t* data, size_t len) {
+    return send(stream, nullptr, 0, data, len);
+}
+
+bool SecureUdpSender::send(uint16_t stream, const uint8_t* head, size_t headLen,
+                           const uint8_t* body, size_t bodyLen) {
+    size_t dataLen = headLen + bodyLen;
+    // 可靠传输 (如共享内存环) 上不留包, 也就没有流控窗口
+    bool keep = !transport_->reliable();
+
+    uint32_t currentSeq;
+    uint16_t streamField;
+    Priority priority;
+    bool compress;
+    uint32_t span;
+    std::chrono::milliseconds nackDeadline;
+    bool stamp = timestamps_;
+    bool routed;
+    uint32_t route;
+    bool encrypt = transport_->requiresEncryption();
+    size_t tagLen = encrypt ? wire::TAG_LEN : 0;
+    std::unique_lock<std::mutex> ordered(reliableMu_, std::defer_lock);
+    if (!keep) ordered.lock();
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = streams_.find(stream);
+        if (it == streams_.end()) {
+            std::cerr << "Unknown stream " << stream << "\n";
+            return false;
+        }
+        if (dataLen > messageLimit()) {
+            std::cerr << "Message of " << dataLen << " bytes exceeds maximum datagram size "
+                      << maxDatagram_ << "\n";
+            return false;
+        }
+        StreamState& st = it->second;
+        nackDeadline = st.nackDeadline;
+        bool nack = nackDeadline.count() > 0;
+        size_t window = st.window;
+        auto scavenger = scavengers_.find(stream);
+        if (scavenger != scavengers_.end()) {
+            window = std::min(window, scavenger->second.window());
+            stamp = true;
+        }
+        if (keep && !nack && st.inFlight >= window) {
+            return false; // 该流窗口已满, 不影响其他流
+        }
+        if (st.nextSeq == UINT32_MAX) {
+            std::cerr << "Sequence space exhausted on stream " << stream << "\n";
+            return false; // 再发 NONCE 就会重复
+        }
+        currentSeq = st.nextSeq++;
+        if (keep && !nack) st.inFlight++;
+        streamField = st.ordered ? (stream | wire::STREAM_ORDERED_FLAG) : stream;
+        if (nack) streamField |= wire::STREAM_NACK_FLAG;
+        priority = st.priority;
+        routed = routed_;
+        route = route_;
+        compress = compress_[static_cast<size_t>(priority)];
+        // 可靠传输按序送达, 对端总在等下一个
+        span = keep ? packetNumberSpan(st.nextSeq, st.acked, currentSeq) : 1;
+    }
+
+    wire::Header header;
+    header.streamField = streamField;
+    header.session = session_;
+    // 对端分不出来源地址时短包头对不上会话, 每个包都带会话号
+    if (!sessionConfirmed_ || !transport_->hasSourceAddress()) header.flags |= wire::FLAG_LONG;
+    if (routed) {
+        header.flags |= wire::FLAG_ROUTE;
+        header.route = route;
+    }
+    if (stamp) {
+        header.flags |= wire::FLAG_TIMESTAMP;
+        header.deltaTs = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - sessionStart_).count());
+    }
+
+    // 没有前缀时直接从调用方的内存加密进包, 不经过中间字符串
+    const uint8_t* payload = body;
+    size_t payloadLen = bodyLen;
+    std::string joined;
+    if (headLen > 0 && compress) {
+        // 压缩要连续的输入, 只在这条路径上先拼起来
+        joined.reserve(dataLen);
+        joined.append(reinterpret_cast<const char*>(head), headLen);
+        joined.append(reinterpret_cast<const char*>(body), bodyLen);
+        payload = reinterpret_cast<const uint8_t*>(joined.data());
+        payloadLen = joined.size();
+        headLen = 0;
+    }
+
+    // 压缩必须在加密之前; 压不动时照原样发
+    std::string compressed;
+    if (compress && compressor_.compress(payload, payloadLen, compressed)) {
+        header.flags |= wire::FLAG_COMPRESSED;
+        payload = reinterpret_cast<const uint8_t*>(compressed.data());
+        payloadLen = compressed.size();
+    }
+
+    size_t plainLen = headLen + payloadLen;
+    std::string packet(wire::MAX_HEADER_LEN + plainLen + tagLen, '\0');
+    uint8_t* out = reinterpret_cast<uint8_t*>(&packet[0]);
+    size_t pnLen = wire::packetNumberLength(span);
+    size_t headerLen = wire::encodeHeader(header, currentSeq, pnLen, out);
+
+    uint8_t* plain = out + headerLen;
+    const uint8_t* src = payload;
+    if (headLen > 0) {
+        // 前缀和正文在包缓冲里拼好, 原地加密
+        std::memcpy(plain, head, headLen);
+        std::memcpy(plain + headLen, payload, payloadLen);
+        src = plain;
     }
 
-    // 组包: [SEQ(4B)][TIMESTAMP(8B)][NONCE(12B)][CIPHERTEXT][TAG(16B)]
-    uint64_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (encrypt) {
+        uint8_t nonce[wire::NONCE_LEN];
+        wire::makeNonce(session_, stream, currentSeq, nonce);
+        // 路由号和 COMPRESSED 位作 AAD: 中继看得见、改不了
+        uint8_t ad[wire::MAX_AAD_LEN];
+        size_t adLen = wire::makeAad(out, ad);
+        if (!aes_gcm_encrypt(ctx_, nonce, ad, adLen, src, plainLen, plain, plain + plainLen)) {
+            std::cerr << "Encryption failed\n";
+            std::lock_guard<std::mutex> lock(mu_);
+            if (!keep) {
+                streams_[stream].nextSeq = currentSeq;
+            } else if (nackDeadline.count() == 0) {
+                streams_[stream].inFlight--;
+            }
+            return false;
+        }
+    } else if (src != plain) {
+        // 本机共享内存通道且对端策略不要求加密, TAG 也省掉
+        std::memcpy(plain, src, plainLen);
+    }
+    packet.resize(headerLen + plainLen + tagLen);
 
-    std::vector<uint8_t> packet;
-    // 写SEQ（小端）
-    for(int i=0; i<4; i++) packet.push_back((currentSeq >> (i*8)) & 0xff);
-    // 写TIMESTAMP（小端）
-    for(int i=0; i<8; i++) packet.push_back((timestamp >> (i*8)) & 0xff);
-    // 写NONCE
-    packet.insert(packet.end(), nonce.begin(), nonce.end());
-    // 写CIPHERTEXT
-    packet.insert(packet.end(), cipherText.begin(), cipherText.end());
-    // 写TAG
-    packet.insert(packet.end(), tag.begin(), tag.end());
+    if (!keep) {
+        // 可靠传输按序送达, 第一个包到了对端就知道会话号了
+        if (transport_->send(out, packet.size())) {
+            sessionConfirmed_ = true;
+            return true;
+        }
+        // 没送出去 (如共享内存环满了) 就退回序号, 否则对端按序流永远等着这个空洞;
+        // 调用方照常重试
+        std::lock_guard<std::mutex> lock(mu_);
+        streams_[stream].nextSeq = currentSeq;
+        return false;
+    }
 
+    // 不直接发, 进调度队列, 由发送线程或事件循环按优先级取
+    uint64_t key = packetKey(stream, currentSeq);
     {
         std::lock_guard<std::mutex> lock(mu_);
-        unackedPackets_[currentSeq] = std::string(packet.begin(), packet.end());
+        bool nack = nackDeadline.count() > 0;
+        // 新一轮在途从现在起算对端的沉默时间
+        if (unackedPackets_.empty() && history_.empty()) lastFeedback_ = std::chrono::steady_clock::now();
+        Outgoing& entry = nack ? history_[key] : unackedPackets_[key];
+        if (nack) entry.expires = std::chrono::steady_clock::now() + nackDeadline;
+        entry.packet = std::move(packet);
+        entry.pnLen = static_cast<uint8_t>(pnLen);
+        entry.resent = false;
+        entry.priority = priority;
+        entry.queued = true;
+        scheduler_.push(priority, key, entry.packet.size());
     }
-    cv_.notify_one();
+    wake();
     return true;
 }
 
-void SecureUdpSender::sendThreadFunc() {
+uint32_t SecureUdpSender::nextSequence(uint16_t stream) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = streams_.find(stream);
+    if (it == streams_.end()) {
+        throw std::runtime_error("Unknown stream");
+    }
+    return it->second.nextSeq;
+}
+
+bool SecureUdpSender::acknowledgedBefore(uint16_t stream, uint32_t seq) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = streams_.find(stream);
+    if (it == streams_.end()) {
+        throw std::runtime_error("Unknown stream");
+    }
+    // 可靠传输上 send() 成功即送达
+    if (transport_->reliable()) return static_cast<int32_t>(it->second.nextSeq - seq) >= 0;
+    return static_cast<int32_t>(it->second.acked - seq) >= 0;
+}
+
+bool SecureUdpSender::acknowledged(uint16_t stream, uint32_t seq) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = streams_.find(stream);
+    if (it == streams_.end()) {
+        throw std::runtime_error("Unknown stream");
+    }
+    // 还没发出的序号不算; 发出过且不在未确认表里的就是确认过了
+    if (static_cast<int32_t>(seq - it->second.nextSeq) >= 0) return false;
+    if (transport_->reliable()) return true;
+    return unackedPackets_.find(packetKey(stream, seq)) == unackedPackets_.end();
+}
+
+void SecureUdpSender::wake() {
+    if (!loop_) {
+        uint64_t one = 1;
+        (void)write(wakeFd_, &one, sizeof(one));
+        return;
+    }
+    // 一次排空处理多个包, 不必每个包投递一个任务
+    if (!drainScheduled_.exchange(true)) {
+        loop_->runInLoop([this] {
+            drainScheduled_ = false;
+            drain();
+        });
+    }
+}
+
+// 持锁调用
+void SecureUdpSender::transmit(const Outgoing& out) {
+    size_t level = static_cast<size_t>(out.priority);
+    if (!fec_.enabled()) {
+        transmitRaw(out.packet, tos_[level], redundant_[level]);
+        return;
+    }
+    // 修复包跟着凑满这一组的数据包发, 用同样的标记
+    std::vector<std::string> datagrams;
+    fec_.protect(reinterpret_cast<const uint8_t*>(out.packet.data()), out.packet.size(), datagrams);
+    for (auto& d : datagrams) transmitRaw(d, tos_[level], redundant_[level]);
+}
+
+void SecureUdpSender::transmitRaw(const std::string& packet, uint8_t tos, bool redundant) {
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(packet.data());
+    if (ecn_) tos = static_cast<uint8_t>((tos & ~wire::ECN_MASK) | wire::ECN_ECT0_CODE);
+    if (redundant) {
+        transport_->sendRedundant(data, packet.size(), tos);
+    } else if (tos) {
+        transport_->sendMarked(data, packet.size(), tos);
+    } else {
+        transport_->send(data, packet.size());
+    }
+}
+
+void SecureUdpSender::drain() {
+    // 每发一个包就放一次锁, 新来的高优先级包能插到前面
     while (running_) {
-        std::unique_lock<std::mutex> lock(mu_);
-        if (unackedPackets_.empty()) {
-            cv_.wait(lock);
+        std::lock_guard<std::mutex> lock(mu_);
+        uint64_t key;
+        if (!scheduler_.pop(key)) return;
+        Outgoing* found = findOutgoing(key);
+        if (!found) continue; // 排队期间已被确认或过期
+        Outgoing& out = *found;
+        out.queued = false;
+        out.lastSent = std::chrono::steady_clock::now();
+
+        // 重传时对端见过的最大序号可能已经走远, 原来的 PN 长度不够还原就重写包头;
+        // AAD 里的 ROUTE 和 COMPRESSED 位原样带上, 密文不依赖包头的其余部分, 不用重新加密
+        auto st = streams_.find(static_cast<uint16_t>(key >> 32));
+        uint32_t seq = static_cast<uint32_t>(key);
+        size_t need = wire::packetNumberLength(packetNumberSpan(st->second.nextSeq, st->second.acked, seq));
+        if (need > out.pnLen) {
+            wire::Header header;
+            size_t oldLen = wire::parseHeader(reinterpret_cast<const uint8_t*>(out.packet.data()),
+                                              out.packet.size(), header);
+            uint8_t buf[wire::MAX_HEADER_LEN];
+            size_t newLen = wire::encodeHeader(header, seq, need, buf);
+            out.packet.replace(0, oldLen, reinterpret_cast<const char*>(buf), newLen);
+            out.pnLen = static_cast<uint8_t>(need);
         }
-        if (!running_) break;
+        transmit(out);
+    }
+}
+
+// 持锁调用
+SecureUdpSender::Outgoing* SecureUdpSender::findOutgoing(uint64_t key) {
+    auto it = unackedPackets_.find(key);
+    if (it != unackedPackets_.end()) return &it->second;
+    auto h = history_.find(key);
+    return h != history_.end() ? &h->second : nullptr;
+}
 
-        for (auto& p : unackedPackets_) {
-            ssize_t sent = sendto(sockfd_, p.second.data(), p.second.size(), 0,
-                    (struct sockaddr*)&remoteAddr_, sizeof(remoteAddr_));
-            if (sent < 0) {
-                perror("sendto");
+// 持锁调用。丢掉过期的 NACK 历史; 各 NACK 流的 acked 跟到最老的还留着的包,
+// PN 长度只需覆盖历史里的范围
+void SecureUdpSender::pruneHistory(std::chrono::steady_clock::time_point now) {
+    for (auto& p : streams_) {
+        StreamState& st = p.second;
+        if (st.nackDeadline.count() == 0) continue;
+        auto it = history_.lower_bound(packetKey(p.first, 0));
+        auto end = history_.lower_bound(packetKey(p.first, st.nextSeq));
+        while (it != end && it->second.expires <= now) it = history_.erase(it);
+        st.acked = it != end ? static_cast<uint32_t>(it->first) : st.nextSeq;
+    }
+}
+
+void SecureUdpSender::queueRetransmits() {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mu_);
+    pruneHistory(now);
+
+    // 对端沉默太久: 可能重启过, 只认长包头了。NACK 流平时没有回音,
+    // 也借此隔一阵带一次长包头, 换一个 ACK 回来
+    if (unackedPackets_.empty() && history_.empty()) {
+        lastFeedback_ = now;
+    } else if (sessionConfirmed_ && now - lastFeedback_ >= SESSION_PROBE_AFTER) {
+        sessionConfirmed_ = false;
+    }
+    if (!sessionConfirmed_ && !unackedPackets_.empty() && now - lastFeedback_ >= RETRANSMIT_INTERVAL &&
+        now - lastSync_ >= RETRANSMIT_INTERVAL) {
+        sendSync(now);
+    }
+    for (auto& p : unackedPackets_) {
+        Outgoing& out = p.second;
+        if (out.queued || now - out.lastSent < RETRANSMIT_INTERVAL) continue;
+        out.queued = true;
+        out.resent = true;
+        scheduler_.push(out.priority, p.first, out.packet.size());
+
+        auto scavenger = scavengers_.find(static_cast<uint16_t>(p.first >> 32));
+        if (scavenger != scavengers_.end()) scavenger->second.onLoss(now);
+    }
+
+    std::vector<std::string> repairs;
+    fec_.flushOlderThan(FEC_FLUSH_DELAY, repairs);
+    for (auto& r : repairs) transmitRaw(r, 0, false);
+}
+
+void SecureUdpSender::pollAcks(int timeoutMs) {
+    // 可靠传输没有回程, 读它只会读到自己发出的包
+    if (transport_->reliable()) return;
+
+    // 装得下最长的 NACK, 截断的帧过不了认证
+    uint8_t buffer[std::max(wire::MAX_ACK_LEN, wire::MAX_NACK_LEN)];
+    ssize_t len = transport_->recv(buffer, sizeof(buffer), timeoutMs);
+    while (len > 0) {
+        handleAck(buffer, static_cast<size_t>(len));
+        len = transport_->recv(buffer, sizeof(buffer), 0);
+    }
+}
+
+void SecureUdpSender::handleAck(const uint8_t* frame, size_t frameLen) {
+    // 只认本会话、认证通过的帧; 伪造或别的会话重放来的 ACK 不能清未确认表
+    size_t len = wire::openControl(ctx_, session_, frame, frameLen);
+    if (len == 0) return;
+    const uint8_t* data = frame;
+
+    uint16_t nackStream;
+    const uint8_t* seqs;
+    size_t count;
+    if (wire::parseNack(data, len, nackStream, seqs, count)) {
+        handleNack(nackStream, seqs, count);
+        return;
+    }
+
+    wire::Ack ack;
+    if (!wire::parseAck(data, len, ack)) return;
+    uint16_t stream = ack.stream;
+    uint32_t cumulative = ack.cumulative;
+    uint32_t seq = ack.seq;
+
+    size_t acked;
+    std::function<void()> onWindowOpen;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto st = streams_.find(stream);
+        if (st == streams_.end()) return;
+
+        // 认证过的 ACK 说明对端记下了会话号, 之后可以用短包头; 除非它的累计确认
+        // 比我们已收到的还落后, 那是对端丢了状态 (重启后从长包头重新认出本会话), 要发 SYNC
+        lastFeedback_ = std::chrono::steady_clock::now();
+        bool regressed = st->second.nackDeadline.count() == 0 &&
+                         static_cast<int32_t>(st->second.acked - cumulative) > 0;
+        sessionConfirmed_ = !regressed;
+        // 长包头的包对端照样回 ACK 并逐个确认, 在途包可能就此清空, 等不到沉默后的 SYNC
+        if (regressed && lastFeedback_ - lastSync_ >= RETRANSMIT_INTERVAL) sendSync(lastFeedback_);
+
+        if (ack.hasEcn && ack.ecn.ce > peerEcn_.ce) {
+            // 新的 CE 说明路径上已经在排队, 赶在丢包之前让后台流退让
+            ceMarks_ += ack.ecn.ce - peerEcn_.ce;
+            auto now = std::chrono::steady_clock::now();
+            for (auto& sc : scavengers_) sc.second.onLoss(now);
+        }
+        if (ack.hasEcn) {
+            peerEcn_.ect0 = std::max(peerEcn_.ect0, ack.ecn.ect0);
+            peerEcn_.ect1 = std::max(peerEcn_.ect1, ack.ecn.ect1);
+            peerEcn_.ce = std::max(peerEcn_.ce, ack.ecn.ce);
+        }
+
+        auto scavenger = scavengers_.find(stream);
+        if (scavenger != scavengers_.end() && ack.hasDelay) {
+            auto sampled = unackedPackets_.find(packetKey(stream, seq));
+            if (sampled != unackedPackets_.end() && !sampled->second.resent) {
+                scavenger->second.onDelaySample(ack.delay, std::chrono::steady_clock::now());
             }
         }
-        lock.unlock();
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        size_t inFlightBefore = st->second.inFlight;
+
+        acked = unackedPackets_.erase(packetKey(stream, seq));
+        auto first = unackedPackets_.lower_bound(packetKey(stream, 0));
+        auto last = unackedPackets_.lower_bound(packetKey(stream, cumulative));
+        acked += static_cast<size_t>(std::distance(first, last));
+        unackedPackets_.erase(first, last);
+
+        st->second.inFlight -= std::min(acked, st->second.inFlight);
+        if (static_cast<int32_t>(cumulative - st->second.acked) > 0) st->second.acked = cumulative;
+        if (scavenger != scavengers_.end()) scavenger->second.onAck(acked, inFlightBefore);
+        if (acked) onWindowOpen = st->second.onWindowOpen;
+    }
+
+    // 锁外回调, 回调里可以直接再 send()
+    if (onWindowOpen) onWindowOpen();
+}
+
+void SecureUdpSender::waitForWork(int timeoutMs) {
+    // 同时等新包唤醒和 ACK 到达; 没有 fd 的传输只能短间隔轮询
+    int ackFd = transport_->reliable() ? -1 : transport_->fd();
+    struct pollfd fds[2] = {{wakeFd_, POLLIN, 0}, {ackFd, POLLIN, 0}};
+    bool fdless = !transport_->reliable() && transport_->fd() < 0;
+
+    if (poll(fds, 2, fdless ? 1 : timeoutMs) > 0 && (fds[0].revents & POLLIN)) {
+        uint64_t v;
+        (void)read(wakeFd_, &v, sizeof(v));
+    }
+    pollAcks(0);
+}
+
+void SecureUdpSender::sendThreadFunc() {
+    while (running_) {
+        drain();
+        queueRetransmits();
+        drain();
+        waitForWork(RETRANSMIT_CHECK_MS);
     }
 }
 
 void SecureUdpSender::stop() {
     if (running_) {
         running_ = false;
-        cv_.notify_all();
+        if (!loop_) wake();
         if (sendThread_.joinable()) sendThread_.join();
-        close(sockfd_);
+        if (loop_) {
+            if (transport_->fd() >= 0) loop_->removeFd(transport_->fd());
+            loop_->cancelTimer(retransmitTimer_);
+            // 等之前投递到循环里的发送任务跑完
+            loop_->runSync([] {});
+            runtime_->release(*loop_);
+        }
     }
 }
 
+// 对端要的包还在历史里且没过期就插队重传, 否则不理会
+void SecureUdpSender::handleNack(uint16_t stream, const uint8_t* seqs, size_t count) {
+    auto now = std::chrono::steady_clock::now();
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        // 认证过的 NACK 说明对端已经记下会话号
+        sessionConfirmed_ = true;
+        lastFeedback_ = now;
+        for (size_t i = 0; i < count; i++) {
+            uint32_t seq = wire::loadLe<uint32_t>(seqs + i * 4);
+            auto it = history_.find(packetKey(stream, seq));
+            if (it == history_.end()) continue;
+            Outgoing& out = it->second;
+            if (out.queued || out.expires <= now) continue;
+            out.queued = true;
+            scheduler_.push(out.priority, it->first, out.packet.size());
+            queued = true;
+        }
+    }
+    if (queued) wake();
+}
+
+// 持锁调用。把各可靠流的累计确认作为 BASE 装进 SYNC_STREAM 上的长包头包发出去:
+// 重启过的接收端靠它认出会话号, 并从 BASE 接着收, 之后短包头的重传它也解得开了
+void SecureUdpSender::sendSync(std::chrono::steady_clock::time_point now) {
+    lastSync_ = now;
+    bool encrypt = transport_->requiresEncryption();
+    size_t tagLen = encrypt ? wire::TAG_LEN : 0;
+    size_t perPacket = std::max<size_t>(1, (maxDatagram_ - wire::MAX_HEADER_LEN - tagLen) / wire::SyncEntry::SIZE);
+
+    std::string entries;
+    auto flush = [&] {
+        if (entries.empty() || syncSeq_ == UINT32_MAX) return;
+        wire::Header header;
+        header.flags = wire::FLAG_LONG;
+        header.session = session_;
+        header.streamField = wire::SYNC_STREAM;
+        if (routed_) {
+            header.flags |= wire::FLAG_ROUTE;
+            header.route = route_;
+        }
+        uint32_t seq = syncSeq_++;
+        std::string packet(wire::MAX_HEADER_LEN + entries.size() + tagLen, '\0');
+        uint8_t* out = reinterpret_cast<uint8_t*>(&packet[0]);
+        size_t headerLen = wire::encodeHeader(header, seq, 4, out);
+        uint8_t* plain = out + headerLen;
+        if (encrypt) {
+            uint8_t nonce[wire::NONCE_LEN];
+            wire::makeNonce(session_, wire::SYNC_STREAM, seq, nonce);
+            uint8_t ad[wire::MAX_AAD_LEN];
+            size_t adLen = wire::makeAad(out, ad);
+            if (!aes_gcm_encrypt(ctx_, nonce, ad, adLen, reinterpret_cast<const uint8_t*>(entries.data()),
+                                 entries.size(), plain, plain + entries.size())) {
+                return;
+            }
+        } else {
+            std::memcpy(plain, entries.data(), entries.size());
+        }
+        packet.resize(headerLen + entries.size() + tagLen);
+        transmitRaw(packet, 0, false);
+        entries.clear();
+    };
+
+    for (auto& p : streams_) {
+        const StreamState& st = p.second;
+        if (st.nackDeadline.count() > 0 || st.acked == st.nextSeq) continue;
+        uint8_t entry[wire::SyncEntry::SIZE];
+        uint16_t field = st.ordered ? (p.first | wire::STREAM_ORDERED_FLAG) : p.first;
+        wire::SyncEntry::encode(entry, field, st.acked);
+        entries.append(reinterpret_cast<const char*>(entry), sizeof(entry));
+        if (entries.size() / wire::SyncEntry::SIZE >= perPacket) flush();
+    }
+    flush();
+}
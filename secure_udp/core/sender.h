@@ -2,31 +2,186 @@
 #include <string>
 #include <thread>
 #include <atomic>
+#include <map>
 #include <unordered_map>
 #include <mutex>
-#include <condition_variable>
-#include <netinet/in.h>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include "../crypto/aes_gcm.h"
+#include "compression.h"
+#include "fec.h"
+#include "ledbat.h"
+#include "scheduler.h"
+#include "sequence_store.h"
+#include "transport.h"
+#include "wire.h"
+
+class Runtime;
+class EventLoop;
 
 class SecureUdpSender {
 public:
+    // 每个流最多这么多包在途未确认, 超出时 send() 返回 false
+    static constexpr size_t DEFAULT_STREAM_WINDOW = 256;
+    // 包头 SESSION 字段能表示的会话号个数
+    static constexpr uint64_t SESSION_SPACE = uint64_t(1) << (wire::SESSION_LEN * 8);
+
+    // 走 UDP; 同机的共享内存通道要显式选, 用 connectTransport(ip, port, SameHostPath::SharedMemory) 构造
     SecureUdpSender(const std::string& remoteIp, int remotePort);
+    // 挂到共享运行时上, 不再单独起线程
+    SecureUdpSender(Runtime& runtime, const std::string& remoteIp, int remotePort);
+    explicit SecureUdpSender(std::unique_ptr<Transport> transport);
+    SecureUdpSender(Runtime& runtime, std::unique_ptr<Transport> transport);
     ~SecureUdpSender();
 
+    // 打开一个逻辑流, 各流有独立的序号空间、按序/乱序交付方式和流控窗口,
+    // 一个流丢包不会阻塞其他流。流 0 默认存在, 乱序交付。
+    uint16_t openStream(bool ordered, size_t window = DEFAULT_STREAM_WINDOW,
+                        Priority priority = Priority::Normal);
+    // 实时流: 乱序交付, 对端不回 ACK, 只在发现缺口时 NACK 指定的包。
+    // 发出的包只保留 deadline 这么久, 过期的不再重传, 也不受窗口限制
+    uint16_t openNackStream(std::chrono::milliseconds deadline,
+                            Priority priority = Priority::Interactive);
+
+    // 发送队列按流的优先级调度: 严格优先级, 或按权重的 DRR
+    void setScheduler(SendScheduler::Mode mode,
+                      const std::array<uint32_t, PRIORITY_LEVELS>& weights = {8, 4, 2, 1});
+    // 该流改为后台流量: 按 LEDBAT 的时延窗口发, 排队时延超过 target 就退让,
+    // 实际窗口不超过 openStream 时给的窗口。该流的包自动带时间戳, 不适用于 NACK 流
+    void setScavenger(uint16_t stream, std::chrono::milliseconds target = LedbatController::DEFAULT_TARGET);
+    // 该优先级的包带上 DSCP 标记 (0 表示不标记)
+    void setDscp(Priority priority, uint8_t dscp);
+    // 该优先级的消息加密前尝试压缩; 对时延敏感的类别保持关闭
+    void setCompression(Priority priority, bool enabled);
+    // 小消息压缩用的 zstd 字典 (PayloadCompressor::trainDictionary), 接收端要装同一份
+    void setCompressionDictionary(const std::string& dictionary);
+    // 每 dataCount 个数据报追加 repairCount 个修复包, 对端丢包不超过修复包数时不用重传;
+    // Xor 固定一个修复包。只用于不可靠传输, FecScheme::None 关闭
+    void setFec(FecScheme scheme, size_t dataCount, size_t repairCount = 1);
+    // 包标上 ECT(0); 路径上的 AQM 可以打 CE 标记代替丢包, 对端在 ACK 里回报计数,
+    // 后台流收到新的 CE 就按丢包退让
+    void setEcn(bool enabled);
+    // 对端回报的 CE 标记累计数
+    uint64_t congestionMarks() const { return ceMarks_; }
+    // 发出的数据报 (UDP 载荷) 上限, 默认 DEFAULT_MAX_DATAGRAM, 最大 MAX_UDP_DATAGRAM。
+    // 消息加上最长包头、TAG 和 FEC 开销 (前缀和修复包的长度字段) 超过它时 send() 返回 false;
+    // 对端接收端要设得不小于它
+    void setMaxDatagram(size_t bytes);
+    // 会话号改从持久化的计数器取, 不再随机: 进程崩溃重启后也不会再用到之前的会话号,
+    // 隐式 NONCE 因此在同一把密钥下不重复。store 的 limit 不能超过 SESSION_SPACE,
+    // 可以被多个发送端共用。须在第一次 send() 之前调用
+    void setSessionStore(const std::shared_ptr<SequenceStore>& store);
+    // 包头带上中继路由号, 沿途的 Relay 据此转发且无需密钥; 路由号作为 AAD 参与认证。
+    // 之后发的包生效, 已在途的重传仍带原来的路由号
+    void setRoute(uint32_t route);
+    // 包头带上距会话开始的毫秒数, 供对端估计单向时延变化
+    void setTimestamps(bool enabled);
+    // 该优先级的包在多路径传输的每条路径上各发一份, 用带宽换延迟
+    void setRedundant(Priority priority, bool redundant);
+
+    // 该流有包被确认、窗口腾出空间时回调 (在发送线程或事件循环里), 传空函数取消
+    void onWindowOpen(uint16_t stream, std::function<void()> callback);
+
     bool send(const std::string& data);
+    bool send(uint16_t stream, const std::string& data);
+    // 直接从调用方的内存 (如文件映射) 加密进包, 不先拷进字符串
+    bool send(uint16_t stream, const uint8_t* data, size_t len);
+    // head 和 body 作为一个消息发出: 两段在包缓冲里拼好后原地加密
+    bool send(uint16_t stream, const uint8_t* head, size_t headLen, const uint8_t* body, size_t bodyLen);
+    // 按当前的最大数据报和 FEC 设置, send() 收得下的最长消息; 更长的 send() 总是返回 false
+    size_t maxMessage();
+    // 该流下一个消息会用的序号
+    uint32_t nextSequence(uint16_t stream);
+    // 对端已确认该流 seq 之前的消息都已交付 (按序流即已交给回调)
+    bool acknowledgedBefore(uint16_t stream, uint32_t seq);
+    // 对端已收到该流的 seq 这个消息 (累计或单独确认); 只对非 NACK 流有意义
+    bool acknowledged(uint16_t stream, uint32_t seq);
     void stop();
 
 private:
+    struct StreamState {
+        bool ordered;
+        size_t window;
+        uint32_t nextSeq;
+        size_t inFlight;
+        uint32_t acked;         // 对端累计确认到的序号
+        Priority priority;
+        std::function<void()> onWindowOpen;
+        std::chrono::milliseconds nackDeadline{0};     // 非 0 为 NACK 流, acked 表示历史里最老的序号
+    };
+
+    struct Outgoing {
+        std::string packet;
+        Priority priority;
+        std::chrono::steady_clock::time_point lastSent;
+        bool queued;
+        uint8_t pnLen;      // 包头里 PN 当前的字节数
+        bool resent;        // 重传过的包的时间戳是旧的, 不拿来采样时延
+        std::chrono::steady_clock::time_point expires;  // 只用于 NACK 历史
+    };
+
+    void initSession();
+    size_t messageLimit() const;
     void sendThreadFunc();
+    void wake();
+    void waitForWork(int timeoutMs);
+    void drain();
+    void queueRetransmits();
+    void transmit(const Outgoing& out);
+    void transmitRaw(const std::string& packet, uint8_t tos, bool redundant);
+    void pollAcks(int timeoutMs);
+    void handleAck(const uint8_t* data, size_t len);
+    void handleNack(uint16_t stream, const uint8_t* seqs, size_t count);
+    void sendSync(std::chrono::steady_clock::time_point now);
+    void pruneHistory(std::chrono::steady_clock::time_point now);
+    Outgoing* findOutgoing(uint64_t key);
 
-    int sockfd_;
-    struct sockaddr_in remoteAddr_;
-    std::atomic<uint32_t> seq_;
+    std::unique_ptr<Transport> transport_;
+    AesGcmContext ctx_;
+    uint64_t session_;
+    std::chrono::steady_clock::time_point sessionStart_;
+    // 对端已记下会话号, 可以用短包头; 在途的包久久没有回音时撤销, 见 queueRetransmits
+    std::atomic<bool> sessionConfirmed_;
+    std::chrono::steady_clock::time_point lastFeedback_;   // 最近一个认证过的 ACK/NACK
+    std::chrono::steady_clock::time_point lastSync_;
+    uint32_t syncSeq_;                                     // SYNC_STREAM 上的序号
+    std::atomic<bool> timestamps_;
 
-    std::unordered_map<uint32_t, std::string> unackedPackets_;
+    // 键为 (流ID << 32) | 流内序号
+    std::map<uint64_t, Outgoing> unackedPackets_;
+    // NACK 流发出的包, 只留到各自的期限, 键同上
+    std::map<uint64_t, Outgoing> history_;
+    std::unordered_map<uint16_t, StreamState> streams_;
+    // 后台流的拥塞窗口
+    std::unordered_map<uint16_t, LedbatController> scavengers_;
+    uint16_t nextStreamId_;
+    SendScheduler scheduler_;
+    std::array<uint8_t, PRIORITY_LEVELS> tos_;
+    std::array<bool, PRIORITY_LEVELS> redundant_;
+    std::array<bool, PRIORITY_LEVELS> compress_;
+    bool ecn_;
+    bool routed_;
+    uint32_t route_;
+    size_t maxDatagram_;
+    wire::EcnCounts peerEcn_;       // ACK 里见过的最大计数
+    std::atomic<uint64_t> ceMarks_;
+    PayloadCompressor compressor_;
+    FecEncoder fec_;
     std::mutex mu_;
-    std::condition_variable cv_;
+    // 可靠传输上从分配序号到交给传输整段串行: 包按序号顺序进传输,
+    // 发送失败时退回的序号也一定是最后分出去的那个。先于 mu_ 加锁
+    std::mutex reliableMu_;
+
+    // 线程模式下用来唤醒发送线程
+    int wakeFd_;
+    std::atomic<bool> drainScheduled_;
 
     std::thread sendThread_;
     std::atomic<bool> running_;
-};
 
+    Runtime* runtime_;
+    EventLoop* loop_;
+    uint64_t retransmitTimer_;
+};
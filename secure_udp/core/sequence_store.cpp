@@ -0,0 +1,101 @@
+#include "sequence_store.h"
+#include "../crypto/aes_gcm.h"
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+
+static constexpr uint32_t STATE_MAGIC = 0x53455153; // "SQES"
+static constexpr uint32_t STATE_VERSION = 1;
+static constexpr size_t STATE_FILE_SIZE = 4096;
+
+// 整个状态在一页里, 一次 msync 落盘; magic 为 0 说明建文件时就崩了, 还没发出过任何值
+struct SequenceStore::State {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t limit;
+    uint64_t reserved;      // 已预留到 (不含) 这个值
+};
+
+static uint64_t randomBelow(uint64_t bound) {
+    uint8_t random[12]; // aes_gcm_random_nonce 写满一个 NONCE
+    aes_gcm_random_nonce(random);
+    uint64_t v = 0;
+    for (size_t i = 0; i < sizeof(v); i++) v |= uint64_t(random[i]) << (i * 8);
+    return bound ? v % bound : 0;
+}
+
+SequenceStore::SequenceStore(const std::string& path, uint64_t limit, uint64_t block)
+    : fd_(-1), state_(nullptr), next_(0), limit_(limit), block_(std::max<uint64_t>(block, 1)) {
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd_ < 0) {
+        perror("open");
+        throw std::runtime_error("Failed to open sequence state file " + path);
+    }
+    // 两个进程共用一个文件会拿到同样的块
+    if (flock(fd_, LOCK_EX | LOCK_NB) < 0) {
+        close(fd_);
+        throw std::runtime_error("Sequence state file is in use: " + path);
+    }
+    struct stat st{};
+    if (fstat(fd_, &st) < 0 ||
+        (static_cast<size_t>(st.st_size) < STATE_FILE_SIZE && ftruncate(fd_, STATE_FILE_SIZE) < 0)) {
+        perror("ftruncate");
+        close(fd_);
+        throw std::runtime_error("Failed to size sequence state file " + path);
+    }
+    void* base = mmap(nullptr, STATE_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        close(fd_);
+        throw std::runtime_error("Failed to map sequence state file " + path);
+    }
+    state_ = static_cast<State*>(base);
+
+    if (state_->magic == STATE_MAGIC) {
+        if (state_->version != STATE_VERSION || state_->limit != limit_) {
+            munmap(state_, STATE_FILE_SIZE);
+            close(fd_);
+            throw std::runtime_error("Sequence state file version or limit mismatch: " + path);
+        }
+        next_ = state_->reserved; // 跳过上次预留但可能已用掉的整块
+    } else {
+        next_ = randomBelow(limit_ / 2);
+        state_->version = STATE_VERSION;
+        state_->limit = limit_;
+        state_->magic = STATE_MAGIC;
+    }
+    try {
+        reserveBlock();
+    } catch (...) {
+        munmap(state_, STATE_FILE_SIZE);
+        close(fd_);
+        throw;
+    }
+}
+
+SequenceStore::~SequenceStore() {
+    if (state_) munmap(state_, STATE_FILE_SIZE);
+    if (fd_ >= 0) close(fd_);
+}
+
+// 先落盘新的上界, 再交出块里的值
+void SequenceStore::reserveBlock() {
+    if (next_ >= limit_) {
+        throw std::runtime_error("Sequence space exhausted");
+    }
+    state_->reserved = next_ + std::min(block_, limit_ - next_);
+    if (msync(state_, STATE_FILE_SIZE, MS_SYNC) < 0) {
+        perror("msync");
+        throw std::runtime_error("Failed to persist sequence reservation");
+    }
+}
+
+uint64_t SequenceStore::next() {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (next_ >= state_->reserved) reserveBlock();
+    return next_++;
+}
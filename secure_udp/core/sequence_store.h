@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// 崩溃安全的单调计数器, 用来分配隐式 NONCE 里不能重复的部分。
+// 状态文件 mmap 进来, 值按块预留: 每用完一块先把下一块的上界写进文件并 msync 一次,
+// 之后块内取值只是内存里加一。重启后直接从上次预留的上界开始, 没用完的部分作废,
+// 所以崩溃在任何时刻都不会让一个值发出两次。
+class SequenceStore {
+public:
+    static constexpr uint64_t DEFAULT_BLOCK = 1024;
+
+    // 打开或创建状态文件, 同一文件同时只能有一个实例打开。新建时起点在 [0, limit/2) 里随机取,
+    // 用同一把密钥的不同主机不会从同一个值开始
+    explicit SequenceStore(const std::string& path, uint64_t limit = UINT64_MAX,
+                           uint64_t block = DEFAULT_BLOCK);
+    ~SequenceStore();
+
+    SequenceStore(const SequenceStore&) = delete;
+    SequenceStore& operator=(const SequenceStore&) = delete;
+
+    // 取一个从没取出过的值; 到 limit 时抛出
+    uint64_t next();
+    uint64_t limit() const { return limit_; }
+
+private:
+    struct State;
+
+    void reserveBlock();
+
+    int fd_;
+    State* state_;
+    uint64_t next_;
+    uint64_t limit_;
+    uint64_t block_;
+    std::mutex mu_;
+};
@@ -0,0 +1,172 @@
+#include "shm_transport.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+static constexpr uint32_t SHM_MAGIC = 0x53554450; // "SUDP"
+static constexpr uint32_t SHM_VERSION = 1;
+
+struct ShmTransport::Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t encrypt;
+    uint32_t reserved;
+    uint64_t size;
+};
+
+// 环要 64 字节对齐
+static constexpr size_t RING_OFFSET = 64;
+
+static std::string shmName(int port) {
+    return "/secure_udp." + std::to_string(port);
+}
+
+ShmTransport::ShmTransport(std::string name, void* base, size_t size, bool owner, bool encrypt)
+    : name_(std::move(name)), base_(base), size_(size), owner_(owner), encrypt_(encrypt),
+      header_(static_cast<Header*>(base)),
+      ring_(reinterpret_cast<DatagramRing*>(static_cast<uint8_t*>(base) + RING_OFFSET)) {
+    static_assert(sizeof(Header) <= RING_OFFSET, "shm header too large");
+}
+
+ShmTransport::ShmTransport(ShmTransport&& other) noexcept
+    : name_(std::move(other.name_)), base_(other.base_), size_(other.size_), owner_(other.owner_),
+      encrypt_(other.encrypt_), header_(other.header_), ring_(other.ring_) {
+    other.base_ = nullptr;
+    other.owner_ = false;
+}
+
+ShmTransport::~ShmTransport() {
+    if (base_) munmap(base_, size_);
+    if (owner_) shm_unlink(name_.c_str());
+}
+
+ShmTransport ShmTransport::listen(int localPort, bool encrypt, size_t capacity, size_t maxDatagram) {
+    std::string name = shmName(localPort);
+    size_t size = RING_OFFSET + DatagramRing::bytesFor(capacity, maxDatagram);
+
+    // 上一个进程崩溃可能留下旧环, 直接重建
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        perror("shm_open");
+        throw std::runtime_error("Failed to create shared memory ring");
+    }
+    if (ftruncate(fd, static_cast<off_t>(size)) < 0) {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Failed to size shared memory ring");
+    }
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Failed to map shared memory ring");
+    }
+
+    ShmTransport t(std::move(name), base, size, true, encrypt);
+    DatagramRing::create(t.ring_, capacity, maxDatagram);
+    t.header_->encrypt = encrypt ? 1 : 0;
+    t.header_->version = SHM_VERSION;
+    t.header_->size = size;
+    // magic 最后写, 发送端看到它才认为环已初始化好
+    __atomic_store_n(&t.header_->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    return t;
+}
+
+ShmTransport ShmTransport::connect(int remotePort, bool allowPlaintext) {
+    std::string name = shmName(remotePort);
+    int fd = shm_open(name.c_str(), O_RDWR | O_NOFOLLOW, 0);
+    if (fd < 0) {
+        throw std::runtime_error("No shared memory ring for port " + std::to_string(remotePort));
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < RING_OFFSET) {
+        close(fd);
+        throw std::runtime_error("Shared memory ring not initialized");
+    }
+    // /dev/shm 谁都能写, 只认本用户建的、别人读写不了的环 (listen 用 0600 建)
+    if (!S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+        close(fd);
+        throw std::runtime_error("Shared memory ring for port " + std::to_string(remotePort) +
+                                 " is not owned by this user or is accessible to others");
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        throw std::runtime_error("Failed to map shared memory ring");
+    }
+
+    ShmTransport t(std::move(name), base, size, false, true);
+    if (__atomic_load_n(&t.header_->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+        t.header_->version != SHM_VERSION || t.header_->size != size) {
+        throw std::runtime_error("Shared memory ring version mismatch");
+    }
+    // 对端的头只能说明它收不收明文, 放弃加密要发送端自己同意
+    if (t.header_->encrypt == 0) {
+        if (!allowPlaintext) {
+            throw std::runtime_error("Shared memory ring does not require encryption");
+        }
+        t.encrypt_ = false;
+    }
+    return t;
+}
+
+bool ShmTransport::available(int remotePort) {
+    struct stat st{};
+    std::string path = "/dev/shm" + shmName(remotePort);
+    return stat(path.c_str(), &st) == 0;
+}
+
+ssize_t ShmTransport::recv(uint8_t* buf, size_t len, int timeoutMs) {
+    ssize_t n = ring_->pop(buf, len);
+    if (n >= 0 || timeoutMs == 0) return n;
+
+    // 忙等拿到亚微秒延迟, 一段时间没数据后才让出 CPU
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    for (unsigned spins = 0; ; spins++) {
+        n = ring_->pop(buf, len);
+        if (n >= 0) return n;
+        if (spins < 4096) continue;
+        if (timeoutMs > 0 && std::chrono::steady_clock::now() >= deadline) return -1;
+        std::this_thread::yield();
+    }
+}
+
+bool isLocalAddress(const std::string& ip) {
+    struct in_addr addr{};
+    if (inet_pton(AF_INET, ip.c_str(), &addr) != 1) return false;
+    if ((ntohl(addr.s_addr) >> 24) == 127) return true;
+
+    struct ifaddrs* ifs = nullptr;
+    if (getifaddrs(&ifs) < 0) return false;
+    bool local = false;
+    for (struct ifaddrs* it = ifs; it && !local; it = it->ifa_next) {
+        if (!it->ifa_addr || it->ifa_addr->sa_family != AF_INET) continue;
+        local = reinterpret_cast<struct sockaddr_in*>(it->ifa_addr)->sin_addr.s_addr == addr.s_addr;
+    }
+    freeifaddrs(ifs);
+    return local;
+}
+
+std::unique_ptr<Transport> connectTransport(const std::string& remoteIp, int remotePort, SameHostPath path) {
+    if (path != SameHostPath::Udp && isLocalAddress(remoteIp) && ShmTransport::available(remotePort)) {
+        try {
+            return std::make_unique<ShmTransport>(
+                ShmTransport::connect(remotePort, path == SameHostPath::SharedMemoryPlaintext));
+        } catch (const std::exception&) {
+            // 环还没初始化完、版本不对、属主或权限不对, 或者加密策略不合, 退回 UDP
+        }
+    }
+    return std::make_unique<UdpTransport>(UdpTransport::connect(remoteIp, remotePort));
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "transport.h"
+#include <memory>
+#include <string>
+
+// 同机对端的共享内存快速通道。接收端在 /dev/shm 下按端口建一个数据报环,
+// 同机发送端直接往环里写, 不经过 UDP 协议栈。
+// 环只有属于本用户且其他用户无权访问时才会连, 别的本机用户抢先建的环不会被用上。
+// 接收端建环时决定是否接受明文, 写在共享内存头里; 但放不放弃加密由发送端决定,
+// 发送端没有明确允许明文时, 对端不要求加密的环一律不连。
+class ShmTransport final : public Transport {
+public:
+    // 接收端: 创建 /secure_udp.<port>, 析构时删除
+    static ShmTransport listen(int localPort, bool encrypt = true,
+                               size_t capacity = 1024, size_t maxDatagram = DEFAULT_MAX_DATAGRAM);
+    // 发送端: 连接已有的环, 对端没在监听、环不归本用户或权限过宽时抛出。
+    // allowPlaintext 为 false 时遇到不要求加密的环也抛出
+    static ShmTransport connect(int remotePort, bool allowPlaintext = false);
+    static bool available(int remotePort);
+
+    ShmTransport(ShmTransport&& other) noexcept;
+    ShmTransport(const ShmTransport&) = delete;
+    ShmTransport& operator=(const ShmTransport&) = delete;
+    ~ShmTransport() override;
+
+    bool send(const uint8_t* data, size_t len) override { return ring_->push(data, len); }
+    ssize_t recv(uint8_t* buf, size_t len, int timeoutMs) override;
+    int fd() const override { return -1; }
+    bool requiresEncryption() const override { return encrypt_; }
+    // 环满时 send() 直接失败, 不会静默丢包; 单向通道, 没有回程
+    bool reliable() const override { return true; }
+    bool sendTo(const uint8_t*, size_t, const struct sockaddr_in&) override { return false; }
+
+private:
+    struct Header;
+
+    ShmTransport(std::string name, void* base, size_t size, bool owner, bool encrypt);
+
+    std::string name_;
+    void* base_;
+    size_t size_;
+    bool owner_;
+    bool encrypt_;
+    Header* header_;
+    DatagramRing* ring_;
+};
+
+// 目标地址是否落在本机 (回环或本机任一网卡地址)
+bool isLocalAddress(const std::string& ip);
+
+// 同机对端走哪条路
+enum class SameHostPath {
+    Udp,                    // 默认: 同机也走 UDP
+    SharedMemory,           // 对端开了共享内存通道就用, 照样加密
+    SharedMemoryPlaintext,  // 同上, 对端的环不要求加密时两端都跳过 AES-GCM
+};
+
+// 按 path 选择: 对端在本机且有可用的共享内存环时走共享内存, 否则走 UDP
+std::unique_ptr<Transport> connectTransport(const std::string& remoteIp, int remotePort,
+                                            SameHostPath path = SameHostPath::Udp);
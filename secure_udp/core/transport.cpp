@@ -0,0 +1,246 @@
+#include "transport.h"
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <stdexcept>
+#include <new>
+#include <thread>
+
+// 接收缓冲至少排得下这么多个最大数据报
+static constexpr size_t RCVBUF_DATAGRAMS = 64;
+
+UdpTransport::UdpTransport() : remoteAddr_{}, connected_(false), truncated_(0) {
+    sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd_ < 0) {
+        perror("socket");
+        throw std::runtime_error("Failed to create socket");
+    }
+}
+
+UdpTransport::UdpTransport(UdpTransport&& other) noexcept
+    : sockfd_(other.sockfd_), remoteAddr_(other.remoteAddr_), connected_(other.connected_),
+      truncated_(other.truncated_) {
+    other.sockfd_ = -1;
+}
+
+UdpTransport::~UdpTransport() {
+    if (sockfd_ >= 0) close(sockfd_);
+}
+
+UdpTransport UdpTransport::connect(const std::string& remoteIp, int remotePort,
+                                   const std::string& localIp) {
+    UdpTransport t;
+    t.remoteAddr_.sin_family = AF_INET;
+    t.remoteAddr_.sin_port = htons(remotePort);
+    inet_pton(AF_INET, remoteIp.c_str(), &t.remoteAddr_.sin_addr);
+
+    if (!localIp.empty()) {
+        struct sockaddr_in localAddr{};
+        localAddr.sin_family = AF_INET;
+        localAddr.sin_port = 0;
+        if (inet_pton(AF_INET, localIp.c_str(), &localAddr.sin_addr) != 1) {
+            throw std::runtime_error("Invalid local address: " + localIp);
+        }
+        if (::bind(t.sockfd_, (struct sockaddr*)&localAddr, sizeof(localAddr)) < 0) {
+            perror("bind");
+            throw std::runtime_error("Failed to bind socket");
+        }
+    }
+    // 连上对端, 内核只把对端地址来的包交上来, 别的主机发的 ACK 进不来
+    if (::connect(t.sockfd_, (struct sockaddr*)&t.remoteAddr_, sizeof(t.remoteAddr_)) < 0) {
+        perror("connect");
+        throw std::runtime_error("Failed to connect socket to " + remoteIp);
+    }
+    t.connected_ = true;
+    return t;
+}
+
+UdpTransport UdpTransport::bind(int localPort) {
+    UdpTransport t;
+    struct sockaddr_in localAddr{};
+    localAddr.sin_family = AF_INET;
+    localAddr.sin_addr.s_addr = INADDR_ANY;
+    localAddr.sin_port = htons(localPort);
+
+    if (::bind(t.sockfd_, (struct sockaddr*)&localAddr, sizeof(localAddr)) < 0) {
+        perror("bind");
+        throw std::runtime_error("Failed to bind socket");
+    }
+    // 收包时带上 TOS, 接收端据此统计 ECN 标记
+    int on = 1;
+    if (setsockopt(t.sockfd_, IPPROTO_IP, IP_RECVTOS, &on, sizeof(on)) < 0) {
+        perror("setsockopt IP_RECVTOS");
+    }
+    return t;
+}
+
+bool UdpTransport::send(const uint8_t* data, size_t len) {
+    if (!connected_) return sendTo(data, len, remoteAddr_);
+    if (::send(sockfd_, data, len, 0) < 0) {
+        // 对端端口没开时内核回的 ICMP 会让下一次发送报错, 和丢包一样交给重传
+        if (errno != ECONNREFUSED) perror("send");
+        return false;
+    }
+    return true;
+}
+
+bool UdpTransport::sendMarked(const uint8_t* data, size_t len, uint8_t tos) {
+    // 一个 socket 上逐包打不同标记, 用 IP_TOS 控制消息而不是 setsockopt
+    struct iovec iov = {const_cast<uint8_t*>(data), len};
+    char control[CMSG_SPACE(sizeof(int))] = {};
+
+    struct msghdr msg{};
+    msg.msg_name = connected_ ? nullptr : &remoteAddr_;
+    msg.msg_namelen = connected_ ? 0 : sizeof(remoteAddr_);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = IPPROTO_IP;
+    cmsg->cmsg_type = IP_TOS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    int value = tos;
+    std::memcpy(CMSG_DATA(cmsg), &value, sizeof(value));
+
+    if (sendmsg(sockfd_, &msg, 0) < 0) {
+        if (errno != ECONNREFUSED) perror("sendmsg");
+        return false;
+    }
+    return true;
+}
+
+bool UdpTransport::sendTo(const uint8_t* data, size_t len, const struct sockaddr_in& to) {
+    ssize_t sent = sendto(sockfd_, data, len, 0, (const struct sockaddr*)&to, sizeof(to));
+    if (sent < 0) {
+        perror("sendto");
+        return false;
+    }
+    return true;
+}
+
+ssize_t UdpTransport::recvMarked(uint8_t* buf, size_t len, int timeoutMs, struct sockaddr_in* from,
+                                 uint8_t* tos) {
+    if (tos) *tos = 0;
+    if (timeoutMs > 0) {
+        struct pollfd pfd = {sockfd_, POLLIN, 0};
+        if (poll(&pfd, 1, timeoutMs) <= 0) return -1;
+    }
+    int flags = timeoutMs == 0 ? MSG_DONTWAIT : 0;
+    while (true) {
+        struct iovec iov = {buf, len};
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        struct msghdr msg{};
+        msg.msg_name = from;
+        msg.msg_namelen = from ? sizeof(struct sockaddr_in) : 0;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(sockfd_, &msg, flags);
+        if (n < 0) return n;
+        if (msg.msg_flags & MSG_TRUNC) {
+            // 比缓冲区大的包整个丢掉, 截断的密文反正过不了认证
+            truncated_++;
+            if (timeoutMs > 0) flags = MSG_DONTWAIT; // 等待时间已经用掉了
+            continue;
+        }
+        if (tos) {
+            for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                // Linux 对 IP_TOS 回的是 1 字节
+                if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TOS) {
+                    *tos = *CMSG_DATA(cmsg);
+                }
+            }
+        }
+        return n;
+    }
+}
+
+ssize_t UdpTransport::recvFrom(uint8_t* buf, size_t len, int timeoutMs, struct sockaddr_in* from) {
+    if (timeoutMs > 0) {
+        struct pollfd pfd = {sockfd_, POLLIN, 0};
+        if (poll(&pfd, 1, timeoutMs) <= 0) return -1;
+    }
+    int flags = timeoutMs == 0 ? MSG_DONTWAIT : 0;
+    while (true) {
+        // 带 MSG_TRUNC 时返回数据报的实际长度, 超过 len 说明被截断了
+        socklen_t addrLen = sizeof(struct sockaddr_in);
+        ssize_t n = recvfrom(sockfd_, buf, len, flags | MSG_TRUNC,
+                             (struct sockaddr*)from, from ? &addrLen : nullptr);
+        if (n < 0 || static_cast<size_t>(n) <= len) return n;
+        truncated_++;
+        if (timeoutMs > 0) flags = MSG_DONTWAIT;
+    }
+}
+
+void UdpTransport::setMaxDatagram(size_t maxDatagram) {
+    // 内核按包的实际占用记账, 默认的接收缓冲放不下几个 64 KB 的包。
+    // 超过 net.core.rmem_max 的部分会被内核静默截掉
+    int want = static_cast<int>(std::min<size_t>(maxDatagram * RCVBUF_DATAGRAMS, INT_MAX / 2));
+    int have = 0;
+    socklen_t optLen = sizeof(have);
+    // 读回来的是内核加倍后的值
+    if (getsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF, &have, &optLen) == 0 && have / 2 >= want) return;
+    if (setsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF, &want, sizeof(want)) < 0) {
+        perror("setsockopt SO_RCVBUF");
+    }
+}
+
+DatagramRing::DatagramRing(uint64_t mask, uint64_t maxDatagram)
+    : mask_(mask), maxDatagram_(maxDatagram), head_(0), tail_(0)
+{
+    for (uint64_t i = 0; i <= mask_; i++) {
+        new (&slots()[i]) Slot();
+        slots()[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
+
+static uint64_t roundUpPow2(size_t n) {
+    uint64_t v = 1;
+    while (v < n) v <<= 1;
+    return v;
+}
+
+size_t DatagramRing::bytesFor(size_t capacity, size_t maxDatagram) {
+    uint64_t n = roundUpPow2(capacity);
+    return sizeof(DatagramRing) + n * sizeof(Slot) + n * maxDatagram;
+}
+
+DatagramRing* DatagramRing::create(void* mem, size_t capacity, size_t maxDatagram) {
+    return new (mem) DatagramRing(roundUpPow2(capacity) - 1, maxDatagram);
+}
+
+static std::shared_ptr<DatagramRing> makeHeapRing(size_t capacity, size_t maxDatagram) {
+    void* mem = ::operator new(DatagramRing::bytesFor(capacity, maxDatagram), std::align_val_t(64));
+    return std::shared_ptr<DatagramRing>(DatagramRing::create(mem, capacity, maxDatagram),
+        [](DatagramRing* ring) { ::operator delete(ring, std::align_val_t(64)); });
+}
+
+std::pair<LoopbackTransport, LoopbackTransport> LoopbackTransport::pair(size_t capacity, size_t maxDatagram) {
+    auto a = makeHeapRing(capacity, maxDatagram);
+    auto b = makeHeapRing(capacity, maxDatagram);
+    return {LoopbackTransport(a, b), LoopbackTransport(b, a)};
+}
+
+ssize_t LoopbackTransport::recv(uint8_t* buf, size_t len, int timeoutMs) {
+    ssize_t n = rx_->pop(buf, len);
+    if (n >= 0 || timeoutMs == 0) return n;
+
+    // 没有 fd 可等, 先自旋再让出 CPU
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    for (unsigned spins = 0; ; spins++) {
+        n = rx_->pop(buf, len);
+        if (n >= 0) return n;
+        if (spins < 1024) continue;
+        if (timeoutMs > 0 && std::chrono::steady_clock::now() >= deadline) return -1;
+        std::this_thread::yield();
+    }
+}
@@ -0,0 +1,198 @@
+#pragma once
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 默认的最大数据报 (UDP 载荷): 1500 字节 MTU 减去 IPv4 头 20 字节和 UDP 头 8 字节,
+// 不会在路上分片; 回环和巨帧路径可以放大到 UDP 上限
+constexpr size_t DEFAULT_MAX_DATAGRAM = 1472;
+constexpr size_t MAX_UDP_DATAGRAM = 65507;
+
+// 数据报传输抽象。SecureUdpSender/SecureUdpReceiver 只通过它收发,
+// 协议和加密层因此可以脱离内核单独压测。具体实现都标了 final,
+// 作为 secure_udp 模板的 Transport 策略使用时不会走虚调用。
+class Transport {
+public:
+    virtual ~Transport() = default;
+
+    virtual bool send(const uint8_t* data, size_t len) = 0;
+
+    // 带 IP TOS (DSCP/ECN) 标记发送, 不支持标记的传输照常发
+    virtual bool sendMarked(const uint8_t* data, size_t len, uint8_t tos) {
+        (void)tos;
+        return send(data, len);
+    }
+
+    // 延迟敏感的包: 多路径传输在每条路径上各发一份, 其他传输等同 sendMarked
+    virtual bool sendRedundant(const uint8_t* data, size_t len, uint8_t tos) {
+        return tos ? sendMarked(data, len, tos) : send(data, len);
+    }
+
+    // timeoutMs < 0 一直等, 0 不等, > 0 最多等这么久; 没有数据返回 -1
+    virtual ssize_t recv(uint8_t* buf, size_t len, int timeoutMs) = 0;
+
+    // 可交给 epoll 的描述符, 没有则为 -1
+    virtual int fd() const = 0;
+
+    // 链路本身不出主机且对端按策略放弃了加密时返回 false, 收发两端都跳过 AES-GCM
+    virtual bool requiresEncryption() const { return true; }
+
+    // 要么按序送达要么 send() 当场失败, 发送端不必留包等 ACK
+    virtual bool reliable() const { return false; }
+
+    // 这条通道上的包带来源地址 (UDP), 接收端能据此分辨同一端口上的几个发送端。
+    // 不带时 (共享内存环、回环) 所有发送端看起来都来自同一个空地址,
+    // 发送端因此每个包都带长包头, 接收端也不收短包头
+    virtual bool hasSourceAddress() const { return false; }
+
+    // 带来源地址的收发, 接收端据此给发送方回 ACK; 没有地址概念的传输忽略地址
+    virtual ssize_t recvFrom(uint8_t* buf, size_t len, int timeoutMs, struct sockaddr_in* from) {
+        if (from) *from = {};
+        return recv(buf, len, timeoutMs);
+    }
+    virtual bool sendTo(const uint8_t* data, size_t len, const struct sockaddr_in& to) {
+        (void)to;
+        return send(data, len);
+    }
+
+    // 同 recvFrom, 另外取回该包的 IP TOS 字节 (ECN 码点在低两位); 拿不到时为 0
+    virtual ssize_t recvMarked(uint8_t* buf, size_t len, int timeoutMs, struct sockaddr_in* from, uint8_t* tos) {
+        if (tos) *tos = 0;
+        return recvFrom(buf, len, timeoutMs, from);
+    }
+
+    // 接收端打算收的最大数据报, 传输据此调整内核缓冲; 收包缓冲仍由调用方给
+    virtual void setMaxDatagram(size_t maxDatagram) { (void)maxDatagram; }
+    // 比调用方缓冲区大、被整个丢掉的数据报数; 截断的包不会交给调用方
+    virtual uint64_t truncated() const { return 0; }
+};
+
+class UdpTransport final : public Transport {
+public:
+    // 发送端: connect 到对端地址, 只收对端发回的包; 给了 localIp 就从该本地地址发出, 用来选择出口网卡
+    static UdpTransport connect(const std::string& remoteIp, int remotePort,
+                                const std::string& localIp = "");
+    // 接收端: 绑定本地端口
+    static UdpTransport bind(int localPort);
+
+    UdpTransport(UdpTransport&& other) noexcept;
+    UdpTransport(const UdpTransport&) = delete;
+    UdpTransport& operator=(const UdpTransport&) = delete;
+    ~UdpTransport() override;
+
+    bool send(const uint8_t* data, size_t len) override;
+    bool sendMarked(const uint8_t* data, size_t len, uint8_t tos) override;
+    ssize_t recv(uint8_t* buf, size_t len, int timeoutMs) override {
+        return recvFrom(buf, len, timeoutMs, nullptr);
+    }
+    int fd() const override { return sockfd_; }
+    bool hasSourceAddress() const override { return true; }
+
+    ssize_t recvFrom(uint8_t* buf, size_t len, int timeoutMs, struct sockaddr_in* from) override;
+    bool sendTo(const uint8_t* data, size_t len, const struct sockaddr_in& to) override;
+    ssize_t recvMarked(uint8_t* buf, size_t len, int timeoutMs, struct sockaddr_in* from, uint8_t* tos) override;
+    void setMaxDatagram(size_t maxDatagram) override;
+    uint64_t truncated() const override { return truncated_; }
+
+private:
+    UdpTransport();
+
+    int sockfd_;
+    struct sockaddr_in remoteAddr_;
+    bool connected_;
+    uint64_t truncated_;    // 只在收包线程里改
+};
+
+// 有界无锁 MPMC 环 (Vyukov), 每个槽位放一个数据报。
+// 槽位和数据区紧跟在对象后面, 整块内存不含指针, 可以放进跨进程的共享内存。
+class DatagramRing {
+public:
+    static size_t bytesFor(size_t capacity, size_t maxDatagram);
+    // 在 mem 上原地构造, mem 至少 bytesFor() 字节且 64 字节对齐
+    static DatagramRing* create(void* mem, size_t capacity, size_t maxDatagram);
+
+    bool push(const uint8_t* data, size_t len) {
+        if (len > maxDatagram_) return false;
+        uint64_t pos = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots()[pos & mask_];
+            uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            int64_t diff = static_cast<int64_t>(seq - pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    std::memcpy(payload() + (pos & mask_) * maxDatagram_, data, len);
+                    slot.len = len;
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // 满了, 和 UDP 一样直接丢
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    ssize_t pop(uint8_t* buf, size_t len) {
+        uint64_t pos = head_.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots()[pos & mask_];
+            uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            int64_t diff = static_cast<int64_t>(seq - (pos + 1));
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    // 放不进调用方缓冲区的包整个丢掉, 不交出截断的数据
+                    size_t n = slot.len;
+                    if (n <= len) std::memcpy(buf, payload() + (pos & mask_) * maxDatagram_, n);
+                    slot.seq.store(pos + mask_ + 1, std::memory_order_release);
+                    if (n <= len) return static_cast<ssize_t>(n);
+                    pos++;
+                }
+            } else if (diff < 0) {
+                return -1;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        uint64_t len;
+    };
+
+    DatagramRing(uint64_t mask, uint64_t maxDatagram);
+
+    Slot* slots() { return reinterpret_cast<Slot*>(reinterpret_cast<uint8_t*>(this) + sizeof(DatagramRing)); }
+    uint8_t* payload() { return reinterpret_cast<uint8_t*>(slots() + mask_ + 1); }
+
+    uint64_t mask_;
+    uint64_t maxDatagram_;
+    alignas(64) std::atomic<uint64_t> head_;
+    alignas(64) std::atomic<uint64_t> tail_;
+};
+
+// 进程内直连的传输, 一对实例通过两个无锁环互相收发, 不经过内核
+class LoopbackTransport final : public Transport {
+public:
+    static std::pair<LoopbackTransport, LoopbackTransport> pair(size_t capacity = 1024,
+                                                                size_t maxDatagram = DEFAULT_MAX_DATAGRAM);
+
+    bool send(const uint8_t* data, size_t len) override { return tx_->push(data, len); }
+    ssize_t recv(uint8_t* buf, size_t len, int timeoutMs) override;
+    int fd() const override { return -1; }
+
+private:
+    LoopbackTransport(std::shared_ptr<DatagramRing> tx, std::shared_ptr<DatagramRing> rx)
+        : tx_(std::move(tx)), rx_(std::move(rx)) {}
+
+    std::shared_ptr<DatagramRing> tx_;
+    std::shared_ptr<DatagramRing> rx_;
+};
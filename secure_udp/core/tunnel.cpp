@@ -0,0 +1,168 @@
+#include "tunnel.h"
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+// 读线程 poll 的超时, 决定 stop() 最多等多久
+static constexpr int READ_POLL_MS = 100;
+
+// ---------------- TUN 设备 ----------------
+
+TunDevice::TunDevice(const std::string& name, size_t queues) {
+    if (queues == 0 || name.size() >= IFNAMSIZ) {
+        throw std::runtime_error("Invalid TUN device parameters");
+    }
+    for (size_t i = 0; i < queues; i++) {
+        int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+            perror("open /dev/net/tun");
+            for (int f : fds_) close(f);
+            throw std::runtime_error("Failed to open /dev/net/tun");
+        }
+        struct ifreq ifr{};
+        ifr.ifr_flags = IFF_TUN | IFF_NO_PI | (queues > 1 ? IFF_MULTI_QUEUE : 0);
+        // 后面的队列挂到第一个队列拿到的名字上
+        std::string want = fds_.empty() ? name : name_;
+        std::strncpy(ifr.ifr_name, want.c_str(), IFNAMSIZ - 1);
+        if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+            perror("ioctl TUNSETIFF");
+            close(fd);
+            for (int f : fds_) close(f);
+            throw std::runtime_error("Failed to attach TUN device " + want);
+        }
+        if (fds_.empty()) name_ = ifr.ifr_name;
+        fds_.push_back(fd);
+    }
+}
+
+TunDevice::~TunDevice() {
+    for (int fd : fds_) close(fd);
+}
+
+void TunDevice::up(size_t mtu) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        throw std::runtime_error("Failed to create socket");
+    }
+    struct ifreq ifr{};
+    std::strncpy(ifr.ifr_name, name_.c_str(), IFNAMSIZ - 1);
+    ifr.ifr_mtu = static_cast<int>(mtu);
+    bool ok = ioctl(sock, SIOCSIFMTU, &ifr) == 0;
+    if (!ok) perror("ioctl SIOCSIFMTU");
+    if (ok && (ok = ioctl(sock, SIOCGIFFLAGS, &ifr) == 0)) {
+        ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+        ok = ioctl(sock, SIOCSIFFLAGS, &ifr) == 0;
+        if (!ok) perror("ioctl SIOCSIFFLAGS");
+    }
+    close(sock);
+    if (!ok) {
+        throw std::runtime_error("Failed to bring up " + name_);
+    }
+}
+
+// ---------------- 隧道 ----------------
+
+Tunnel::Tunnel(const TunnelOptions& options)
+    : options_(options), tun_(options.device, options.queues), running_(false)
+{
+    if (options_.mtu == 0) options_.mtu = DEFAULT_MTU;
+    // 一个 TUN 包加上最长包头和 TAG 要放得进一个数据报
+    size_t datagram = std::max(DEFAULT_MAX_DATAGRAM, options_.mtu + wire::MAX_HEADER_LEN + wire::TAG_LEN);
+    if (datagram > MAX_UDP_DATAGRAM) {
+        throw std::runtime_error("Tunnel MTU too large");
+    }
+    tun_.up(options_.mtu);
+
+    for (size_t i = 0; i < tun_.queues(); i++) {
+        auto q = std::make_unique<Queue>();
+        q->sender = std::make_unique<SecureUdpSender>(options_.peerIp, options_.peerPort + static_cast<int>(i));
+        q->sender->setMaxDatagram(datagram);
+        q->stream = q->sender->openNackStream(options_.deadline, Priority::Normal);
+
+        q->receiver = std::make_unique<SecureUdpReceiver>(options_.localPort + static_cast<int>(i));
+        q->receiver->setMaxDatagram(datagram);
+        q->receiver->setNackDeadline(options_.deadline);
+        queues_.push_back(std::move(q));
+    }
+}
+
+Tunnel::~Tunnel() {
+    stop();
+}
+
+void Tunnel::start() {
+    if (running_) return;
+    running_ = true;
+    for (size_t i = 0; i < queues_.size(); i++) {
+        Queue& q = *queues_[i];
+        int fd = tun_.fd(i);
+        // 对端发送端的 NACK 流和本端一样是它打开的第一个流; 写回收包的同一个队列
+        q.receiver->setStreamHandler(q.stream, [&q, fd](const std::string& packet) {
+            // TUN 写满时和网卡一样丢包, 不阻塞接收线程
+            if (write(fd, packet.data(), packet.size()) < 0) {
+                q.dropped++;
+                return;
+            }
+            q.received++;
+        });
+        q.receiver->start([](const std::string&) {});
+        q.reader = std::thread(&Tunnel::readLoop, this, i);
+    }
+}
+
+void Tunnel::stop() {
+    if (!running_) return;
+    running_ = false;
+    for (auto& q : queues_) {
+        if (q->reader.joinable()) q->reader.join();
+        q->receiver->stop();
+        q->receiver->setStreamHandler(q->stream, nullptr);
+        q->sender->stop();
+    }
+}
+
+// 一个 TUN 队列的读线程: 有包就连读一批, 逐个交给发送端加密入队
+void Tunnel::readLoop(size_t index) {
+    Queue& q = *queues_[index];
+    int fd = tun_.fd(index);
+    std::vector<uint8_t> buffer(options_.mtu);
+
+    while (running_) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, READ_POLL_MS) <= 0) continue;
+
+        for (size_t i = 0; i < READ_BATCH; i++) {
+            ssize_t n = read(fd, buffer.data(), buffer.size());
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EINTR) perror("read tun");
+                break;
+            }
+            if (n == 0) continue;
+            if (q.sender->send(q.stream, buffer.data(), static_cast<size_t>(n))) {
+                q.sent++;
+            } else {
+                q.dropped++;
+            }
+        }
+    }
+}
+
+Tunnel::Stats Tunnel::stats() const {
+    Stats s;
+    for (const auto& q : queues_) {
+        s.sentPackets += q->sent;
+        s.receivedPackets += q->received;
+        s.droppedPackets += q->dropped;
+    }
+    return s;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "receiver.h"
+#include "sender.h"
+#include "wire.h"
+
+// Linux TUN 设备 (IFF_TUN | IFF_NO_PI), 读写的是裸 IP 包。
+// 多队列时同名设备打开 queues 次, 内核按流哈希把出站包分到各队列, 同一条流不会乱序
+class TunDevice {
+public:
+    // name 为空由内核分配; 需要 CAP_NET_ADMIN
+    explicit TunDevice(const std::string& name, size_t queues = 1);
+    ~TunDevice();
+
+    TunDevice(const TunDevice&) = delete;
+    TunDevice& operator=(const TunDevice&) = delete;
+
+    const std::string& name() const { return name_; }
+    size_t queues() const { return fds_.size(); }
+    // 非阻塞的队列描述符
+    int fd(size_t queue) const { return fds_[queue]; }
+
+    // 设 MTU 并拉起接口; 地址和路由留给 ip 命令配置
+    void up(size_t mtu);
+
+private:
+    std::string name_;
+    std::vector<int> fds_;
+};
+
+struct TunnelOptions {
+    std::string device;
+    size_t queues = 1;
+    // 队列 i 在 localPort + i 上收, 发往 peerPort + i; 两端队列数要一致
+    int localPort = 0;
+    std::string peerIp;
+    int peerPort = 0;
+    // 0 取 Tunnel::DEFAULT_MTU
+    size_t mtu = 0;
+    // 丢了的包在这么久内还能靠 NACK 补回, 再晚就交给内层协议自己重传
+    std::chrono::milliseconds deadline{50};
+};
+
+// 站点间的 IP 隧道。每个 TUN 队列配一对发送端/接收端和各自的 UDP 端口:
+// 一个线程批量读 TUN 队列、加密发出, 接收端线程解密后写回同一个队列。
+// 不同队列的流量走不同的五元组, 两端网卡的 RSS 也能把它们分到不同的核。
+// 隧道包走 NACK 流: 不受窗口限制, 不会因为等重传卡住后面的包 (避免 TCP over TCP)。
+class Tunnel {
+public:
+    // 默认最大数据报 (1500 字节的外层 MTU 减去 IP/UDP 头) 减去最长包头和 TAG
+    static constexpr size_t DEFAULT_MTU = DEFAULT_MAX_DATAGRAM - wire::MAX_HEADER_LEN - wire::TAG_LEN;
+    // 读线程一次醒来最多连读这么多个包再看停止标志
+    static constexpr size_t READ_BATCH = 64;
+
+    explicit Tunnel(const TunnelOptions& options);
+    ~Tunnel();
+
+    Tunnel(const Tunnel&) = delete;
+    Tunnel& operator=(const Tunnel&) = delete;
+
+    const TunDevice& device() const { return tun_; }
+
+    void start();
+    void stop();
+
+    struct Stats {
+        uint64_t sentPackets = 0;       // 从 TUN 读出并加密发出的
+        uint64_t receivedPackets = 0;   // 解密后写回 TUN 的
+        uint64_t droppedPackets = 0;    // 发送失败或 TUN 写不进去的
+    };
+    Stats stats() const;
+
+private:
+    struct Queue {
+        std::unique_ptr<SecureUdpSender> sender;
+        std::unique_ptr<SecureUdpReceiver> receiver;
+        uint16_t stream = 0;
+        std::thread reader;
+        std::atomic<uint64_t> sent{0};
+        std::atomic<uint64_t> received{0};
+        std::atomic<uint64_t> dropped{0};
+    };
+
+    void readLoop(size_t index);
+
+    TunnelOptions options_;
+    TunDevice tun_;
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::atomic<bool> running_;
+};
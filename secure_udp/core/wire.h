@@ -0,0 +1,387 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "../crypto/aes_gcm.h"
+#include "codec.h"
+
+// SecureUdpSender / SecureUdpReceiver 的线上格式, 收发两端和多路径传输共用。
+//
+// 短包头: [FLAGS(1B)][ROUTE(4B)?][PN(1-4B)][STREAM(2B)?][DELTA_TS(4B)?][CIPHERTEXT][TAG(16B)]
+// 长包头: ROUTE 后多 [VERSION(1B)][SESSION(6B)], 发送端收到第一个 ACK 之前一直带着,
+// 之后对端长时间没有回音时也重新带上。
+// ROUTE 给中继选下一跳, 紧跟 FLAGS 以便不解析其余部分就能读到。
+// AAD 是 [FLAGS & AAD_FLAGS_MASK][ROUTE(4B)?]: 中继没有密钥, 改了路由号或
+// COMPRESSED 位的包到终点过不了认证。PN 长度等其余位重传时会改写, 不进 AAD。
+//
+// PN 是流内序号的低位, 接收端按该流已收到的最大序号还原。
+// NONCE 不上线, 两端各自拼成 [SESSION(6B)][STREAM(2B)][SEQ(4B)],
+// 改动 PN 或 STREAM 会让解密失败, 相当于它们也被认证了。
+// 各定长部分的布局见下面的 Layout 定义, 编解码由 codec.h 生成。
+namespace wire {
+
+constexpr uint8_t VERSION = 2;
+
+constexpr uint8_t FLAG_PN_LEN_MASK = 0x03;     // PN 字节数 - 1
+constexpr uint8_t FLAG_STREAM = 0x04;          // 没有时为流 0
+constexpr uint8_t FLAG_TIMESTAMP = 0x08;       // 距会话开始的毫秒数
+constexpr uint8_t FLAG_LONG = 0x10;
+constexpr uint8_t FLAG_COMPRESSED = 0x20;      // 载荷加密前压缩过, 见 compression.h
+constexpr uint8_t FLAG_ROUTE = 0x40;           // 带中继路由号
+constexpr uint8_t FLAG_RESERVED = 0x80;        // 和 ROUTE 同时置位是 FEC 前缀, 见 fec.h
+
+// STREAM 字段最高位表示该流按序交付, 次高位表示该流只靠 NACK 补包, 其余是流ID
+constexpr uint16_t STREAM_ORDERED_FLAG = 0x8000;
+constexpr uint16_t STREAM_NACK_FLAG = 0x4000;
+constexpr uint16_t STREAM_ID_MASK = 0x3fff;
+// 最大的流ID留给发送端的 SYNC 包, openStream 不会分出去
+constexpr uint16_t SYNC_STREAM = STREAM_ID_MASK;
+
+constexpr size_t SESSION_LEN = 6;
+constexpr size_t NONCE_LEN = 12;
+constexpr size_t TAG_LEN = 16;
+
+// 长包头在 FLAGS 之后的部分
+using LongPrefix = Layout<Field<uint8_t>, Field<uint64_t, SESSION_LEN>>;
+enum { LONG_VERSION, LONG_SESSION };
+using RouteLayout = Layout<Field<uint32_t>>;
+using StreamLayout = Layout<Field<uint16_t>>;
+using TimestampLayout = Layout<Field<uint32_t>>;
+
+// SYNC: SYNC_STREAM 上的长包头数据包, 照常加密认证, 明文是若干个 [STREAM(2B)][BASE(4B)]。
+// STREAM 带按序标志, BASE 是发送端在该流上收到的累计确认: 它之前的包对端都已交付过。
+// 发送端迟迟收不到 ACK 时发出, 丢了状态的接收端据此重新认出会话号, 从 BASE 接着收
+using SyncEntry = Layout<Field<uint16_t>, Field<uint32_t>>;
+enum { SYNC_ENTRY_STREAM, SYNC_ENTRY_BASE };
+
+// NONCE: [SESSION(6B)][STREAM(2B)][SEQ(4B)]
+using NonceLayout = Layout<Field<uint64_t, SESSION_LEN>, Field<uint16_t>, Field<uint32_t>>;
+static_assert(NonceLayout::SIZE == NONCE_LEN, "nonce layout must fill the AES-GCM nonce");
+
+// ACK 和 NACK 帧体之后都跟认证尾 [NONCE(12B)][TAG(16B)]: TAG 是空明文的 GCM 标签,
+// AAD 为 [SESSION(6B)] + 帧体, SESSION 是被确认的发送端会话号, 不上线。
+// 伪造的帧过不了认证, 别的会话的帧重放过来也过不了。
+// NONCE 为 [PREFIX(6B)][0xFFFF][COUNTER(4B)], PREFIX 由发帧的接收端随机取;
+// 数据包隐式 NONCE 的 STREAM 段不超过 STREAM_ID_MASK, 两者不会相撞。
+using ControlNonce = Layout<Field<uint64_t, SESSION_LEN>, Field<uint16_t>, Field<uint32_t>>;
+constexpr uint16_t CONTROL_NONCE_MARKER = 0xffff;
+constexpr size_t CONTROL_TRAILER_LEN = NONCE_LEN + TAG_LEN;
+static_assert(ControlNonce::SIZE == NONCE_LEN, "control nonce layout must fill the AES-GCM nonce");
+static_assert(CONTROL_NONCE_MARKER > STREAM_ID_MASK, "control nonces must not collide with data nonces");
+
+// ACK: [VERSION(1B)][STREAM(2B)][CUMULATIVE(4B)][SEQ(4B)][ECN(12B)?][DELAY(4B)?] + 认证尾,
+// CUMULATIVE 之前的包和 SEQ 本身都已收到。
+// ECN: 接收端累计收到的 [ECT0(4B)][ECT1(4B)][CE(4B)] 包数, 有这一段时 STREAM 带 ACK_ECN_FLAG。
+// SEQ 带时间戳时附上 DELAY: 接收端自己的毫秒钟减去包头 DELTA_TS, 含两端时钟的固定偏差
+using AckLayout = Layout<Field<uint8_t>, Field<uint16_t>, Field<uint32_t>, Field<uint32_t>>;
+enum { ACK_VERSION, ACK_STREAM, ACK_CUMULATIVE, ACK_SEQ };
+using AckEcnLayout = Layout<Field<uint32_t>, Field<uint32_t>, Field<uint32_t>>;
+enum { ECN_ECT0, ECN_ECT1, ECN_CE };
+using AckDelayLayout = Layout<Field<uint32_t>>;
+constexpr uint16_t ACK_ECN_FLAG = 0x8000;
+constexpr size_t ACK_LEN = AckLayout::SIZE;
+// 含认证尾
+constexpr size_t MAX_ACK_LEN = ACK_LEN + AckEcnLayout::SIZE + AckDelayLayout::SIZE + CONTROL_TRAILER_LEN;
+
+// IP TOS 字节低两位的 ECN 码点
+constexpr uint8_t ECN_MASK = 0x03;
+constexpr uint8_t ECN_NOT_ECT = 0x00;
+constexpr uint8_t ECN_ECT1_CODE = 0x01;
+constexpr uint8_t ECN_ECT0_CODE = 0x02;
+constexpr uint8_t ECN_CE_CODE = 0x03;
+
+struct EcnCounts {
+    uint32_t ect0 = 0;
+    uint32_t ect1 = 0;
+    uint32_t ce = 0;
+
+    bool any() const { return ect0 || ect1 || ce; }
+    // 按 TOS 字节计一个包
+    void count(uint8_t tos) {
+        switch (tos & ECN_MASK) {
+        case ECN_ECT0_CODE: ect0++; break;
+        case ECN_ECT1_CODE: ect1++; break;
+        case ECN_CE_CODE: ce++; break;
+        default: break;
+        }
+    }
+};
+
+// 包头长度只取决于 FLAGS, 编译期算好每种 FLAGS 的长度, 解析时一次检查
+constexpr size_t headerLength(uint8_t flags) {
+    return 1 + RouteLayout::SIZE * ((flags & FLAG_ROUTE) != 0)
+             + LongPrefix::SIZE * ((flags & FLAG_LONG) != 0)
+             + (flags & FLAG_PN_LEN_MASK) + 1
+             + StreamLayout::SIZE * ((flags & FLAG_STREAM) != 0)
+             + TimestampLayout::SIZE * ((flags & FLAG_TIMESTAMP) != 0);
+}
+
+constexpr size_t FLAG_COMBINATIONS = 0x80;
+
+constexpr std::array<uint8_t, FLAG_COMBINATIONS> makeHeaderLengths() {
+    std::array<uint8_t, FLAG_COMBINATIONS> table{};
+    for (size_t f = 0; f < FLAG_COMBINATIONS; f++) {
+        table[f] = static_cast<uint8_t>(headerLength(static_cast<uint8_t>(f)));
+    }
+    return table;
+}
+
+constexpr std::array<uint8_t, FLAG_COMBINATIONS> HEADER_LENGTHS = makeHeaderLengths();
+constexpr size_t MAX_HEADER_LEN =
+    headerLength(FLAG_ROUTE | FLAG_LONG | FLAG_PN_LEN_MASK | FLAG_STREAM | FLAG_TIMESTAMP);
+static_assert(MAX_HEADER_LEN == 22, "long header with every optional field");
+
+struct Header {
+    uint8_t flags = 0;
+    uint32_t route = 0;
+    uint8_t version = VERSION;
+    uint64_t session = 0;
+    uint32_t pn = 0;            // 截断后的值
+    uint16_t streamField = 0;
+    uint32_t deltaTs = 0;
+
+    size_t pnLen() const { return (flags & FLAG_PN_LEN_MASK) + 1u; }
+    bool hasLong() const { return flags & FLAG_LONG; }
+    bool hasRoute() const { return flags & FLAG_ROUTE; }
+    bool hasTimestamp() const { return flags & FLAG_TIMESTAMP; }
+    uint16_t stream() const { return streamField & STREAM_ID_MASK; }
+    bool ordered() const { return streamField & STREAM_ORDERED_FLAG; }
+    bool nack() const { return streamField & STREAM_NACK_FLAG; }
+};
+
+// 对端可能还没确认的序号跨度为 span 时需要几字节 PN, 保证还原时落在半窗口内
+inline size_t packetNumberLength(uint32_t span) {
+    for (size_t len = 1; len < 4; len++) {
+        if (span < (1u << (len * 8 - 1))) return len;
+    }
+    return 4;
+}
+
+// 取离 expected 最近、低位等于 truncated 的序号
+inline uint32_t decodePacketNumber(uint32_t expected, uint32_t truncated, size_t pnLen) {
+    if (pnLen >= 4) return truncated;
+    uint32_t win = 1u << (pnLen * 8);
+    uint32_t hwin = win / 2;
+    uint32_t candidate = (expected & ~(win - 1)) | truncated;
+    int32_t diff = static_cast<int32_t>(candidate - expected);
+    if (diff <= -static_cast<int32_t>(hwin)) return candidate + win;
+    if (diff > static_cast<int32_t>(hwin)) return candidate - win;
+    return candidate;
+}
+
+// 按 seq 和 pnLen 填好 flags 里的 PN 长度并写出包头, 返回包头长度。
+// out 至少 MAX_HEADER_LEN 字节。
+inline size_t encodeHeader(Header& h, uint32_t seq, size_t pnLen, uint8_t* out) {
+    h.flags = static_cast<uint8_t>((h.flags & ~FLAG_PN_LEN_MASK) | (pnLen - 1));
+    if (h.streamField != 0) h.flags |= FLAG_STREAM;
+    h.pn = pnLen >= 4 ? seq : (seq & ((1u << (pnLen * 8)) - 1));
+
+    size_t offset = 0;
+    out[offset++] = h.flags;
+    if (h.hasRoute()) {
+        RouteLayout::encode(out + offset, h.route);
+        offset += RouteLayout::SIZE;
+    }
+    if (h.hasLong()) {
+        LongPrefix::encode(out + offset, h.version, h.session);
+        offset += LongPrefix::SIZE;
+    }
+    storeLe<uint32_t>(out + offset, h.pn, pnLen);
+    offset += pnLen;
+    if (h.flags & FLAG_STREAM) {
+        StreamLayout::encode(out + offset, h.streamField);
+        offset += StreamLayout::SIZE;
+    }
+    if (h.hasTimestamp()) {
+        TimestampLayout::encode(out + offset, h.deltaTs);
+        offset += TimestampLayout::SIZE;
+    }
+    return offset;
+}
+
+// 解析包头, 格式不对或版本不支持返回 0, 否则返回包头长度
+inline size_t parseHeader(const uint8_t* data, size_t len, Header& h) {
+    if (len < 1) return 0;
+    h = Header{};
+    h.flags = data[0];
+    if (h.flags & FLAG_RESERVED) return 0;
+    size_t headerLen = HEADER_LENGTHS[h.flags];
+    if (len < headerLen) return 0;
+
+    // 长度已经检查过, 以下按偏移直接读
+    size_t offset = 1;
+    if (h.hasRoute()) {
+        h.route = RouteLayout::get<0>(data + offset);
+        offset += RouteLayout::SIZE;
+    }
+    if (h.hasLong()) {
+        h.version = LongPrefix::get<LONG_VERSION>(data + offset);
+        if (h.version != VERSION) return 0;
+        h.session = LongPrefix::get<LONG_SESSION>(data + offset);
+        offset += LongPrefix::SIZE;
+    }
+    h.pn = loadLe<uint32_t>(data + offset, h.pnLen());
+    offset += h.pnLen();
+    if (h.flags & FLAG_STREAM) {
+        h.streamField = StreamLayout::get<0>(data + offset);
+        offset += StreamLayout::SIZE;
+    }
+    if (h.hasTimestamp()) {
+        h.deltaTs = TimestampLayout::get<0>(data + offset);
+    }
+    return headerLen;
+}
+
+// 中继用: 只读 FLAGS 和 ROUTE, 没有路由号返回 false
+inline bool peekRoute(const uint8_t* data, size_t len, uint32_t& route) {
+    if (len < 1 + RouteLayout::SIZE || (data[0] & (FLAG_ROUTE | FLAG_RESERVED)) != FLAG_ROUTE) return false;
+    route = RouteLayout::get<0>(data + 1);
+    return true;
+}
+
+// 数据包的 AAD 由 FLAGS 里这些位和线上的 ROUTE 字节组成
+constexpr uint8_t AAD_FLAGS_MASK = FLAG_COMPRESSED | FLAG_ROUTE;
+constexpr size_t MAX_AAD_LEN = 1 + RouteLayout::SIZE;
+
+// 按 packet 开头的 FLAGS 和 ROUTE 填好 aad (至少 MAX_AAD_LEN 字节), 返回长度
+inline size_t makeAad(const uint8_t* packet, uint8_t* aad) {
+    aad[0] = packet[0] & AAD_FLAGS_MASK;
+    if (!(packet[0] & FLAG_ROUTE)) return 1;
+    std::memcpy(aad + 1, packet + 1, RouteLayout::SIZE);
+    return MAX_AAD_LEN;
+}
+
+inline void makeNonce(uint64_t session, uint16_t stream, uint32_t seq, uint8_t* nonce) {
+    NonceLayout::encode(nonce, session, stream, seq);
+}
+
+struct Ack {
+    uint16_t stream = 0;
+    uint32_t cumulative = 0;
+    uint32_t seq = 0;
+    bool hasDelay = false;
+    uint32_t delay = 0;
+    bool hasEcn = false;
+    EcnCounts ecn;
+};
+
+// out 至少 MAX_ACK_LEN 字节, 返回帧体长度, 认证尾由 sealControl 追加
+inline size_t encodeAck(const Ack& ack, uint8_t* out) {
+    uint16_t streamField = ack.hasEcn ? static_cast<uint16_t>(ack.stream | ACK_ECN_FLAG) : ack.stream;
+    AckLayout::encode(out, VERSION, streamField, ack.cumulative, ack.seq);
+    size_t len = ACK_LEN;
+    if (ack.hasEcn) {
+        AckEcnLayout::encode(out + len, ack.ecn.ect0, ack.ecn.ect1, ack.ecn.ce);
+        len += AckEcnLayout::SIZE;
+    }
+    if (ack.hasDelay) {
+        AckDelayLayout::encode(out + len, ack.delay);
+        len += AckDelayLayout::SIZE;
+    }
+    return len;
+}
+
+// data 是 openControl 认证过的帧体
+inline bool parseAck(const uint8_t* data, size_t len, Ack& ack) {
+    if (len < ACK_LEN || AckLayout::get<ACK_VERSION>(data) != VERSION) return false;
+    uint16_t streamField = AckLayout::get<ACK_STREAM>(data);
+    if (streamField & STREAM_NACK_FLAG) return false;
+    ack = Ack{};
+    ack.hasEcn = streamField & ACK_ECN_FLAG;
+    size_t fixed = ACK_LEN + (ack.hasEcn ? AckEcnLayout::SIZE : 0);
+    if (len < fixed) return false;
+    size_t rest = len - fixed;
+    if (rest != 0 && rest != AckDelayLayout::SIZE) return false;
+
+    ack.stream = streamField & STREAM_ID_MASK;
+    ack.cumulative = AckLayout::get<ACK_CUMULATIVE>(data);
+    ack.seq = AckLayout::get<ACK_SEQ>(data);
+    size_t offset = ACK_LEN;
+    if (ack.hasEcn) {
+        ack.ecn.ect0 = AckEcnLayout::get<ECN_ECT0>(data + offset);
+        ack.ecn.ect1 = AckEcnLayout::get<ECN_ECT1>(data + offset);
+        ack.ecn.ce = AckEcnLayout::get<ECN_CE>(data + offset);
+        offset += AckEcnLayout::SIZE;
+    }
+    ack.hasDelay = rest == AckDelayLayout::SIZE;
+    if (ack.hasDelay) ack.delay = AckDelayLayout::get<0>(data + offset);
+    return true;
+}
+
+// NACK: [VERSION(1B)][STREAM(2B)][COUNT(1B)][SEQ(4B) * COUNT] + 认证尾, STREAM 带 STREAM_NACK_FLAG 和 ACK 区分
+using NackPrefix = Layout<Field<uint8_t>, Field<uint16_t>, Field<uint8_t>>;
+enum { NACK_VERSION, NACK_STREAM, NACK_COUNT };
+constexpr size_t MAX_NACK_SEQS = 64;
+// 含认证尾
+constexpr size_t MAX_NACK_LEN = NackPrefix::SIZE + MAX_NACK_SEQS * 4 + CONTROL_TRAILER_LEN;
+
+// seqs 最多 MAX_NACK_SEQS 个, out 至少 MAX_NACK_LEN 字节, 返回帧体长度
+inline size_t encodeNack(uint16_t stream, const uint32_t* seqs, size_t count, uint8_t* out) {
+    NackPrefix::encode(out, VERSION, static_cast<uint16_t>(stream | STREAM_NACK_FLAG),
+                       static_cast<uint8_t>(count));
+    for (size_t i = 0; i < count; i++) storeLe<uint32_t>(out + NackPrefix::SIZE + i * 4, seqs[i]);
+    return NackPrefix::SIZE + count * 4;
+}
+
+// data 是认证过的帧体。不是 NACK 返回 false; 是的话 seqs 指向 count 个小端序号
+inline bool parseNack(const uint8_t* data, size_t len, uint16_t& stream, const uint8_t*& seqs, size_t& count) {
+    if (len < NackPrefix::SIZE || NackPrefix::get<NACK_VERSION>(data) != VERSION) return false;
+    uint16_t field = NackPrefix::get<NACK_STREAM>(data);
+    if (!(field & STREAM_NACK_FLAG)) return false;
+    count = NackPrefix::get<NACK_COUNT>(data);
+    if (count > MAX_NACK_SEQS || len != NackPrefix::SIZE + count * 4) return false;
+    stream = field & STREAM_ID_MASK;
+    seqs = data + NackPrefix::SIZE;
+    return true;
+}
+
+// 控制帧 (ACK/NACK) 的 NONCE 来源: 每个接收端一个随机 PREFIX 加计数器,
+// 计数器每转一圈 PREFIX 加一
+class ControlNonceSource {
+public:
+    ControlNonceSource() : prefix_(0), counter_(0) {
+        uint8_t random[NONCE_LEN];
+        aes_gcm_random_nonce(random);
+        prefix_ = loadLe<uint64_t, SESSION_LEN>(random);
+    }
+
+    void next(uint8_t* nonce) {
+        uint64_t c = counter_.fetch_add(1, std::memory_order_relaxed);
+        uint64_t prefix = (prefix_ + (c >> 32)) & ((uint64_t(1) << (SESSION_LEN * 8)) - 1);
+        ControlNonce::encode(nonce, prefix, CONTROL_NONCE_MARKER, static_cast<uint32_t>(c));
+    }
+
+private:
+    uint64_t prefix_;
+    std::atomic<uint64_t> counter_;
+};
+
+constexpr size_t MAX_CONTROL_BODY = (MAX_ACK_LEN > MAX_NACK_LEN ? MAX_ACK_LEN : MAX_NACK_LEN) - CONTROL_TRAILER_LEN;
+
+// 给 frame 里 len 字节的帧体追加认证尾, 返回整帧长度; frame 在帧体后至少还有 CONTROL_TRAILER_LEN 字节
+inline size_t sealControl(const AesGcmContext& ctx, ControlNonceSource& nonces, uint64_t session,
+                          uint8_t* frame, size_t len) {
+    uint8_t ad[SESSION_LEN + MAX_CONTROL_BODY];
+    storeLe<uint64_t, SESSION_LEN>(ad, session);
+    std::memcpy(ad + SESSION_LEN, frame, len);
+    uint8_t* nonce = frame + len;
+    nonces.next(nonce);
+    if (!aes_gcm_encrypt(ctx, nonce, ad, SESSION_LEN + len, nullptr, 0, nullptr, nonce + NONCE_LEN)) return 0;
+    return len + CONTROL_TRAILER_LEN;
+}
+
+// 按 session 认证一个控制帧, 通过返回帧体长度, 否则返回 0
+inline size_t openControl(const AesGcmContext& ctx, uint64_t session, const uint8_t* frame, size_t len) {
+    if (len <= CONTROL_TRAILER_LEN || len - CONTROL_TRAILER_LEN > MAX_CONTROL_BODY) return 0;
+    size_t bodyLen = len - CONTROL_TRAILER_LEN;
+    uint8_t ad[SESSION_LEN + MAX_CONTROL_BODY];
+    storeLe<uint64_t, SESSION_LEN>(ad, session);
+    std::memcpy(ad + SESSION_LEN, frame, bodyLen);
+    const uint8_t* nonce = frame + bodyLen;
+    if (!aes_gcm_decrypt(ctx, nonce, ad, SESSION_LEN + bodyLen, nullptr, 0, nonce + NONCE_LEN, nullptr)) return 0;
+    return bodyLen;
+}
+
+} // namespace wire
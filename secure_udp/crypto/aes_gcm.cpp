@@ -11,15 +11,15 @@ bool aes_gcm_encrypt(const std::vector<uint8_t>& key,
         return false;
     }
 
-    if (nonce.size() != crypto_aead_aes256gcm_KEYBYTES) {
+    if (nonce.size() != crypto_aead_aes256gcm_NPUBBYTES) {
         return false;
     }
 
-    ciphertext.resize(plaintext.size() + crypto_aead_aes256gcm_KEYBYTES);
+    ciphertext.resize(plaintext.size() + crypto_aead_aes256gcm_ABYTES);
 
     unsigned long long clen{};
     if (crypto_aead_aes256gcm_encrypt(ciphertext.data(), &clen,
-                static_cast<const unsigned char*>(plaintext.data()), plaintext.size(),
+                reinterpret_cast<const unsigned char*>(plaintext.data()), plaintext.size(),
                 nullptr, 0, nullptr,
                 nonce.data(), key.data()) != 0) {
         return false;
@@ -42,7 +42,7 @@ bool aes_gcm_decrypt(const std::vector<uint8_t>& key,
         return false;
     }
 
-    if (nonce.size() != crypto_aead_aes256gcm_KEYBYTES) {
+    if (nonce.size() != crypto_aead_aes256gcm_NPUBBYTES) {
         return false;
     }
 
@@ -61,8 +61,68 @@ bool aes_gcm_decrypt(const std::vector<uint8_t>& key,
         return false;
     }
 
-    plaintext.assign(static_cast<char*>(decrypted.data(), declen));
+    plaintext.assign(reinterpret_cast<char*>(decrypted.data()), declen);
 
     return true;
 }
 
+
+static_assert(sizeof(crypto_aead_aes256gcm_state) <= sizeof(AesGcmContext::state),
+              "AesGcmContext too small for libsodium state");
+
+static const crypto_aead_aes256gcm_state* sodiumState(const AesGcmContext& ctx) {
+    return reinterpret_cast<const crypto_aead_aes256gcm_state*>(ctx.state);
+}
+
+bool aes_gcm_init(AesGcmContext& ctx, const uint8_t* key, size_t keyLen) {
+    if (keyLen != crypto_aead_aes256gcm_KEYBYTES) {
+        return false;
+    }
+    return crypto_aead_aes256gcm_beforenm(
+        reinterpret_cast<crypto_aead_aes256gcm_state*>(ctx.state), key) == 0;
+}
+
+void aes_gcm_random_nonce(uint8_t* nonce) {
+    randombytes_buf(nonce, crypto_aead_aes256gcm_NPUBBYTES);
+}
+
+bool aes_gcm_encrypt(const AesGcmContext& ctx,
+                     const uint8_t* nonce,
+                     const uint8_t* plaintext, size_t len,
+                     uint8_t* ciphertext,
+                     uint8_t* tag) {
+    return aes_gcm_encrypt(ctx, nonce, nullptr, 0, plaintext, len, ciphertext, tag);
+}
+
+bool aes_gcm_decrypt(const AesGcmContext& ctx,
+                     const uint8_t* nonce,
+                     const uint8_t* ciphertext, size_t len,
+                     const uint8_t* tag,
+                     uint8_t* plaintext) {
+    return aes_gcm_decrypt(ctx, nonce, nullptr, 0, ciphertext, len, tag, plaintext);
+}
+
+bool aes_gcm_encrypt(const AesGcmContext& ctx,
+                     const uint8_t* nonce,
+                     const uint8_t* ad, size_t adLen,
+                     const uint8_t* plaintext, size_t len,
+                     uint8_t* ciphertext,
+                     uint8_t* tag) {
+    unsigned long long tagLen{};
+    return crypto_aead_aes256gcm_encrypt_detached_afternm(ciphertext, tag, &tagLen,
+                plaintext, len,
+                ad, adLen, nullptr,
+                nonce, sodiumState(ctx)) == 0;
+}
+
+bool aes_gcm_decrypt(const AesGcmContext& ctx,
+                     const uint8_t* nonce,
+                     const uint8_t* ad, size_t adLen,
+                     const uint8_t* ciphertext, size_t len,
+                     const uint8_t* tag,
+                     uint8_t* plaintext) {
+    return crypto_aead_aes256gcm_decrypt_detached_afternm(plaintext, nullptr,
+                ciphertext, len, tag,
+                ad, adLen,
+                nonce, sodiumState(ctx)) == 0;
+}
@@ -16,3 +16,39 @@ bool aes_gcm_decrypt(const std::vector<uint8_t>& key,
                      const std::vector<uint8_t>& tag,
                      std::string& plaintext);
 
+
+// 预先展开好密钥的上下文, 热路径上不必每包都从 key 向量重新初始化
+struct AesGcmContext {
+    alignas(16) unsigned char state[512];
+};
+
+bool aes_gcm_init(AesGcmContext& ctx, const uint8_t* key, size_t keyLen);
+
+void aes_gcm_random_nonce(uint8_t* nonce);
+
+bool aes_gcm_encrypt(const AesGcmContext& ctx,
+                     const uint8_t* nonce,
+                     const uint8_t* plaintext, size_t len,
+                     uint8_t* ciphertext,
+                     uint8_t* tag);
+
+bool aes_gcm_decrypt(const AesGcmContext& ctx,
+                     const uint8_t* nonce,
+                     const uint8_t* ciphertext, size_t len,
+                     const uint8_t* tag,
+                     uint8_t* plaintext);
+
+// 带附加数据 (AAD): ad 不加密但参与认证, 解密时给的 ad 不一致就失败
+bool aes_gcm_encrypt(const AesGcmContext& ctx,
+                     const uint8_t* nonce,
+                     const uint8_t* ad, size_t adLen,
+                     const uint8_t* plaintext, size_t len,
+                     uint8_t* ciphertext,
+                     uint8_t* tag);
+
+bool aes_gcm_decrypt(const AesGcmContext& ctx,
+                     const uint8_t* nonce,
+                     const uint8_t* ad, size_t adLen,
+                     const uint8_t* ciphertext, size_t len,
+                     const uint8_t* tag,
+                     uint8_t* plaintext);
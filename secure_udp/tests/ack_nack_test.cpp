@@ -0,0 +1,75 @@
+#include "../config/config.h"
+#include "receiver.h"
+#include "sender.h"
+#include "test_util.h"
+#include <atomic>
+#include <mutex>
+#include <set>
+
+using namespace std::chrono_literals;
+
+// 没有认证尾、认证尾不对、会话号不对的 ACK 都不能确认任何包; 真正的接收端接上后全部确认
+static void testForgedAcksIgnored() {
+    auto ends = LoopbackTransport::pair();
+    auto peer = std::make_shared<LoopbackTransport>(std::move(ends.second));
+    SecureUdpSender tx(std::make_unique<LoopbackTransport>(std::move(ends.first)));
+    for (int i = 0; i < 10; i++) CHECK(tx.send("m" + std::to_string(i)));
+    std::this_thread::sleep_for(50ms);
+
+    wire::Ack ack;
+    ack.cumulative = 10;
+    ack.seq = 9;
+    uint8_t buf[wire::MAX_ACK_LEN] = {};
+    size_t len = wire::encodeAck(ack, buf);
+    peer->send(buf, len);
+    peer->send(buf, len + wire::CONTROL_TRAILER_LEN);
+    AesGcmContext ctx;
+    CHECK(aes_gcm_init(ctx, reinterpret_cast<const uint8_t*>(SHARED_KEY.data()), SHARED_KEY.size()));
+    wire::ControlNonceSource nonces;
+    peer->send(buf, wire::sealControl(ctx, nonces, 12345, buf, len));
+    std::this_thread::sleep_for(50ms);
+    CHECK(!tx.acknowledgedBefore(0, 1));
+
+    std::atomic<int> got{0};
+    SecureUdpReceiver rx(std::make_unique<SharedTransport>(peer));
+    rx.start([&](const std::string&) { got++; });
+    CHECK(waitFor([&] { return tx.acknowledgedBefore(0, 10); }));
+    CHECK(got == 10);
+    tx.stop();
+    rx.stop();
+}
+
+// 一次连丢 40 个包: 接收端的一个 NACK 列出全部 40 个序号, 发送端都要补发
+static void testLargeNack() {
+    auto ends = LoopbackTransport::pair();
+    int sent = 0;
+    auto dropBurst = [&](std::string&) {
+        sent++;
+        return sent <= 10 || sent > 50;
+    };
+    SecureUdpSender tx(std::make_unique<HookedTransport>(std::move(ends.first), dropBurst));
+    SecureUdpReceiver rx(std::make_unique<LoopbackTransport>(std::move(ends.second)));
+    uint16_t stream = tx.openNackStream(500ms);
+    rx.setNackDeadline(500ms);
+
+    std::mutex mu;
+    std::set<std::string> got;
+    rx.start([&](const std::string& m) {
+        std::lock_guard<std::mutex> lock(mu);
+        got.insert(m);
+    });
+    for (int i = 0; i < 60; i++) CHECK(tx.send(stream, "m" + std::to_string(i)));
+    CHECK(waitFor([&] {
+        std::lock_guard<std::mutex> lock(mu);
+        return got.size() == 60;
+    }));
+    tx.stop();
+    rx.stop();
+}
+
+int main() {
+    testForgedAcksIgnored();
+    testLargeNack();
+    std::cout << "ack_nack_test passed\n";
+    return 0;
+}
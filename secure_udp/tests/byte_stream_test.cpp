@@ -0,0 +1,62 @@
+#include "byte_stream.h"
+#include "test_util.h"
+#include <sys/uio.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+
+// 写端攒段发送、读端拼回连续字节: 大于读端缓冲的数据要靠读端归还空间才能发完,
+// 零拷贝读和普通读交替使用, 读到的字节和写入的一致, 关闭后读到流结束
+int main() {
+    auto ends = LoopbackTransport::pair(4096);
+    SecureUdpSender tx(std::make_unique<LoopbackTransport>(std::move(ends.first)));
+    SecureUdpReceiver rx(std::make_unique<LoopbackTransport>(std::move(ends.second)));
+    ByteStreamWriter writer(tx);
+    ByteStreamReader reader(rx, writer.stream(), 64 << 10);
+    rx.start([](const std::string&) {});
+
+    std::string content;
+    for (int i = 0; content.size() < (1 << 20); i++) content += std::to_string(i * 2654435761u) + ",";
+    std::thread producer([&] {
+        size_t off = 0;
+        while (off < content.size()) {
+            size_t n = std::min<size_t>(10000, content.size() - off);
+            off += writer.write(reinterpret_cast<const uint8_t*>(content.data()) + off, n);
+        }
+        writer.close();
+    });
+
+    std::string got;
+    uint8_t buf[3000];
+    bool usePeek = false;
+    while (true) {
+        if (usePeek) {
+            struct iovec iov[2];
+            int parts = reader.peek(iov, 2000);
+            CHECK(parts >= 0);
+            if (parts == 0) break;
+            size_t taken = 0;
+            for (int i = 0; i < parts; i++) {
+                got.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+                taken += iov[i].iov_len;
+            }
+            reader.consume(taken);
+        } else {
+            ssize_t n = reader.read(buf, sizeof(buf), 2000);
+            CHECK(n >= 0);
+            if (n == 0) break;
+            got.append(reinterpret_cast<const char*>(buf), static_cast<size_t>(n));
+        }
+        usePeek = !usePeek;
+    }
+    producer.join();
+    CHECK(reader.eof());
+    CHECK(got == content);
+
+    tx.stop();
+    rx.stop();
+    std::cout << "byte_stream_test passed\n";
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include "codec.h"
+#include "wire.h"
+#include "test_util.h"
+#include <cstring>
+#include <tuple>
+
+// codec.h 的字节序和 Layout, 以及建在它上面的 ACK/NACK 帧
+using namespace wire;
+
+static void testLittleEndianOnTheWire() {
+    uint8_t buf[8];
+    storeLe<uint32_t>(buf, 0x01020304);
+    const uint8_t expected[] = {0x04, 0x03, 0x02, 0x01};
+    CHECK(std::memcmp(buf, expected, 4) == 0);
+    CHECK(loadLe<uint32_t>(buf) == 0x01020304);
+
+    storeLe<uint16_t>(buf, 0xa1b2);
+    CHECK(buf[0] == 0xb2 && buf[1] == 0xa1);
+    CHECK(loadLe<uint16_t>(buf) == 0xa1b2);
+
+    storeLe<uint64_t>(buf, 0x0807060504030201ull);
+    for (int i = 0; i < 8; i++) CHECK(buf[i] == i + 1);
+    CHECK(loadLe<uint64_t>(buf) == 0x0807060504030201ull);
+}
+
+// 比类型窄的字段 (6 字节的会话号等) 只写低 N 字节, 不碰后面的内存
+static void testNarrowFields() {
+    uint8_t buf[8];
+    std::memset(buf, 0xee, sizeof(buf));
+    storeLe<uint64_t, 6>(buf, 0xffff060504030201ull);
+    for (int i = 0; i < 6; i++) CHECK(buf[i] == i + 1);
+    CHECK(buf[6] == 0xee && buf[7] == 0xee);
+    CHECK((loadLe<uint64_t, 6>(buf)) == 0x060504030201ull);
+
+    // 运行时宽度, 截断的 PN 走这条路
+    for (size_t n = 1; n <= 4; n++) {
+        std::memset(buf, 0xee, sizeof(buf));
+        storeLe<uint32_t>(buf, 0x44332211u, n);
+        CHECK(buf[n] == 0xee);
+        uint32_t mask = n == 4 ? 0xffffffffu : (1u << (8 * n)) - 1;
+        CHECK(loadLe<uint32_t>(buf, n) == (0x44332211u & mask));
+    }
+}
+
+static void testByteSwap() {
+    CHECK(byteSwap<uint8_t>(0x12) == 0x12);
+    CHECK(byteSwap<uint16_t>(0x1234) == 0x3412);
+    CHECK(byteSwap<uint32_t>(0x12345678u) == 0x78563412u);
+    CHECK(byteSwap<uint64_t>(0x0102030405060708ull) == 0x0807060504030201ull);
+}
+
+static void testLayout() {
+    using Sample = Layout<Field<uint8_t>, Field<uint64_t, 6>, Field<uint16_t>, Field<uint32_t>>;
+    static_assert(Sample::SIZE == 13, "sum of field sizes");
+    static_assert(Sample::offset<0>() == 0 && Sample::offset<1>() == 1, "offsets");
+    static_assert(Sample::offset<2>() == 7 && Sample::offset<3>() == 9, "offsets");
+
+    uint8_t buf[Sample::SIZE];
+    Sample::encode(buf, 2, 0x0000aabbccddeeffull, 0x3fff, 0xdeadbeef);
+    CHECK(buf[0] == 2 && buf[1] == 0xff && buf[6] == 0xaa && buf[7] == 0xff && buf[8] == 0x3f);
+    CHECK(Sample::get<1>(buf) == 0xaabbccddeeffull);
+    CHECK(Sample::get<3>(buf) == 0xdeadbeef);
+    CHECK(Sample::decode(buf) == std::make_tuple(uint8_t(2), uint64_t(0xaabbccddeeffull),
+                                                 uint16_t(0x3fff), uint32_t(0xdeadbeef)));
+    Sample::set<2>(buf, 7);
+    CHECK(Sample::get<2>(buf) == 7);
+    CHECK(Sample::get<3>(buf) == 0xdeadbeef);
+}
+
+static void testAckFrame() {
+    Ack ack;
+    ack.stream = 5;
+    ack.cumulative = 1000;
+    ack.seq = 1003;
+    ack.hasDelay = true;
+    ack.delay = 250;
+    ack.hasEcn = true;
+    ack.ecn.ect0 = 10;
+    ack.ecn.ect1 = 0;
+    ack.ecn.ce = 3;
+    uint8_t buf[MAX_ACK_LEN];
+    size_t len = encodeAck(ack, buf);
+    CHECK(len == MAX_ACK_LEN - CONTROL_TRAILER_LEN);
+
+    Ack parsed;
+    CHECK(parseAck(buf, len, parsed));
+    CHECK(parsed.stream == 5 && parsed.cumulative == 1000 && parsed.seq == 1003);
+    CHECK(parsed.hasDelay && parsed.delay == 250);
+    CHECK(parsed.hasEcn && parsed.ecn.ect0 == 10 && parsed.ecn.ce == 3);
+    CHECK(!parseAck(buf, len - 1, parsed));
+}
+
+// 超过 15 个序号的 NACK 照样完整往返
+static void testNackFrame() {
+    uint32_t seqs[40];
+    for (uint32_t i = 0; i < 40; i++) seqs[i] = 0x10000 + i * 3;
+    uint8_t buf[MAX_NACK_LEN];
+    size_t len = encodeNack(9, seqs, 40, buf);
+    CHECK(len == NackPrefix::SIZE + 40 * 4);
+
+    uint16_t stream = 0;
+    const uint8_t* p = nullptr;
+    size_t count = 0;
+    CHECK(parseNack(buf, len, stream, p, count));
+    CHECK(stream == 9 && count == 40);
+    for (size_t i = 0; i < count; i++) CHECK(loadLe<uint32_t>(p + i * 4) == seqs[i]);
+    CHECK(!parseNack(buf, len - 4, stream, p, count));
+
+    // ACK 和 NACK 靠 STREAM_NACK_FLAG 区分, 互相不会误解析
+    Ack ack;
+    CHECK(!parseAck(buf, len, ack));
+    uint8_t ackBuf[MAX_ACK_LEN];
+    size_t ackLen = encodeAck(ack, ackBuf);
+    CHECK(!parseNack(ackBuf, ackLen, stream, p, count));
+}
+
+int main() {
+    testLittleEndianOnTheWire();
+    testNarrowFields();
+    testByteSwap();
+    testLayout();
+    testAckFrame();
+    testNackFrame();
+    std::cout << "codec_test passed\n";
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include "endpoint.h"
+#include "test_util.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// 一端收到的消息, 按到达顺序
+struct Inbox {
+    std::mutex mu;
+    std::vector<std::string> got;
+
+    std::function<void(const std::string&)> sink() {
+        return [this](const std::string& m) {
+            std::lock_guard<std::mutex> lock(mu);
+            got.push_back(m);
+        };
+    }
+    bool equals(const std::vector<std::string>& want) {
+        std::lock_guard<std::mutex> lock(mu);
+        return got == want;
+    }
+    void clear() {
+        std::lock_guard<std::mutex> lock(mu);
+        got.clear();
+    }
+};
+
+std::vector<std::string> numbered(const std::string& prefix, int from, int to) {
+    std::vector<std::string> v;
+    for (int i = from; i < to; i++) v.push_back(prefix + std::to_string(i));
+    return v;
+}
+
+} // namespace
+
+// 一端重启后序号从 0 重新开始: 另一端要按新会话重新收, 不能把新包当重复丢掉,
+// 旧会话的 ACK 也不能清掉新会话的未确认包; 对端离线期间发出的消息重启后照样送到
+int main() {
+    const int portA = 39811, portB = 39812;
+    Inbox inA, inB;
+    SecureUdpEndpoint b(portB, "127.0.0.1", portA);
+    b.start(inB.sink());
+
+    auto a = std::make_unique<SecureUdpEndpoint>(portA, "127.0.0.1", portB);
+    a->start(inA.sink());
+    for (const auto& m : numbered("a", 0, 50)) CHECK(a->send(m));
+    for (const auto& m : numbered("b", 0, 50)) CHECK(b.send(m));
+    CHECK(waitFor([&] { return inB.equals(numbered("a", 0, 50)); }));
+    CHECK(waitFor([&] { return inA.equals(numbered("b", 0, 50)); }));
+    CHECK(waitFor([&] { return a->unacknowledged() == 0 && b.unacknowledged() == 0; }));
+
+    a->stop();
+    a.reset();
+    inA.clear();
+    inB.clear();
+    // A 不在时 B 发的消息留在 B 的未确认表里
+    for (const auto& m : numbered("b", 50, 60)) CHECK(b.send(m));
+
+    a = std::make_unique<SecureUdpEndpoint>(portA, "127.0.0.1", portB);
+    a->start(inA.sink());
+    for (const auto& m : numbered("a", 0, 20)) CHECK(a->send(m));
+    CHECK(waitFor([&] { return inB.equals(numbered("a", 0, 20)); }, 5s));
+    CHECK(waitFor([&] { return inA.equals(numbered("b", 50, 60)); }, 5s));
+
+    for (const auto& m : numbered("b", 60, 70)) CHECK(b.send(m));
+    CHECK(waitFor([&] { return inA.equals(numbered("b", 50, 70)); }, 5s));
+    // 双方的 ACK 都认得出是给自己当前会话的
+    CHECK(waitFor([&] { return a->unacknowledged() == 0 && b.unacknowledged() == 0; }));
+
+    a->stop();
+    b.stop();
+    std::cout << "endpoint_test passed\n";
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "fec.h"
+#include "receiver.h"
+#include "sender.h"
+#include "test_util.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// 只记录发出的数据报长度
+class MeterTransport final : public Transport {
+public:
+    bool send(const uint8_t*, size_t len) override {
+        largest_ = std::max(largest_.load(), len);
+        return true;
+    }
+    ssize_t recv(uint8_t*, size_t, int) override { return -1; }
+    int fd() const override { return -1; }
+
+    size_t largest() const { return largest_; }
+
+private:
+    std::atomic<size_t> largest_{0};
+};
+
+// 开了 FEC 时, 最大的消息连同修复包的前缀和长度字段也不能超过最大数据报
+static void testRepairFitsDatagram() {
+    auto meter = std::make_unique<MeterTransport>();
+    MeterTransport* m = meter.get();
+    SecureUdpSender tx(std::move(meter));
+    tx.setFec(FecScheme::ReedSolomon, 4, 2);
+    size_t maxMessage = DEFAULT_MAX_DATAGRAM - wire::MAX_HEADER_LEN - wire::TAG_LEN - fec::PREFIX_LEN - fec::LEN_FIELD;
+    CHECK(!tx.send(0, std::string(maxMessage + 1, 'x')));
+    for (int i = 0; i < 4; i++) CHECK(tx.send(0, std::string(maxMessage, 'x')));
+    std::this_thread::sleep_for(50ms);
+    tx.stop();
+    CHECK(m->largest() > maxMessage);
+    CHECK(m->largest() <= DEFAULT_MAX_DATAGRAM);
+    // 默认设置下连修复包也装得进 1500 字节 MTU 的 IPv4 包 (20 字节 IP 头 + 8 字节 UDP 头), 路上不分片
+    CHECK(m->largest() + 20 + 8 <= 1500);
+}
+
+// 编码器直接对接解码器: 长度到上限的一组数据报丢掉两个, 靠两个修复包补回来,
+// 修复包本身也不超过最大数据报
+static void testRecoveryAtMaxSize() {
+    size_t maxInner = DEFAULT_MAX_DATAGRAM - fec::PREFIX_LEN - fec::LEN_FIELD;
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 4; i++) {
+        std::string d(maxInner - i * 100, '\0');
+        for (size_t j = 0; j < d.size(); j++) d[j] = static_cast<char>(j * 7 + i);
+        inputs.push_back(d);
+    }
+    FecEncoder encoder;
+    encoder.configure(FecScheme::ReedSolomon, 4, 2);
+    std::vector<std::string> packets;
+    for (const auto& d : inputs) {
+        encoder.protect(reinterpret_cast<const uint8_t*>(d.data()), d.size(), packets);
+    }
+    CHECK(packets.size() == 6);
+    for (const auto& w : packets) CHECK(w.size() <= DEFAULT_MAX_DATAGRAM);
+
+    FecDecoder decoder;
+    std::vector<std::string> out;
+    for (size_t i = 0; i < packets.size(); i++) {
+        if (i == 1 || i == 2) continue;
+        decoder.receive(reinterpret_cast<const uint8_t*>(packets[i].data()), packets[i].size(), out);
+    }
+    CHECK(decoder.recovered() == 2);
+    std::multiset<std::string> expected(inputs.begin(), inputs.end());
+    CHECK(std::multiset<std::string>(out.begin(), out.end()) == expected);
+}
+
+// 两个发送端经 UDP 回环发给同一个接收端, 各自的组号互不干扰: 后一个发送端丢了一个包,
+// 之后的重传全被挡掉, 只能靠它自己那组的修复包补回来
+static void testSessionsDoNotShareGroups() {
+    const int port = 39821;
+    SecureUdpReceiver rx(port);
+    std::mutex mu;
+    std::multiset<std::string> got;
+    rx.start([&](const std::string& m) {
+        std::lock_guard<std::mutex> lock(mu);
+        got.insert(m);
+    });
+    auto count = [&](const std::string& prefix) {
+        std::lock_guard<std::mutex> lock(mu);
+        return std::count_if(got.begin(), got.end(), [&](const std::string& m) { return m.rfind(prefix, 0) == 0; });
+    };
+
+    SecureUdpSender first(std::make_unique<UdpTransport>(UdpTransport::connect("127.0.0.1", port)));
+    first.setFec(FecScheme::Xor, 4);
+    for (int i = 0; i < 8; i++) CHECK(first.send(0, "first" + std::to_string(i)));
+    CHECK(waitFor([&] { return count("first") == 8; }));
+
+    // XOR 每 4 个数据包跟 1 个修复包: 前 10 个数据报是两整组, 丢掉第 2 个, 之后的全丢
+    std::atomic<int> sent{0};
+    auto lossy = [&](std::string&) {
+        int n = sent++;
+        return n < 10 && n != 1;
+    };
+    SecureUdpSender second(std::make_unique<HookedTransport>(
+        std::make_unique<UdpTransport>(UdpTransport::connect("127.0.0.1", port)), lossy));
+    second.setFec(FecScheme::Xor, 4);
+    for (int i = 0; i < 8; i++) CHECK(second.send(0, "second" + std::to_string(i)));
+    CHECK(waitFor([&] { return count("second") == 8; }));
+    first.stop();
+    second.stop();
+    rx.stop();
+}
+
+int main() {
+    testRepairFitsDatagram();
+    testRecoveryAtMaxSize();
+    testSessionsDoNotShareGroups();
+    std::cout << "fec_test passed\n";
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include "file_transfer.h"
+#include "test_util.h"
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+using namespace std::chrono_literals;
+
+static std::string readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream out;
+    out << in.rdbuf();
+    return out.str();
+}
+
+// 跑一次传输; dropAfter >= 0 时发送端发出这么多个数据报后就全部丢掉, 模拟中途断开
+static bool transfer(const FileTransferOptions& options, const std::string& source, const std::string& target,
+                     int dropAfter, int timeoutMs, uint64_t& bytesSent, int& receiverError) {
+    auto ends = LoopbackTransport::pair(4096);
+    std::atomic<int> sent{0};
+    auto cut = [&](std::string&) { return dropAfter < 0 || sent++ < dropAfter; };
+    SecureUdpSender tx(std::make_unique<HookedTransport>(std::move(ends.first), cut));
+    SecureUdpReceiver rx(std::make_unique<LoopbackTransport>(std::move(ends.second)));
+    FileSender fileTx(tx, options);
+    FileReceiver fileRx(rx, target, fileTx.firstStream(), options.streams);
+    rx.start([](const std::string&) {});
+    bool ok = fileTx.send(source, timeoutMs);
+    if (ok) CHECK(fileRx.wait(2000));
+    bytesSent = fileTx.bytesSent();
+    receiverError = fileRx.lastError();
+    return ok;
+}
+
+// 续传日志只记对端已落盘的块: 目标落不了盘时一块也不记, DONE 也不被确认;
+// 中途断开后重跑只补发缺的块, 最终文件和源文件一致
+int main() {
+    char dir[] = "/tmp/file_transfer_testXXXXXX";
+    CHECK(mkdtemp(dir));
+    const std::string base(dir);
+    const std::string source = base + "/source";
+    const std::string target = base + "/target", journal = base + "/journal";
+    const std::string resumed = base + "/resumed", resumeJournal = base + "/resume_journal";
+
+    std::string content;
+    for (int i = 0; content.size() < (1 << 20) + 1234; i++) content += "block" + std::to_string(i * 7919) + ";";
+    {
+        std::ofstream out(source, std::ios::binary);
+        out << content;
+    }
+
+    FileTransferOptions options;
+    options.chunkSize = 64 << 10;
+    options.streams = 2;
+    // 窗口小, 发送端要等确认才能往下发, SYNC 和后面的数据交错发出
+    options.window = 32;
+    options.journalPath = journal;
+    uint64_t bytesSent = 0;
+    int error = 0;
+
+    // /dev/null 收得下数据, 但 fdatasync 和 ftruncate 都失败: 一块也不记, DONE 不被确认
+    CHECK(!transfer(options, source, "/dev/null", -1, 1000, bytesSent, error));
+    CHECK(error != 0);
+    CHECK(transfer(options, source, target, -1, 5000, bytesSent, error));
+    CHECK(bytesSent == content.size());
+    CHECK(readFile(target) == content);
+
+    // 中途断开后重跑, 断开前已落盘确认的块不再发
+    options.journalPath = resumeJournal;
+    CHECK(!transfer(options, source, resumed, 400, 1000, bytesSent, error));
+    CHECK(transfer(options, source, resumed, -1, 5000, bytesSent, error));
+    CHECK(bytesSent > 0 && bytesSent < content.size());
+    CHECK(readFile(resumed) == content);
+
+    // 全部记进日志后再跑, 只剩 DONE
+    CHECK(transfer(options, source, resumed, -1, 5000, bytesSent, error));
+    CHECK(bytesSent == 0);
+    CHECK(readFile(resumed) == content);
+
+    // 超出消息上限的分段发不出去; 不设期限时不能一直等, 当场抛出
+    FileTransferOptions oversized = options;
+    oversized.journalPath.clear();
+    oversized.segmentSize = DEFAULT_MAX_DATAGRAM;
+    bool threw = false;
+    try {
+        transfer(oversized, source, target, -1, -1, bytesSent, error);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    std::remove(source.c_str());
+    std::remove(target.c_str());
+    std::remove(journal.c_str());
+    std::remove(resumed.c_str());
+    std::remove(resumeJournal.c_str());
+    rmdir(dir);
+    std::cout << "file_transfer_test passed\n";
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include "group.h"
+#include "test_util.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// 一份密文发给两个单播目标: 组密钥对的接收端按序收齐, 密钥不对的一条也收不到;
+// 目标移除后不再收到
+int main() {
+    const int portA = 39871, portB = 39872;
+    const uint32_t group = 7;
+    const std::string key(32, 'g');
+
+    std::mutex mu;
+    std::vector<std::string> got;
+    GroupReceiver member(portA, group, key);
+    member.start([&](const std::string& m) {
+        std::lock_guard<std::mutex> lock(mu);
+        got.push_back(m);
+    });
+    std::atomic<int> forged{0};
+    GroupReceiver outsider(portB, group, std::string(32, 'x'));
+    outsider.start([&](const std::string&) { forged++; });
+
+    GroupSender sender(group, key);
+    sender.enableNack(256);
+    sender.addDestination("127.0.0.1", portA);
+    sender.addDestination("127.0.0.1", portB);
+
+    const int count = 200;
+    for (int i = 0; i < count; i++) CHECK(sender.send("g" + std::to_string(i)));
+    CHECK(waitFor([&] {
+        std::lock_guard<std::mutex> lock(mu);
+        return got.size() == static_cast<size_t>(count);
+    }));
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        for (int i = 0; i < count; i++) CHECK(got[i] == "g" + std::to_string(i));
+    }
+
+    sender.removeDestination("127.0.0.1", portA);
+    CHECK(sender.send("after"));
+    std::this_thread::sleep_for(100ms);
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        CHECK(got.size() == static_cast<size_t>(count));
+    }
+    CHECK(forged == 0);
+
+    sender.stop();
+    member.stop();
+    outsider.stop();
+    std::cout << "group_test passed\n";
+    return 0;
+}
@@ -0,0 +1,37 @@
+#include "endpoint.h"
+#include "test_util.h"
+#include <atomic>
+#include <cstdlib>
+
+using namespace std::chrono_literals;
+
+// 两端互发 PING/PONG: 都估出 RTT; 同一台机器上时钟偏差接近 0;
+// 开了新鲜度检查后正常的数据包照常交付, 没有被当成过期丢掉
+int main() {
+    const int portA = 39881, portB = 39882;
+    SecureUdpEndpoint a(portA, "127.0.0.1", portB);
+    SecureUdpEndpoint b(portB, "127.0.0.1", portA);
+    a.setKeepalive(20ms);
+    b.setKeepalive(20ms);
+    std::atomic<int> gotA{0}, gotB{0};
+    a.start([&](const std::string&) { gotA++; });
+    b.start([&](const std::string&) { gotB++; });
+
+    CHECK(waitFor([&] { return a.pathStats().synced && b.pathStats().synced; }));
+    for (SecureUdpEndpoint* e : {&a, &b}) {
+        SecureUdpEndpoint::PathStats stats = e->pathStats();
+        CHECK(stats.srtt.count() > 0);
+        CHECK(stats.minRtt <= stats.srtt);
+        CHECK(std::llabs(stats.clockOffset.count()) < 5000);
+    }
+
+    a.setFreshnessWindow(500ms);
+    for (int i = 0; i < 20; i++) CHECK(b.send("fresh" + std::to_string(i)));
+    CHECK(waitFor([&] { return gotA == 20; }));
+    CHECK(a.pathStats().stale == 0);
+
+    a.stop();
+    b.stop();
+    std::cout << "keepalive_test passed\n";
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include "multipath_transport.h"
+#include "receiver.h"
+#include "sender.h"
+#include "test_util.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// 两条路径 (本地 127.0.0.1 和 127.0.0.2) 通到同一个接收端: 两条都有 ACK 回来、都估出 RTT,
+// 按序流的消息经两条路径交错送达后仍然按序交付
+int main() {
+    const int port = 39861;
+    SecureUdpReceiver rx(port);
+    std::mutex mu;
+    std::vector<std::string> got;
+    rx.start([&](const std::string& m) {
+        std::lock_guard<std::mutex> lock(mu);
+        got.push_back(m);
+    });
+
+    auto transport = std::make_unique<MultipathTransport>(std::vector<MultipathTransport::PathSpec>{
+        {"127.0.0.1", "127.0.0.1", port},
+        {"127.0.0.2", "127.0.0.1", port},
+    });
+    MultipathTransport* paths = transport.get();
+    SecureUdpSender tx(std::move(transport));
+    uint16_t stream = tx.openStream(true);
+
+    const int count = 500;
+    for (int i = 0; i < count; i++) {
+        CHECK(waitFor([&] { return tx.send(stream, "m" + std::to_string(i)); }));
+    }
+    CHECK(waitFor([&] { return tx.acknowledgedBefore(stream, count); }));
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        CHECK(got.size() == static_cast<size_t>(count));
+        for (int i = 0; i < count; i++) CHECK(got[i] == "m" + std::to_string(i));
+    }
+    for (const auto& p : paths->stats()) {
+        CHECK(p.sent > 0);
+        CHECK(p.srttMs > 0);
+    }
+
+    tx.stop();
+    rx.stop();
+    std::cout << "multipath_test passed\n";
+    return 0;
+}
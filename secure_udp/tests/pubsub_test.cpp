@@ -0,0 +1,49 @@
+#include "pubsub.h"
+#include "test_util.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// 发布端重启后序号从 0 重来: 订阅端凭新的 EPOCH 重新开始去重, 新实例的消息不会被当成重复丢掉
+int main() {
+    const int publisherPort = 39831, subscriberPort = 39832;
+    const std::string key(32, 'k');
+    std::mutex mu;
+    std::vector<std::string> got;
+    auto handler = [&](const std::string& m) {
+        std::lock_guard<std::mutex> lock(mu);
+        got.push_back(m);
+    };
+    auto received = [&] {
+        std::lock_guard<std::mutex> lock(mu);
+        return got.size();
+    };
+
+    auto publisher = std::make_unique<Publisher>(publisherPort, key);
+    Subscriber subscriber("127.0.0.1", publisherPort, key, subscriberPort);
+    subscriber.subscribe(1, handler);
+    subscriber.start();
+    CHECK(waitFor([&] { return publisher->subscribers(1) == 1; }));
+    for (int i = 0; i < 100; i++) CHECK(publisher->publish(1, "old" + std::to_string(i)));
+    CHECK(waitFor([&] { return received() == 100; }));
+
+    publisher.reset();
+    publisher = std::make_unique<Publisher>(publisherPort, key);
+    // 再订阅一次让登记立即发出, 不等续约; 同一主题的去重状态不受影响
+    subscriber.subscribe(1, handler);
+    CHECK(waitFor([&] { return publisher->subscribers(1) == 1; }));
+    for (int i = 0; i < 10; i++) CHECK(publisher->publish(1, "new" + std::to_string(i)));
+    CHECK(waitFor([&] { return received() == 110; }));
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        CHECK(got[100] == "new0" && got[109] == "new9");
+    }
+    CHECK(subscriber.filtered() == 0);
+
+    subscriber.stop();
+    publisher->stop();
+    std::cout << "pubsub_test passed\n";
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include "receiver.h"
+#include "relay.h"
+#include "sender.h"
+#include "test_util.h"
+#include <mutex>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// 经中继按路由号转发: 消息按序到达接收端, ACK 沿原路回到发送端;
+// 没有路由的包被丢掉, 不建流
+int main() {
+    const int relayPort = 39891, receiverPort = 39892;
+    Relay relay(relayPort);
+    relay.addRoute(7, "127.0.0.1", receiverPort);
+    relay.start();
+
+    SecureUdpReceiver rx(receiverPort);
+    std::mutex mu;
+    std::vector<std::string> got;
+    rx.start([&](const std::string& m) {
+        std::lock_guard<std::mutex> lock(mu);
+        got.push_back(m);
+    });
+
+    SecureUdpSender tx("127.0.0.1", relayPort);
+    tx.setRoute(7);
+    uint16_t stream = tx.openStream(true);
+    const int count = 100;
+    for (int i = 0; i < count; i++) {
+        CHECK(waitFor([&] { return tx.send(stream, "r" + std::to_string(i)); }));
+    }
+    CHECK(waitFor([&] { return tx.acknowledgedBefore(stream, count); }));
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        CHECK(got.size() == static_cast<size_t>(count));
+        for (int i = 0; i < count; i++) CHECK(got[i] == "r" + std::to_string(i));
+    }
+    Relay::Stats stats = relay.stats();
+    CHECK(stats.forwarded >= static_cast<uint64_t>(count));
+    CHECK(stats.returned > 0);
+    CHECK(stats.flows == 1);
+
+    SecureUdpSender stray("127.0.0.1", relayPort);
+    stray.setRoute(8);
+    CHECK(stray.send("lost"));
+    CHECK(waitFor([&] { return relay.stats().dropped > stats.dropped; }));
+    CHECK(relay.stats().flows == 1);
+
+    stray.stop();
+    tx.stop();
+    rx.stop();
+    relay.stop();
+    std::cout << "relay_test passed\n";
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include "receiver.h"
+#include "sender.h"
+#include "test_util.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// 按 reliable() 的约定工作的传输: 要么送达要么 send() 当场失败。
+// failAt 指定第几次 send 失败 (从 1 数起), 像共享内存环满了一样
+class FlakyReliableTransport final : public Transport {
+public:
+    FlakyReliableTransport(LoopbackTransport inner, int failAt) : inner_(std::move(inner)), failAt_(failAt) {}
+
+    bool send(const uint8_t* data, size_t len) override {
+        if (++sends_ == failAt_) return false;
+        return inner_.send(data, len);
+    }
+    ssize_t recv(uint8_t* buf, size_t len, int timeoutMs) override { return inner_.recv(buf, len, timeoutMs); }
+    int fd() const override { return -1; }
+    bool reliable() const override { return true; }
+
+private:
+    LoopbackTransport inner_;
+    int failAt_;
+    std::atomic<int> sends_{0};
+};
+
+// 一次发送失败后调用方重试, 按序流不能因此留下永远补不上的空洞
+int main() {
+    auto ends = LoopbackTransport::pair();
+    SecureUdpSender tx(std::make_unique<FlakyReliableTransport>(std::move(ends.first), 2));
+    SecureUdpReceiver rx(std::make_unique<FlakyReliableTransport>(std::move(ends.second), 0));
+    uint16_t stream = tx.openStream(true);
+
+    std::mutex mu;
+    std::vector<std::string> got;
+    rx.start([&](const std::string& m) {
+        std::lock_guard<std::mutex> lock(mu);
+        got.push_back(m);
+    });
+
+    int failures = 0;
+    for (int i = 0; i < 5; i++) {
+        std::string m = "m" + std::to_string(i);
+        while (!tx.send(stream, m)) failures++;
+    }
+    CHECK(failures == 1);
+    CHECK(tx.nextSequence(stream) == 5);
+    CHECK(waitFor([&] {
+        std::lock_guard<std::mutex> lock(mu);
+        return got.size() == 5;
+    }));
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        for (int i = 0; i < 5; i++) CHECK(got[i] == "m" + std::to_string(i));
+    }
+    tx.stop();
+    rx.stop();
+    std::cout << "reliable_transport_test passed\n";
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include "rpc.h"
+#include "test_util.h"
+#include <future>
+#include <memory>
+
+using namespace std::chrono_literals;
+
+// 发不出的请求当场以 TooLarge 结束, 不挡住排在后面的调用; 发不出的结果也回 TooLarge
+int main() {
+    auto requests = LoopbackTransport::pair();
+    auto responses = LoopbackTransport::pair();
+    SecureUdpSender clientTx(std::make_unique<LoopbackTransport>(std::move(requests.first)));
+    SecureUdpReceiver serverRx(std::make_unique<LoopbackTransport>(std::move(requests.second)));
+    SecureUdpSender serverTx(std::make_unique<LoopbackTransport>(std::move(responses.first)));
+    SecureUdpReceiver clientRx(std::make_unique<LoopbackTransport>(std::move(responses.second)));
+
+    RpcServer server(serverRx, serverTx);
+    server.handle(1, [](const std::string& args) { return "echo:" + args; });
+    server.handle(2, [&](const std::string&) { return std::string(serverTx.maxMessage(), 'r'); });
+    RpcClient client(clientTx, clientRx, server.responseStream());
+    serverRx.start([](const std::string&) {});
+    clientRx.start([](const std::string&) {});
+
+    std::future<RpcResult> oversized = client.call(1, std::string(clientTx.maxMessage(), 'x'), 2s);
+    CHECK(oversized.wait_for(0s) == std::future_status::ready);
+    CHECK(oversized.get().status == RpcStatus::TooLarge);
+
+    RpcResult echoed = client.call(1, "hello", 2s).get();
+    CHECK(echoed.status == RpcStatus::Ok);
+    CHECK(echoed.body == "echo:hello");
+
+    RpcResult large = client.call(2, "", 2s).get();
+    CHECK(large.status == RpcStatus::TooLarge);
+
+    server.stop();
+    clientTx.stop();
+    serverTx.stop();
+    clientRx.stop();
+    serverRx.stop();
+    std::cout << "rpc_test passed\n";
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "receiver.h"
+#include "runtime.h"
+#include "sender.h"
+#include "test_util.h"
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+// 会话还挂在循环上时 stop() 要等它们都停了才释放循环, 之后不能再放会话
+static void testStopWaitsForSessions() {
+    const int port = 39851;
+    Runtime runtime(2);
+    std::atomic<int> got{0};
+    auto rx = std::make_unique<SecureUdpReceiver>(runtime, port);
+    rx->start([&](const std::string&) { got++; });
+    auto tx = std::make_unique<SecureUdpSender>(runtime, "127.0.0.1", port);
+    uint16_t stream = tx->openStream(true);
+    for (int i = 0; i < 10; i++) CHECK(tx->send(stream, "m" + std::to_string(i)));
+    CHECK(waitFor([&] { return got == 10; }));
+
+    std::atomic<bool> stopped{false};
+    std::thread stopper([&] {
+        runtime.stop();
+        stopped = true;
+    });
+    std::this_thread::sleep_for(100ms);
+    CHECK(!stopped);
+    tx.reset();
+    rx.reset();
+    stopper.join();
+    CHECK(stopped);
+
+    bool threw = false;
+    try {
+        runtime.place();
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+// 循环退出前要跑完排着的任务, 投递方可能在等它们
+static void testStopRunsQueuedTasks() {
+    Runtime runtime(1);
+    EventLoop& loop = runtime.place();
+    std::atomic<int> ran{0};
+    loop.runInLoop([] { std::this_thread::sleep_for(50ms); });
+    for (int i = 0; i < 1000; i++) loop.post([&] { ran++; });
+    runtime.release(loop);
+    runtime.stop();
+    CHECK(ran == 1000);
+}
+
+// 开了 work stealing 的接收端在自己的循环线程里停: 排在该循环上的解密任务没人跑, 不能干等
+static void testReceiverStopOnLoopThread() {
+    const int port = 39852;
+    Runtime runtime(1, true);
+    std::atomic<int> got{0};
+    SecureUdpReceiver rx(runtime, port);
+    rx.start([&](const std::string&) { got++; });
+    SecureUdpSender tx("127.0.0.1", port);
+    CHECK(tx.send("first"));
+    CHECK(waitFor([&] { return got == 1; }));
+
+    // 只有一个循环: 先让它忙, 期间到的包在下一轮投递成任务, 排在 stop() 之后
+    EventLoop& loop = runtime.place();
+    loop.runInLoop([] { std::this_thread::sleep_for(100ms); });
+    for (int i = 0; i < 100; i++) tx.send("m" + std::to_string(i));
+    std::this_thread::sleep_for(20ms);
+    std::atomic<bool> done{false};
+    loop.runInLoop([&] {
+        rx.stop();
+        done = true;
+    });
+    CHECK(waitFor([&] { return done.load(); }));
+    runtime.release(loop);
+    tx.stop();
+}
+
+int main() {
+    testStopWaitsForSessions();
+    testStopRunsQueuedTasks();
+    testReceiverStopOnLoopThread();
+    std::cout << "runtime_test passed\n";
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "ledbat.h"
+#include "receiver.h"
+#include "sender.h"
+#include "test_util.h"
+#include <memory>
+
+using namespace std::chrono_literals;
+
+// 把每个收到的包都报成带 CE 标记, 像路径上的 AQM 在排队时打的标
+class CeMarkingTransport final : public Transport {
+public:
+    explicit CeMarkingTransport(LoopbackTransport inner) : inner_(std::move(inner)) {}
+
+    bool send(const uint8_t* data, size_t len) override { return inner_.send(data, len); }
+    ssize_t recv(uint8_t* buf, size_t len, int timeoutMs) override { return inner_.recv(buf, len, timeoutMs); }
+    ssize_t recvMarked(uint8_t* buf, size_t len, int timeoutMs, struct sockaddr_in* from, uint8_t* tos) override {
+        ssize_t n = recvFrom(buf, len, timeoutMs, from);
+        if (tos) *tos = 0x03;
+        return n;
+    }
+    int fd() const override { return -1; }
+
+private:
+    LoopbackTransport inner_;
+};
+
+// 慢启动涨到上限; 排队时延超过目标后退到最小窗口; 丢包减半, 同一轮的多次丢包只算一次
+static void testLedbatWindow() {
+    auto t0 = std::chrono::steady_clock::now();
+    LedbatController cc(100ms, 64);
+    cc.onDelaySample(1000, t0);
+    for (int i = 0; i < 100; i++) cc.onAck(cc.window(), cc.window());
+    CHECK(cc.window() == 64);
+
+    for (int i = 0; i < 4; i++) cc.onDelaySample(1300, t0);
+    CHECK(cc.queuingDelay() == 300ms);
+    for (int i = 0; i < 100; i++) cc.onAck(cc.window(), cc.window());
+    CHECK(cc.window() == static_cast<size_t>(LedbatController::MIN_WINDOW));
+
+    LedbatController lossy(100ms, 64);
+    lossy.onDelaySample(1000, t0);
+    for (int i = 0; i < 100; i++) lossy.onAck(lossy.window(), lossy.window());
+    lossy.onLoss(t0 + 1s);
+    CHECK(lossy.window() == 32);
+    lossy.onLoss(t0 + 1s + 10ms);
+    CHECK(lossy.window() == 32);
+    lossy.onLoss(t0 + 2s);
+    CHECK(lossy.window() == 16);
+}
+
+// 时延样本按 32 位回绕: 跨过 UINT32_MAX 的样本不会被当成几十天的排队
+static void testDelayWraps() {
+    auto t0 = std::chrono::steady_clock::now();
+    LedbatController cc;
+    cc.onDelaySample(0xfffffff0u, t0);
+    for (int i = 0; i < 4; i++) cc.onDelaySample(0x10u, t0);
+    CHECK(cc.queuingDelay() == 32ms);
+}
+
+// 对端在 ACK 里回报 CE 计数, 发送端累计新的 CE 标记, 消息照常送达
+static void testCeFeedback() {
+    auto ends = LoopbackTransport::pair();
+    SecureUdpSender tx(std::make_unique<LoopbackTransport>(std::move(ends.first)));
+    SecureUdpReceiver rx(std::make_unique<CeMarkingTransport>(std::move(ends.second)));
+    tx.setEcn(true);
+    uint16_t stream = tx.openStream(false);
+    tx.setScavenger(stream);
+    rx.start([](const std::string&) {});
+
+    for (int i = 0; i < 20; i++) CHECK(waitFor([&] { return tx.send(stream, "bulk" + std::to_string(i)); }));
+    CHECK(waitFor([&] { return tx.acknowledgedBefore(stream, 20); }));
+    CHECK(tx.congestionMarks() > 0);
+
+    tx.stop();
+    rx.stop();
+}
+
+int main() {
+    testLedbatWindow();
+    testDelayWraps();
+    testCeFeedback();
+    std::cout << "scavenger_test passed\n";
+    return 0;
+}
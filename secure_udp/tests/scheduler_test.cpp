@@ -0,0 +1,40 @@
+#include "scheduler.h"
+#include "test_util.h"
+#include <array>
+#include <vector>
+
+// 严格优先级: 高优先级的包总是先出, 同级按入队顺序
+static void testStrictPriority() {
+    SendScheduler scheduler;
+    scheduler.push(Priority::Bulk, 1, 1000);
+    scheduler.push(Priority::Bulk, 2, 1000);
+    scheduler.push(Priority::Normal, 20, 1000);
+    scheduler.push(Priority::Control, 10, 100);
+    std::vector<uint64_t> order;
+    uint64_t key;
+    while (scheduler.pop(key)) order.push_back(key);
+    CHECK((order == std::vector<uint64_t>{10, 20, 1, 2}));
+    CHECK(scheduler.empty());
+}
+
+// DRR: 各级都有积压时按权重分字节, 权重最低的也不会饿死
+static void testWeightedShares() {
+    SendScheduler scheduler(SendScheduler::Mode::DeficitRoundRobin);
+    scheduler.setWeights({8, 4, 2, 1});
+    for (size_t level = 0; level < PRIORITY_LEVELS; level++) {
+        for (uint64_t i = 0; i < 200; i++) scheduler.push(static_cast<Priority>(level), level << 32 | i, 1000);
+    }
+    std::array<int, PRIORITY_LEVELS> sent{};
+    uint64_t key;
+    for (int i = 0; i < 150 && scheduler.pop(key); i++) sent[key >> 32]++;
+    CHECK(sent[0] > sent[1] && sent[1] > sent[2] && sent[2] > sent[3] && sent[3] > 0);
+    // 大致按 8:4:2:1
+    CHECK(sent[0] >= 3 * sent[2] && sent[1] >= 3 * sent[3]);
+}
+
+int main() {
+    testStrictPriority();
+    testWeightedShares();
+    std::cout << "scheduler_test passed\n";
+    return 0;
+}
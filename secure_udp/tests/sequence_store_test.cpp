@@ -0,0 +1,55 @@
+#include "sequence_store.h"
+#include "test_util.h"
+#include <unistd.h>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+
+// 重开后从上次预留的上界接着取, 不会再取到用过的值; 同一文件不能同时开两个;
+// 到 limit 时抛出
+int main() {
+    char dir[] = "/tmp/sequence_store_testXXXXXX";
+    CHECK(mkdtemp(dir));
+    const std::string path = std::string(dir) + "/state";
+
+    uint64_t last;
+    {
+        SequenceStore store(path, UINT64_MAX, 16);
+        last = store.next();
+        CHECK(last < UINT64_MAX / 2);
+        for (int i = 0; i < 40; i++) {
+            uint64_t v = store.next();
+            CHECK(v > last);
+            last = v;
+        }
+
+        bool busy = false;
+        try {
+            SequenceStore second(path, UINT64_MAX, 16);
+        } catch (const std::runtime_error&) {
+            busy = true;
+        }
+        CHECK(busy);
+    }
+    {
+        // 像崩溃重启一样重开: 块里没用完的值作废, 新值都比旧值大
+        SequenceStore store(path, UINT64_MAX, 16);
+        CHECK(store.next() > last);
+    }
+    std::remove(path.c_str());
+
+    {
+        SequenceStore store(path, 64, 16);
+        bool exhausted = false;
+        try {
+            for (int i = 0; i <= 64; i++) store.next();
+        } catch (const std::runtime_error&) {
+            exhausted = true;
+        }
+        CHECK(exhausted);
+    }
+    std::remove(path.c_str());
+    rmdir(dir);
+    std::cout << "sequence_store_test passed\n";
+    return 0;
+}
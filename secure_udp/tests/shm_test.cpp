@@ -0,0 +1,61 @@
+#include "receiver.h"
+#include "sender.h"
+#include "shm_transport.h"
+#include "test_util.h"
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 共享内存环没有来源地址, 几个发送端写同一个环时只能靠包头里的会话号分开。
+// senders 个发送端交替往按序流上各发 count 条, 每个发送端的消息都要按序到齐
+static void runSenders(int port, bool encrypt, int senders, int count) {
+    SecureUdpReceiver rx(std::make_unique<ShmTransport>(ShmTransport::listen(port, encrypt)));
+    std::mutex mu;
+    std::map<std::string, std::vector<int>> got;
+    rx.start([&](const std::string& m) {
+        size_t dash = m.find('-');
+        std::lock_guard<std::mutex> lock(mu);
+        got[m.substr(0, dash)].push_back(std::stoi(m.substr(dash + 1)));
+    });
+
+    std::vector<std::unique_ptr<SecureUdpSender>> txs;
+    std::vector<uint16_t> streams;
+    for (int s = 0; s < senders; s++) {
+        txs.emplace_back(new SecureUdpSender(std::make_unique<ShmTransport>(ShmTransport::connect(port, !encrypt))));
+        streams.push_back(txs.back()->openStream(true));
+    }
+    for (int i = 0; i < count; i++) {
+        for (int s = 0; s < senders; s++) {
+            CHECK(txs[s]->send(streams[s], "s" + std::to_string(s) + "-" + std::to_string(i)));
+        }
+    }
+
+    CHECK(waitFor([&] {
+        std::lock_guard<std::mutex> lock(mu);
+        if (got.size() != static_cast<size_t>(senders)) return false;
+        for (auto& entry : got) {
+            if (entry.second.size() != static_cast<size_t>(count)) return false;
+        }
+        return true;
+    }));
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        for (auto& entry : got) {
+            for (int i = 0; i < count; i++) CHECK(entry.second[i] == i);
+        }
+    }
+    for (auto& tx : txs) tx->stop();
+    rx.stop();
+}
+
+int main() {
+    // 明文环: 包没有 TAG 可试, 短包头会被算到别的发送端头上
+    runSenders(39841, false, 2, 50);
+    // 加密环: 发送端多于试解的候选数时, 短包头谁都解不开
+    runSenders(39842, true, 5, 50);
+    std::cout << "shm_test passed\n";
+    return 0;
+}
@@ -0,0 +1,45 @@
+#include "secure_udp.h"
+#include "test_util.h"
+#include <vector>
+
+// 编译期模板的两条约定: 明文包头参与认证; 可靠模式下发送端未确认的包不超过去重窗口,
+// 收到 ACK 后才能接着发
+int main() {
+    using Sender = secure_udp::SecureUdpSender<secure_udp::AesGcmCipher, secure_udp::RetransmitReliability,
+                                               LoopbackTransport>;
+    auto ends = LoopbackTransport::pair(2 * secure_udp::DEDUP_WINDOW);
+    const std::string key(32, 'k');
+    Sender tx(secure_udp::AesGcmCipher(key), std::move(ends.first));
+
+    std::vector<std::string> got;
+    auto handler = [&](std::string_view m) { got.emplace_back(m); };
+    secure_udp::SecureUdpReceiver rx(secure_udp::AesGcmCipher(key), std::move(ends.second), handler,
+                                     secure_udp::RetransmitReliability());
+
+    // 改了 SEQ 的包认证不过
+    CHECK(tx.send("first"));
+    uint8_t packet[DEFAULT_MAX_DATAGRAM];
+    ssize_t len = rx.transport().recv(packet, sizeof(packet), 0);
+    CHECK(len > 0);
+    packet[0] ^= 0x01;
+    CHECK(!rx.processDatagram(packet, static_cast<size_t>(len)));
+    CHECK(got.empty());
+    packet[0] ^= 0x01;
+    CHECK(rx.processDatagram(packet, static_cast<size_t>(len)));
+    CHECK(got.size() == 1 && got[0] == "first");
+    tx.ack(1);
+
+    // 没有 ACK 时最多发出 DEDUP_WINDOW 个
+    for (uint32_t i = 0; i < secure_udp::DEDUP_WINDOW; i++) CHECK(tx.send("m" + std::to_string(i)));
+    CHECK(!tx.send("over"));
+
+    // 接收端全部收下并回 ACK, 发送端读到 ACK 后又能发了
+    for (uint32_t i = 0; i < secure_udp::DEDUP_WINDOW; i++) CHECK(rx.pollOnce());
+    CHECK(got.size() == 1 + secure_udp::DEDUP_WINDOW);
+    CHECK(got.back() == "m" + std::to_string(secure_udp::DEDUP_WINDOW - 1));
+    CHECK(tx.send("after"));
+    CHECK(rx.pollOnce());
+    CHECK(got.back() == "after");
+    std::cout << "templates_test passed\n";
+    return 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include "transport.h"
+
+// 各测试共用的小工具。测试是普通的 main, 第一个失败的检查打印位置后以非零码退出
+
+// 不随 NDEBUG 关掉的 assert
+#define CHECK(cond)                                                                       \
+    do {                                                                                  \
+        if (!(cond)) {                                                                    \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed\n";    \
+            std::exit(1);                                                                 \
+        }                                                                                 \
+    } while (0)
+
+// 轮询到条件成立, 超时返回 false
+inline bool waitFor(const std::function<bool()>& cond,
+                    std::chrono::milliseconds timeout = std::chrono::seconds(2)) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!cond()) {
+        if (std::chrono::steady_clock::now() >= deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+}
+
+// 包在另一个传输外面, 每个发出的数据报先交给 hook:
+// hook 可以就地改写包, 返回 false 表示丢掉
+class HookedTransport final : public Transport {
+public:
+    using Hook = std::function<bool(std::string& packet)>;
+
+    HookedTransport(LoopbackTransport inner, Hook hook)
+        : HookedTransport(std::make_unique<LoopbackTransport>(std::move(inner)), std::move(hook)) {}
+    HookedTransport(std::unique_ptr<Transport> inner, Hook hook) : inner_(std::move(inner)), hook_(std::move(hook)) {}
+
+    bool send(const uint8_t* data, size_t len) override {
+        std::string packet(reinterpret_cast<const char*>(data), len);
+        if (!hook_(packet)) return true;
+        return inner_->send(reinterpret_cast<const uint8_t*>(packet.data()), packet.size());
+    }
+    ssize_t recv(uint8_t* buf, size_t len, int timeoutMs) override { return inner_->recv(buf, len, timeoutMs); }
+    int fd() const override { return inner_->fd(); }
+    bool hasSourceAddress() const override { return inner_->hasSourceAddress(); }
+
+private:
+    std::unique_ptr<Transport> inner_;
+    Hook hook_;
+};
+
+// 几个收发对象先后用同一端, 如模拟接收端重启: 前一个用完析构, 端口上的数据还在
+class SharedTransport final : public Transport {
+public:
+    explicit SharedTransport(std::shared_ptr<Transport> inner) : inner_(std::move(inner)) {}
+
+    bool send(const uint8_t* data, size_t len) override { return inner_->send(data, len); }
+    ssize_t recv(uint8_t* buf, size_t len, int timeoutMs) override { return inner_->recv(buf, len, timeoutMs); }
+    int fd() const override { return -1; }
+    bool hasSourceAddress() const override { return inner_->hasSourceAddress(); }
+
+private:
+    std::shared_ptr<Transport> inner_;
+};
@@ -0,0 +1,58 @@
+#include "file_transfer.h"
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+// 用法:
+//   file_transfer recv <port> <dest>
+//   file_transfer send <ip> <port> <file> [journal]
+// 发送端带 journal 时中断后重跑同一条命令就只发剩下的块; 接收端要一直开着或者重开在同一个 dest 上。
+
+static int usage() {
+    std::cerr << "usage: file_transfer recv <port> <dest>\n"
+              << "       file_transfer send <ip> <port> <file> [journal]\n";
+    return 2;
+}
+
+static int receive(int port, const std::string& dest) {
+    SecureUdpReceiver receiver(port);
+    FileReceiver file(receiver, dest);
+    receiver.start([](const std::string&) {});
+    file.wait();
+    receiver.stop();
+    std::cout << "received " << file.fileSize() << " bytes into " << dest << "\n";
+    return 0;
+}
+
+static int send(const std::string& ip, int port, const std::string& path, const std::string& journal) {
+    SecureUdpSender sender(ip, port);
+    FileTransferOptions options;
+    options.journalPath = journal;
+    FileSender file(sender, options);
+
+    auto start = std::chrono::steady_clock::now();
+    bool ok = file.send(path);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    sender.stop();
+    if (!ok) return 1;
+    std::cout << "sent " << file.bytesSent() << " bytes in " << seconds << " s ("
+              << file.bytesSent() / seconds / (1 << 20) << " MiB/s)\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) return usage();
+    std::string mode = argv[1];
+    try {
+        if (mode == "recv" && argc == 4) return receive(std::atoi(argv[2]), argv[3]);
+        if (mode == "send" && (argc == 5 || argc == 6)) {
+            return send(argv[2], std::atoi(argv[3]), argv[4], argc == 6 ? argv[5] : "");
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return usage();
+}
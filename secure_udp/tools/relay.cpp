@@ -0,0 +1,48 @@
+#include "relay.h"
+#include <signal.h>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+// 用法: relay <port> <route>=<ip>:<port> [<route>=<ip>:<port> ...]
+// 不需要也不读取密钥; SIGINT/SIGTERM 退出。
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "usage: relay <port> <route>=<ip>:<port> ...\n";
+        return 2;
+    }
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    try {
+        Relay relay(std::atoi(argv[1]));
+        for (int i = 2; i < argc; i++) {
+            std::string spec = argv[i];
+            size_t eq = spec.find('=');
+            size_t colon = spec.rfind(':');
+            if (eq == std::string::npos || colon == std::string::npos || colon < eq) {
+                std::cerr << "bad route: " << spec << "\n";
+                return 2;
+            }
+            relay.addRoute(static_cast<uint32_t>(std::strtoul(spec.substr(0, eq).c_str(), nullptr, 0)),
+                           spec.substr(eq + 1, colon - eq - 1), std::atoi(spec.c_str() + colon + 1));
+        }
+        relay.start();
+        int sig = 0;
+        sigwait(&signals, &sig);
+        relay.stop();
+        Relay::Stats s = relay.stats();
+        std::cout << "forwarded " << s.forwarded << " returned " << s.returned
+                  << " dropped " << s.dropped << " refused flows " << s.refusedFlows
+                  << " evicted flows " << s.evictedFlows << "\n";
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include "tunnel.h"
+#include <signal.h>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+// 用法: tunnel <device> <local-port> <peer-ip> <peer-port> [queues] [mtu]
+// 起来后给设备配地址和路由, 例如 ip addr add 10.9.0.1/24 dev <device>; SIGINT/SIGTERM 退出。
+
+int main(int argc, char** argv) {
+    if (argc < 5 || argc > 7) {
+        std::cerr << "usage: tunnel <device> <local-port> <peer-ip> <peer-port> [queues] [mtu]\n";
+        return 2;
+    }
+    TunnelOptions options;
+    options.device = argv[1];
+    options.localPort = std::atoi(argv[2]);
+    options.peerIp = argv[3];
+    options.peerPort = std::atoi(argv[4]);
+    if (argc > 5) options.queues = std::strtoul(argv[5], nullptr, 10);
+    if (argc > 6) options.mtu = std::strtoul(argv[6], nullptr, 10);
+
+    // 先屏蔽信号再起线程, 只在主线程里等
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    try {
+        Tunnel tunnel(options);
+        tunnel.start();
+        std::cout << "tunnel up on " << tunnel.device().name() << " with "
+                  << tunnel.device().queues() << " queue(s)" << std::endl;
+        int sig = 0;
+        sigwait(&signals, &sig);
+        tunnel.stop();
+        Tunnel::Stats s = tunnel.stats();
+        std::cout << "sent " << s.sentPackets << " received " << s.receivedPackets
+                  << " dropped " << s.droppedPackets << "\n";
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}